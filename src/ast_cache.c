@@ -0,0 +1,572 @@
+/*
+ * Precompiled scripts.
+ *
+ * A cache file is a header, the NUL-terminated path of the script, and
+ * one record per non-empty command line:
+ *
+ *   u32 line, u32 npipes
+ *   per pipeline: u8 flags, [input word], [output word], u32 ncommands,
+ *                 or u8 flags with COMPOUND, compound
+ *   per command:  u8 dup_stderr, u32 argc, argc words
+ *   compound:     u8 kind, u8 parts, [name word], [u32 nwords, nwords
+ *                 words], [cond], [body], [orelse]
+ *
+ * where cond, body and orelse are u32 npipes and their pipelines.  A
+ * command line that goes on over several lines is stored at its last
+ * line.  A line that does not parse is stored as its line number, SOURCE
+ * and its text, and is parsed again when it is reached, so that its
+ * error is reported at the same point of the run as without the cache.
+ * Numbers are in host byte order; the cache is not meant to be copied
+ * between machines.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ast_cache.h"
+#include "script.h"
+
+#define SOURCE UINT32_MAX       /* npipes of a line kept as text */
+
+/* Pipeline flags */
+#define BG_JOB 1
+#define APPEND 2
+#define INPUT 4
+#define OUTPUT 8
+#define AND 16
+#define OR 32
+#define COMPOUND 64
+
+/* Parts of a compound command */
+#define NAME 1
+#define WORDS 2
+#define COND 4
+#define BODY 8
+#define ORELSE 16
+
+struct header {
+    char magic[8];              /* AST_CACHE_MAGIC, not NUL-terminated */
+    uint32_t version;           /* AST_CACHE_VERSION */
+    uint32_t path_len;          /* Length of the path after the header */
+    uint64_t size;              /* Size of the script */
+    int64_t mtime_sec;          /* Modification time of the script */
+    int64_t mtime_nsec;
+};
+
+struct ast_cache {
+    bool mapped;                /* 'data' is a mapping, else malloc'ed */
+    char *data;                 /* The whole cache file */
+    size_t size;
+    size_t pos;                 /* Next record */
+};
+
+/* A growing buffer for compiling */
+struct buffer {
+    char *data;
+    size_t len, cap;
+    bool failed;
+};
+
+static void
+put(struct buffer *b, const void *p, size_t n)
+{
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n)
+            cap *= 2;
+        char *data = realloc(b->data, cap);
+        if (data == NULL) {
+            b->failed = true;
+            return;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+static void
+put_u8(struct buffer *b, uint8_t v)
+{
+    put(b, &v, sizeof v);
+}
+
+static void
+put_u32(struct buffer *b, uint32_t v)
+{
+    put(b, &v, sizeof v);
+}
+
+static void
+put_word(struct buffer *b, const char *s)
+{
+    put(b, s, strlen(s) + 1);
+}
+
+static void put_pipelines(struct buffer *b, struct ast_command_line *cline);
+
+/* Serialize a compound command */
+static void
+put_compound(struct buffer *b, struct ast_compound *c)
+{
+    put_u8(b, c->kind);
+    put_u8(b, (c->name ? NAME : 0) | (c->words ? WORDS : 0) |
+              (c->cond ? COND : 0) | (c->body ? BODY : 0) |
+              (c->orelse ? ORELSE : 0));
+    if (c->name)
+        put_word(b, c->name);
+    if (c->words) {
+        uint32_t n = 0;
+        while (c->words[n])
+            n++;
+        put_u32(b, n);
+        for (uint32_t i = 0; i < n; i++)
+            put_word(b, c->words[i]);
+    }
+    if (c->cond)
+        put_pipelines(b, c->cond);
+    if (c->body)
+        put_pipelines(b, c->body);
+    if (c->orelse)
+        put_pipelines(b, c->orelse);
+}
+
+/* Serialize the pipelines of a command line */
+static void
+put_pipelines(struct buffer *b, struct ast_command_line *cline)
+{
+    put_u32(b, list_size(&cline->pipes));
+    struct list_elem *e = list_begin(&cline->pipes);
+    for (; e != list_end(&cline->pipes); e = list_next(e)) {
+        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
+        put_u8(b, (pipe->bg_job ? BG_JOB : 0) |
+                  (pipe->append_to_output ? APPEND : 0) |
+                  (pipe->iored_input ? INPUT : 0) |
+                  (pipe->iored_output ? OUTPUT : 0) |
+                  (pipe->connector == AST_AND ? AND : 0) |
+                  (pipe->connector == AST_OR ? OR : 0) |
+                  (pipe->compound ? COMPOUND : 0));
+        if (pipe->compound) {
+            put_compound(b, pipe->compound);
+            continue;
+        }
+        if (pipe->iored_input)
+            put_word(b, pipe->iored_input);
+        if (pipe->iored_output)
+            put_word(b, pipe->iored_output);
+
+        put_u32(b, list_size(&pipe->commands));
+        struct list_elem *f = list_begin(&pipe->commands);
+        for (; f != list_end(&pipe->commands); f = list_next(f)) {
+            struct ast_command *cmd = list_entry(f, struct ast_command, elem);
+            uint32_t argc = 0;
+            while (cmd->argv[argc])
+                argc++;
+            put_u8(b, cmd->dup_stderr_to_stdout);
+            put_u32(b, argc);
+            for (uint32_t i = 0; i < argc; i++)
+                put_word(b, cmd->argv[i]);
+        }
+    }
+}
+
+/* Serialize a parsed command line */
+static void
+put_command_line(struct buffer *b, unsigned line,
+                 struct ast_command_line *cline)
+{
+    put_u32(b, line);
+    put_pipelines(b, cline);
+}
+
+/* Parse every line of the script at 'path' into 'b' */
+static bool
+compile(struct buffer *b, const char *path)
+{
+    struct script *s = script_open(path);
+    if (s == NULL)
+        return false;
+
+    ast_input_quiet = true;
+    char *line;
+    char *text = NULL;          /* The lines of a command that goes on */
+    while ((line = script_read_line(s)) != NULL) {
+        if (line[0] == '#')
+            continue;
+        if (text != NULL) {
+            size_t len = strlen(text);
+            char *t = realloc(text, len + strlen(line) + 2);
+            if (t == NULL) {
+                b->failed = true;
+                break;
+            }
+            text = t;
+            text[len] = '\n';
+            strcpy(text + len + 1, line);
+            line = text;
+        }
+        struct ast_command_line *cline = ast_parse_command_line(line);
+        if (cline == NULL && ast_input_incomplete) {
+            if (text == NULL)
+                text = strdup(line);
+            continue;
+        }
+        if (cline == NULL) {
+            put_u32(b, script_line(s));
+            put_u32(b, SOURCE);
+            put_word(b, line);
+            free(text);
+            text = NULL;
+            continue;
+        }
+        free(text);
+        text = NULL;
+        if (!list_empty(&cline->pipes))
+            put_command_line(b, script_line(s), cline);
+        ast_command_line_free(cline);
+    }
+    /* The script ends inside a command, which is reported when reached */
+    if (text != NULL) {
+        put_u32(b, script_line(s));
+        put_u32(b, SOURCE);
+        put_word(b, text);
+        free(text);
+    }
+    ast_input_quiet = false;
+    script_close(s);
+    return true;
+}
+
+/* Name the cache file of the script at 'abspath' in 'buf' */
+static bool
+cache_file_name(char *buf, size_t size, const char *abspath, bool create)
+{
+    char dir[PATH_MAX];
+    const char *base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && base[0] == '/') {
+        snprintf(dir, sizeof dir, "%s", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL)
+            return false;
+        snprintf(dir, sizeof dir, "%s/.cache", home);
+    }
+    if (create)
+        mkdir(dir, 0700);
+    strncat(dir, "/cush", sizeof dir - strlen(dir) - 1);
+    if (create)
+        mkdir(dir, 0700);
+
+    /* FNV-1a of the path */
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char *p = abspath; *p; p++) {
+        h ^= (unsigned char) *p;
+        h *= 0x100000001b3ULL;
+    }
+    return snprintf(buf, size, "%s/%016llx.astc", dir,
+                    (unsigned long long) h) < (int) size;
+}
+
+/* Check that 'data' is the cache of the script at 'abspath' */
+static bool
+valid_header(const char *data, size_t size, const char *abspath,
+             const struct stat *st)
+{
+    const struct header *h = (const struct header *) data;
+    size_t path_len = strlen(abspath);
+    return size >= sizeof *h + path_len + 1 &&
+           memcmp(h->magic, AST_CACHE_MAGIC, sizeof h->magic) == 0 &&
+           h->version == AST_CACHE_VERSION &&
+           h->size == (uint64_t) st->st_size &&
+           h->mtime_sec == st->st_mtim.tv_sec &&
+           h->mtime_nsec == st->st_mtim.tv_nsec &&
+           h->path_len == path_len &&
+           memcmp(data + sizeof *h, abspath, path_len + 1) == 0;
+}
+
+/* Map the cache file, if it matches the script */
+static bool
+load(struct ast_cache *c, const char *cache_path, const char *abspath,
+     const struct stat *st)
+{
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat cst;
+    if (fstat(fd, &cst) == -1 ||
+        cst.st_size < (off_t) sizeof(struct header)) {
+        close(fd);
+        return false;
+    }
+    char *data = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    if (!valid_header(data, cst.st_size, abspath, st)) {
+        munmap(data, cst.st_size);
+        return false;
+    }
+
+    c->mapped = true;
+    c->data = data;
+    c->size = cst.st_size;
+    c->pos = sizeof(struct header) + strlen(abspath) + 1;
+    return true;
+}
+
+/* Write the compiled cache under a temporary name and rename it */
+static void
+save(const char *cache_path, const struct buffer *b)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", cache_path) >= (int) sizeof tmp)
+        return;
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+        return;
+
+    size_t done = 0;
+    while (done < b->len) {
+        ssize_t n = write(fd, b->data + done, b->len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (close(fd) == -1 || done < b->len || rename(tmp, cache_path) == -1)
+        unlink(tmp);
+}
+
+/* Open the cache of a script, compiling it if needed */
+struct ast_cache *
+ast_cache_open(const char *path)
+{
+    char abspath[PATH_MAX];
+    struct stat st;
+    if (realpath(path, abspath) == NULL || stat(abspath, &st) == -1)
+        return NULL;
+
+    struct ast_cache *c = calloc(1, sizeof *c);
+    if (c == NULL)
+        return NULL;
+
+    /* Only regular files have a size and time that key their contents */
+    char cache_path[PATH_MAX];
+    bool named = S_ISREG(st.st_mode) &&
+                 cache_file_name(cache_path, sizeof cache_path, abspath,
+                                 false);
+    if (named && load(c, cache_path, abspath, &st))
+        return c;
+
+    /* Compile the script behind a header */
+    struct header h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, AST_CACHE_MAGIC, sizeof h.magic);
+    h.version = AST_CACHE_VERSION;
+    h.path_len = strlen(abspath);
+    h.size = st.st_size;
+    h.mtime_sec = st.st_mtim.tv_sec;
+    h.mtime_nsec = st.st_mtim.tv_nsec;
+
+    struct buffer b = { 0 };
+    put(&b, &h, sizeof h);
+    put(&b, abspath, h.path_len + 1);
+    if (!compile(&b, path) || b.failed) {
+        int saved_errno = b.failed ? ENOMEM : errno;
+        free(b.data);
+        free(c);
+        errno = saved_errno;
+        return NULL;
+    }
+    if (named && cache_file_name(cache_path, sizeof cache_path, abspath,
+                                 true))
+        save(cache_path, &b);
+
+    c->data = b.data;
+    c->size = b.len;
+    c->pos = sizeof h + h.path_len + 1;
+    return c;
+}
+
+static bool
+get_u8(struct ast_cache *c, uint8_t *v)
+{
+    if (c->size - c->pos < sizeof *v)
+        return false;
+    memcpy(v, c->data + c->pos, sizeof *v);
+    c->pos += sizeof *v;
+    return true;
+}
+
+static bool
+get_u32(struct ast_cache *c, uint32_t *v)
+{
+    if (c->size - c->pos < sizeof *v)
+        return false;
+    memcpy(v, c->data + c->pos, sizeof *v);
+    c->pos += sizeof *v;
+    return true;
+}
+
+/* Return a copy of the next word, or NULL */
+static char *
+get_word(struct ast_cache *c)
+{
+    const char *s = c->data + c->pos;
+    const char *nul = memchr(s, '\0', c->size - c->pos);
+    if (nul == NULL)
+        return NULL;
+    c->pos += nul - s + 1;
+    return strdup(s);
+}
+
+static struct ast_command_line *get_pipelines(struct ast_cache *c);
+
+/* Rebuild a compound command */
+static struct ast_compound *
+get_compound(struct ast_cache *c)
+{
+    uint8_t kind, parts;
+    if (!get_u8(c, &kind) || !get_u8(c, &parts) || kind > AST_FUNCTION)
+        return NULL;
+    struct ast_compound *compound = ast_compound_create(kind);
+    if ((parts & NAME) && (compound->name = get_word(c)) == NULL)
+        goto corrupt;
+    if (parts & WORDS) {
+        uint32_t n;
+        if (!get_u32(c, &n) || n > c->size - c->pos)
+            goto corrupt;
+        compound->words = calloc(n + 1, sizeof *compound->words);
+        for (uint32_t i = 0; i < n; i++)
+            if ((compound->words[i] = get_word(c)) == NULL)
+                goto corrupt;
+    }
+    if (((parts & COND) && (compound->cond = get_pipelines(c)) == NULL) ||
+        ((parts & BODY) && (compound->body = get_pipelines(c)) == NULL) ||
+        ((parts & ORELSE) && (compound->orelse = get_pipelines(c)) == NULL))
+        goto corrupt;
+    return compound;
+
+corrupt:
+    ast_compound_free(compound);
+    return NULL;
+}
+
+/* Rebuild one pipeline */
+static struct ast_pipeline *
+get_pipeline(struct ast_cache *c)
+{
+    uint8_t flags;
+    if (!get_u8(c, &flags))
+        return NULL;
+    if (flags & COMPOUND) {
+        struct ast_compound *compound = get_compound(c);
+        if (compound == NULL)
+            return NULL;
+        struct ast_pipeline *pipe = ast_pipeline_create_compound(compound);
+        pipe->connector = (flags & AND) ? AST_AND
+                        : (flags & OR) ? AST_OR : AST_SEQ;
+        return pipe;
+    }
+    char *input = (flags & INPUT) ? get_word(c) : NULL;
+    char *output = (flags & OUTPUT) ? get_word(c) : NULL;
+    struct ast_pipeline *pipe = ast_pipeline_create(input, output,
+                                                    flags & APPEND);
+    pipe->bg_job = flags & BG_JOB;
+    pipe->connector = (flags & AND) ? AST_AND
+                    : (flags & OR) ? AST_OR : AST_SEQ;
+
+    uint32_t ncommands;
+    if (((flags & INPUT) && !input) || ((flags & OUTPUT) && !output) ||
+        !get_u32(c, &ncommands))
+        goto corrupt;
+    for (uint32_t i = 0; i < ncommands; i++) {
+        uint8_t dup_stderr;
+        uint32_t argc;
+        if (!get_u8(c, &dup_stderr) || !get_u32(c, &argc) ||
+            argc > c->size - c->pos)
+            goto corrupt;
+        char **argv = calloc(argc + 1, sizeof *argv);
+        for (uint32_t j = 0; j < argc; j++)
+            argv[j] = get_word(c);
+        ast_pipeline_add_command(pipe, ast_command_create(argv, dup_stderr));
+        if (argc > 0 && argv[argc - 1] == NULL)
+            goto corrupt;
+    }
+    return pipe;
+
+corrupt:
+    ast_pipeline_free(pipe);
+    return NULL;
+}
+
+/* Rebuild the pipelines of a command line, or return NULL */
+static struct ast_command_line *
+get_pipelines(struct ast_cache *c)
+{
+    uint32_t npipes;
+    if (!get_u32(c, &npipes))
+        return NULL;
+    struct ast_command_line *cline = ast_command_line_create_empty();
+    for (uint32_t i = 0; i < npipes; i++) {
+        struct ast_pipeline *pipe = get_pipeline(c);
+        if (pipe == NULL) {
+            ast_command_line_free(cline);
+            return NULL;
+        }
+        list_push_back(&cline->pipes, &pipe->elem);
+    }
+    return cline;
+}
+
+/* Rebuild the next command line */
+bool
+ast_cache_next(struct ast_cache *c, struct ast_command_line **cline)
+{
+    uint32_t line, npipes;
+    if (!get_u32(c, &line) || !get_u32(c, &npipes))
+        return false;
+    ast_input_line = line;
+
+    if (npipes == SOURCE) {
+        char *text = get_word(c);
+        if (text == NULL)
+            return false;
+        *cline = ast_parse_command_line(text);
+        free(text);
+        if (ast_input_incomplete)
+            fprintf(stderr, "%s:%u: Unexpected end of file.\n",
+                    ast_input_name, line);
+        return true;
+    }
+
+    /* get_pipelines reads npipes again */
+    c->pos -= sizeof npipes;
+    *cline = get_pipelines(c);
+    if (*cline == NULL) {
+        fprintf(stderr, "%s:%u: corrupt script cache\n", ast_input_name,
+                line);
+        c->pos = c->size;
+        return false;
+    }
+    return true;
+}
+
+/* Release the cache */
+void
+ast_cache_close(struct ast_cache *c)
+{
+    if (c->mapped)
+        munmap(c->data, c->size);
+    else
+        free(c->data);
+    free(c);
+}
@@ -0,0 +1,41 @@
+#ifndef __AST_CACHE_H
+#define __AST_CACHE_H
+
+#include <stdbool.h>
+
+#include "shell-ast.h"
+
+/*
+ * Precompiled scripts.
+ *
+ * The parsed command lines of a script are serialized into a cache
+ * file that holds no pointers: counts, flags and NUL-terminated words
+ * in the order in which they are executed.  The cache is keyed by the
+ * script's absolute path, size and modification time and by
+ * AST_CACHE_VERSION, so editing the script or changing the parser or
+ * the format invalidates it.  Later runs map the cache and rebuild each
+ * command line just before it runs, without lexing or parsing.
+ *
+ * Cache files live in $XDG_CACHE_HOME/cush, or ~/.cache/cush, and are
+ * replaced with a rename so that concurrent runs see whole files.
+ */
+#define AST_CACHE_MAGIC "CUSHASTC"
+#define AST_CACHE_VERSION 2     /* Bump when the grammar or format changes */
+
+struct ast_cache;
+
+/* Open the cache of the script at 'path', compiling the script and
+ * writing the cache first if it is missing or stale.  A cache that
+ * cannot be written is only kept in memory.  Returns NULL, with errno
+ * set, if the script cannot be read. */
+struct ast_cache *ast_cache_open(const char *path);
+
+/* Rebuild the next command line, and set ast_input_line to its line.
+ * Returns false at the end of the script.  '*cline' is NULL if the
+ * line has a syntax error, which is reported. */
+bool ast_cache_next(struct ast_cache *c, struct ast_command_line **cline);
+
+/* Unmap or free the cache */
+void ast_cache_close(struct ast_cache *c);
+
+#endif /* __AST_CACHE_H */
@@ -0,0 +1,45 @@
+#!/usr/bin/python
+#
+# Tests the script cache: the first run of a script writes its parsed
+# command lines to $XDG_CACHE_HOME/cush, later runs execute them from
+# there, and changing the script invalidates the cache
+
+import atexit, proc_check, time, os, subprocess, tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+cachedir = os.path.join(tmpdir, "cush")
+path = os.path.join(tmpdir, "script.cush")
+with open(path, "w") as f:
+    f.write("echo one | cat\necho a | | echo b\necho two &\n")
+
+env = dict(os.environ, XDG_CACHE_HOME=tmpdir)
+def run_script():
+    shell = subprocess.Popen(["./cush", path], env=env,
+                             stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    out, err = shell.communicate()
+    assert err == path + ":2: Invalid null command.\n", \
+        "Unexpected error output: " + err
+    # the order of the background job's output and its "[1] pid" varies
+    return "".join(sorted(l for l in out.splitlines(True)
+                          if not l.startswith("[")))
+
+assert run_script() == "one\ntwo\n", "Unexpected output of first run"
+caches = os.listdir(cachedir)
+assert len(caches) == 1, "Expected one cache file: " + str(caches)
+cache = os.path.join(cachedir, caches[0])
+
+# a later run takes the commands from the cache, not from the script
+with open(cache) as f:
+    data = f.read()
+assert "one\0" in data, "Words are not in the cache"
+with open(cache, "w") as f:
+    f.write(data.replace("one\0", "uno\0"))
+assert run_script() == "two\nuno\n", "Cache was not used"
+
+# a newer script is compiled again
+os.utime(path, (time.time() + 10, time.time() + 10))
+assert run_script() == "one\ntwo\n", "Stale cache was used"
+assert os.listdir(cachedir) == caches, "Cache file was not replaced"
+
+test_success()
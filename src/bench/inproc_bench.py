@@ -0,0 +1,40 @@
+#!/usr/bin/python
+#
+# Runs a script of echo, true, test and printf lines, as loops of a
+# larger script would, with the utilities run in the shell and, after
+# "set +o inproc", forked and executed.  Reports the wall and CPU time
+# per line, and the lines per second.
+#
+# Usage: python bench/inproc_bench.py [shell] [lines]
+#
+import os, shutil, subprocess, sys, tempfile, time
+
+shell = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+lines = int(sys.argv[2]) if len(sys.argv) > 2 else 1000000
+
+body = ["true", "echo iteration > /dev/null", "[ 1 -lt 2 ]",
+        "printf %d\\n 42 > /dev/null"]
+devnull = open(os.devnull, "r+")
+tmpdir = tempfile.mkdtemp()
+
+def run(name, options):
+    """Run the script with 'options' before it and report the time"""
+    path = os.path.join(tmpdir, name)
+    with open(path, "w") as script:
+        script.writelines(line + "\n" for line in options)
+        for i in range(lines):
+            script.write(body[i % len(body)] + "\n")
+    begin = time.time()
+    proc = subprocess.Popen([shell, path], stdin=devnull, stdout=devnull)
+    pid, status, rusage = os.wait4(proc.pid, 0)
+    elapsed = time.time() - begin
+    cpu = rusage.ru_utime + rusage.ru_stime
+    print("%-9s  %8.2fs  %7.2fus/line  cpu %8.2fs  %10.0f lines/s" % (
+        name, elapsed, elapsed / lines * 1e6, cpu, lines / elapsed))
+    return elapsed
+
+print("%d lines of %s" % (lines, ", ".join(b.split()[0] for b in body)))
+forked = run("forked", ["set +o inproc"])
+inproc = run("inproc", [])
+print("speedup %.1fx" % (forked / inproc))
+shutil.rmtree(tmpdir)
@@ -0,0 +1,50 @@
+#!/usr/bin/python
+#
+# Compares GNU readline with the built-in line editor (-e): the time
+# until the first prompt, the shell's RSS at the prompt, and the time
+# a large bracketed paste takes from being sent until the next prompt.
+#
+# Usage: python bench/lineedit_bench.py [shell] [paste kilobytes] [runs]
+#
+import os, sys, time, pexpect
+
+shell = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+kilobytes = int(sys.argv[2]) if len(sys.argv) > 2 else 1024
+runs = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+
+prompt = "<[^@]*@[^>]*>\$ "
+env = dict(os.environ, TERM="xterm")
+# 'true' with words of 100 bytes, so that it stays below ARG_MAX
+paste = "true " + " ".join(["y" * 99] * (kilobytes * 1024 // 100))
+
+def rss_kb(pid):
+    """Return the resident set size of 'pid'"""
+    for line in open("/proc/%d/status" % pid):
+        if line.startswith("VmRSS:"):
+            return int(line.split()[1])
+
+def measure(args):
+    """Return the median startup time, RSS and paste time of the shell"""
+    startups, rss, pastes = [], [], []
+    for i in range(runs):
+        start = time.time()
+        console = pexpect.spawn(shell + args, env=env, timeout=600,
+                                drainpty=True)
+        console.expect(prompt)
+        startups.append(time.time() - start)
+        rss.append(rss_kb(console.pid))
+
+        start = time.time()
+        console.send("\x1b[200~" + paste + "\x1b[201~\r")
+        console.expect(prompt)
+        pastes.append(time.time() - start)
+        console.sendline("exit")
+        console.expect(pexpect.EOF)
+    median = lambda samples: sorted(samples)[len(samples) // 2]
+    return median(startups), median(rss), median(pastes)
+
+print("%d KB paste, median of %d runs" % (kilobytes, runs))
+for name, args in (("readline", ""), ("lineedit", " -e")):
+    startup, rss, pasted = measure(args)
+    print("%-9s  first prompt %7.2fms  rss %6d KB  paste %8.1fms" % (
+        name, startup * 1000, rss, pasted * 1000))
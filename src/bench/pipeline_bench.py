@@ -0,0 +1,42 @@
+#!/usr/bin/python
+#
+# Measures the throughput of a multi-stage pipeline launched by cush,
+# with and without 'set -o placement'.
+#
+# Usage: python bench/pipeline_bench.py [shell] [megabytes] [runs]
+#
+import sys, time, pexpect
+
+shell = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+megabytes = int(sys.argv[2]) if len(sys.argv) > 2 else 2048
+runs = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+
+prompt = "<[^@]*@[^>]*>\$"
+pipeline = ("dd if=/dev/zero bs=64k count=%d status=none | cat | cat | cat"
+            " > /dev/null" % (megabytes * 16))
+
+console = pexpect.spawn(shell, timeout=600)
+console.expect(prompt)
+
+def best_time(placement):
+    """Return the fastest of 'runs' executions of the pipeline"""
+    console.sendline("set %s placement" % ("-o" if placement else "+o"))
+    console.expect(prompt)
+    best = None
+    for i in range(runs):
+        start = time.time()
+        console.sendline(pipeline)
+        console.expect(prompt)
+        elapsed = time.time() - start
+        if best is None or elapsed < best:
+            best = elapsed
+    return best
+
+print("pipeline: %s" % pipeline)
+for placement in (False, True):
+    best = best_time(placement)
+    print("placement %-3s  best of %d: %7.3fs  %8.1f MB/s" % (
+        "on" if placement else "off", runs, best, megabytes / best))
+
+console.sendline("exit")
+console.expect(pexpect.EOF)
@@ -0,0 +1,74 @@
+#!/usr/bin/python
+#
+# Measures how fast cush starts: the time until "cush -c true" runs its
+# command, the time until it has exited, and the dynamic relocations
+# and page faults of the shell process.
+#
+# Usage: python bench/startup_bench.py [shell] [runs]
+#
+import os, re, shutil, subprocess, sys, tempfile, time
+
+shell = sys.argv[1] if len(sys.argv) > 1 else "./cush"
+runs = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+
+devnull = open(os.devnull, "r+")
+tmpdir = tempfile.mkdtemp()
+fifo = os.path.join(tmpdir, "fifo")
+os.mkfifo(fifo)
+
+def start(commands, env=None):
+    """Start the shell on 'commands'"""
+    return subprocess.Popen([shell, "-c", commands], env=env, stdin=devnull,
+                            stdout=devnull, stderr=subprocess.PIPE)
+
+def time_to_exec():
+    """Return the seconds until the command opens its output, which it
+    does right before it is executed"""
+    begin = time.time()
+    proc = start("true > " + fifo)
+    open(fifo).close()
+    elapsed = time.time() - begin
+    proc.wait()
+    return elapsed
+
+def time_to_exit():
+    """Return the seconds until the shell has exited, and its rusage"""
+    begin = time.time()
+    proc = start("true")
+    pid, status, rusage = os.wait4(proc.pid, 0)
+    elapsed = time.time() - begin
+    proc.returncode = status
+    return elapsed, rusage
+
+def relocations():
+    """Return the relocations the dynamic loader made in the shell, as
+    reported by LD_DEBUG=statistics"""
+    env = dict(os.environ, LD_DEBUG="statistics")
+    proc = start("true", env)
+    err = proc.communicate()[1]
+    counts = []
+    for label, name in (("relocations", "final number of relocations"),
+                        ("relative relocations",
+                         "number of relative relocations")):
+        m = re.search("^\s*%d:\s+%s: (\d+)" % (proc.pid, name), err, re.M)
+        counts.append((label, int(m.group(1)) if m else -1))
+    return counts
+
+def report(name, samples):
+    samples.sort()
+    print("%-22s median %8.3fms  min %8.3fms  p90 %8.3fms" % (
+        name, samples[len(samples) // 2] * 1000, samples[0] * 1000,
+        samples[len(samples) * 9 // 10] * 1000))
+
+exec_times = [time_to_exec() for i in range(runs)]
+exits = [time_to_exit() for i in range(runs)]
+shutil.rmtree(tmpdir)
+
+print("%s -c true, %d runs" % (shell, runs))
+report("time to first exec", exec_times)
+report("time to exit", [elapsed for elapsed, rusage in exits])
+print("%-22s minor %6d  major %d  (shell and command)" % ("page faults",
+      min(rusage.ru_minflt for elapsed, rusage in exits),
+      min(rusage.ru_majflt for elapsed, rusage in exits)))
+for label, count in relocations():
+    print("%-22s %d" % (label, count))
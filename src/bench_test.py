@@ -0,0 +1,30 @@
+#!/usr/bin/python
+#
+# Tests the bench builtin: repeated runs of one pipeline, and a side by
+# side comparison of quoted pipelines
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the rest of the command line is run and summarized
+sendline("bench -n 3 -w 0 -- sleep 0.2")
+expect("mean\s+stddev\s+min\s+p50\s+p95\s+p99\s+user\s+sys\s+maxrss\s+out\s+pipeline")
+expect("1\s+20\d\.\d+ms .* sleep 0.2\r\n")
+expect_prompt()
+
+# quoted pipelines are compared, and the fastest one is named
+sendline('bench -n 2 -w 0 "sleep 0.3" "sleep 0.1 | cat"')
+expect("1\s+30\d\.\d+ms .* sleep 0.3\r\n")
+expect("2\s+10\d\.\d+ms .* sleep 0.1\| cat\r\n")
+expect("#2 is \d\.\d+x faster than #1")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
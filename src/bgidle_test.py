@@ -0,0 +1,71 @@
+#!/usr/bin/python
+#
+# Tests set -o bgidle: every thread of a background job runs at idle
+# priority while a job runs in the foreground, including threads it
+# starts meanwhile, and all get their settings back afterwards
+
+import atexit, proc_check, time, os, sys, tempfile
+from testutils import *
+
+SCHED_OTHER, SCHED_BATCH, SCHED_IDLE = 0, 3, 5
+
+# a process with two threads that starts a third one after a second
+script = os.path.join(tempfile.mkdtemp(), "threads.py")
+with open(script, "w") as f:
+    f.write("\n".join([
+        "import threading, time",
+        "def idle():",
+        "    time.sleep(8)",
+        "for i in range(2):",
+        "    threading.Thread(target=idle).start()",
+        "time.sleep(1.5)",
+        "threading.Thread(target=idle).start()",
+        "time.sleep(8)",
+        ""]))
+atexit.register(lambda: os.unlink(script))
+
+# the policy of each thread of 'pid', from field 41 of its stat file
+def thread_policies(pid):
+    policies = []
+    for tid in os.listdir("/proc/%d/task" % pid):
+        with open("/proc/%d/task/%s/stat" % (pid, tid)) as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+        policies.append(int(fields[38]))
+    return policies
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("set -o bgidle")
+expect_prompt()
+
+sendline("%s %s &" % (sys.executable, script))
+expect("\[1\] (\d+)\r\n")
+pid = int(console.match.group(1))
+expect_prompt()
+time.sleep(0.5)
+assert thread_policies(pid) == [SCHED_OTHER] * 3, \
+    "Expected the background job to run normally"
+
+# while a foreground job runs, all threads are demoted
+sendline("sleep 2.5")
+time.sleep(2)
+policies = thread_policies(pid)
+assert len(policies) == 4 and \
+    all(p in (SCHED_BATCH, SCHED_IDLE) for p in policies), \
+    "Expected every thread to be demoted"
+expect_prompt()
+
+# once it is done, all threads are restored
+assert thread_policies(pid) == [SCHED_OTHER] * 4, \
+    "Expected every thread to be restored"
+
+sendline("kill 1")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
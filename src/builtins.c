@@ -0,0 +1,198 @@
+/*
+ * The table of builtins, and loading plugins.
+ *
+ * The table is open addressing with linear probing on a power of two
+ * of slots, at most half of which are used.  Builtins are never removed,
+ * but a function can be defined again; those of a plugin are only added
+ * once its cush_plugin_init succeeded.
+ */
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+
+static struct builtin *table;
+static size_t table_size;       /* A power of two, or 0 */
+static size_t table_used;
+
+/* The plugin being initialized, and the builtins it registered */
+static const char *plugin_path;
+static const struct cush_builtin **pending;
+static size_t pending_used, pending_size;
+
+/* FNV-1a */
+static uint32_t
+hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+    for (; *name != '\0'; name++)
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    return h;
+}
+
+/* The slot of 'name', or the free slot where it belongs */
+static struct builtin *
+lookup(struct builtin *slots, size_t size, const char *name)
+{
+    size_t i = hash_name(name) & (size - 1);
+    while (slots[i].name != NULL && strcmp(slots[i].name, name) != 0)
+        i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+static bool
+grow(void)
+{
+    size_t size = table_size == 0 ? 64 : table_size * 2;
+    struct builtin *slots = calloc(size, sizeof *slots);
+    if (slots == NULL)
+        return false;
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].name != NULL)
+            *lookup(slots, size, table[i].name) = table[i];
+    }
+    free(table);
+    table = slots;
+    table_size = size;
+    return true;
+}
+
+/* Add a builtin */
+bool
+builtin_add(const struct builtin *b)
+{
+    if ((table_used + 1) * 2 > table_size && !grow())
+        return false;
+    struct builtin *slot = lookup(table, table_size, b->name);
+    if (slot->name != NULL)
+        return false;
+    *slot = *b;
+    table_used++;
+    return true;
+}
+
+/* Define or redefine a function */
+bool
+builtin_define_function(const struct ast_compound *f)
+{
+    struct builtin *slot = table_size == 0 ? NULL
+                                           : lookup(table, table_size, f->name);
+    if (slot == NULL || slot->name == NULL) {
+        struct builtin b = { f->name, NULL, NULL, NULL, f };
+        return builtin_add(&b);
+    }
+    if (slot->function == NULL)
+        return false;
+    /* The old definition may still be running, so it is not freed */
+    slot->name = f->name;
+    slot->function = f;
+    return true;
+}
+
+/* Return the builtin called 'name', or NULL */
+const struct builtin *
+builtin_find(const char *name)
+{
+    if (table_size == 0)
+        return NULL;
+    struct builtin *slot = lookup(table, table_size, name);
+    return slot->name != NULL ? slot : NULL;
+}
+
+/* The register_builtin of the host */
+static int
+register_builtin(const struct cush_builtin *b)
+{
+    if (b == NULL || b->name == NULL || b->name[0] == '\0' ||
+        b->handler == NULL) {
+        fprintf(stderr, "%s: invalid builtin\n", plugin_path);
+        return -1;
+    }
+    bool taken = builtin_find(b->name) != NULL;
+    for (size_t i = 0; !taken && i < pending_used; i++)
+        taken = strcmp(pending[i]->name, b->name) == 0;
+    if (taken) {
+        fprintf(stderr, "%s: %s is already a builtin\n", plugin_path,
+                b->name);
+        return -1;
+    }
+    if (pending_used == pending_size) {
+        size_t size = pending_size == 0 ? 16 : pending_size * 2;
+        const struct cush_builtin **p = realloc(pending, size * sizeof *p);
+        if (p == NULL)
+            return -1;
+        pending = p;
+        pending_size = size;
+    }
+    pending[pending_used++] = b;
+    return 0;
+}
+
+static const struct cush_plugin_host host = {
+    CUSH_PLUGIN_ABI_VERSION, register_builtin
+};
+
+/* Load one plugin and add its builtins */
+static void
+load_plugin(const char *path)
+{
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return;
+    }
+    int (*init)(const struct cush_plugin_host *) =
+        (int (*)(const struct cush_plugin_host *))
+        dlsym(handle, "cush_plugin_init");
+    if (init == NULL) {
+        fprintf(stderr, "%s: no cush_plugin_init\n", path);
+        dlclose(handle);
+        return;
+    }
+
+    plugin_path = path;
+    pending_used = 0;
+    if (init(&host) == -1) {
+        fprintf(stderr, "%s: plugin failed to initialize\n", path);
+        dlclose(handle);
+        return;
+    }
+    for (size_t i = 0; i < pending_used; i++) {
+        struct builtin b = { pending[i]->name, NULL, NULL, pending[i] };
+        builtin_add(&b);
+    }
+}
+
+static int
+is_plugin(const struct dirent *e)
+{
+    size_t len = strlen(e->d_name);
+    return e->d_name[0] != '.' && len > 3 &&
+           strcmp(e->d_name + len - 3, ".so") == 0;
+}
+
+/* Load the plugins in 'dir' */
+bool
+builtin_load_plugins(const char *dir)
+{
+    struct dirent **entries;
+    int n = scandir(dir, &entries, is_plugin, alphasort);
+    if (n == -1)
+        return false;
+    for (int i = 0; i < n; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s/%s", dir, entries[i]->d_name);
+        load_plugin(path);
+        free(entries[i]);
+    }
+    free(entries);
+    free(pending);
+    pending = NULL;
+    pending_used = pending_size = 0;
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __BUILTINS_H
+#define __BUILTINS_H
+
+#include <stdbool.h>
+
+#include "cush_plugin.h"
+#include "inproc.h"
+#include "shell-ast.h"
+
+/*
+ * The builtins of the shell by name: its own builtins for job control
+ * and the like, the utilities of inproc.h, the builtins registered by
+ * plugins, and the functions defined by the user.  They are kept in a
+ * hash table, which is looked up for every command.
+ */
+
+/* A builtin is one of these kinds; the other pointers are NULL */
+struct builtin {
+    const char *name;
+    /* A builtin of the shell, which runs on the shell's stdio and
+     * returns its exit status */
+    int (*shell)(int argc, char **argv);
+    const struct inproc_utility *utility;
+    const struct cush_builtin *plugin;
+    const struct ast_compound *function;    /* An AST_FUNCTION */
+};
+
+/* Add a builtin.  Returns false if there is one of that name. */
+bool builtin_add(const struct builtin *b);
+
+/* Define the function 'f', or replace the function of its name.
+ * Returns false if its name is another kind of builtin. */
+bool builtin_define_function(const struct ast_compound *f);
+
+/* Return the builtin called 'name', or NULL */
+const struct builtin *builtin_find(const char *name);
+
+/* Load the plugins in 'dir', in the order of their names.  A plugin
+ * that cannot be loaded, or registers a name that is taken, is reported
+ * and skipped.  Returns false if 'dir' cannot be read. */
+bool builtin_load_plugins(const char *dir);
+
+#endif /* __BUILTINS_H */
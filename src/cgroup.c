@@ -0,0 +1,219 @@
+/*
+ * Support for placing jobs into cgroup v2 leaves.
+ *
+ * The shell is given a delegated cgroup directory.  Below it, it
+ * creates cush-<pid>/ with a leaf shell/ for itself (cgroup v2 does
+ * not allow processes in inner nodes) and one leaf job-<jid>/ per job.
+ * On exit the shell moves back to the cgroup it started in, so that
+ * cush-<pid>/ can be removed.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+#include "utils.h"
+
+static char *cgroup_base;       /* cush-<pid>/ below the delegated cgroup */
+static char *cgroup_home;       /* The cgroup the shell started in */
+
+/* Write 'value' to 'path'.  Returns -1 on error. */
+static int
+write_file(const char *path, const char *value)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    ssize_t len = strlen(value);
+    ssize_t rc = write(fd, value, len);
+    close(fd);
+    return rc == len ? 0 : -1;
+}
+
+/* Build the path of 'file' within cgroup 'cg' in 'path'.
+ * Returns -1 if the path does not fit. */
+static int
+control_path(char path[PATH_MAX], const char *cg, const char *file)
+{
+    if (snprintf(path, PATH_MAX, "%s/%s", cg, file) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the malloc'd path of the cgroup v2 the shell is in, or NULL */
+static char *
+current_cgroup(void)
+{
+    char mount[PATH_MAX] = "";
+    FILE *f = setmntent("/proc/self/mounts", "r");
+    if (f == NULL)
+        return NULL;
+    struct mntent *m;
+    while ((m = getmntent(f)) != NULL) {
+        if (strcmp(m->mnt_type, "cgroup2") == 0) {
+            snprintf(mount, sizeof mount, "%s", m->mnt_dir);
+            break;
+        }
+    }
+    endmntent(f);
+
+    /* The cgroup v2 entry is the line "0::/path" */
+    char line[PATH_MAX], path[PATH_MAX];
+    char *home = NULL;
+    f = fopen("/proc/self/cgroup", "re");
+    if (f == NULL)
+        return NULL;
+    while (mount[0] != '\0' && fgets(line, sizeof line, f) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            if (snprintf(path, sizeof path, "%s%s", mount, line + 3)
+                    < sizeof path)
+                home = strdup(path);
+            break;
+        }
+    }
+    fclose(f);
+    return home;
+}
+
+/* Set up the shell's subtree below 'parent' */
+void
+cgroup_init(const char *parent)
+{
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof path, "%s/cush-%d", parent, getpid())
+            >= sizeof path || mkdir(path, 0755) == -1)
+        utils_fatal_error("cgroup: cannot create %s: ", path);
+    cgroup_base = strdup(path);
+    cgroup_home = current_cgroup();
+
+    if (control_path(path, cgroup_base, "shell") == -1
+            || mkdir(path, 0755) == -1 || cgroup_enter(path) == -1)
+        utils_fatal_error("cgroup: cannot move shell into %s: ", path);
+
+    /* Enable the controllers we expose; not every kernel or
+     * delegation provides all of them, so failures are not fatal. */
+    static const char *controllers[] = { "+cpu", "+memory", "+cpuset" };
+    for (int i = 0; i < sizeof controllers / sizeof controllers[0]; i++) {
+        if (control_path(path, parent, "cgroup.subtree_control") == 0)
+            write_file(path, controllers[i]);
+        if (control_path(path, cgroup_base, "cgroup.subtree_control") == 0)
+            write_file(path, controllers[i]);
+    }
+}
+
+/* Leave the shell's subtree and remove it */
+void
+cgroup_cleanup(void)
+{
+    char path[PATH_MAX];
+
+    if (cgroup_base == NULL)
+        return;
+    if (cgroup_home != NULL)
+        cgroup_enter(cgroup_home);
+    if (control_path(path, cgroup_base, "shell") == 0)
+        rmdir(path);
+    rmdir(cgroup_base);
+}
+
+/* Return true if jobs are placed into cgroups */
+bool
+cgroup_enabled(void)
+{
+    return cgroup_base != NULL;
+}
+
+/* Create the leaf cgroup for job 'jid' */
+char *
+cgroup_create_job(int jid)
+{
+    char path[PATH_MAX];
+    char leaf[32];
+
+    snprintf(leaf, sizeof leaf, "job-%d", jid);
+    if (control_path(path, cgroup_base, leaf) == -1
+            || (mkdir(path, 0755) == -1 && errno != EEXIST)) {
+        utils_error("cgroup: cannot create %s: ", path);
+        return NULL;
+    }
+    return strdup(path);
+}
+
+/* Move the calling process into cgroup 'cg' */
+int
+cgroup_enter(const char *cg)
+{
+    char path[PATH_MAX];
+
+    if (control_path(path, cg, "cgroup.procs") == -1)
+        return -1;
+    return write_file(path, "0");
+}
+
+/* Write 'value' into the control file 'file' of cgroup 'cg' */
+int
+cgroup_set(const char *cg, const char *file, const char *value)
+{
+    char path[PATH_MAX];
+
+    /* Control files are plain names, do not let them escape the leaf. */
+    if (strchr(file, '/') != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (control_path(path, cg, file) == -1)
+        return -1;
+    return write_file(path, value);
+}
+
+/* Print the value of the control file 'file' of cgroup 'cg' */
+void
+cgroup_print(const char *cg, const char *file)
+{
+    char path[PATH_MAX];
+    char value[256];
+
+    if (control_path(path, cg, file) == -1)
+        return;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    ssize_t len = read(fd, value, sizeof value - 1);
+    close(fd);
+    if (len <= 0)
+        return;
+
+    value[len] = '\0';
+    value[strcspn(value, "\n")] = '\0';
+    printf("%s\t%s\n", file, value);
+}
+
+/* Kill every process in cgroup 'cg' */
+int
+cgroup_kill(const char *cg)
+{
+    return cgroup_set(cg, "cgroup.kill", "1");
+}
+
+/* Remove the leaf cgroup 'cg'.  This fails with EBUSY while
+ * processes that escaped the job's process group are still alive;
+ * the leaf is then left behind for the user to inspect. */
+void
+cgroup_remove(const char *cg)
+{
+    rmdir(cg);
+}
@@ -0,0 +1,39 @@
+#ifndef __CGROUP_H
+#define __CGROUP_H
+
+#include <stdbool.h>
+
+/* Set up a cgroup v2 subtree for the shell's jobs below the
+ * delegated cgroup directory 'parent'. */
+void cgroup_init(const char *parent);
+
+/* Move the shell back to the cgroup it started in and remove its
+ * subtree.  Leaves of jobs that are still running are left behind,
+ * and so is the subtree then. */
+void cgroup_cleanup(void);
+
+/* Return true if jobs are placed into cgroups */
+bool cgroup_enabled(void);
+
+/* Create the leaf cgroup for job 'jid'.
+ * Returns a malloc'd path, or NULL on failure. */
+char *cgroup_create_job(int jid);
+
+/* Move the calling process into cgroup 'cg'.  Returns -1 on error. */
+int cgroup_enter(const char *cg);
+
+/* Write 'value' into the control file 'file' of cgroup 'cg'.
+ * Returns -1 on error. */
+int cgroup_set(const char *cg, const char *file, const char *value);
+
+/* Print the value of the control file 'file' of cgroup 'cg' */
+void cgroup_print(const char *cg, const char *file);
+
+/* Kill every process in cgroup 'cg' with one write to cgroup.kill.
+ * Returns -1 on error, e.g. if the kernel lacks cgroup.kill. */
+int cgroup_kill(const char *cg);
+
+/* Remove the leaf cgroup 'cg', if it is empty */
+void cgroup_remove(const char *cg);
+
+#endif /* __CGROUP_H */
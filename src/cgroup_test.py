@@ -0,0 +1,105 @@
+#!/usr/bin/python
+#
+# Tests -g: every job runs in its own cgroup leaf, limit only touches
+# the limits of a job, and the shell removes its subtree on exit.
+# Skipped without a cgroup v2 directory that can be delegated to us.
+
+import atexit, proc_check, time, os, tempfile
+from testutils import *
+
+# a fresh directory below the cgroup v2 mount, if we may create one
+parent = None
+with open("/proc/self/mounts") as f:
+    for line in f:
+        fields = line.split()
+        if fields[2] == "cgroup2":
+            try:
+                parent = tempfile.mkdtemp(prefix="cush-test-", dir=fields[1])
+            except OSError:
+                pass
+            break
+
+if parent is None:
+    test_success("(skipped: no delegated cgroup v2 directory)")
+
+# kill whatever a failed test left behind and remove the whole tree
+def remove_parent():
+    if not os.path.exists(parent):
+        return
+    with open(os.path.join(parent, "cgroup.kill"), "w") as f:
+        f.write("1")
+    time.sleep(0.2)
+    for dirpath, dirnames, filenames in os.walk(parent, topdown=False):
+        os.rmdir(dirpath)
+atexit.register(remove_parent)
+
+# the cgroup of 'pid' relative to the cgroup v2 mount
+def cgroup_of(pid):
+    with open("/proc/%d/cgroup" % pid) as f:
+        for line in f:
+            if line.startswith("0::"):
+                return line[3:].strip()
+
+# wait for 'pid', which joins its leaf after the fork, to be in 'leaf'
+def wait_for_cgroup(pid, leaf):
+    for i in range(50):
+        if cgroup_of(pid).endswith(leaf):
+            return True
+        time.sleep(0.02)
+    return False
+
+console = setup_tests([" -g " + parent])
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+subtree = "cush-%d" % console.pid
+assert os.path.isdir(os.path.join(parent, subtree, "shell")), \
+    "Expected the shell's leaf"
+assert cgroup_of(console.pid).endswith("/%s/shell" % subtree), \
+    "Expected the shell in its leaf"
+
+# each job gets a leaf of its own
+sendline("sleep 10 &")
+expect("\[1\] (\d+)\r\n")
+pid = int(console.match.group(1))
+expect_prompt()
+assert wait_for_cgroup(pid, "/%s/job-1" % subtree), \
+    "Expected the job in its leaf"
+
+# limit refuses files other than the limits
+sendline("limit 1 cgroup.procs=0 cgroup.kill=1")
+expect_exact("limit: cgroup.procs is not one of cpu.max, cpu.weight, "
+             "memory.max, cpuset.cpus")
+expect_exact("limit: cgroup.kill is not one of cpu.max, cpu.weight, "
+             "memory.max, cpuset.cpus")
+expect_prompt()
+assert os.path.exists("/proc/%d" % pid), "Expected the job to be alive"
+assert cgroup_of(console.pid).endswith("/%s/shell" % subtree), \
+    "Expected the shell to stay in its leaf"
+
+# and sets them where the controller is available
+leaf = os.path.join(parent, subtree, "job-1")
+if os.path.exists(os.path.join(leaf, "cpu.weight")):
+    sendline("limit 1 cpu.weight=20")
+    expect_prompt()
+    sendline("limit 1")
+    expect("cpu.weight\t20\r\n")
+    expect_prompt()
+
+# kill removes the job and its leaf
+sendline("kill 1")
+expect_prompt()
+sendline("jobs")
+expect_prompt()
+assert not os.path.exists(leaf), "Expected the job's leaf to be removed"
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+expect(pexpect.EOF)
+
+# the shell's subtree is gone with it
+assert not os.path.exists(os.path.join(parent, subtree)), \
+    "Expected the shell's subtree to be removed"
+
+test_success()
@@ -0,0 +1,88 @@
+#!/usr/bin/python
+#
+# Tests if, while, until, for, { }, && and || and functions: they run in
+# the shell without forking, from the script cache as from stdin, and
+# their body may span lines
+
+import atexit, os, re, json, shutil, signal, subprocess
+import tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+atexit.register(shutil.rmtree, tmpdir)
+
+script = """stats reset
+if false; then echo no; elif true; then echo elif; else echo no; fi
+if false
+then
+    echo no
+else
+    echo else
+fi
+for i in a b c; do echo item $i; done
+for i in 1 2 3 4 5
+do
+    if [ $i = 2 ]; then continue; fi
+    if test $i = 4; then break; fi
+    echo loop $i
+done
+true && echo and
+false && echo no
+false || echo or
+true || echo no
+until true; do echo no; done
+while true; do while true; do echo inner; break 2; done; echo no; done
+greet() { echo hello $1 of $#; return 3; }
+greet world x
+echo status $?
+args() {
+    for a in $@ $*; do echo arg $a; done
+}
+args p q r s
+{ echo g1; echo g2; }
+echo "literal $i" ${i}x
+stats -j
+for i in 1; do sh -c "exit 5"; done
+echo status $?
+export 1bad || echo export failed
+fg 99 && echo no
+if set -o nosuchoption; then echo no; else echo set failed; fi
+unset i && echo unset ok
+jobs() { echo no; }
+if true; then
+"""
+
+def check(output):
+    lines = ["elif", "else", "item a", "item b", "item c", "loop 1", "loop 3",
+             "and", "or", "inner", "hello world of 2", "status 3", "arg p",
+             "arg q", "g1", "g2", "literal $i 4x", "status 5",
+             "export failed", "set failed", "unset ok", "jobs: is a builtin"]
+    for line in lines:
+        assert "\n" + line + "\n" in "\n" + output, \
+            "Missing '" + line + "': " + output
+    assert "no\n" not in output, "Unexpected output: " + output
+    assert output.count("arg ") == 8, "$@ not expanded twice: " + output
+    assert ":%d: Unexpected end of file.\n" % script.count("\n") in output, \
+        "Unfinished command not reported: " + output
+    stats = json.loads(re.search("^(\{.*\})$", output, re.M).group(1))
+    assert stats["spawn"]["count"] == 0, "Control flow forked: " + output
+
+def start_shell():
+    # Python ignores SIGPIPE, and its children would inherit that
+    signal.signal(signal.SIGPIPE, signal.SIG_DFL)
+
+path = os.path.join(tmpdir, "script.cush")
+with open(path, "w") as f:
+    f.write(script)
+
+env = dict(os.environ, XDG_CACHE_HOME=tmpdir)
+# Compiled into the cache, run from the cache, and read from stdin
+for args, stdin in [([path], ""), ([path], ""), ([], script)]:
+    shell = subprocess.Popen(["./cush"] + args, env=env,
+                             stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                             stderr=subprocess.STDOUT, preexec_fn=start_shell)
+    output = shell.communicate(stdin)[0]
+    assert shell.returncode == 0, "Shell failed: " + output
+    check(output)
+
+test_success()
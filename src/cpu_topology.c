@@ -0,0 +1,184 @@
+/*
+ * CPU cache topology support for pipeline placement.
+ *
+ * Adjacent stages of a pipeline exchange data through pipes, so
+ * running them on cores that share the last level cache keeps that
+ * data in cache.  Each stage gets a physical core of its own within
+ * that cache: SMT siblings share one core's execution units, and two
+ * busy stages on them would slow each other down.  The topology is
+ * read lazily from /sys/devices/system/cpu the first time a pipeline
+ * is placed.
+ */
+#define _GNU_SOURCE 1
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu_topology.h"
+
+#define MAX_DOMAINS 256
+#define MAX_CORES 1024
+
+/* The distinct sets of CPUs sharing one cache at a given level */
+struct cache_level {
+    cpu_set_t domains[MAX_DOMAINS];
+    int ndomains;
+    int next;                   /* round-robin position */
+    int next_core[MAX_DOMAINS]; /* round-robin position within a domain */
+};
+
+static struct cache_level l2, l3;
+
+/* The distinct sets of SMT siblings, one per physical core */
+static cpu_set_t cores[MAX_CORES];
+static int ncores;
+
+static bool topology_read;
+
+/* Parse a cpulist such as "0-3,8-11" into 'set' */
+static void
+parse_cpulist(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*list) {
+        char *end;
+        long lo = strtol(list, &end, 10);
+        long hi = lo;
+        if (end == list)
+            break;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+/* Read the first line of a sysfs file into 'buf' */
+static bool
+read_sysfs(const char *path, char *buf, int size)
+{
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return false;
+
+    bool ok = fgets(buf, size, f) != NULL;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+/* Add 'set' to the domains of 'level' unless it is already known */
+static void
+add_domain(struct cache_level *level, cpu_set_t *set)
+{
+    for (int i = 0; i < level->ndomains; i++)
+        if (CPU_EQUAL(&level->domains[i], set))
+            return;
+
+    if (level->ndomains < MAX_DOMAINS)
+        level->domains[level->ndomains++] = *set;
+}
+
+/* Add the core of 'set' unless it is already known */
+static void
+add_core(cpu_set_t *set)
+{
+    for (int i = 0; i < ncores; i++)
+        if (CPU_EQUAL(&cores[i], set))
+            return;
+
+    if (ncores < MAX_CORES)
+        cores[ncores++] = *set;
+}
+
+/* Collect the L2 and L3 domains and the cores of the CPUs we may
+ * run on.  Without SMT information every CPU counts as a core. */
+static void
+read_topology(void)
+{
+    cpu_set_t allowed;
+    char path[128], buf[1024];
+
+    topology_read = true;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == -1)
+        return;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        cpu_set_t siblings;
+        snprintf(path, sizeof path,
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+                 cpu);
+        if (read_sysfs(path, buf, sizeof buf))
+            parse_cpulist(buf, &siblings);
+        else
+            CPU_ZERO(&siblings);
+        CPU_SET(cpu, &siblings);
+        CPU_AND(&siblings, &siblings, &allowed);
+        add_core(&siblings);
+
+        for (int index = 0; ; index++) {
+            snprintf(path, sizeof path,
+                     "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+                     cpu, index);
+            if (!read_sysfs(path, buf, sizeof buf))
+                break;
+
+            int level = atoi(buf);
+            if (level != 2 && level != 3)
+                continue;
+
+            snprintf(path, sizeof path,
+                     "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+                     cpu, index);
+            if (!read_sysfs(path, buf, sizeof buf))
+                continue;
+
+            cpu_set_t shared;
+            parse_cpulist(buf, &shared);
+            CPU_AND(&shared, &shared, &allowed);
+            add_domain(level == 2 ? &l2 : &l3, &shared);
+        }
+    }
+}
+
+/* Place the 'nstages' stages of a pipeline */
+bool
+topology_place_pipeline(int nstages, cpu_set_t sets[])
+{
+    if (!topology_read)
+        read_topology();
+
+    struct cache_level *level = l3.ndomains > 0 ? &l3 : &l2;
+    if (level->ndomains == 0)
+        return false;
+
+    int d = level->next;
+    level->next = (level->next + 1) % level->ndomains;
+
+    /* The cores within the domain, in order */
+    int in_domain[MAX_CORES];
+    int n = 0;
+    for (int i = 0; i < ncores; i++) {
+        cpu_set_t shared;
+        CPU_AND(&shared, &cores[i], &level->domains[d]);
+        if (CPU_COUNT(&shared) > 0)
+            in_domain[n++] = i;
+    }
+    if (n == 0)
+        return false;
+
+    /* Successive pipelines in the domain start at the next free core,
+     * and stages only share a core if there are more stages than cores */
+    int first = level->next_core[d] % n;
+    for (int i = 0; i < nstages; i++)
+        CPU_AND(&sets[i], &cores[in_domain[(first + i) % n]],
+                &level->domains[d]);
+    level->next_core[d] = (first + nstages) % n;
+    return true;
+}
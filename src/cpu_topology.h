@@ -0,0 +1,15 @@
+#ifndef __CPU_TOPOLOGY_H
+#define __CPU_TOPOLOGY_H
+
+#include <sched.h>
+#include <stdbool.h>
+
+/* Place a pipeline of 'nstages' stages on the CPUs that share a last
+ * level cache, giving each stage a core of its own where the cache
+ * has enough cores, and store the CPUs of stage i in 'sets[i]'.
+ * Successive calls rotate through the caches and their cores so that
+ * concurrent pipelines are spread over the machine.
+ * Returns false if no cache topology is available. */
+bool topology_place_pipeline(int nstages, cpu_set_t sets[]);
+
+#endif /* __CPU_TOPOLOGY_H */
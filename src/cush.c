@@ -6,31 +6,85 @@
  */
 #define _GNU_SOURCE 1
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#ifndef NO_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
+#endif
+#include <sched.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 /* Max capacity of the pid array */
 #define MAX_CAP 10
+/* Number of events kept by the trace ring buffer */
+#define TRACE_EVENTS (1 << 16)
 
 /* Since the handed out code contains a number of unused functions. */
 #pragma GCC diagnostic ignored "-Wunused-function"
 
+#include "ast_cache.h"
+#include "builtins.h"
+#include "cgroup.h"
+#include "cpu_topology.h"
+#include "cushd.h"
+#include "jacct.h"
+#include "jobserver.h"
+#include "lineedit.h"
+#include "perf_counters.h"
+#include "predict.h"
+#include "proc_sampler.h"
+#include "proc_usage.h"
+#include "sample_stats.h"
+#include "sched_policy.h"
+#include "script.h"
 #include "shell-ast.h"
+#include "shm_jobs.h"
 #include "signal_support.h"
+#include "stage_io.h"
+#include "stats.h"
 #include "termstate_management.h"
+#include "trace.h"
 #include "utils.h"
+#include "vars.h"
 
 static void usage(char *progname) {
     printf(
-        "Usage: %s -h\n"
-        " -h            print this help\n",
+        "Usage: %s -h -b -c commands -e -j slots -g cgroup -T file -P file "
+        "-I seconds -S -A file -D socket -p dir [script]\n"
+        " script        run the commands in this file, then exit\n"
+        " -c commands   run these commands without a terminal, then exit\n"
+        " -e            edit command lines with the built-in editor instead\n"
+        "               of readline\n"
+        " -h            print this help\n"
+        " -b            run without a terminal, as when stdin is not a tty\n"
+        " -g cgroup     place each job into a leaf of this cgroup v2 directory\n"
+        " -j slots      act as a make jobserver with this many job slots\n"
+        " -T file       trace the shell and write the trace to file on exit\n"
+        " -P file       write latency histograms to this Prometheus text file\n"
+        "               on exit\n"
+        " -I seconds    also rewrite the -P file at this interval\n"
+        " -S            publish the job table in /dev/shm/cush-<pid>\n"
+        " -A file       append a record of every finished job to this\n"
+        "               accounting log\n"
+        " -D socket     run command lines sent by cushc to this UNIX socket\n"
+        " -p dir        load the builtins of the plugins (*.so) in this\n"
+        "               directory\n",
         progname);
 
     exit(EXIT_SUCCESS);
@@ -39,11 +93,99 @@ static void usage(char *progname) {
 /* Build a prompt */
 static char *build_prompt(void) {
     char hostn[1204] = "";
+    char *prompt;
     gethostname(hostn, sizeof(hostn));
-    printf("<%s@%s %s>$ ", getenv("LOGNAME"), basename(hostn),
-           basename(getenv("PWD")));
-    return strdup("");
-} 
+    if (asprintf(&prompt, "<%s@%s %s>$ ", getenv("LOGNAME"),
+                 basename(hostn), basename(getenv("PWD"))) == -1) {
+        return strdup("");
+    }
+    return prompt;
+}
+
+/* Command lines are read with GNU readline, or with lineedit when the
+ * shell is started with -e or built with NO_READLINE */
+#ifdef NO_READLINE
+static bool use_lineedit = true;
+#else
+static bool use_lineedit;
+#endif
+
+/* Print the prompt and read a line, or return NULL at EOF */
+static char *edit_read_line(const char *prompt) {
+#ifndef NO_READLINE
+    if (!use_lineedit) {
+        /* readline is not told the prompt, as it never was */
+        fputs(prompt, stdout);
+        return readline("");
+    }
+#endif
+    return lineedit_read(prompt);
+}
+
+/* Expand history references, as history_expand does */
+static int edit_history_expand(char *line, char **expansion) {
+#ifndef NO_READLINE
+    if (!use_lineedit) {
+        return history_expand(line, expansion);
+    }
+#endif
+    return lineedit_history_expand(line, expansion);
+}
+
+static void edit_add_history(char *line) {
+#ifndef NO_READLINE
+    if (!use_lineedit) {
+        add_history(line);
+        return;
+    }
+#endif
+    lineedit_add_history(line);
+}
+
+/* Print the history list, numbered from 1 */
+static void print_history(void) {
+#ifndef NO_READLINE
+    if (!use_lineedit) {
+        /* Get the state of the history, eg. history length */
+        HISTORY_STATE *history = history_get_history_state();
+        /* Obtain the history list */
+        HIST_ENTRY **hist_list = history_list();
+        for (int i = 0; i < history->length; i++) {
+            /* Print out the history list */
+            printf("%d %s\n", (i + 1), hist_list[i]->line);
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < lineedit_history_length(); i++) {
+        printf("%d %s\n", (i + 1), lineedit_history_get(i));
+    }
+}
+
+/* Shell options, toggled with 'set -o name' and 'set +o name' */
+static bool opt_placement;  /* Pin pipelines to cores sharing a cache */
+static bool opt_bgidle;     /* Idle background jobs while a job is in
+                               the foreground */
+static bool opt_rusage;     /* Report resource usage of foreground jobs */
+static bool opt_inproc = true;  /* Run echo, printf, test and friends in
+                                   the shell instead of forking */
+static bool headless;       /* Running without a terminal: no job control
+                               of the terminal and no readline */
+static struct script *script;   /* Input when headless */
+static struct ast_cache *script_cache;  /* The compiled script file */
+static struct client *serving;  /* Client whose command line is being
+                                   started, in daemon mode */
+
+static struct shell_option {
+    const char *name;
+    bool *value;
+} shell_options[] = {
+    { "placement", &opt_placement },
+    { "bgidle", &opt_bgidle },
+    { "rusage", &opt_rusage },
+    { "inproc", &opt_inproc },
+    { NULL, NULL }
+};
 
 enum job_status {
     FOREGROUND,    /* job is running in foreground.  Only one job can be
@@ -54,6 +196,19 @@ enum job_status {
                       and requires exclusive terminal access */
 };
 
+/* A stage of a pipeline that the shell runs itself */
+struct inproc_stage {
+    cush_builtin_fn *main; /* Utility or builtin of a plugin, or NULL if
+                              its redirections failed */
+    char **argv;
+    int stage;             /* Position in the pipeline */
+    bool dup_stderr;       /* Stderr goes where stdout goes */
+    int fd[3];             /* Its stdin, stdout and stderr */
+    int status;            /* Exit status, once it has run */
+    bool threaded;         /* Runs on 'thread' */
+    pthread_t thread;
+};
+
 struct job {
     struct list_elem elem; /* Link element for jobs list. */
     struct ast_pipeline
@@ -67,18 +222,60 @@ struct job {
                             stopped after having been in foreground */
     int total_processes; /* Total number of processes */
     int pid[MAX_CAP];    /* pid array */
+    bool pid_alive[MAX_CAP]; /* True until pid[i] has been reaped */
     pid_t pgid;            /* Process group id */
+    bool holds_token;      /* True if the job holds a jobserver token */
+    char *cgroup;          /* Path of the job's cgroup leaf, or NULL */
+    bool demoted;          /* True if the job runs at idle priority */
+    struct sched_saved
+        saved_sched[MAX_CAP]; /* Scheduling settings before demotion */
+    struct proc_usage
+        usage[MAX_CAP];    /* Resource usage of each reaped process */
+    struct timespec start_time; /* When the job was started */
+    struct timespec end_time;   /* When the last process was reaped */
+    bool timed;            /* True if prefixed by the time keyword */
+    int exit_status;       /* Wait status of the last process in the pipeline */
+    bool profiled;         /* True if prefixed by the profile keyword */
+    struct perf_counters
+        perf[MAX_CAP];     /* Counters of each process of a profiled job */
+    struct perf_values perf_total; /* Counters summed when the job ended */
+    int shm_slot;          /* Slot in the shared job table, or -1 */
+    uint64_t predict_key;  /* Key of the command line for predictions */
+    bool was_stopped;      /* True if the job was ever stopped */
+    struct client *client; /* Daemon client that started the job, or NULL */
+    struct inproc_stage
+        *inproc;           /* Stages run in the shell, not yet joined */
+    int num_inproc;        /* The number of them */
 };
 
-void handle_child_process(int fds[], bool not_last, int total_pipes,
-                          int pipe_counter, char *cmd_arg, char **argv);
-static void handle_child_status(pid_t pid, int status);
+void handle_child_process(int fds[], int total_pipes, char *cmd_arg,
+                          char **argv, char **envp);
+static void serve_child_io(struct client *c);
+static void print_location(void);
+static cush_builtin_fn *inproc_main(const struct builtin *b, char **argv,
+                                    const char *input, int total_commands);
+static void open_inproc_stage(struct inproc_stage *s,
+                              struct ast_pipeline *pipe_line, int fds[],
+                              int total_commands);
+static void run_inproc_inline(struct inproc_stage *s);
+static void start_inproc_threads(struct job *job);
+static void join_inproc_stages(struct job *job);
+static void handle_child_status(pid_t pid, int status,
+                                struct proc_usage *usage);
+static void publish_job(struct job *job, bool new_job);
+static bool delete_finished_jobs(void);
+static void expand_pipeline(struct ast_pipeline *pipe_line);
+static void account_job(struct job *job);
+static double job_elapsed(struct job *job);
+static int job_status(struct job *job);
 int get_process_pgid(int jid);
 bool is_built_in(char *cmd);
-void handle_build_in(struct ast_command *cmd);
+int handle_build_in(struct ast_command *cmd);
 void execute(struct ast_command_line *cmd_line);
 bool not_last_arg(int curr_cmd, int total_commands);
-void handle_pipeline(struct ast_pipeline *pipe_line, struct ast_command *cmd);
+struct job *handle_pipeline(struct ast_pipeline *pipe_line,
+                            struct ast_command *cmd, bool timed,
+                            bool profiled);
 
 /* Utility functions for job list management.
  * We use 2 data structures:
@@ -122,6 +319,16 @@ static struct job *get_job_from_pid(pid_t pid) {
     }
 }
 
+/* Return the index of 'pid' in the job's pid array, or -1 */
+static int get_stage_from_pid(struct job *job, pid_t pid) {
+    for (int i = 0; i < job->total_processes; i++) {
+        if (job->pid[i] == pid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /* Return the pgid corresponding to jid */
 int get_process_pgid(int jid) {
     struct job *j;
@@ -135,11 +342,30 @@ int get_process_pgid(int jid) {
 
 /* Add a new job to the job list */
 static struct job *add_job(struct ast_pipeline *pipe) {
+    uint64_t trace_start_time = trace_begin();
     struct job *job = malloc(sizeof *job);
     /* Initialize the job structure */
     job->total_processes = 0;
     job->pipe = pipe;
     job->num_processes_alive = 0;
+    job->holds_token = false;
+    job->cgroup = NULL;
+    job->demoted = false;
+    memset(job->saved_sched, 0, sizeof job->saved_sched);
+    memset(job->usage, 0, sizeof job->usage);
+    clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+    job->timed = false;
+    job->exit_status = 0;
+    job->profiled = false;
+    job->predict_key = predict_key(pipe);
+    job->was_stopped = false;
+    job->client = serving;
+    job->pgid = 0;
+    job->inproc = NULL;
+    job->num_inproc = 0;
+    for (int i = 0; i < MAX_CAP; i++) {
+        perf_counters_init(&job->perf[i]);
+    }
     /* Check if the user enter & */
     if (pipe->bg_job) {
         job->status = BACKGROUND;
@@ -151,6 +377,9 @@ static struct job *add_job(struct ast_pipeline *pipe) {
         if (jid2job[i] == NULL) {
             jid2job[i] = job;
             job->jid = i;
+            job->shm_slot = shm_jobs_enabled() ? shm_jobs_alloc(i) : -1;
+            publish_job(job, true);
+            trace_end("add_job", trace_start_time, job->jid, -1);
             return job;
         }
     }
@@ -164,12 +393,75 @@ static struct job *add_job(struct ast_pipeline *pipe) {
  * forked for this job are known to have terminated.
  */
 static void delete_job(struct job *job) {
+    uint64_t trace_start_time = trace_begin();
     int jid = job->jid;
     assert(jid != -1);
+    /* The processes are gone, so stages writing to them are done */
+    join_inproc_stages(job);
     jid2job[jid]->jid = -1;
     jid2job[jid] = NULL;
+    if (job->shm_slot != -1) {
+        shm_jobs_free(job->shm_slot);
+    }
+    if (jacct_path() != NULL && job->total_processes > 0) {
+        account_job(job);
+    }
+    /* Learn the duration of jobs that ran to completion undisturbed */
+    if (job->total_processes > 0 && !job->was_stopped &&
+        WIFEXITED(job->exit_status)) {
+        predict_record(job->predict_key, job_elapsed(job));
+    }
+    /* Remove the job's cgroup leaf */
+    if (job->cgroup != NULL) {
+        cgroup_remove(job->cgroup);
+        free(job->cgroup);
+    }
+    for (int i = 0; i < job->total_processes; i++) {
+        sched_forget(&job->saved_sched[i]);
+    }
     ast_pipeline_free(job->pipe);
     free(job);
+    trace_end("delete_job", trace_start_time, jid, -1);
+}
+
+/* Apply the 'bgidle' policy: while a job runs in the foreground,
+ * the processes of background jobs run at idle CPU and I/O priority.
+ * Their settings are restored once no foreground job is running.
+ * Must be called after every change of a job's status, with SIGCHLD
+ * blocked so that no process is reaped while its priority changes.
+ */
+static void update_background_priority(void) {
+    assert(signal_is_blocked(SIGCHLD));
+    bool fg_running = false;
+    struct job *j;
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list);
+         e = list_next(e)) {
+        j = list_entry(e, struct job, elem);
+        if (j->status == FOREGROUND && j->num_processes_alive > 0) {
+            fg_running = true;
+        }
+    }
+
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list);
+         e = list_next(e)) {
+        j = list_entry(e, struct job, elem);
+        bool demote = opt_bgidle && fg_running && j->status == BACKGROUND;
+        if (demote == j->demoted) {
+            continue;
+        }
+        /* Only touch processes not yet reaped; their pids may be reused */
+        for (int i = 0; i < j->total_processes; i++) {
+            if (!j->pid_alive[i]) {
+                continue;
+            }
+            if (demote) {
+                sched_demote(j->pid[i], &j->saved_sched[i]);
+            } else {
+                sched_restore(j->pid[i], &j->saved_sched[i]);
+            }
+        }
+        j->demoted = demote;
+    }
 }
 
 /* Get the status of the running process */
@@ -188,23 +480,295 @@ static const char *get_status(enum job_status status) {
     }
 }
 
-/* Print the command line that belongs to one job. */
-static void print_cmdline(struct ast_pipeline *pipeline) {
+/* Append 's' to the string of length *len in 'buf', as far as it fits */
+static void append_string(char *buf, size_t size, size_t *len, const char *s) {
+    for (; *s; s++, (*len)++) {
+        if (*len + 1 < size) {
+            buf[*len] = *s;
+            buf[*len + 1] = '\0';
+        }
+    }
+}
+
+/* Format the command line that belongs to one job into 'buf'.
+ * Returns the length of the whole command line, like snprintf.
+ * Async-signal-safe. */
+static size_t format_cmdline(struct ast_pipeline *pipeline, char *buf,
+                             size_t size) {
+    size_t len = 0;
+    if (size > 0) {
+        buf[0] = '\0';
+    }
     struct list_elem *e = list_begin(&pipeline->commands);
     for (; e != list_end(&pipeline->commands); e = list_next(e)) {
         struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        if (e != list_begin(&pipeline->commands)) printf("| ");
-        char **p = cmd->argv;
-        printf("%s", *p++);
-        while (*p) printf(" %s", *p++);
+        if (e != list_begin(&pipeline->commands)) {
+            append_string(buf, size, &len, "| ");
+        }
+        for (char **p = cmd->argv; *p; p++) {
+            if (p != cmd->argv) {
+                append_string(buf, size, &len, " ");
+            }
+            append_string(buf, size, &len, *p);
+        }
+    }
+    return len;
+}
+
+/* Print the command line that belongs to one job. */
+static void print_cmdline(struct ast_pipeline *pipeline) {
+    char buf[256];
+    size_t len = format_cmdline(pipeline, buf, sizeof buf);
+    if (len < sizeof buf) {
+        printf("%s", buf);
+    } else {
+        char *long_buf = malloc(len + 1);
+        format_cmdline(pipeline, long_buf, len + 1);
+        printf("%s", long_buf);
+        free(long_buf);
+    }
+}
+
+/* Update the job's slot in the shared job table.  The command line
+ * and start time only need to be written once.
+ * Must not be interrupted by a SIGCHLD handler that updates the same
+ * job, so it is called with SIGCHLD blocked, or before the job has
+ * any processes. */
+static void publish_job(struct job *job, bool new_job) {
+    if (job->shm_slot == -1) {
+        return;
+    }
+    struct shm_job *s = shm_jobs_begin(job->shm_slot);
+    s->jid = job->jid;
+    s->pgid = job->total_processes > 0 ? job->pgid : 0;
+    s->status = job->status;
+    s->nprocs = job->total_processes;
+    s->nalive = job->num_processes_alive;
+    for (int i = 0; i < job->total_processes && i < SHM_JOBS_PIDS; i++) {
+        s->pids[i] = job->pid[i];
+    }
+    if (new_job) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        s->start_sec = now.tv_sec;
+        s->start_nsec = now.tv_nsec;
+        format_cmdline(job->pipe, s->cmdline, sizeof s->cmdline);
     }
+    shm_jobs_end(job->shm_slot);
 }
 
-/* Print a job */
+/* Print a job.  Running jobs of commands that have run before show
+ * how long they are expected to take. */
 static void print_job(struct job *job) {
     printf("[%d]\t%s\t\t(", job->jid, get_status(job->status));
     print_cmdline(job->pipe);
-    printf(")\n");
+    printf(")");
+    struct prediction p;
+    if ((job->status == FOREGROUND || job->status == BACKGROUND) &&
+        job->num_processes_alive > 0 &&
+        predict_lookup(job->predict_key, &p)) {
+        char eta[48];
+        predict_format_eta(eta, sizeof eta, &p, job_elapsed(job));
+        printf("\t%s", eta);
+    }
+    printf("\n");
+}
+
+/* Return the wall time a job has been running, in seconds */
+static double job_elapsed(struct job *job) {
+    struct timespec end = job->end_time;
+    if (job->num_processes_alive > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    return (end.tv_sec - job->start_time.tv_sec) +
+           (end.tv_nsec - job->start_time.tv_nsec) / 1e9;
+}
+
+/* Sum the resource usage of all processes of a job.
+ * Reaped processes contribute their final rusage, processes that are
+ * still alive are sampled from /proc.
+ */
+static void get_job_usage(struct job *job, struct proc_usage *sum) {
+    memset(sum, 0, sizeof *sum);
+    for (int i = 0; i < job->total_processes; i++) {
+        struct proc_usage live;
+        if (!job->pid_alive[i]) {
+            proc_usage_add(sum, &job->usage[i]);
+        } else if (proc_usage_sample(job->pid[i], &live)) {
+            proc_usage_add(sum, &live);
+        }
+    }
+}
+
+/* Print a job together with its pids and resource usage */
+static void print_job_long(struct job *job) {
+    struct proc_usage usage;
+    char buf[256];
+
+    print_job(job);
+    printf("\tpids");
+    for (int i = 0; i < job->total_processes; i++) {
+        printf(" %d", job->pid[i]);
+    }
+    get_job_usage(job, &usage);
+    proc_usage_format(buf, sizeof buf, job_elapsed(job), &usage);
+    printf("\n\t%s\n", buf);
+}
+
+/* Print the summary line for a job that has finished */
+static void print_usage_summary(struct job *job) {
+    struct proc_usage usage;
+    char buf[256];
+
+    get_job_usage(job, &usage);
+    proc_usage_format(buf, sizeof buf, job_elapsed(job), &usage);
+    fprintf(stderr, "[%d] %s\n", job->jid, buf);
+}
+
+/* Append a finished job to the accounting log */
+static void account_job(struct job *job) {
+    struct jacct_record r;
+    struct proc_usage usage;
+    struct timespec mono, real;
+
+    memset(&r, 0, sizeof r);
+    /* Job times are taken from the monotonic clock */
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t offset = (real.tv_sec - mono.tv_sec) * 1000000000LL +
+                     (real.tv_nsec - mono.tv_nsec);
+    r.start_ns = job->start_time.tv_sec * 1000000000LL +
+                 job->start_time.tv_nsec + offset;
+    r.end_ns = job->end_time.tv_sec * 1000000000LL +
+               job->end_time.tv_nsec + offset;
+
+    get_job_usage(job, &usage);
+    r.utime_us = usage.utime_us;
+    r.stime_us = usage.stime_us;
+    r.maxrss_kb = usage.maxrss_kb;
+    r.rchar = usage.rchar;
+    r.wchar = usage.wchar;
+    r.exit_status = job->exit_status;
+    r.nprocs = job->total_processes;
+
+    /* The command is the name of the first program, without its path */
+    struct ast_command *first = list_entry(list_begin(&job->pipe->commands),
+                                           struct ast_command, elem);
+    char *name = strrchr(first->argv[0], '/');
+    name = name != NULL ? name + 1 : first->argv[0];
+    strncpy(r.command, name, sizeof r.command - 1);
+    format_cmdline(job->pipe, r.cmdline, sizeof r.cmdline);
+
+    jacct_append(&r);
+}
+
+/* Print the report for a job prefixed with the time keyword.
+ * Besides the totals, each stage of a pipeline gets its share of the
+ * job's CPU time, and the stage with the highest share is flagged.
+ */
+static void print_time_report(struct job *job) {
+    struct proc_usage total;
+
+    get_job_usage(job, &total);
+    fprintf(stderr, "real %.3fs\tuser %.3fs\tsys %.3fs\n", job_elapsed(job),
+            total.utime_us / 1e6, total.stime_us / 1e6);
+    if (job->total_processes < 2) {
+        return;
+    }
+
+    /* Find the bottleneck stage */
+    long long total_cpu = total.utime_us + total.stime_us;
+    int bottleneck = 0;
+    for (int i = 1; i < job->total_processes; i++) {
+        struct proc_usage *u = &job->usage[i], *b = &job->usage[bottleneck];
+        if (u->utime_us + u->stime_us > b->utime_us + b->stime_us) {
+            bottleneck = i;
+        }
+    }
+
+    int i = 0;
+    for (struct list_elem *e = list_begin(&job->pipe->commands);
+         e != list_end(&job->pipe->commands) && i < job->total_processes;
+         e = list_next(e), i++) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        struct proc_usage *u = &job->usage[i];
+        long long cpu = u->utime_us + u->stime_us;
+        fprintf(stderr, "  %d: user %.3fs\tsys %.3fs\t%5.1f%%\t", i + 1,
+                u->utime_us / 1e6, u->stime_us / 1e6,
+                total_cpu > 0 ? 100.0 * cpu / total_cpu : 0.0);
+        for (char **p = cmd->argv; *p; p++) {
+            fprintf(stderr, p == cmd->argv ? "%s" : " %s", *p);
+        }
+        fprintf(stderr, i == bottleneck && total_cpu > 0 ?
+                        "\t<- bottleneck\n" : "\n");
+    }
+}
+
+/* Print the counters of a job prefixed with the profile keyword */
+static void print_profile_report(struct job *job) {
+    fprintf(stderr, "Performance counters for '");
+    int i = 0;
+    for (struct list_elem *e = list_begin(&job->pipe->commands);
+         e != list_end(&job->pipe->commands); e = list_next(e), i++) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        fprintf(stderr, i == 0 ? "" : " | ");
+        for (char **p = cmd->argv; *p; p++) {
+            fprintf(stderr, p == cmd->argv ? "%s" : " %s", *p);
+        }
+    }
+    fprintf(stderr, "':\n\n");
+    perf_values_print(stderr, &job->perf_total);
+    fprintf(stderr, "\n%18.3f  seconds time elapsed\n", job_elapsed(job));
+}
+
+/* Report on a job after waiting for it in the foreground */
+static void report_foreground_job(struct job *job) {
+    /* Nothing to report if the job was stopped */
+    if (job->num_processes_alive > 0) {
+        return;
+    }
+    if (job->timed) {
+        print_time_report(job);
+        job->timed = false;
+    } else if (opt_rusage) {
+        print_usage_summary(job);
+    }
+    if (job->profiled) {
+        print_profile_report(job);
+        job->profiled = false;
+    }
+}
+
+/* Reap one child that changed state, like waitpid(-1, ...) with
+ * WUNTRACED.  The child's I/O counters are read from /proc while it
+ * is still a zombie, and its rusage is collected by wait4.
+ * 'noticed' is set to the time waitid reported the child's state change,
+ * which may be well after the child exited if the shell was busy.
+ */
+static pid_t reap_child(int options, int *status, struct proc_usage *usage,
+                        uint64_t *noticed) {
+    siginfo_t info;
+    struct rusage ru;
+
+    info.si_pid = 0;
+    if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOWAIT | options) == -1) {
+        return -1;
+    }
+    if (info.si_pid == 0) { /* WNOHANG and no child changed state */
+        return 0;
+    }
+    *noticed = trace_clock();
+
+    memset(usage, 0, sizeof *usage);
+    if (info.si_code != CLD_STOPPED) {
+        proc_usage_read_io(info.si_pid, usage);
+    }
+    pid_t child = wait4(info.si_pid, status, WUNTRACED, &ru);
+    if (child > 0) {
+        proc_usage_from_rusage(usage, &ru);
+        trace_instant("waitpid", -1, child, *status);
+    }
+    return child;
 }
 
 /*
@@ -225,11 +789,14 @@ static void print_job(struct job *job) {
 static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt) {
     pid_t child;
     int status;
+    struct proc_usage usage;
+    uint64_t noticed;
 
     assert(sig == SIGCHLD);
 
-    while ((child = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0) {
-        handle_child_status(child, status);
+    while ((child = reap_child(WNOHANG, &status, &usage, &noticed)) > 0) {
+        handle_child_status(child, status, &usage);
+        stats_record(STAT_REAP, trace_clock() - noticed);
     }
 }
 
@@ -261,8 +828,10 @@ static void wait_for_job(struct job *job) {
 
     while (job->status == FOREGROUND && job->num_processes_alive > 0) {
         int status;
+        struct proc_usage usage;
+        uint64_t noticed;
 
-        pid_t child = waitpid(-1, &status, WUNTRACED);
+        pid_t child = reap_child(0, &status, &usage, &noticed);
 
         // When called here, any error returned by waitpid indicates a logic
         // bug in the shell.
@@ -273,15 +842,17 @@ static void wait_for_job(struct job *job) {
         // fashion.
         // Since SIGCHLD is blocked, there cannot be races where a child's exit
         // was handled via the SIGCHLD signal handler.
-        if (child != -1)
-            handle_child_status(child, status);
-        else
+        if (child != -1) {
+            handle_child_status(child, status, &usage);
+            stats_record(STAT_REAP, trace_clock() - noticed);
+        } else
             utils_fatal_error("waitpid failed, see code for explanation");
     }
 }
 
 /* Update child status when it received signal */
-static void handle_child_status(pid_t pid, int status) {
+static void handle_child_status(pid_t pid, int status,
+                                struct proc_usage *usage) {
     assert(signal_is_blocked(SIGCHLD));
 
     /* To be implemented.
@@ -289,6 +860,7 @@ static void handle_child_status(pid_t pid, int status) {
      *         (how to do this is not part of the provided code.)
      */
     struct job *job = get_job_from_pid(pid);
+    int stage = get_stage_from_pid(job, pid);
 
     /* Step 2. Determine what status change occurred using the
      *         WIF*() macros.
@@ -301,19 +873,34 @@ static void handle_child_status(pid_t pid, int status) {
     if (WIFSTOPPED(status)) {
         /* Set its status to stopped */
         job->status = STOPPED;
+        job->was_stopped = true;
         /* Save the current terminal settings */
-        termstate_save(&job->saved_tty_state);
+        if (!headless) {
+            termstate_save(&job->saved_tty_state);
+        }
         /* Print the stopped process */
         print_job(job);
+        /* A stopped job gives its job slot to others until it is
+         * continued */
+        if (job->holds_token) {
+            job->holds_token = false;
+            jobserver_release();
+        }
     } 
     /* Check if the child exited */
     else if (WIFEXITED(status)) {
         /* Decrement the number of running processes */
         job->num_processes_alive--;
+        job->pid_alive[stage] = false;
+        job->usage[stage] = *usage;
     } 
     /* Check if the child was terminated by a signal */
     else if (WIFSIGNALED(status)) {
-        job->num_processes_alive = 0;
+        /* Decrement the number of running processes; the remaining
+         * processes of the job are reaped, and accounted, separately */
+        job->num_processes_alive--;
+        job->pid_alive[stage] = false;
+        job->usage[stage] = *usage;
         int term_signal = WTERMSIG(status);
         if (term_signal == 6) {
             utils_error("aborted\n");
@@ -327,218 +914,1576 @@ static void handle_child_status(pid_t pid, int status) {
             utils_error("terminated\n");
         }
     }
+
+    /* The status of a pipeline is the status of its last command */
+    if (stage == job->total_processes - 1 && !WIFSTOPPED(status)) {
+        job->exit_status = status;
+    }
+
+    /* Record when the last process of the job was reaped */
+    if (job->num_processes_alive == 0 && !WIFSTOPPED(status)) {
+        clock_gettime(CLOCK_MONOTONIC, &job->end_time);
+        /* The counters are final once all processes are gone */
+        if (job->profiled) {
+            memset(&job->perf_total, 0, sizeof job->perf_total);
+            for (int i = 0; i < job->total_processes; i++) {
+                struct perf_values values;
+                perf_counters_read(&job->perf[i], &values);
+                perf_values_add(&job->perf_total, &values);
+            }
+        }
+    }
+
+    /* Return the jobserver token once every process of the job is gone */
+    if (job->num_processes_alive == 0 && job->holds_token) {
+        job->holds_token = false;
+        jobserver_release();
+    }
+
+    publish_job(job, false);
 }
 
-/* Check if the command is a build in function */
-bool is_built_in(char *cmd) {
-    return (strcmp(cmd, "jobs") == 0 || strcmp(cmd, "fg") == 0 ||
-            strcmp(cmd, "bg") == 0 || strcmp(cmd, "stop") == 0 ||
-            strcmp(cmd, "kill") == 0 || strcmp(cmd, "exit") == 0 ||
-            strcmp(cmd, "history") == 0);
+/* Columns of the jtop table, in display order */
+enum jtop_column {
+    JTOP_JID, JTOP_STATE, JTOP_NPROC, JTOP_CPU, JTOP_RSS, JTOP_READ,
+    JTOP_WRITE, JTOP_TIME, JTOP_COMMAND, JTOP_NCOLUMNS
+};
+
+static const char *jtop_columns[JTOP_NCOLUMNS] = {
+    "jid", "state", "nproc", "cpu", "rss", "read", "write", "time", "command"
+};
+
+/* One row of the jtop table, copied out of the job list */
+struct jtop_row {
+    int jid;
+    const char *state;
+    int nproc;           /* Number of live processes */
+    double cpu_pct;      /* Summed over all stages */
+    long rss_kb;         /* Summed over all stages */
+    double read_rate;    /* Bytes per second, summed over all stages */
+    double write_rate;
+    double elapsed;      /* Wall time since the job was started */
+    char cmdline[128];
+};
+
+static enum jtop_column jtop_sort = JTOP_CPU;
+static bool jtop_reverse;
+
+/* Compare two numbers so that the larger one comes first */
+static int compare_descending(double x, double y) {
+    return (x < y) - (x > y);
 }
 
-/* Handle the build in function */
-void handle_build_in(struct ast_command *cmd) {
-    /* Count the number of arguments in the command */
-    char **cmd_argv = cmd->argv;
-    int argc = 0;
-    while (*(cmd_argv + argc) != NULL) {
-        argc++;
+/* Order rows by the sort column; numbers largest first, text and
+ * job ids ascending */
+static int jtop_compare(const void *a, const void *b) {
+    const struct jtop_row *x = a, *y = b;
+    int c = 0;
+    switch (jtop_sort) {
+        case JTOP_STATE:
+            c = strcmp(x->state, y->state);
+            break;
+        case JTOP_NPROC:
+            c = compare_descending(x->nproc, y->nproc);
+            break;
+        case JTOP_CPU:
+            c = compare_descending(x->cpu_pct, y->cpu_pct);
+            break;
+        case JTOP_RSS:
+            c = compare_descending(x->rss_kb, y->rss_kb);
+            break;
+        case JTOP_READ:
+            c = compare_descending(x->read_rate, y->read_rate);
+            break;
+        case JTOP_WRITE:
+            c = compare_descending(x->write_rate, y->write_rate);
+            break;
+        case JTOP_TIME:
+            c = compare_descending(x->elapsed, y->elapsed);
+            break;
+        case JTOP_COMMAND:
+            c = strcmp(x->cmdline, y->cmdline);
+            break;
+        default:
+            break;
+    }
+    if (c == 0) {
+        c = x->jid - y->jid;
     }
+    return jtop_reverse ? -c : c;
+}
 
-    /* Compare the first argument to the build in function */
-    if (strcmp(*cmd_argv, "exit") == 0) {
-        exit(0);
-    } else if (strcmp(*cmd_argv, "jobs") == 0) {
-        /* Check if jobs has only one argument */
-        if (argc == 1) {
-            struct job *j;
-            /* Iterates through the job list */
-            for (struct list_elem *e = list_begin(&job_list);
-                 e != list_end(&job_list); e = list_next(e)) {
-                j = list_entry(e, struct job, elem);
-                /* Print out the existing job */
-                print_job(j);
-            }
-        } else {
-            printf("jobs: expected exactly one argument\n");
-        }
-    } else if (strcmp(*cmd_argv, "bg") == 0) {
-        /* Check if bg has two arguments */
-        if (argc == 2) {
-            /* Convert the string to int */
-            int jid = atoi(*(cmd_argv + 1));
-            struct job *j = get_job_from_jid(jid);
-            /* If the job does not exist, print no such job */
-            if (j == NULL) {
-                printf("bg %d: No such job\n", jid);
-                return;
-            }
-            /* Sent signal to the process group*/
-            if (killpg(get_process_pgid(jid), SIGCONT) == -1) {
-                perror("bg: Error when calling killpg");
-                exit(EXIT_FAILURE);
+/* Sample all processes of all jobs into *rows, which grows as needed,
+ * and return the number of rows */
+static int jtop_collect(struct proc_sampler *sampler, struct jtop_row **rows,
+                        int *capacity) {
+    int n = 0;
+
+    /* The SIGCHLD handler updates and reaps the jobs */
+    signal_block(SIGCHLD);
+    for (struct list_elem *e = list_begin(&job_list);
+         e != list_end(&job_list); e = list_next(e)) {
+        struct job *j = list_entry(e, struct job, elem);
+        if (n == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            *rows = realloc(*rows, *capacity * sizeof **rows);
+            if (*rows == NULL) {
+                utils_fatal_error("jtop: out of memory");
             }
-            /* Set the status of the job to BACKGROUND*/
-            j->status = BACKGROUND;
-        } else {
-            printf("bg: job id is missing\n");
         }
-    } else if (strcmp(*cmd_argv, "kill") == 0) {
-        /* Check if kill has two arguments */
-        if (argc == 2) {
-            /* Convert the string to int */
-            int jid = atoi(*(cmd_argv + 1));
-            struct job *j = get_job_from_jid(jid);
-            /* If the job does not exist, print no such job */
-            if (j == NULL) {
-                printf("kill %d: No such job\n", jid);
-            }
-            /* Sent signal to the process group*/
-            if (killpg(get_process_pgid(jid), SIGKILL) == -1) {
-                perror("kill: Error when calling killpg");
-                exit(EXIT_FAILURE);
+        struct jtop_row *r = &(*rows)[n++];
+        memset(r, 0, sizeof *r);
+        r->jid = j->jid;
+        r->state = j->num_processes_alive == 0 ? "Done" : get_status(j->status);
+        r->nproc = j->num_processes_alive;
+        r->elapsed = job_elapsed(j);
+        format_cmdline(j->pipe, r->cmdline, sizeof r->cmdline);
+        for (int i = 0; i < j->total_processes; i++) {
+            struct proc_sample s;
+            if (j->pid_alive[i] && proc_sampler_read(sampler, j->pid[i], &s)) {
+                r->cpu_pct += s.cpu_pct;
+                r->rss_kb += s.rss_kb;
+                r->read_rate += s.read_rate;
+                r->write_rate += s.write_rate;
             }
-        } else {
-            printf("kill: job id is missing\n");
         }
-    } else if (strcmp(*cmd_argv, "stop") == 0) {
-        /* Check if kill has two arguments */
-        if (argc == 2) {
-            /* Convert the string to int */
-            int jid = atoi(*(cmd_argv + 1));
-            struct job *j = get_job_from_jid(jid);
-            /* If the job does not exist, print no such job */
-            if (j == NULL) {
-                printf("stop %d: No such job\n", jid);
-            }
-            /* Sent signal to the process group*/
-            if (killpg(get_process_pgid(jid), SIGSTOP) == -1) {
-                perror("stop: Error when calling killpg");
-                exit(EXIT_FAILURE);
-            }
-        } else {
-            printf("stop: job id is missing\n");
+    }
+    signal_unblock(SIGCHLD);
+
+    /* Close the files of processes that are gone */
+    proc_sampler_sweep(sampler);
+    qsort(*rows, n, sizeof **rows, jtop_compare);
+    return n;
+}
+
+/* Write one frame of the table to stdout in a single write.
+ * On a terminal, the frame replaces the previous one and is cut to
+ * the size of the window. */
+static void jtop_render(struct jtop_row *rows, int n, double delay,
+                        bool interactive) {
+    struct winsize ws = { .ws_row = 0, .ws_col = 0 };
+    if (interactive) {
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
+    }
+    int max_rows = ws.ws_row > 4 ? ws.ws_row - 4 : n;
+    int cmd_width = ws.ws_col > 80 ? ws.ws_col - 70 : 10;
+    if (!interactive) {
+        cmd_width = sizeof rows->cmdline;
+    }
+    /* Erase to the end of each line instead of clearing the screen */
+    const char *eol = interactive ? "\033[K\n" : "\n";
+
+    char *frame;
+    size_t size;
+    FILE *f = open_memstream(&frame, &size);
+    if (f == NULL) {
+        return;
+    }
+    if (interactive) {
+        fprintf(f, "\033[H");
+    }
+    fprintf(f, "jtop - %d job%s, sorted by %s%s, every %.1fs%s", n,
+            n == 1 ? "" : "s", jtop_columns[jtop_sort],
+            jtop_reverse ? " (reversed)" : "", delay, eol);
+    if (interactive) {
+        fprintf(f, "q quit, < > sort column, r reverse%s", eol);
+    }
+    fprintf(f, "%4s %-13s %5s %6s %8s %8s %8s %9s  %s%s", "JID", "STATE",
+            "NPROC", "CPU%", "RSS", "READ/s", "WRITE/s", "TIME", "COMMAND",
+            eol);
+    for (int i = 0; i < n; i++) {
+        if (i == max_rows) {
+            fprintf(f, "... %d more%s", n - i, eol);
+            break;
         }
-    } else if (strcmp(*cmd_argv, "fg") == 0) {
-        /* Check if kill has two arguments */
-        if (argc == 2) {
-            struct job *j = NULL;
-            /* Convert the string to int */
-            int jid = atoi(*(cmd_argv + 1));
-            /* Get the job from jid */
-            j = get_job_from_jid(jid);
-            /* If the job does not exist, print no such job */
-            if (j == NULL) {
-                printf("job was not found\n");
-            }
-
-            /* Set the status of the job to FOREGROUND */
-            j->status = FOREGROUND;
-
-            /* Print the job to stdout */
-            print_cmdline(j->pipe);
-            printf("\n");
-            fflush(stdout);
+        struct jtop_row *r = &rows[i];
+        char rss[16], rd[16], wr[16];
+        proc_usage_format_bytes(rss, sizeof rss, r->rss_kb * 1024.0);
+        proc_usage_format_bytes(rd, sizeof rd, r->read_rate);
+        proc_usage_format_bytes(wr, sizeof wr, r->write_rate);
+        int secs = (int) r->elapsed;
+        fprintf(f, "%4d %-13s %5d %6.1f %8s %8s %8s %3d:%02d:%02d  %.*s%s",
+                r->jid, r->state, r->nproc, r->cpu_pct, rss, rd, wr,
+                secs / 3600, secs / 60 % 60, secs % 60, cmd_width,
+                r->cmdline, eol);
+    }
+    if (interactive) {
+        fprintf(f, "\033[J");
+    }
+    fclose(f);
 
-            /* Sent signal to the process group*/
-            if (killpg(get_process_pgid(jid), SIGCONT) == -1) {
-                perror("fg: Error when calling killpg");
-                exit(EXIT_FAILURE);
-            }
+    fwrite(frame, 1, size, stdout);
+    fflush(stdout);
+    free(frame);
+}
 
-            /* Block the signal */
-            signal_block(SIGCHLD);
-            /* Give the terminal to the process group */
-            termstate_give_terminal_to(NULL, get_process_pgid(jid));
-            /* Wait until the job is done */
-            wait_for_job(j);
-            /* Give the terminal back to shell */
-            termstate_give_terminal_back_to_shell();
-            /* Unblock the signal */
-            signal_unblock(SIGCHLD);
-        } else {
-            printf("fg: job id is missing\n");
+/* Wait until 'deadline' or until a key is pressed on 'tty'.
+ * Returns the key, or 0 at the deadline. */
+static int jtop_wait(int tty, struct timespec *deadline) {
+    struct timespec now;
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double left = (deadline->tv_sec - now.tv_sec) +
+                      (deadline->tv_nsec - now.tv_nsec) / 1e9;
+        if (left <= 0) {
+            return 0;
         }
-    } else if (strcmp(*cmd_argv, "history") == 0) {
-        /* Get the state of the history, eg. history length */
-        HISTORY_STATE *history = history_get_history_state();
-        /* Obtain the history list */
-        HIST_ENTRY **hist_list = history_list();
-        for (int i = 0; i < history->length; i++) {
-            /* Print out the history list */
-            printf("%d %s\n", (i + 1), hist_list[i]->line);
+        struct pollfd pfd = { .fd = tty, .events = POLLIN };
+        /* Interrupted by SIGCHLD when a job changes state */
+        int rc = poll(tty == -1 ? NULL : &pfd, tty == -1 ? 0 : 1,
+                      (int) (left * 1000) + 1);
+        unsigned char c;
+        if (rc > 0 && read(tty, &c, 1) == 1) {
+            return c;
         }
     }
 }
 
-/* Execute the commands */
-void execute(struct ast_command_line *cmdline) {
-    /* Iterates through the command line to get the pipeline */
-    for (struct list_elem *e = list_begin(&cmdline->pipes);
-         e != list_end(&cmdline->pipes); e = list_next(e)) {
-        /* Get the pipeline from the command line */
-        struct ast_pipeline *pipe_line = list_entry(e, struct ast_pipeline, elem);
-
-        /* Get the first command from the pipeline */
-        struct ast_command *cmd = list_entry(list_begin(&pipe_line->commands),
-                                             struct ast_command, elem);
-
-        /* Check if the command is the build in function */
-        if (is_built_in(cmd->argv[0])) {
-            handle_build_in(cmd);
+/* Show a refreshing table of the jobs and their resource usage */
+static int handle_jtop(int argc, char **argv) {
+    double delay = 1.0;
+    int count = -1;
+    bool batch = false;
+    int i = 1;
+
+    /* Parse the options */
+    jtop_sort = JTOP_CPU;
+    jtop_reverse = false;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delay = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            int c = 0;
+            while (c < JTOP_NCOLUMNS && strcmp(jtop_columns[c], argv[i + 1])) {
+                c++;
+            }
+            if (c == JTOP_NCOLUMNS) {
+                break;
+            }
+            jtop_sort = c;
+            i++;
+        } else {
             break;
         }
-        /* If the command is not build in, run the handle_pipeline function */
-        handle_pipeline(pipe_line, cmd);
     }
-}
-
-void handle_pipeline(struct ast_pipeline *pipe_line, struct ast_command *cmd) {
-
-    int pipe_counter = 0;
-    pid_t pid = -1;
+    if (i < argc || delay <= 0 || count == 0) {
+        printf("jtop: usage: jtop [-b] [-n count] [-d seconds] [-s column]\n"
+               "      columns: jid state nproc cpu rss read write time "
+               "command\n");
+        return 1;
+    }
+    /* Without a terminal, print frames one after another.  The daemon
+     * prints only one, as it must not wait between them. */
+    bool interactive = !batch && serving == NULL && isatty(STDIN_FILENO) &&
+                       isatty(STDOUT_FILENO);
+    if (!interactive && count == -1) {
+        count = 1;
+    }
+    if (serving != NULL && count != 1) {
+        printf("jtop: only one frame is available in the daemon\n");
+        return 1;
+    }
 
-    /* Add a new job to the job list */
-    struct job *j = add_job(pipe_line);
-    /* Get the total number of commands in the pipeline */
-    int total_commands = list_size(&pipe_line->commands);
-    /* The total number of pipes should be one less than the number of total commands */
-    int total_pipes = total_commands - 1;
-    /* Initialize the current command counter */
-    int curr_cmd = 0;
+    /* Read single keys without echo */
+    int tty = -1;
+    struct termios saved;
+    if (interactive) {
+        tty = STDIN_FILENO;
+        tcgetattr(tty, &saved);
+        struct termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(tty, TCSANOW, &raw);
+        printf("\033[?25l\033[H\033[2J");
+    }
 
-    /* Create the necessary number of pipes */
-    int fds[2 * total_pipes];
-    for (int i = 0; i < total_pipes; i++) {
-        /* Print error if piping failed */
-        if (pipe2((fds + i * 2), O_CLOEXEC) == -1) {
-            perror("Error when piping");
-            exit(EXIT_FAILURE);
+    struct proc_sampler *sampler = proc_sampler_create();
+    struct jtop_row *rows = NULL;
+    int capacity = 0, n_rows = 0;
+    bool quit = false;
+    for (int frame = 0; !quit && (count == -1 || frame < count); frame++) {
+        if (frame > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += (time_t) delay;
+            deadline.tv_nsec += (delay - (time_t) delay) * 1e9;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            int key;
+            while (!quit && (key = jtop_wait(tty, &deadline)) != 0) {
+                /* Re-sort the current frame without sampling again */
+                if (key == 'q' || key == 3) {
+                    quit = true;
+                } else if (key == '<') {
+                    jtop_sort = (jtop_sort + JTOP_NCOLUMNS - 1) % JTOP_NCOLUMNS;
+                } else if (key == '>') {
+                    jtop_sort = (jtop_sort + 1) % JTOP_NCOLUMNS;
+                } else if (key == 'r') {
+                    jtop_reverse = !jtop_reverse;
+                } else {
+                    continue;
+                }
+                qsort(rows, n_rows, sizeof *rows, jtop_compare);
+                jtop_render(rows, n_rows, delay, interactive);
+            }
+            if (quit) {
+                break;
+            }
         }
+        n_rows = jtop_collect(sampler, &rows, &capacity);
+        jtop_render(rows, n_rows, delay, interactive);
     }
 
-    /* ---------- Handle I/O redirections ---------- */
-    /* Read input from iored_input file */
-    if (j->pipe->iored_input != NULL) {
-        freopen(j->pipe->iored_input, "r", stdin);
-    }
-    /* Write the last command to iored_output file */
-    if (j->pipe->iored_output != NULL) {
-        /* Check if it needs to be appended to the end of the file */
-        if (j->pipe->append_to_output) {
-            freopen(j->pipe->iored_output, "a", stdout);
-        }
-        /* Write the last command to iored_output file */
-        else {
-            freopen(j->pipe->iored_output, "w", stdout);
-        }
-        /* Check if stderr should be redirected as well */
-        if (cmd->dup_stderr_to_stdout) {
-            dup2(STDOUT_FILENO, STDERR_FILENO);
-        }
+    free(rows);
+    proc_sampler_destroy(sampler);
+    if (interactive) {
+        printf("\033[?25h");
+        fflush(stdout);
+        tcsetattr(tty, TCSANOW, &saved);
     }
-    /* ---------- Handle I/O redirections ---------- */
+    return 0;
+}
+
+/* Return the length of a time span such as 90s, 30m, 12h or 7d in
+ * nanoseconds, or -1 if it is malformed */
+static int64_t parse_age(const char *s) {
+    char *end;
+    double value = strtod(s, &end);
+    double unit;
+    switch (*end) {
+        case '\0':
+        case 's':
+            unit = 1;
+            break;
+        case 'm':
+            unit = 60;
+            break;
+        case 'h':
+            unit = 3600;
+            break;
+        case 'd':
+            unit = 86400;
+            break;
+        default:
+            return -1;
+    }
+    if (end == s || value < 0 || (*end && end[1])) {
+        return -1;
+    }
+    return value * unit * 1e9;
+}
+
+/* Query the job accounting log */
+static int handle_jacct(int argc, char **argv) {
+    const char *path = jacct_path();
+    int64_t age = -1;
+    int count = 10;
+    int key = JACCT_CPU;
+    bool list = false;
+    int i = 1;
+
+    /* Parse the options */
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            list = true;
+        } else if (i + 1 == argc) {
+            break;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            if ((age = parse_age(argv[++i])) == -1) {
+                break;
+            }
+        } else if (strcmp(argv[i], "-n") == 0) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            if ((key = jacct_parse_key(argv[++i])) == -1) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+    if (i < argc || count < 0) {
+        printf("jacct: usage: jacct [-f file] [-s age] [-n count] "
+               "[-k key | -l]\n"
+               "       keys: cpu count p50 p99 rss io\n");
+        return 1;
+    }
+    if (path == NULL) {
+        printf("jacct: no accounting log (start cush with -A file, "
+               "or use -f file)\n");
+        return 1;
+    }
+
+    /* Only jobs that ended within 'age' of now */
+    int64_t since = INT64_MIN;
+    if (age != -1) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        since = now.tv_sec * 1000000000LL + now.tv_nsec - age;
+    }
+    bool ok = list ? jacct_list(path, since, count, stdout)
+                   : jacct_summary(path, since, key, count, stdout);
+    if (!ok) {
+        utils_error("jacct: %s: ", path);
+        return 1;
+    }
+    return 0;
+}
+
+/* Exit the shell */
+static int handle_exit(int argc, char **argv) {
+    exit(0);
+}
+
+/* List the jobs */
+static int handle_jobs(int argc, char **argv) {
+    /* Check if jobs has only one argument, or -l */
+    bool long_format = argc == 2 && strcmp(argv[1], "-l") == 0;
+    if (argc == 1 || long_format) {
+        struct job *j;
+        /* Iterates through the job list */
+        for (struct list_elem *e = list_begin(&job_list);
+             e != list_end(&job_list); e = list_next(e)) {
+            j = list_entry(e, struct job, elem);
+            /* Print out the existing job */
+            if (long_format) {
+                print_job_long(j);
+            } else {
+                print_job(j);
+            }
+        }
+    } else {
+        printf("jobs: usage: jobs [-l]\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Take a jobserver token again for a stopped job that is about to
+ * continue.  Returns false if ^C was typed while waiting for it. */
+static bool retake_token(struct job *j) {
+    assert(signal_is_blocked(SIGCHLD));
+    if (!jobserver_enabled() || j->holds_token) {
+        return true;
+    }
+    if (!jobserver_acquire()) {
+        printf("\n");
+        return false;
+    }
+    /* The job may have ended while the shell waited */
+    if (j->num_processes_alive > 0) {
+        j->holds_token = true;
+    } else {
+        jobserver_release();
+    }
+    return true;
+}
+
+/* Continue a stopped job in the background */
+static int handle_bg(int argc, char **argv) {
+    /* Check if bg has two arguments */
+    if (argc == 2) {
+        /* Convert the string to int */
+        int jid = atoi(*(argv + 1));
+        struct job *j = get_job_from_jid(jid);
+        /* If the job does not exist, print no such job */
+        if (j == NULL) {
+            printf("bg %d: No such job\n", jid);
+            return 1;
+        }
+        /* Block the signal, also while the priorities change, as the
+         * pids of processes reaped meanwhile may be reused */
+        signal_block(SIGCHLD);
+        /* It needs a job slot to run again */
+        if (!retake_token(j)) {
+            signal_unblock(SIGCHLD);
+            return 1;
+        }
+        /* Sent signal to the process group*/
+        if (killpg(get_process_pgid(jid), SIGCONT) == -1) {
+            perror("bg: Error when calling killpg");
+            exit(EXIT_FAILURE);
+        }
+        /* Set the status of the job to BACKGROUND*/
+        j->status = BACKGROUND;
+        publish_job(j, false);
+        update_background_priority();
+        signal_unblock(SIGCHLD);
+    } else {
+        printf("bg: job id is missing\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Kill a job */
+static int handle_kill(int argc, char **argv) {
+    /* Check if kill has two arguments */
+    if (argc == 2) {
+        /* Convert the string to int */
+        int jid = atoi(*(argv + 1));
+        struct job *j = get_job_from_jid(jid);
+        /* If the job does not exist, print no such job */
+        if (j == NULL) {
+            printf("kill %d: No such job\n", jid);
+            return 1;
+        }
+        /* Kill the whole cgroup, including processes that left the
+         * process group, with a single write if possible */
+        if (j->cgroup != NULL && cgroup_kill(j->cgroup) == 0) {
+            return 0;
+        }
+        /* Sent signal to the process group*/
+        if (killpg(get_process_pgid(jid), SIGKILL) == -1) {
+            perror("kill: Error when calling killpg");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        printf("kill: job id is missing\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Stop a job */
+static int handle_stop(int argc, char **argv) {
+    /* Check if kill has two arguments */
+    if (argc == 2) {
+        /* Convert the string to int */
+        int jid = atoi(*(argv + 1));
+        struct job *j = get_job_from_jid(jid);
+        /* If the job does not exist, print no such job */
+        if (j == NULL) {
+            printf("stop %d: No such job\n", jid);
+            return 1;
+        }
+        /* Sent signal to the process group*/
+        if (killpg(get_process_pgid(jid), SIGSTOP) == -1) {
+            perror("stop: Error when calling killpg");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        printf("stop: job id is missing\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Continue a job in the foreground and wait for it */
+static int handle_fg(int argc, char **argv) {
+    /* Check if kill has two arguments */
+    if (argc == 2) {
+        struct job *j = NULL;
+        /* Convert the string to int */
+        int jid = atoi(*(argv + 1));
+        /* Get the job from jid */
+        j = get_job_from_jid(jid);
+        /* If the job does not exist, print no such job */
+        if (j == NULL) {
+            printf("job was not found\n");
+            return 1;
+        }
+
+        /* Block the signal, also while the priorities change, as the
+         * pids of processes reaped meanwhile may be reused */
+        signal_block(SIGCHLD);
+        /* It needs a job slot to run again */
+        if (!retake_token(j)) {
+            signal_unblock(SIGCHLD);
+            return 1;
+        }
+
+        /* Set the status of the job to FOREGROUND */
+        j->status = FOREGROUND;
+        update_background_priority();
+
+        /* Print the job to stdout */
+        print_cmdline(j->pipe);
+        printf("\n");
+        fflush(stdout);
+
+        /* Sent signal to the process group*/
+        if (killpg(get_process_pgid(jid), SIGCONT) == -1) {
+            perror("fg: Error when calling killpg");
+            exit(EXIT_FAILURE);
+        }
+
+        publish_job(j, false);
+        /* Give the terminal to the process group */
+        if (!headless) {
+            termstate_give_terminal_to(NULL, get_process_pgid(jid));
+        }
+        /* Wait until the job is done */
+        wait_for_job(j);
+        /* Give the terminal back to shell */
+        if (!headless) {
+            termstate_give_terminal_back_to_shell();
+        }
+        update_background_priority();
+        report_foreground_job(j);
+        int status = job_status(j);
+        /* Unblock the signal */
+        signal_unblock(SIGCHLD);
+        return status;
+    } else {
+        printf("fg: job id is missing\n");
+        return 1;
+    }
+}
+
+/* The control files the limit builtin shows and changes */
+static const char *limit_files[] = {
+    "cpu.max", "cpu.weight", "memory.max", "cpuset.cpus",
+};
+
+/* Write one file=value setting of the limit builtin into the cgroup
+ * of 'j'.  The setting is parsed from a copy, as the words of a
+ * command belong to its pipeline.  Returns false if it failed. */
+static bool set_limit(struct job *j, const char *setting) {
+    char *file = strdup(setting);
+    char *value = strchr(file, '=');
+    if (value == NULL) {
+        printf("limit: expected file=value, got %s\n", setting);
+        free(file);
+        return false;
+    }
+    *value++ = '\0';
+    /* Only limits, not files such as cgroup.procs or cgroup.kill
+     * that would move or kill processes */
+    bool known = false;
+    for (int k = 0; k < sizeof limit_files / sizeof *limit_files; k++) {
+        known = known || strcmp(file, limit_files[k]) == 0;
+    }
+    bool ok = known;
+    if (!known) {
+        printf("limit: %s is not one of cpu.max, cpu.weight, "
+               "memory.max, cpuset.cpus\n", file);
+    } else {
+        /* cpu.max takes "quota period", accept quota/period */
+        if (strcmp(file, "cpu.max") == 0) {
+            for (char *c = value; *c; c++) {
+                if (*c == '/') *c = ' ';
+            }
+        }
+        if (cgroup_set(j->cgroup, file, value) == -1) {
+            utils_error("limit: cannot set %s: ", file);
+            ok = false;
+        }
+    }
+    free(file);
+    return ok;
+}
+
+/* Show or change the cgroup limits of a job */
+static int handle_limit(int argc, char **argv) {
+    /* Check if limit has at least two arguments */
+    if (argc >= 2) {
+        /* Convert the string to int */
+        int jid = atoi(*(argv + 1));
+        struct job *j = get_job_from_jid(jid);
+        /* If the job does not exist, print no such job */
+        if (j == NULL) {
+            printf("limit %d: No such job\n", jid);
+            return 1;
+        }
+        if (j->cgroup == NULL) {
+            printf("limit %d: job has no cgroup (start cush with -g)\n",
+                   jid);
+            return 1;
+        }
+        /* Without settings, print the current limits of the job */
+        if (argc == 2) {
+            for (int i = 0; i < sizeof limit_files / sizeof *limit_files;
+                 i++) {
+                cgroup_print(j->cgroup, limit_files[i]);
+            }
+            return 0;
+        }
+        /* Write each file=value setting into the job's cgroup */
+        int status = 0;
+        for (int i = 2; i < argc; i++) {
+            if (!set_limit(j, argv[i])) {
+                status = 1;
+            }
+        }
+        return status;
+    } else {
+        printf("limit: job id is missing\n");
+        return 1;
+    }
+}
+
+/* List or change the shell options */
+static int handle_set(int argc, char **argv) {
+    /* Without arguments, list the shell options */
+    if (argc == 1) {
+        for (struct shell_option *o = shell_options; o->name; o++) {
+            printf("%-16s%s\n", o->name, *o->value ? "on" : "off");
+        }
+        return 0;
+    }
+    /* Check if set has an -o or +o flag and an option name */
+    if (argc != 3 ||
+        (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0)) {
+        printf("set: usage: set [-o|+o option]\n");
+        return 1;
+    }
+    for (struct shell_option *o = shell_options; o->name; o++) {
+        if (strcmp(o->name, argv[2]) == 0) {
+            *o->value = argv[1][0] == '-';
+            return 0;
+        }
+    }
+    printf("set: %s: invalid option name\n", argv[2]);
+    return 1;
+}
+
+/* Export variables, or list the exported ones */
+static int handle_export(int argc, char **argv) {
+    if (argc == 1) {
+        vars_print_exported();
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        /* export name=value sets the variable, too */
+        char *eq = strchr(argv[i], '=');
+        if (eq != NULL) {
+            *eq = '\0';
+        }
+        bool ok = vars_export(argv[i]) && (eq == NULL ||
+                                           vars_set(argv[i], eq + 1));
+        if (!ok) {
+            printf("export: %s: invalid variable name\n", argv[i]);
+            status = 1;
+        }
+        if (eq != NULL) {
+            *eq = '=';
+        }
+    }
+    return status;
+}
+
+/* Unset variables */
+static int handle_unset(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        vars_unset(argv[i]);
+    }
+    return 0;
+}
+
+/* Print or reset the latency histograms */
+static int handle_stats(int argc, char **argv) {
+    int status = 0;
+    /* Histograms are updated by the SIGCHLD handler */
+    signal_block(SIGCHLD);
+    if (argc == 1) {
+        stats_print(stdout);
+    } else if (argc == 2 && strcmp(argv[1], "-j") == 0) {
+        stats_print_json(stdout);
+    } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        stats_reset();
+    } else {
+        printf("stats: usage: stats [-j | reset]\n");
+        status = 1;
+    }
+    signal_unblock(SIGCHLD);
+    return status;
+}
+
+/* Start, stop or dump the trace */
+static int handle_trace(int argc, char **argv) {
+    int status = 0;
+    /* The SIGCHLD handler records events, too */
+    signal_block(SIGCHLD);
+    if (argc >= 2 && argc <= 3 && strcmp(argv[1], "on") == 0) {
+        trace_start(argc == 3 ? atoi(argv[2]) : TRACE_EVENTS);
+    } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        trace_stop();
+    } else if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+        if (!trace_dump(argv[2])) {
+            utils_error("trace: %s: ", argv[2]);
+            status = 1;
+        }
+    } else {
+        printf("trace: usage: trace on [events] | off | dump file\n");
+        status = 1;
+    }
+    signal_unblock(SIGCHLD);
+    return status;
+}
+
+/* Print the history */
+static int handle_history(int argc, char **argv) {
+    print_history();
+    return 0;
+}
+
+/* The builtins of the shell, which run on its stdio */
+static const struct builtin shell_builtins[] = {
+    { "bg", handle_bg },
+    { "exit", handle_exit },
+    { "export", handle_export },
+    { "fg", handle_fg },
+    { "history", handle_history },
+    { "jacct", handle_jacct },
+    { "jobs", handle_jobs },
+    { "jtop", handle_jtop },
+    { "kill", handle_kill },
+    { "limit", handle_limit },
+    { "set", handle_set },
+    { "stats", handle_stats },
+    { "stop", handle_stop },
+    { "trace", handle_trace },
+    { "unset", handle_unset },
+};
+
+/* Add the builtins of the shell and the utilities it runs itself to
+ * the table of builtins, before any plugin can take their names */
+static void register_builtins(void) {
+    for (size_t i = 0; i < sizeof shell_builtins / sizeof *shell_builtins;
+         i++) {
+        builtin_add(&shell_builtins[i]);
+    }
+    const struct inproc_utility *u;
+    for (size_t i = 0; (u = inproc_utility(i)) != NULL; i++) {
+        struct builtin b = { u->name, NULL, u, NULL };
+        builtin_add(&b);
+    }
+}
+
+/* Check if the command is a build in function */
+bool is_built_in(char *cmd) {
+    const struct builtin *b = builtin_find(cmd);
+    return b != NULL && b->shell != NULL;
+}
+
+/* Handle the build in function.  Returns its exit status. */
+int handle_build_in(struct ast_command *cmd) {
+    /* Count the number of arguments in the command */
+    char **cmd_argv = cmd->argv;
+    int argc = 0;
+    while (*(cmd_argv + argc) != NULL) {
+        argc++;
+    }
+    return builtin_find(cmd_argv[0])->shell(argc, cmd_argv);
+}
+
+/* Measurements of one pipeline benchmarked by the bench builtin */
+struct bench_result {
+    struct sample_summary wall; /* Wall time of the measured runs */
+    double user;                /* Mean user CPU time */
+    double sys;                 /* Mean system CPU time */
+    long maxrss_kb;             /* Largest maximum RSS of any run */
+};
+
+/* Run a pipeline 'warmup' + 'runs' times in the foreground and
+ * summarize the measured runs.
+ * Returns false if a run was stopped or interrupted by ^C.
+ */
+static bool bench_pipeline(struct ast_pipeline *template, int runs,
+                           int warmup, struct bench_result *result) {
+    double *wall = malloc(runs * sizeof *wall);
+    bool completed = true;
+
+    memset(result, 0, sizeof *result);
+    for (int i = 0; i < warmup + runs && completed; i++) {
+        struct ast_pipeline *pipe_line = ast_pipeline_clone(template);
+        pipe_line->bg_job = false;
+        struct ast_command *cmd = list_entry(list_begin(&pipe_line->commands),
+                                             struct ast_command, elem);
+        struct job *j = handle_pipeline(pipe_line, cmd, false, false);
+
+        /* A stopped run stays in the job list */
+        if (j->num_processes_alive > 0) {
+            completed = false;
+            break;
+        }
+
+        /* Warmup runs are not measured */
+        if (i >= warmup) {
+            struct proc_usage usage;
+            get_job_usage(j, &usage);
+            wall[i - warmup] = job_elapsed(j);
+            result->user += usage.utime_us / 1e6 / runs;
+            result->sys += usage.stime_us / 1e6 / runs;
+            if (usage.maxrss_kb > result->maxrss_kb) {
+                result->maxrss_kb = usage.maxrss_kb;
+            }
+        }
+
+        if (WIFSIGNALED(j->exit_status) && WTERMSIG(j->exit_status) == SIGINT) {
+            completed = false;
+        }
+        list_remove(&j->elem);
+        delete_job(j);
+    }
+
+    if (completed) {
+        sample_summarize(wall, runs, &result->wall);
+    }
+    free(wall);
+    return completed;
+}
+
+/* Print one row of the bench table */
+static void print_bench_result(int n, struct bench_result *r) {
+    double times[] = { r->wall.mean, r->wall.stddev, r->wall.min, r->wall.p50,
+                       r->wall.p95, r->wall.p99, r->user, r->sys };
+    char buf[32];
+
+    printf("%-3d", n);
+    for (int i = 0; i < sizeof times / sizeof times[0]; i++) {
+        sample_format_duration(buf, sizeof buf, times[i]);
+        printf(" %9s", buf);
+    }
+    printf(" %7.1fM %4d  ", r->maxrss_kb / 1024.0, r->wall.outliers);
+}
+
+/* The bench builtin.
+ *   bench [-n runs] [-w warmup] -- pipeline
+ *   bench [-n runs] [-w warmup] "pipeline" "pipeline" ...
+ * The first form benchmarks the rest of the command line, the second
+ * compares quoted pipelines side by side.
+ */
+#define BENCH_MAX 16
+static int handle_bench(struct ast_pipeline *pipe_line) {
+    struct ast_command *cmd = list_entry(list_begin(&pipe_line->commands),
+                                         struct ast_command, elem);
+    char **argv = cmd->argv;
+    int runs = 10, warmup = 1;
+    int i = 1;
+
+    /* Parse the options */
+    for (; argv[i] != NULL && argv[i + 1] != NULL; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) {
+            runs = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-w") == 0) {
+            warmup = atoi(argv[i + 1]);
+        } else {
+            break;
+        }
+    }
+    bool rest = argv[i] != NULL && strcmp(argv[i], "--") == 0;
+    if (runs < 1 || warmup < 0 || argv[i] == NULL ||
+        (rest && argv[i + 1] == NULL) || (!rest && argv[i][0] == '-')) {
+        printf("bench: usage: bench [-n runs] [-w warmup] -- pipeline\n"
+               "       bench [-n runs] [-w warmup] \"pipeline\" ...\n");
+        return 1;
+    }
+
+    /* Collect the pipelines to benchmark */
+    struct ast_pipeline *template = NULL;
+    struct ast_command_line *cline = ast_command_line_create_empty();
+    if (rest) {
+        /* Drop "bench [options] --" from a copy of the command line */
+        template = ast_pipeline_clone(pipe_line);
+        struct ast_command *first = list_entry(
+            list_begin(&template->commands), struct ast_command, elem);
+        int argc = 0;
+        while (first->argv[argc] != NULL) {
+            argc++;
+        }
+        for (int k = 0; k <= i; k++) {
+            free(first->argv[k]);
+        }
+        memmove(first->argv, first->argv + i + 1,
+                (argc - i) * sizeof *first->argv);
+        template->bg_job = false;
+        list_push_back(&cline->pipes, &template->elem);
+    } else {
+        for (; argv[i] != NULL; i++) {
+            struct ast_command_line *one = ast_parse_command_line(argv[i]);
+            if (one == NULL || list_size(&one->pipes) != 1 ||
+                !ast_command_line_is_simple(one) ||
+                list_size(&cline->pipes) == BENCH_MAX) {
+                printf("bench: cannot benchmark \"%s\"\n", argv[i]);
+                if (one != NULL) {
+                    ast_command_line_free(one);
+                }
+                ast_command_line_free(cline);
+                return 1;
+            }
+            struct ast_pipeline *p = list_entry(list_pop_front(&one->pipes),
+                                                struct ast_pipeline, elem);
+            expand_pipeline(p);
+            list_push_back(&cline->pipes, &p->elem);
+            ast_command_line_free(one);
+        }
+    }
+
+    /* Run the pipelines one after the other */
+    struct bench_result results[BENCH_MAX];
+    int n = 0, fastest = 0;
+    for (struct list_elem *e = list_begin(&cline->pipes);
+         e != list_end(&cline->pipes); e = list_next(e), n++) {
+        struct ast_pipeline *p = list_entry(e, struct ast_pipeline, elem);
+        if (!bench_pipeline(p, runs, warmup, &results[n])) {
+            printf("bench: interrupted\n");
+            ast_command_line_free(cline);
+            return 1;
+        }
+        if (results[n].wall.mean < results[fastest].wall.mean) {
+            fastest = n;
+        }
+    }
+
+    /* Print the results side by side */
+    printf("%-3s %9s %9s %9s %9s %9s %9s %9s %9s %8s %4s  %s\n", "#", "mean",
+           "stddev", "min", "p50", "p95", "p99", "user", "sys", "maxrss",
+           "out", "pipeline");
+    n = 0;
+    for (struct list_elem *e = list_begin(&cline->pipes);
+         e != list_end(&cline->pipes); e = list_next(e), n++) {
+        print_bench_result(n + 1, &results[n]);
+        print_cmdline(list_entry(e, struct ast_pipeline, elem));
+        printf("\n");
+    }
+    for (int k = 0; k < n; k++) {
+        if (k != fastest) {
+            printf("#%d is %.2fx faster than #%d\n", fastest + 1,
+                   results[k].wall.mean / results[fastest].wall.mean, k + 1);
+        }
+    }
+    ast_command_line_free(cline);
+    return 0;
+}
+
+/* Set the variables of a command that consists of name=value words
+ * only.  Returns false if it does not. */
+static bool set_variables(char **argv) {
+    for (char **w = argv; *w != NULL; w++) {
+        char *eq = strchr(*w, '=');
+        if (eq == NULL || !vars_valid_name(*w, eq - *w)) {
+            return false;
+        }
+    }
+    for (char **w = argv; *w != NULL; w++) {
+        char *eq = strchr(*w, '=');
+        *eq = '\0';
+        vars_set(*w, eq + 1);
+        *eq = '=';
+    }
+    return true;
+}
+
+/* Run one pipeline of a command line.  Returns its job, or NULL if
+ * the pipeline was a builtin, assignments or an error, whose exit
+ * status is stored in '*status'. */
+static struct job *execute_pipeline(struct ast_pipeline *pipe_line,
+                                    int *status) {
+    /* Get the first command from the pipeline */
+    struct ast_command *cmd = list_entry(list_begin(&pipe_line->commands),
+                                         struct ast_command, elem);
+
+    /* The time and profile keywords report on the pipeline they
+     * prefix */
+    bool timed = false, profiled = false;
+    while (cmd->argv[0] != NULL && (strcmp(cmd->argv[0], "time") == 0 ||
+                                    strcmp(cmd->argv[0], "profile") == 0)) {
+        int argc = 0;
+        while (cmd->argv[argc] != NULL) {
+            argc++;
+        }
+        if (strcmp(cmd->argv[0], "time") == 0) {
+            timed = true;
+        } else {
+            profiled = true;
+        }
+        free(cmd->argv[0]);
+        memmove(cmd->argv, cmd->argv + 1, argc * sizeof *cmd->argv);
+    }
+    if (cmd->argv[0] == NULL) {
+        printf("%s: command is missing\n", profiled ? "profile" : "time");
+        *status = 1;
+        return NULL;
+    }
+
+    /* Assignments change the shell's variables */
+    if (list_size(&pipe_line->commands) == 1 && set_variables(cmd->argv)) {
+        *status = 0;
+        return NULL;
+    }
+
+    /* The daemon never waits on one client, so it does not run the
+     * builtins that wait for jobs */
+    if (serving != NULL && (strcmp(cmd->argv[0], "bench") == 0 ||
+                            strcmp(cmd->argv[0], "fg") == 0)) {
+        printf("%s: not available in the daemon\n", cmd->argv[0]);
+        *status = 1;
+        return NULL;
+    }
+
+    /* The bench builtin runs pipelines itself */
+    if (strcmp(cmd->argv[0], "bench") == 0) {
+        *status = handle_bench(pipe_line);
+        return NULL;
+    }
+
+    /* Check if the command is the build in function */
+    if (is_built_in(cmd->argv[0])) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        *status = handle_build_in(cmd);
+        if (timed) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            fprintf(stderr, "real %.3fs\n", (end.tv_sec - start.tv_sec) +
+                    (end.tv_nsec - start.tv_nsec) / 1e9);
+        }
+        return NULL;
+    }
+    /* If the command is not build in, run the handle_pipeline function */
+    return handle_pipeline(pipe_line, cmd, timed, profiled);
+}
+
+/* ------------- Control flow ------------- */
+
+/* The shell runs compound commands, && and || itself.  Their parts
+ * stay in the AST, parsed once; a pipeline that may run again is
+ * copied for its job, which owns and frees its pipeline. */
+
+#define MAX_FUNCTION_DEPTH 1000
+
+/* How the commands being run are left early */
+enum jump {
+    JUMP_NONE,
+    JUMP_BREAK,            /* break out of 'jump_count' loops */
+    JUMP_CONTINUE,         /* continue the 'jump_count'th loop */
+    JUMP_RETURN,           /* return from the function */
+    JUMP_INTERRUPT,        /* a job was stopped or interrupted by ^C */
+};
+
+static int last_status;        /* Status of the last pipeline, $? */
+static enum jump jump;
+static int jump_count;
+static int loop_depth;         /* Loops running in the current function */
+static int function_depth;     /* Functions running */
+static int frame_argc;         /* Positional parameters $1 ... */
+static char **frame_argv;      /* $0, then the positional parameters */
+
+static void run_list(struct ast_command_line *cline, bool reused);
+
+/* Write the value of the variable named by the 'len' characters at
+ * 'name': a special parameter or a variable */
+static void write_var(FILE *f, const char *name, size_t len) {
+    if (name[0] == '?') {
+        fprintf(f, "%d", last_status);
+    } else if (name[0] == '#') {
+        fprintf(f, "%d", frame_argc);
+    } else if (name[0] == '@' || name[0] == '*') {
+        for (int i = 1; i <= frame_argc; i++) {
+            fprintf(f, i == 1 ? "%s" : " %s", frame_argv[i]);
+        }
+    } else if (isdigit((unsigned char) name[0])) {
+        int n = name[0] - '0';
+        if (n <= frame_argc) {
+            fputs(frame_argv[n], f);
+        }
+    } else {
+        const char *value = vars_get(name, len);
+        if (value != NULL) {
+            fputs(value, f);
+        }
+    }
+}
+
+/* Return a copy of 'word' with its $name, ${name}, $1 ... $9, $#, $?,
+ * $@ and $* expanded.  A $ that names nothing stays. */
+static char *expand_word(const char *word) {
+    char *out;
+    size_t size;
+    FILE *f = open_memstream(&out, &size);
+    for (const char *p = word; *p != '\0';) {
+        if (*p != AST_VAR) {
+            fputc(*p++, f);
+            continue;
+        }
+        bool braced = p[1] == '{';
+        const char *name = p + 1 + braced;
+        size_t len = 0;
+        if (strchr("?#@*", *name) != NULL || isdigit((unsigned char) *name)) {
+            len = *name != '\0';
+        } else if (isalpha((unsigned char) *name) || *name == '_') {
+            while (isalnum((unsigned char) name[len]) || name[len] == '_') {
+                len++;
+            }
+        }
+        if (len == 0 || (braced && name[len] != '}')) {
+            fputc('$', f);
+            p++;
+            continue;
+        }
+        write_var(f, name, len);
+        p = name + len + braced;
+    }
+    fclose(f);
+    return out;
+}
+
+/* Expand the variables in the words and file names of a pipeline */
+static void expand_pipeline(struct ast_pipeline *pipe_line) {
+    char **files[] = { &pipe_line->iored_input, &pipe_line->iored_output };
+    for (int i = 0; i < 2; i++) {
+        if (*files[i] != NULL && strchr(*files[i], AST_VAR) != NULL) {
+            char *s = expand_word(*files[i]);
+            free(*files[i]);
+            *files[i] = s;
+        }
+    }
+    for (struct list_elem *e = list_begin(&pipe_line->commands);
+         e != list_end(&pipe_line->commands); e = list_next(e)) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        for (char **w = cmd->argv; *w != NULL; w++) {
+            if (strchr(*w, AST_VAR) != NULL) {
+                char *s = expand_word(*w);
+                free(*w);
+                *w = s;
+            }
+        }
+    }
+}
+
+/* Return the status of a job the shell ran, as a number for $? */
+static int job_status(struct job *job) {
+    if (job->status == BACKGROUND) {
+        return 0;
+    }
+    if (job->num_processes_alive > 0) {
+        return 128 + SIGTSTP;
+    }
+    if (WIFSIGNALED(job->exit_status)) {
+        return 128 + WTERMSIG(job->exit_status);
+    }
+    return WEXITSTATUS(job->exit_status);
+}
+
+/* Run break, continue or return */
+static void run_jump(int argc, char **argv) {
+    bool is_return = strcmp(argv[0], "return") == 0;
+    int n = argc > 1 ? atoi(argv[1]) : is_return ? last_status : 1;
+    if (argc > 2 || (!is_return && n < 1)) {
+        printf("%s: usage: %s [n]\n", argv[0], argv[0]);
+        last_status = 1;
+    } else if (is_return && function_depth == 0) {
+        printf("return: not in a function\n");
+        last_status = 1;
+    } else if (!is_return && loop_depth == 0) {
+        printf("%s: not in a loop\n", argv[0]);
+        last_status = 1;
+    } else if (is_return) {
+        last_status = n & 0xff;
+        jump = JUMP_RETURN;
+    } else {
+        jump = argv[0][0] == 'b' ? JUMP_BREAK : JUMP_CONTINUE;
+        jump_count = n < loop_depth ? n : loop_depth;
+        last_status = 0;
+    }
+}
+
+/* Call a function with the positional parameters in 'argv' */
+static void call_function(const struct ast_compound *f, int argc,
+                          char **argv) {
+    if (function_depth == MAX_FUNCTION_DEPTH) {
+        printf("%s: maximum function nesting exceeded\n", argv[0]);
+        last_status = 1;
+        return;
+    }
+    int saved_argc = frame_argc, saved_loops = loop_depth;
+    char **saved_argv = frame_argv;
+    frame_argc = argc - 1;
+    frame_argv = argv;
+    loop_depth = 0;
+    function_depth++;
+    run_list(f->body, true);
+    function_depth--;
+    if (jump == JUMP_RETURN) {
+        jump = JUMP_NONE;
+    }
+    frame_argc = saved_argc;
+    frame_argv = saved_argv;
+    loop_depth = saved_loops;
+}
+
+/* Run a pipeline of a command line.  One that may run again is copied
+ * first; the pipeline that runs is owned by its job, or freed here. */
+static void run_pipeline(struct ast_pipeline *pipe_line, bool reused) {
+    struct ast_pipeline *run = reused ? ast_pipeline_clone(pipe_line)
+                                      : pipe_line;
+    expand_pipeline(run);
+    struct ast_command *cmd = list_entry(list_begin(&run->commands),
+                                         struct ast_command, elem);
+    int argc = 0;
+    while (cmd->argv[argc] != NULL) {
+        argc++;
+    }
+    /* A function or a jump runs on the shell's own stdio */
+    const struct builtin *b = builtin_find(cmd->argv[0]);
+    bool jumps = strcmp(cmd->argv[0], "break") == 0 ||
+                 strcmp(cmd->argv[0], "continue") == 0 ||
+                 strcmp(cmd->argv[0], "return") == 0;
+    if (jumps || (b != NULL && b->function != NULL)) {
+        if (list_size(&run->commands) > 1 || run->iored_input != NULL ||
+            run->iored_output != NULL || run->bg_job) {
+            printf("%s: cannot be piped, redirected or run in the "
+                   "background\n", cmd->argv[0]);
+            last_status = 1;
+        } else if (jumps) {
+            run_jump(argc, cmd->argv);
+        } else {
+            call_function(b->function, argc, cmd->argv);
+        }
+        ast_pipeline_free(run);
+        return;
+    }
+
+    int status;
+    struct job *job = execute_pipeline(run, &status);
+    if (job == NULL) {
+        /* A builtin, which does not own the pipeline */
+        last_status = status;
+        ast_pipeline_free(run);
+        return;
+    }
+    last_status = job_status(job);
+    /* A stopped or interrupted job ends the compound commands around
+     * it */
+    if (reused && !job->pipe->bg_job &&
+        (job->num_processes_alive > 0 ||
+         (WIFSIGNALED(job->exit_status) &&
+          WTERMSIG(job->exit_status) == SIGINT))) {
+        jump = JUMP_INTERRUPT;
+    }
+}
+
+/* Handle a break or continue after the body of a loop.  Returns false
+ * if the loop ends. */
+static bool next_iteration(void) {
+    /* Jobs of earlier iterations are done */
+    delete_finished_jobs();
+    if (jump == JUMP_BREAK || jump == JUMP_CONTINUE) {
+        if (--jump_count > 0) {
+            return false;
+        }
+        bool again = jump == JUMP_CONTINUE;
+        jump = JUMP_NONE;
+        return again;
+    }
+    return jump == JUMP_NONE;
+}
+
+/* Return true if 'word' is just $@ or $* */
+static bool is_all_params(const char *word) {
+    return word[0] == AST_VAR && (word[1] == '@' || word[1] == '*') &&
+           word[2] == '\0';
+}
+
+/* Run a compound command */
+static void run_compound(struct ast_compound *c) {
+    switch (c->kind) {
+    case AST_IF:
+        run_list(c->cond, true);
+        if (jump != JUMP_NONE) {
+            break;
+        }
+        if (last_status == 0) {
+            run_list(c->body, true);
+        } else if (c->orelse != NULL) {
+            run_list(c->orelse, true);
+        } else {
+            last_status = 0;
+        }
+        break;
+    case AST_WHILE:
+    case AST_UNTIL: {
+        int status = 0;
+        loop_depth++;
+        for (;;) {
+            run_list(c->cond, true);
+            if (jump == JUMP_NONE &&
+                (last_status == 0) == (c->kind == AST_WHILE)) {
+                run_list(c->body, true);
+                status = last_status;
+            } else if (jump == JUMP_NONE) {
+                break;
+            }
+            if (!next_iteration()) {
+                break;
+            }
+        }
+        loop_depth--;
+        last_status = status;
+        break;
+    }
+    case AST_FOR: {
+        /* The words are expanded once, before the first iteration; a
+         * word that is just $@ or $* stands for each parameter */
+        int nwords = 0, total = 0;
+        for (; c->words[nwords] != NULL; nwords++) {
+            total += is_all_params(c->words[nwords]) ? frame_argc : 1;
+        }
+        char **words = calloc(total + 1, sizeof *words);
+        int n = 0;
+        for (int i = 0; i < nwords; i++) {
+            const char *w = c->words[i];
+            if (is_all_params(w)) {
+                for (int k = 1; k <= frame_argc; k++) {
+                    words[n++] = strdup(frame_argv[k]);
+                }
+            } else {
+                words[n++] = expand_word(w);
+            }
+        }
+        last_status = 0;
+        loop_depth++;
+        for (int i = 0; i < n; i++) {
+            if (!vars_set(c->name, words[i])) {
+                printf("for: %s: invalid variable name\n", c->name);
+                last_status = 1;
+                break;
+            }
+            run_list(c->body, true);
+            if (!next_iteration()) {
+                break;
+            }
+        }
+        loop_depth--;
+        for (int i = 0; i < n; i++) {
+            free(words[i]);
+        }
+        free(words);
+        break;
+    }
+    case AST_GROUP:
+        run_list(c->body, true);
+        break;
+    case AST_FUNCTION: {
+        /* The function keeps a copy of its definition */
+        struct ast_compound *f = ast_compound_clone(c);
+        if (builtin_define_function(f)) {
+            last_status = 0;
+        } else {
+            printf("%s: is a builtin\n", f->name);
+            ast_compound_free(f);
+            last_status = 1;
+        }
+        break;
+    }
+    }
+}
+
+/* Run the pipelines of a command line, as their connectors say.  If
+ * 'reused', they may run again and are left as they are.  Otherwise
+ * each is taken out of the command line when it runs, which leaves the
+ * ones skipped for the command line to free. */
+static void run_list(struct ast_command_line *cline, bool reused) {
+    struct list_elem *next;
+    for (struct list_elem *e = list_begin(&cline->pipes);
+         e != list_end(&cline->pipes) && jump == JUMP_NONE; e = next) {
+        /* A job may free the pipeline once it runs */
+        next = list_next(e);
+        struct ast_pipeline *pipe_line = list_entry(e, struct ast_pipeline, elem);
+        if ((pipe_line->connector == AST_AND && last_status != 0) ||
+            (pipe_line->connector == AST_OR && last_status == 0)) {
+            continue;
+        }
+        if (!reused) {
+            list_remove(e);
+        }
+        if (pipe_line->compound != NULL) {
+            run_compound(pipe_line->compound);
+            if (!reused) {
+                ast_pipeline_free(pipe_line);
+            }
+        } else {
+            run_pipeline(pipe_line, reused);
+        }
+    }
+}
+
+/* Execute the commands */
+void execute(struct ast_command_line *cmdline) {
+    run_list(cmdline, false);
+    jump = JUMP_NONE;
+}
+
+struct job *handle_pipeline(struct ast_pipeline *pipe_line,
+                            struct ast_command *cmd, bool timed,
+                            bool profiled) {
+
+    int pipe_counter = 0;
+    pid_t pid = -1;
+
+    /* Add a new job to the job list */
+    struct job *j = add_job(pipe_line);
+    j->timed = timed;
+    j->profiled = profiled;
+    /* Take a jobserver token.  While all job slots are in use, the
+     * shell waits until ^C, and the daemon, which must not wait, fails
+     * the job. */
+    if (jobserver_enabled()) {
+        bool acquired = serving != NULL ? jobserver_try_acquire()
+                                        : jobserver_acquire();
+        if (!acquired) {
+            if (serving != NULL) {
+                fprintf(stderr, "jobserver: all job slots are in use\n");
+                j->exit_status = W_EXITCODE(1, 0);
+            } else {
+                printf("\n");
+                j->exit_status = W_EXITCODE(0, SIGINT);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &j->end_time);
+            publish_job(j, false);
+            return j;
+        }
+        j->holds_token = true;
+    }
+    /* Give the job its own cgroup leaf */
+    if (cgroup_enabled()) {
+        j->cgroup = cgroup_create_job(j->jid);
+    }
+    /* Get the total number of commands in the pipeline */
+    int total_commands = list_size(&pipe_line->commands);
+    /* The total number of pipes should be one less than the number of total commands */
+    int total_pipes = total_commands - 1;
+    /* Initialize the current command counter */
+    int curr_cmd = 0;
+
+    /* Keep the stages of a pipeline on cores that share a cache */
+    cpu_set_t stage_cpus[total_commands];
+    bool pin_stages = opt_placement && total_commands > 1 &&
+                      topology_place_pipeline(total_commands, stage_cpus);
+
+    /* The shell runs some utilities itself in the foreground */
+    bool in_shell = opt_inproc && !pipe_line->bg_job && serving == NULL &&
+                    !profiled;
+
+    /* Create the necessary number of pipes */
+    int fds[2 * total_pipes];
+    for (int i = 0; i < total_pipes; i++) {
+        /* Print error if piping failed */
+        if (pipe2((fds + i * 2), O_CLOEXEC) == -1) {
+            perror("Error when piping");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Let the children read the script from where the shell stopped */
+    if (script != NULL) {
+        script_sync(script);
+    }
+
+    /* The environment of the children, built again only after a
+     * variable changed */
+    char **envp = vars_environ();
 
     /* ------------- Handle I/O Piping ------------- */
     pid_t pgid = -1;
@@ -547,182 +2492,1191 @@ void handle_pipeline(struct ast_pipeline *pipe_line, struct ast_command *cmd) {
          cmd_line != list_end(&pipe_line->commands);
          cmd_line = list_next(cmd_line)) {
 
-        struct ast_command *cmd =
-            list_entry(cmd_line, struct ast_command, elem);
+        struct ast_command *cmd =
+            list_entry(cmd_line, struct ast_command, elem);
+
+        /* Block the signal */
+        signal_block(SIGCHLD);
+
+        /* The NULL-terminated words making up this command */
+        char **argv = cmd->argv;
+        char *cmd_arg = argv[0];
+
+        /* Stages the shell runs itself start after the forks */
+        cush_builtin_fn *run =
+            in_shell ? inproc_main(builtin_find(cmd_arg), argv,
+                                   curr_cmd == 0 ? pipe_line->iored_input
+                                                 : NULL,
+                                   total_commands)
+                     : NULL;
+        if (run != NULL) {
+            if (j->inproc == NULL) {
+                j->inproc = calloc(total_commands, sizeof *j->inproc);
+            }
+            struct inproc_stage *s = &j->inproc[j->num_inproc++];
+            s->main = run;
+            s->argv = argv;
+            s->stage = curr_cmd;
+            s->dup_stderr = cmd->dup_stderr_to_stdout;
+            j->pid[curr_cmd] = 0;
+            j->pid_alive[curr_cmd] = false;
+            j->total_processes = j->total_processes + 1;
+            curr_cmd++;
+            pipe_counter += 2;
+            continue;
+        }
+
+        /* A profiled child waits until its counters are attached */
+        int attached[2] = { -1, -1 };
+        if (profiled && pipe2(attached, O_CLOEXEC) == -1) {
+            perror("Error when piping");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Fork off a child process to execute each command in a pipeline */
+        uint64_t fork_start = trace_clock();
+        if ((pid = fork()) == 0) {
+            if (profiled) {
+                char c;
+                close(attached[1]);
+                read(attached[0], &c, 1);
+                close(attached[0]);
+            }
+            /* Create a new process group if it is the first process */
+            if (pgid == -1) {
+                setpgid(0, 0);
+            }
+            /* Set the remaining processes in the pipe to have the same pgid */
+            else {
+                setpgid(0, j->pgid);
+            }
+            /* Pin the stage to its core */
+            if (pin_stages &&
+                sched_setaffinity(0, sizeof stage_cpus[curr_cmd],
+                                  &stage_cpus[curr_cmd]) == -1) {
+                perror("sched_setaffinity");
+            }
+            /* Join the job's cgroup before exec */
+            if (j->cgroup != NULL && cgroup_enter(j->cgroup) == -1) {
+                perror("cgroup");
+            }
+            /* Connect the job to its daemon client */
+            if (serving != NULL) {
+                serve_child_io(serving);
+            }
+            /* Idetify the last command in the pipe */
+            bool not_last = not_last_arg(curr_cmd, total_commands);
+
+            /* Connect the stage to its pipes and redirections */
+            struct stage_io io;
+            const char *failed;
+            stage_io_init(&io, j->pipe, cmd, curr_cmd == 0, !not_last,
+                          curr_cmd == 0 ? -1 : fds[pipe_counter - 2],
+                          not_last ? fds[pipe_counter + 1] : -1, -1);
+            if (!stage_io_apply(&io, &failed)) {
+                print_location();
+                perror(failed);
+                exit(EXIT_FAILURE);
+            }
+
+            /* Handle the child process after forking */
+            handle_child_process(fds, total_pipes, cmd_arg, argv, envp);
+        }
+
+        /* Parent process */
+        else {
+            stats_record(STAT_SPAWN, trace_clock() - fork_start);
+            trace_end("fork", fork_start, j->jid, pid);
+            /* Parent's pid and pgid will be the same as its child pgid */
+            if (pgid == -1) {
+                pgid = pid;
+                j->pgid = pgid;
+            }
+
+            setpgid(pid, pgid);
+            /* Attach the counters, then let the child go ahead */
+            if (profiled) {
+                perf_counters_open(pid, &j->perf[curr_cmd]);
+                close(attached[0]);
+                close(attached[1]);
+            }
+            /* Add pid to the pid array in job */
+            j->pid[curr_cmd] = pid;
+            j->pid_alive[curr_cmd] = true;
+            
+            /* Update the number of alive process and the total process */
+            j->num_processes_alive = j->num_processes_alive + 1;
+            j->total_processes = j->total_processes + 1;
+
+            /* Increment command and pipe counter */
+            curr_cmd++;
+            pipe_counter += 2;
+        }
+    }
+
+    /* Publish the job's processes */
+    publish_job(j, false);
+
+    /* The stages the shell runs get descriptors of their own */
+    for (int i = 0; i < j->num_inproc; i++) {
+        open_inproc_stage(&j->inproc[i], pipe_line, fds, total_commands);
+    }
+
+    /* Close the opened pipe */
+    for (int i = 0; i < total_pipes * 2; i++) {
+        close(fds[i]);
+    }
+
+    /* A stage that is the whole pipeline runs on the shell's thread,
+     * and the stages of longer pipelines on threads of their own */
+    if (j->num_inproc == 1 && total_commands == 1) {
+        run_inproc_inline(&j->inproc[0]);
+    } else if (j->num_inproc > 0) {
+        start_inproc_threads(j);
+    }
+    /* Without processes, the job is over once its stages are */
+    if (pgid == -1) {
+        join_inproc_stages(j);
+        clock_gettime(CLOCK_MONOTONIC, &j->end_time);
+        if (j->holds_token) {
+            j->holds_token = false;
+            jobserver_release();
+        }
+        publish_job(j, false);
+    }
+
+    /* Check if the program is executed in the background &.  The
+     * daemon never waits; its jobs are finished by its event loop. */
+    if (j->pipe->bg_job || serving != NULL) {
+        /* Set the status of the job to BG */
+        j->status = BACKGROUND;
+        /* Print the job running on the BG */
+        if (serving == NULL) {
+            printf("[%d] %d\n", j->jid, pid);
+        }
+    }
+    else {
+        /* Give the terminal to the process group */
+        if (!headless && pgid != -1) {
+            termstate_give_terminal_to(NULL, pgid);
+        }
+        update_background_priority();
+        /* Wait until the job is done */
+        wait_for_job(j);
+        /* Stages writing to a stopped job are joined when it ends */
+        if (j->status == FOREGROUND) {
+            join_inproc_stages(j);
+        }
+        /* Give the terminal back to shell */
+        if (!headless && pgid != -1) {
+            termstate_give_terminal_back_to_shell();
+        }
+        update_background_priority();
+        report_foreground_job(j);
+    }
+    /* Unblock the signal */
+    signal_unblock(SIGCHLD);
+    return j;
+}
+
+/* Start an error message with the script and line, if any */
+static void print_location(void) {
+    if (ast_input_name != NULL) {
+        fprintf(stderr, "%s:%u: ", ast_input_name, ast_input_line);
+    }
+}
+
+/* Return the function to run a command in the shell with, or NULL if
+ * it is to be forked.  'b' is the builtin it names, if any, and 'input'
+ * the file its standard input is redirected from. */
+static cush_builtin_fn *inproc_main(const struct builtin *b, char **argv,
+                                    const char *input, int total_commands) {
+    if (b == NULL) {
+        return NULL;
+    }
+    if (b->utility != NULL) {
+        return inproc_can_run(b->utility, argv, input) ? b->utility->main
+                                                       : NULL;
+    }
+    if (b->plugin != NULL) {
+        unsigned flags = b->plugin->flags;
+        struct stat st;
+        if ((flags & CUSH_BUILTIN_READS_INPUT) &&
+            (input == NULL || stat(input, &st) == -1 ||
+             !S_ISREG(st.st_mode))) {
+            return NULL;
+        }
+        if ((flags & CUSH_BUILTIN_NO_THREADS) && total_commands > 1) {
+            return NULL;
+        }
+        return b->plugin->handler;
+    }
+    return NULL;
+}
+
+/* Open the stdin, stdout and stderr of a stage the shell runs: the
+ * pipes next to it, or the files it is redirected to.  They are closed
+ * when the stage has run. */
+static void open_inproc_stage(struct inproc_stage *s,
+                              struct ast_pipeline *pipe_line, int fds[],
+                              int total_commands) {
+    bool first = s->stage == 0, last = s->stage == total_commands - 1;
+
+    s->fd[0] = s->fd[1] = s->fd[2] = -1;
+    if (first && pipe_line->iored_input != NULL) {
+        s->fd[0] = open(pipe_line->iored_input, O_RDONLY | O_CLOEXEC);
+        if (s->fd[0] == -1) {
+            print_location();
+            perror(pipe_line->iored_input);
+            s->main = NULL;
+        }
+    } else {
+        s->fd[0] = fcntl(first ? STDIN_FILENO : fds[2 * s->stage - 2],
+                         F_DUPFD_CLOEXEC, 0);
+    }
+    if (last && pipe_line->iored_output != NULL) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+                    (pipe_line->append_to_output ? O_APPEND : O_TRUNC);
+        s->fd[1] = open(pipe_line->iored_output, flags, 0666);
+        if (s->fd[1] == -1) {
+            print_location();
+            perror(pipe_line->iored_output);
+            s->main = NULL;
+        }
+    } else {
+        s->fd[1] = fcntl(last ? STDOUT_FILENO : fds[2 * s->stage + 1],
+                         F_DUPFD_CLOEXEC, 0);
+    }
+    s->fd[2] = fcntl(s->dup_stderr ? s->fd[1] : STDERR_FILENO,
+                     F_DUPFD_CLOEXEC, 0);
+}
+
+/* Run a stage the shell runs and close its descriptors.  A stage whose
+ * redirection failed exits with status 1. */
+static void *run_inproc_stage(void *arg) {
+    struct inproc_stage *s = arg;
+    if (s->main != NULL) {
+        int argc = 0;
+        while (s->argv[argc] != NULL) {
+            argc++;
+        }
+        s->status = s->main(argc, s->argv, s->fd);
+    } else {
+        s->status = EXIT_FAILURE;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (s->fd[i] != -1) {
+            close(s->fd[i]);
+        }
+    }
+    return NULL;
+}
+
+/* Run a stage on the shell's thread.  Writing to a closed pipe fails
+ * with EPIPE rather than killing the shell with SIGPIPE. */
+static void run_inproc_inline(struct inproc_stage *s) {
+    signal_block(SIGPIPE);
+    run_inproc_stage(s);
+    /* Only a failed stage can have written to a closed pipe */
+    sigset_t pending;
+    if (s->status != 0 && sigpending(&pending) == 0 &&
+        sigismember(&pending, SIGPIPE)) {
+        sigset_t set;
+        struct timespec zero = { 0, 0 };
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        sigtimedwait(&set, NULL, &zero);
+    }
+    signal_unblock(SIGPIPE);
+}
+
+/* Start the stages of a job on threads of their own.  The threads block
+ * all signals, so that signals for the shell are handled by its own
+ * thread and a write to a closed pipe only fails with EPIPE. */
+static void start_inproc_threads(struct job *job) {
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (int i = 0; i < job->num_inproc; i++) {
+        struct inproc_stage *s = &job->inproc[i];
+        int error = pthread_create(&s->thread, NULL, run_inproc_stage, s);
+        if (error == 0) {
+            s->threaded = true;
+        } else {
+            errno = error;
+            utils_error("cannot start %s: ", s->argv[0]);
+            s->main = NULL;
+            run_inproc_stage(s);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+/* Wait for the stages of a job that the shell runs.  The status of the
+ * pipeline is that of its last stage if it is one of them. */
+static void join_inproc_stages(struct job *job) {
+    for (int i = 0; i < job->num_inproc; i++) {
+        struct inproc_stage *s = &job->inproc[i];
+        if (s->threaded) {
+            pthread_join(s->thread, NULL);
+        }
+        if (s->stage == job->total_processes - 1) {
+            job->exit_status = W_EXITCODE(s->status, 0);
+        }
+    }
+    free(job->inproc);
+    job->inproc = NULL;
+    job->num_inproc = 0;
+}
+
+/* Handle the child process, once its stdio is set up */
+void handle_child_process(int fds[], int total_pipes, char *cmd_arg,
+                          char **argv, char **envp) {
+    /* The child sees the exported variables, and execvp looks for the
+     * command in their PATH */
+    if (envp != NULL) {
+        environ = envp;
+    }
+    /* A builtin of a plugin runs in the child without exec, so the
+     * pipes are not closed on exec, and the child's copy of the shell's
+     * stdio buffers is never flushed */
+    const struct builtin *b = builtin_find(cmd_arg);
+    if (b != NULL && b->plugin != NULL) {
+        static const int fd[3] = { STDIN_FILENO, STDOUT_FILENO,
+                                   STDERR_FILENO };
+        for (int i = 0; i < total_pipes * 2; i++) {
+            close(fds[i]);
+        }
+        int argc = 0;
+        while (argv[argc] != NULL) {
+            argc++;
+        }
+        _exit(b->plugin->handler(argc, argv, fd));
+    }
+    /* Execute the command by replacing the current process */
+    if (execvp(cmd_arg, argv) == -1) {
+        if (ast_input_name != NULL) {
+            print_location();
+            fprintf(stderr, "%s: ", cmd_arg);
+        }
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Check whether this is the last argument in the command */
+bool not_last_arg(int curr_cmd, int total_commands) {
+    return curr_cmd != total_commands - 1;
+}
 
-        /* Block the signal */
-        signal_block(SIGCHLD);
+/* ------------- Daemon mode ------------- */
+
+/* Output queued for one client before the daemon stops reading the
+ * pipes of its jobs, so that a slow client stalls only its own jobs */
+#define SERVE_OUT_LIMIT (256 * 1024)
+
+/* A connection to the daemon, and the command line it is running */
+struct client {
+    struct list_elem elem;
+    int fd;
+    char *in;                   /* Received bytes, not yet whole frames */
+    size_t in_len, in_size;
+    char *out;                  /* Frames not yet sent */
+    size_t out_pos, out_len, out_size;
+    bool gone;                  /* The peer closed, or a send failed */
+    bool busy;                  /* A command line is running */
+    bool capture;               /* Its output is sent back */
+    struct ast_command_line *cline;   /* Pipelines not yet started */
+    struct job *job;            /* Job to wait for before the next one */
+    int running;                /* Jobs started and not yet deleted */
+    int capture_rd[2];          /* Read ends for stdout, stderr, or -1 */
+    int capture_wr[2];          /* Write ends, closed once the last
+                                   pipeline has started */
+    struct cushd_status status;
+    struct timespec start;
+};
 
-        /* Put the commands into an array */
-        char **p = cmd->argv; /* array of pointers to words
-                            making up this command. */
-        char *cmd_arg = *p;
-        char *argv[10];
-        int argc = 0;
-        while (*p) {
-            argv[argc] = *p++;
-            argc++;
+static struct list clients;
+static int builtin_out[2] = { -1, -1 };    /* memfds for builtins */
+
+/* Queue a frame for the client */
+static void serve_queue(struct client *c, uint32_t type, const void *data,
+                        size_t len) {
+    struct cushd_frame frame = { type, len };
+    size_t need = c->out_len + sizeof frame + len;
+    if (need > c->out_size) {
+        size_t size = c->out_size ? c->out_size : 4096;
+        while (size < need) {
+            size *= 2;
+        }
+        char *out = realloc(c->out, size);
+        if (out == NULL) {
+            c->gone = true;
+            return;
         }
-        argv[argc] = NULL;
+        c->out = out;
+        c->out_size = size;
+    }
+    memcpy(c->out + c->out_len, &frame, sizeof frame);
+    memcpy(c->out + c->out_len + sizeof frame, data, len);
+    c->out_len = need;
+}
 
-        /* Fork off a child process to execute each command in a pipeline */
-        if ((pid = fork()) == 0) {
-            /* Create a new process group if it is the first command */
-            if (curr_cmd == 0) {
-                setpgid(0, 0);
-            }
-            /* Set the remaining processes in the pipe to have the same pgid */
-            else {
-                setpgid(0, j->pgid);
+/* Send what the socket takes without blocking */
+static void serve_flush(struct client *c) {
+    while (c->out_pos < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos,
+                         MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                c->gone = true;
             }
+            return;
+        }
+        c->out_pos += n;
+    }
+    c->out_pos = c->out_len = 0;
+}
 
-            /* Idetify the last command in the pipe */
-            bool not_last = not_last_arg(curr_cmd, total_commands);
+/* Queue an error and end the command line */
+static void serve_error(struct client *c, const char *msg) {
+    serve_queue(c, CUSHD_ERROR, msg, strlen(msg));
+}
 
-            /* Handle the child process after forking */
-            handle_child_process(fds, not_last, total_pipes, pipe_counter,
-                                cmd_arg, argv);
+/* Called in a child: read from /dev/null and write to the capture
+ * pipes, if any.  Redirections are applied after this. */
+static void serve_child_io(struct client *c) {
+    int null = open("/dev/null", O_RDONLY);
+    if (null != -1 && null != STDIN_FILENO) {
+        dup2(null, STDIN_FILENO);
+        close(null);
+    }
+    if (c->capture) {
+        dup2(c->capture_wr[0], STDOUT_FILENO);
+        dup2(c->capture_wr[1], STDERR_FILENO);
+    }
+}
+
+/* Add the usage of a job that has finished to its client's status */
+static void serve_job_done(struct job *job) {
+    struct client *c = job->client;
+    struct proc_usage usage;
+
+    get_job_usage(job, &usage);
+    c->status.utime_us += usage.utime_us;
+    c->status.stime_us += usage.stime_us;
+    if (usage.maxrss_kb > c->status.maxrss_kb) {
+        c->status.maxrss_kb = usage.maxrss_kb;
+    }
+    c->status.rchar += usage.rchar;
+    c->status.wchar += usage.wchar;
+    if (c->job == job) {
+        c->status.exit_status = job->exit_status;
+        c->job = NULL;
+    }
+    c->running--;
+}
+
+/* Send the contents of a builtin's memfd, and empty it */
+static void serve_builtin_output(struct client *c, int fd, uint32_t type) {
+    char buf[65536];
+    off_t len = lseek(fd, 0, SEEK_CUR);
+    for (off_t off = 0; off < len;) {
+        ssize_t n = pread(fd, buf, sizeof buf, off);
+        if (n <= 0) {
+            break;
         }
+        serve_queue(c, type, buf, n);
+        off += n;
+    }
+    ftruncate(fd, 0);
+    lseek(fd, 0, SEEK_SET);
+}
 
-        /* Parent process */
-        else {
-            /* Parent's pid and pgid will be the same as its child pgid */
-            if (curr_cmd == 0) {
-                pgid = pid;
-                j->pgid = pgid;
-            }
+/* Close the daemon's write ends of the capture pipes */
+static void serve_close_capture(struct client *c) {
+    for (int i = 0; i < 2; i++) {
+        if (c->capture_wr[i] != -1) {
+            close(c->capture_wr[i]);
+            c->capture_wr[i] = -1;
+        }
+    }
+}
 
-            setpgid(pid, pgid);
-            /* Add pid to the pid array in job */
-            j->pid[curr_cmd] = pid;
-            
-            /* Update the number of alive process and the total process */
-            j->num_processes_alive = j->num_processes_alive + 1;
-            j->total_processes = j->total_processes + 1;
+/* Start the client's pipelines up to the next one that must finish
+ * before the rest, as the interactive shell would wait for it */
+static void serve_run_pipelines(struct client *c) {
+    while (c->job == NULL && !list_empty(&c->cline->pipes)) {
+        struct ast_pipeline *pipe_line = list_entry(
+            list_pop_front(&c->cline->pipes), struct ast_pipeline, elem);
+
+        expand_pipeline(pipe_line);
+        /* Builtins write to the daemon's stdout and stderr */
+        int saved[2] = { -1, -1 };
+        if (c->capture) {
+            fflush(stdout);
+            fflush(stderr);
+            saved[0] = dup(STDOUT_FILENO);
+            saved[1] = dup(STDERR_FILENO);
+            dup2(builtin_out[0], STDOUT_FILENO);
+            dup2(builtin_out[1], STDERR_FILENO);
+        }
+        serving = c;
+        int status;
+        struct job *job = execute_pipeline(pipe_line, &status);
+        serving = NULL;
+        /* handle_pipeline unblocked SIGCHLD */
+        signal_block(SIGCHLD);
+        if (c->capture) {
+            fflush(stdout);
+            fflush(stderr);
+            dup2(saved[0], STDOUT_FILENO);
+            dup2(saved[1], STDERR_FILENO);
+            close(saved[0]);
+            close(saved[1]);
+            serve_builtin_output(c, builtin_out[0], CUSHD_STDOUT);
+            serve_builtin_output(c, builtin_out[1], CUSHD_STDERR);
+        }
 
-            /* Increment command and pipe counter */
-            curr_cmd++;
-            pipe_counter += 2;
+        if (job == NULL) {
+            /* A builtin */
+            c->status.exit_status = W_EXITCODE(status, 0);
+            ast_pipeline_free(pipe_line);
+            continue;
+        }
+        c->status.njobs++;
+        c->running++;
+        if (!pipe_line->bg_job) {
+            c->job = job;
         }
     }
+    if (list_empty(&c->cline->pipes)) {
+        serve_close_capture(c);
+    }
+}
 
-    /* Close the opened pipe */
-    for (int i = 0; i < total_pipes * 2; i++) {
-        close(fds[i]);
+/* Parse and start a command line received from the client */
+static void serve_start(struct client *c, const char *text, size_t len,
+                        uint32_t flags) {
+    char *line = strndup(text, len);
+    ast_input_quiet = true;
+    c->cline = ast_parse_command_line(line);
+    ast_input_quiet = false;
+    free(line);
+    if (c->cline == NULL) {
+        serve_error(c, "syntax error");
+        return;
+    }
+    /* Its pipelines run one after the other as their jobs finish */
+    if (!ast_command_line_is_simple(c->cline)) {
+        serve_error(c, "control flow is not supported");
+        ast_command_line_free(c->cline);
+        c->cline = NULL;
+        return;
     }
 
-    /* Reset the file to the console after I/O redirection */
-    freopen("/dev/tty", "w", stdout);
-    freopen("/dev/tty", "r", stdin);
-    dup2(STDERR_FILENO, STDERR_FILENO);
+    c->capture = flags & CUSHD_CAPTURE;
+    if (c->capture) {
+        int out[2], err[2];
+        if (pipe2(out, O_CLOEXEC) == -1) {
+            goto fail;
+        }
+        if (pipe2(err, O_CLOEXEC) == -1) {
+            close(out[0]);
+            close(out[1]);
+            goto fail;
+        }
+        c->capture_rd[0] = out[0];
+        c->capture_wr[0] = out[1];
+        c->capture_rd[1] = err[0];
+        c->capture_wr[1] = err[1];
+        fcntl(out[0], F_SETFL, O_NONBLOCK);
+        fcntl(err[0], F_SETFL, O_NONBLOCK);
+    }
+    memset(&c->status, 0, sizeof c->status);
+    clock_gettime(CLOCK_MONOTONIC, &c->start);
+    c->busy = true;
+    return;
+
+fail:
+    serve_error(c, strerror(errno));
+    ast_command_line_free(c->cline);
+    c->cline = NULL;
+}
 
-    /* Check if the program is executed in the background & */
-    if (j->pipe->bg_job) {
-        /* Set the status of the job to BG */
-        j->status = BACKGROUND;
-        /* Print the job running on the BG */
-        printf("[%d] %d\n", j->jid, pid);
+/* Send the status once the command line's jobs are gone and their
+ * output has been read */
+static void serve_finish(struct client *c) {
+    if (!c->busy || c->job != NULL || !list_empty(&c->cline->pipes)) {
+        return;
     }
-    else {
-        /* Give the terminal to the process group */
-        termstate_give_terminal_to(NULL, pgid);
-        /* Wait until the job is done */
-        wait_for_job(j);
-        /* Give the terminal back to shell */
-        termstate_give_terminal_back_to_shell();
+    serve_close_capture(c);
+    if (c->running > 0 || c->capture_rd[0] != -1 || c->capture_rd[1] != -1) {
+        return;
     }
-    /* Unblock the signal */
-    signal_unblock(SIGCHLD);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    c->status.wall_us = (now.tv_sec - c->start.tv_sec) * 1000000LL +
+                        (now.tv_nsec - c->start.tv_nsec) / 1000;
+    serve_queue(c, CUSHD_STATUS, &c->status, sizeof c->status);
+    ast_command_line_free(c->cline);
+    c->cline = NULL;
+    c->busy = false;
 }
 
-/* Handle the child process */
-void handle_child_process(int fds[], bool not_last, int total_pipes,
-                          int pipe_counter, char *cmd_arg, char **argv) {
-    /* If it is not the first command, read from stdin */
-    if (pipe_counter != 0) {
-        if (dup2(fds[pipe_counter - 2], STDIN_FILENO) == -1) {
-            perror("Error occurred at dup2()");
-            exit(EXIT_FAILURE);
+/* Read one block of a job's output */
+static void serve_read_output(struct client *c, int stream) {
+    char buf[65536];
+    ssize_t n = read(c->capture_rd[stream], buf, sizeof buf);
+    if (n > 0) {
+        serve_queue(c, stream == 0 ? CUSHD_STDOUT : CUSHD_STDERR, buf, n);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close(c->capture_rd[stream]);
+        c->capture_rd[stream] = -1;
+    }
+}
+
+/* Receive command lines from the client.  Only called while it is
+ * idle; a command line sent before the status of the previous one
+ * waits in the socket. */
+static void serve_receive(struct client *c) {
+    if (c->in_size - c->in_len < 4096) {
+        size_t size = c->in_size ? c->in_size * 2 : 8192;
+        char *in = realloc(c->in, size);
+        if (in == NULL) {
+            c->gone = true;
+            return;
         }
+        c->in = in;
+        c->in_size = size;
     }
-    /* If it is not the last command, write to stdout */
-    if (not_last) {
-        if (dup2(fds[pipe_counter + 1], STDOUT_FILENO) == -1) {
-            perror("Error occurred at dup2()");
-            exit(EXIT_FAILURE);
+    ssize_t n = recv(c->fd, c->in + c->in_len, c->in_size - c->in_len, 0);
+    if (n > 0) {
+        c->in_len += n;
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        c->gone = true;
+    }
+}
+
+/* Start the next command line received from an idle client.  Returns
+ * true if a whole frame was taken. */
+static bool serve_next_request(struct client *c) {
+    struct cushd_frame frame;
+    if (c->in_len < sizeof frame) {
+        return false;
+    }
+    memcpy(&frame, c->in, sizeof frame);
+    if (frame.type != CUSHD_RUN || frame.length < sizeof(uint32_t) ||
+        frame.length > CUSHD_MAX_FRAME) {
+        c->gone = true;
+        return false;
+    }
+    size_t total = sizeof frame + frame.length;
+    if (c->in_len < total) {
+        return false;
+    }
+
+    uint32_t flags;
+    memcpy(&flags, c->in + sizeof frame, sizeof flags);
+    serve_start(c, c->in + sizeof frame + sizeof flags,
+                frame.length - sizeof flags, flags);
+    memmove(c->in, c->in + total, c->in_len - total);
+    c->in_len -= total;
+    return true;
+}
+
+/* Forget a client; its jobs run to completion unobserved */
+static void serve_drop(struct client *c) {
+    for (struct list_elem *e = list_begin(&job_list);
+         e != list_end(&job_list); e = list_next(e)) {
+        struct job *j = list_entry(e, struct job, elem);
+        if (j->client == c) {
+            j->client = NULL;
         }
     }
-    /* Execute the command by replacing the current process */
-    if (execvp(cmd_arg, argv) == -1) {
-        perror("");
+    serve_close_capture(c);
+    for (int i = 0; i < 2; i++) {
+        if (c->capture_rd[i] != -1) {
+            close(c->capture_rd[i]);
+        }
+    }
+    if (c->cline != NULL) {
+        ast_command_line_free(c->cline);
+    }
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    list_remove(&c->elem);
+    free(c);
+}
+
+/* Delete the jobs whose processes are all gone.  Returns true if any
+ * job was deleted. */
+static bool delete_finished_jobs(void) {
+    bool deleted = false;
+    struct job *j;
+    for (struct list_elem *e = list_begin(&job_list);
+         e != list_end(&job_list);) {
+        j = list_entry(e, struct job, elem);
+        if (j->num_processes_alive == 0) {
+            /* Report on background jobs prefixed with time or
+             * profile */
+            if (j->timed) {
+                print_time_report(j);
+            }
+            if (j->profiled) {
+                print_profile_report(j);
+            }
+            if (j->client != NULL) {
+                serve_job_done(j);
+            }
+            e = list_remove(e);
+            delete_job(j);
+            deleted = true;
+        } else {
+            e = list_next(e);
+        }
+    }
+    return deleted;
+}
+
+/* Finish jobs, answer and start command lines, and start the next
+ * pipelines until nothing changes, then send what can be sent */
+static void serve_update(void) {
+    bool progress;
+    do {
+        progress = delete_finished_jobs();
+        for (struct list_elem *e = list_begin(&clients);
+             e != list_end(&clients);) {
+            struct client *c = list_entry(e, struct client, elem);
+            e = list_next(e);
+            if (c->gone) {
+                serve_drop(c);
+                continue;
+            }
+            serve_finish(c);
+            if (!c->busy && serve_next_request(c)) {
+                progress = true;
+            }
+            if (c->busy && c->job == NULL && !list_empty(&c->cline->pipes)) {
+                serve_run_pipelines(c);
+                progress = true;
+            }
+        }
+    } while (progress);
+
+    for (struct list_elem *e = list_begin(&clients); e != list_end(&clients);
+         e = list_next(e)) {
+        serve_flush(list_entry(e, struct client, elem));
+    }
+}
+
+/* Accept command lines on the UNIX socket 'path' and run them as
+ * jobs.  Each client waits only for its own jobs: the daemon never
+ * blocks in waitpid, on a pipe or on a socket.  SIGCHLD is blocked
+ * except while the daemon sleeps in ppoll, so a child that exits
+ * before the daemon sleeps interrupts the sleep. */
+static void serve(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: socket path too long\n", path);
         exit(EXIT_FAILURE);
     }
+    strcpy(addr.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0);
+    unlink(path);
+    if (listener == -1 ||
+        bind(listener, (struct sockaddr *) &addr, sizeof addr) == -1 ||
+        listen(listener, SOMAXCONN) == -1) {
+        utils_fatal_error("%s: ", path);
+    }
+    builtin_out[0] = memfd_create("cush-stdout", MFD_CLOEXEC);
+    builtin_out[1] = memfd_create("cush-stderr", MFD_CLOEXEC);
+    if (builtin_out[0] == -1 || builtin_out[1] == -1) {
+        utils_fatal_error("memfd_create: ");
+    }
+    list_init(&clients);
+
+    signal_block(SIGCHLD);
+    sigset_t sleeping;
+    sigprocmask(SIG_BLOCK, NULL, &sleeping);
+    sigdelset(&sleeping, SIGCHLD);
+
+    struct pollfd *fds = NULL;
+    struct { struct client *c; int what; } *owner = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        serve_update();
+
+        /* The listener, then per client its socket and capture pipes */
+        size_t need = 1 + 3 * list_size(&clients), n = 0;
+        if (need > capacity) {
+            capacity = need * 2;
+            fds = realloc(fds, capacity * sizeof *fds);
+            owner = realloc(owner, capacity * sizeof *owner);
+            if (fds == NULL || owner == NULL) {
+                utils_fatal_error("serve: ");
+            }
+        }
+        fds[n++] = (struct pollfd) { .fd = listener, .events = POLLIN };
+        for (struct list_elem *e = list_begin(&clients);
+             e != list_end(&clients); e = list_next(e)) {
+            struct client *c = list_entry(e, struct client, elem);
+            short events = (c->busy ? 0 : POLLIN) |
+                           (c->out_len > 0 ? POLLOUT : 0);
+            owner[n].c = c;
+            owner[n].what = -1;
+            fds[n++] = (struct pollfd) { .fd = c->fd, .events = events };
+            for (int i = 0; i < 2; i++) {
+                if (c->capture_rd[i] != -1 && c->out_len < SERVE_OUT_LIMIT) {
+                    owner[n].c = c;
+                    owner[n].what = i;
+                    fds[n++] = (struct pollfd) { .fd = c->capture_rd[i],
+                                                 .events = POLLIN };
+                }
+            }
+        }
+
+        if (ppoll(fds, n, NULL, &sleeping) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            utils_fatal_error("ppoll: ");
+        }
+
+        for (size_t i = 1; i < n; i++) {
+            struct client *c = owner[i].c;
+            if (fds[i].revents == 0 || c->gone) {
+                continue;
+            }
+            if (owner[i].what != -1) {
+                serve_read_output(c, owner[i].what);
+            } else if (fds[i].revents & (POLLERR | POLLHUP)) {
+                c->gone = true;
+            } else {
+                if (fds[i].revents & POLLOUT) {
+                    serve_flush(c);
+                }
+                if (fds[i].revents & POLLIN) {
+                    serve_receive(c);
+                }
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(listener, NULL, NULL,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                struct client *c = calloc(1, sizeof *c);
+                if (c == NULL) {
+                    close(fd);
+                    break;
+                }
+                c->fd = fd;
+                c->capture_rd[0] = c->capture_rd[1] = -1;
+                c->capture_wr[0] = c->capture_wr[1] = -1;
+                list_push_back(&clients, &c->elem);
+            }
+        }
+    }
 }
 
-/* Check whether this is the last argument in the command */
-bool not_last_arg(int curr_cmd, int total_commands) {
-    return curr_cmd != total_commands - 1;
+/* The shell's pid.  Children that fail to exec exit through the
+ * atexit handlers as well, and must not write the shell's files. */
+static pid_t shell_pid;
+
+/* Remove the shared job table of -S */
+static void remove_job_table(void) {
+    if (getpid() == shell_pid) {
+        shm_jobs_cleanup();
+    }
+}
+
+/* Remove the cgroup subtree of -g */
+static void remove_cgroups(void) {
+    if (getpid() == shell_pid) {
+        cgroup_cleanup();
+    }
+}
+
+/* The file given with -T */
+static char *trace_file;
+
+static void write_trace_file(void) {
+    if (getpid() == shell_pid && !trace_dump(trace_file)) {
+        utils_error("%s: ", trace_file);
+    }
+}
+
+/* The file given with -P, and the interval given with -I */
+static char *prometheus_file;
+static int prometheus_interval;
+
+static void write_prometheus_file(void) {
+    if (getpid() == shell_pid && !stats_write_prometheus(prometheus_file)) {
+        utils_error("%s: ", prometheus_file);
+    }
+}
+
+/* Called by the line editor while it waits for input; rewrites the -P file
+ * once the interval has passed */
+static int prometheus_event_hook(void) {
+    static time_t last_write;
+    time_t now = time(NULL);
+    if (now - last_write >= prometheus_interval) {
+        signal_block(SIGCHLD);
+        write_prometheus_file();
+        signal_unblock(SIGCHLD);
+        last_write = now;
+    }
+    return 0;
+}
+
+/* Take over the terminal and set up history and readline, once a
+ * prompt is first needed, so that runs that never prompt skip it */
+static void init_interactive(void) {
+    static bool initialized;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+    termstate_init();
+#ifndef NO_READLINE
+    using_history();
+#endif
+    if (prometheus_file != NULL && prometheus_interval > 0) {
+#ifndef NO_READLINE
+        rl_event_hook = prometheus_event_hook;
+#endif
+        lineedit_event_hook = prometheus_event_hook;
+    }
+}
+
+/* Print the prompt, or 'continuation' for a line that continues a
+ * command, and read a line with the line editor.  Returns the line after
+ * history expansion, or NULL at EOF. */
+static char *read_interactive_line(const char *continuation) {
+    init_interactive();
+    char *cmdline;
+    if (continuation != NULL) {
+        cmdline = edit_read_line(continuation);
+    } else {
+        uint64_t prompt_start = trace_clock();
+        char *prompt = build_prompt();
+        stats_record(STAT_PROMPT, trace_clock() - prompt_start);
+        cmdline = edit_read_line(prompt);
+        free(prompt);
+    }
+    char *expansion;
+    int result;
+
+    if (cmdline == NULL) { /* User typed EOF */
+        return NULL;
+    }
+    /* Expand history references such as !! */
+    result = edit_history_expand(cmdline, &expansion);
+    /* 0 if no expansion takes place, 
+     * -1 if an error happened,
+     * 2 if the returned line should only be displayed, but not executed
+     */
+    if (result < 0 || result == 2) {
+        exit(EXIT_FAILURE);
+    }
+    /* Add the command into the history */
+    edit_add_history(expansion);
+    free(cmdline);
+    return expansion;
+}
+
+/* Read the next command line of the script, skipping comments such
+ * as a "#!" line.  The line is valid until the next call. */
+static char *read_script_line(void) {
+    char *line;
+    while ((line = script_read_line(script)) != NULL && line[0] == '#') {
+        continue;
+    }
+    ast_input_line = script_line(script);
+    return line;
+}
+
+/* Append a line to the lines of a command that goes on */
+static char *append_line(char *text, const char *line) {
+    size_t len = strlen(text);
+    text = realloc(text, len + strlen(line) + 2);
+    text[len] = '\n';
+    strcpy(text + len + 1, line);
+    return text;
+}
+
+/* Get the next command line, from the compiled script file or by
+ * reading and parsing lines until a command is complete.  Returns false
+ * at EOF.  '*cline' is NULL if the line has an error. */
+static bool next_command_line(struct ast_command_line **cline) {
+    uint64_t parse_start = trace_clock();
+    if (script_cache != NULL) {
+        if (!ast_cache_next(script_cache, cline)) {
+            return false;
+        }
+    } else {
+        char *cmdline = headless ? read_script_line()
+                                 : read_interactive_line(NULL);
+        char *text = NULL;      /* The lines read so far, if several */
+        for (;;) {
+            if (cmdline == NULL) {
+                if (text != NULL) {
+                    print_location();
+                    fprintf(stderr, "Unexpected end of file.\n");
+                    free(text);
+                }
+                return false;
+            }
+            parse_start = trace_clock();
+            if (text != NULL) {
+                text = append_line(text, cmdline);
+            }
+            *cline = ast_parse_command_line(text != NULL ? text : cmdline);
+            if (!ast_input_incomplete) {
+                break;
+            }
+            /* A compound command goes on in the next line */
+            if (text == NULL) {
+                text = strdup(cmdline);
+            }
+            if (!headless) {
+                free(cmdline);
+            }
+            cmdline = headless ? read_script_line()
+                               : read_interactive_line("> ");
+        }
+        /* Free the expanded command line */
+        if (!headless) {
+            free(cmdline);
+        }
+        free(text);
+    }
+    stats_record(STAT_PARSE, trace_clock() - parse_start);
+    trace_end("parse", parse_start, -1, -1);
+    return true;
 }
 
 /* The main function */
 int main(int ac, char *av[]) {
     int opt;
+    const char *daemon_socket = NULL;
+    const char *commands = NULL;
 
+    shell_pid = getpid();
+    register_builtins();
     /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0) {
+    while ((opt = getopt(ac, av, "hbc:ej:g:T:P:I:SA:D:p:")) > 0) {
         switch (opt) {
             case 'h':
                 usage(av[0]);
                 break;
+            case 'b':
+                headless = true;
+                break;
+            case 'c':
+                commands = optarg;
+                headless = true;
+                break;
+            case 'e':
+                use_lineedit = true;
+                break;
+            case 'j':
+                jobserver_init(atoi(optarg));
+                break;
+            case 'g':
+                cgroup_init(optarg);
+                atexit(remove_cgroups);
+                break;
+            case 'T':
+                trace_file = optarg;
+                trace_start(TRACE_EVENTS);
+                atexit(write_trace_file);
+                break;
+            case 'P':
+                prometheus_file = optarg;
+                atexit(write_prometheus_file);
+                break;
+            case 'I':
+                prometheus_interval = atoi(optarg);
+                break;
+            case 'S':
+                if (shm_jobs_init()) {
+                    atexit(remove_job_table);
+                }
+                break;
+            case 'A':
+                if (!jacct_open(optarg)) {
+                    utils_error("-A %s: ", optarg);
+                }
+                break;
+            case 'D':
+                daemon_socket = optarg;
+                headless = true;
+                break;
+            case 'p':
+                if (!builtin_load_plugins(optarg)) {
+                    utils_error("-p %s: ", optarg);
+                }
+                break;
         }
     }
 
     list_init(&job_list);
     signal_set_handler(SIGCHLD, sigchld_handler);
-    termstate_init();
-    using_history();
+    /* Without a terminal, run commands as a script would */
+    if (optind < ac || !isatty(STDIN_FILENO)) {
+        headless = true;
+    }
+    /* $0 is the script, or the first argument after -c, and $1 ... the
+     * arguments after it */
+    frame_argv = optind < ac ? av + optind : av;
+    frame_argc = optind < ac ? ac - optind - 1 : 0;
+    ast_mark_variables = true;
+    vars_init(environ);
+    if (commands != NULL) {
+        script = script_open_string("-c", commands);
+        if (script == NULL) {
+            utils_fatal_error("-c: ");
+        }
+        ast_input_name = script_name(script);
+    } else if (optind < ac) {
+        script_cache = ast_cache_open(av[optind]);
+        if (script_cache == NULL) {
+            utils_fatal_error("%s: ", av[optind]);
+        }
+        ast_input_name = av[optind];
+    } else if (headless && daemon_socket == NULL) {
+        script = script_open(NULL);
+        if (script == NULL) {
+            utils_fatal_error("stdin: ");
+        }
+        ast_input_name = script_name(script);
+    }
+    if (headless) {
+        /* Keep the shell's output in order with that of its jobs */
+        setvbuf(stdout, NULL, _IOLBF, 0);
+    }
+    /* Take command lines from clients instead; does not return */
+    if (daemon_socket != NULL) {
+        serve(daemon_socket);
+    }
 
     /* Read/eval loop. */
     for (;;) {
         /* Clean up the job list when the process is finished */
-        struct job *j;
-        for (struct list_elem *e = list_begin(&job_list);
-             e != list_end(&job_list);) {
-            j = list_entry(e, struct job, elem);
-            if (j->num_processes_alive == 0) {
-                e = list_remove(e);
-                delete_job(j);
-            } else {
-                e = list_next(e);
-            }
+        delete_finished_jobs();
+        /* The -P file is rewritten between commands without readline */
+        if (headless && prometheus_file != NULL && prometheus_interval > 0) {
+            prometheus_event_hook();
         }
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char *prompt = isatty(0) ? build_prompt() : NULL;
-        char *cmdline = readline(prompt);
-        char *expansion;
-        int result;
-        free(prompt);
-
-        if (cmdline == NULL) { /* User typed EOF */
+        struct ast_command_line *cline;
+        if (!next_command_line(&cline)) { /* User typed EOF */
             break;
         } else {
-            /* Expand the command using GNU history library */
-            result = history_expand(cmdline, &expansion);
-            /* 0 if no expansion takes place, 
-             * -1 if an error happened,
-             * 2 if the returned line should only be displayed, but not executed
-             */
-            if (result < 0 || result == 2) {
-                exit(EXIT_FAILURE);
-            }
-            /* Add the command into the history */
-            add_history(expansion);
-            struct ast_command_line *cline = ast_parse_command_line(expansion);
-
-            /* Free the cmdline and expansion */
-            free(cmdline);
-            free(expansion);
-
             if (cline == NULL) /* Error in command line */
                 continue;
 
@@ -731,23 +3685,17 @@ int main(int ac, char *av[]) {
                 continue;
             } else {
                 /* Execute the command */
+                uint64_t execute_start = trace_begin();
                 execute(cline);
+                trace_end("execute", execute_start, -1, -1);
             } 
         }
 
-        
-
         /* Output a representation of the entered command line (Useful when debugging) */
         // ast_command_line_print(cline); 
-        // /* Free the command line.
-        //  * This will free the ast_pipeline objects still contained
-        //  * in the ast_command_line.  Once you implement a job list
-        //  * that may take ownership of ast_pipeline objects that are
-        //  * associated with jobs you will need to reconsider how you
-        //  * manage the lifetime of the associated ast_pipelines.
-        //  * Otherwise, freeing here will cause use-after-free errors.
-        //  */
-        // ast_command_line_free(cline);
+        /* Free the command line.  The pipelines that ran were taken out
+         * of it, and are owned by their jobs. */
+        ast_command_line_free(cline);
     }
     return 0;
 }
\ No newline at end of file
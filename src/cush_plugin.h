@@ -0,0 +1,65 @@
+#ifndef __CUSH_PLUGIN_H
+#define __CUSH_PLUGIN_H
+
+/*
+ * cush_plugin.h - the interface between cush and its plugins.
+ *
+ * A plugin is a shared object in the directory given with "cush -p dir".
+ * The shell loads every *.so file there at startup and calls its
+ * cush_plugin_init, which registers builtins with the host.  A builtin
+ * is then run like the utilities the shell runs itself: called on the
+ * shell's thread when it makes up a whole pipeline, on a thread of its
+ * own as a stage of a longer pipeline, and in a forked child, without
+ * exec, where the shell would not run it itself (in the background, for
+ * example).  Its redirections and pipes are set up for it either way.
+ *
+ * Build a plugin with "cc -shared -fPIC -o name.so name.c".
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The version of this interface.  It changes when the host or the
+ * builtins change incompatibly. */
+#define CUSH_PLUGIN_ABI_VERSION 1
+
+/* Flags of a builtin */
+#define CUSH_BUILTIN_READS_INPUT 1  /* It may read standard input, so
+                                       the shell runs it on a thread only
+                                       if that is a regular file, and
+                                       forks otherwise */
+#define CUSH_BUILTIN_NO_THREADS  2  /* It is not thread-safe, so it runs
+                                       on the shell's thread or in a
+                                       forked child only */
+
+/* Run the builtin on the NULL-terminated 'argv'.  fd[0], fd[1] and
+ * fd[2] are its standard input, output and error, which it must not
+ * close; it should use them instead of stdio, which belongs to the
+ * shell.  Returns the exit status. */
+typedef int cush_builtin_fn(int argc, char *argv[], const int fd[3]);
+
+struct cush_builtin {
+    const char *name;
+    cush_builtin_fn *handler;
+    unsigned flags;             /* CUSH_BUILTIN_* */
+};
+
+/* What the shell offers a plugin */
+struct cush_plugin_host {
+    int abi_version;            /* CUSH_PLUGIN_ABI_VERSION of the shell */
+    /* Register a builtin, which must stay valid while the plugin is
+     * loaded.  Returns 0, or -1 if its name is already a builtin. */
+    int (*register_builtin)(const struct cush_builtin *builtin);
+};
+
+/* Defined by the plugin.  Returns 0, or -1 to have the plugin unloaded
+ * again, for example if 'host->abi_version' is not the version it was
+ * built for. */
+int cush_plugin_init(const struct cush_plugin_host *host);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CUSH_PLUGIN_H */
@@ -0,0 +1,161 @@
+/*
+ * cushc - run a command line in a cush daemon started with -D.
+ *
+ * Sends the command line over the daemon's UNIX socket, copies the
+ * output of its jobs to stdout and stderr, and exits with the status of
+ * the last job, as a shell would.
+ *
+ * Usage: cushc -s socket [-n] [-r] command line...
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cushd.h"
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s -s socket [-n] [-r] command line...\n"
+            " -s socket     the socket of the daemon\n"
+            " -n            leave the output to the daemon's stdout\n"
+            " -r            print the resource usage to stderr\n",
+            progname);
+    exit(2);
+}
+
+/* Write all of 'len' bytes */
+static bool
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Read exactly 'len' bytes */
+static bool
+read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+int
+main(int ac, char *av[])
+{
+    const char *path = NULL;
+    uint32_t flags = CUSHD_CAPTURE;
+    bool report = false;
+    int opt;
+
+    while ((opt = getopt(ac, av, "+s:nr")) > 0) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'n':
+            flags &= ~CUSHD_CAPTURE;
+            break;
+        case 'r':
+            report = true;
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+    if (path == NULL || optind == ac)
+        usage(av[0]);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        perror(path);
+        return 2;
+    }
+
+    /* The words of the command line, separated by spaces */
+    size_t len = 0;
+    for (int i = optind; i < ac; i++)
+        len += strlen(av[i]) + 1;
+    char *frame = malloc(sizeof(struct cushd_frame) + sizeof flags + len);
+    struct cushd_frame *header = (struct cushd_frame *) frame;
+    header->type = CUSHD_RUN;
+    header->length = sizeof flags + len - 1;
+    memcpy(frame + sizeof *header, &flags, sizeof flags);
+    char *p = frame + sizeof *header + sizeof flags;
+    for (int i = optind; i < ac; i++)
+        p += sprintf(p, i == optind ? "%s" : " %s", av[i]);
+    if (!write_all(fd, frame, sizeof *header + header->length)) {
+        perror(path);
+        return 2;
+    }
+    free(frame);
+
+    char *payload = NULL;
+    for (;;) {
+        struct cushd_frame reply;
+        if (!read_all(fd, &reply, sizeof reply) ||
+            reply.length > CUSHD_MAX_FRAME ||
+            (payload = realloc(payload, reply.length + 1)) == NULL ||
+            !read_all(fd, payload, reply.length)) {
+            fprintf(stderr, "%s: connection lost\n", path);
+            return 2;
+        }
+
+        switch (reply.type) {
+        case CUSHD_STDOUT:
+            write_all(STDOUT_FILENO, payload, reply.length);
+            break;
+        case CUSHD_STDERR:
+            write_all(STDERR_FILENO, payload, reply.length);
+            break;
+        case CUSHD_ERROR:
+            payload[reply.length] = '\0';
+            fprintf(stderr, "%s\n", payload);
+            return 2;
+        case CUSHD_STATUS: {
+            struct cushd_status s;
+            if (reply.length != sizeof s) {
+                fprintf(stderr, "%s: bad status\n", path);
+                return 2;
+            }
+            memcpy(&s, payload, sizeof s);
+            if (report)
+                fprintf(stderr, "jobs %d real %.3fs user %.3fs sys %.3fs "
+                        "maxrss %lldK read %llu written %llu\n", s.njobs,
+                        s.wall_us / 1e6, s.utime_us / 1e6, s.stime_us / 1e6,
+                        (long long) s.maxrss_kb,
+                        (unsigned long long) s.rchar,
+                        (unsigned long long) s.wchar);
+            if (WIFSIGNALED(s.exit_status))
+                return 128 + WTERMSIG(s.exit_status);
+            return WEXITSTATUS(s.exit_status);
+        }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef __CUSHD_H
+#define __CUSHD_H
+
+/*
+ * Protocol between a shell started with -D and its clients, such as
+ * cushc, over a UNIX stream socket.
+ *
+ * Every message is a frame: a struct cushd_frame followed by 'length'
+ * bytes of payload.  A client sends one CUSHD_RUN frame at a time.  The
+ * shell answers with any number of CUSHD_STDOUT and CUSHD_STDERR frames
+ * carrying the captured output, then either a CUSHD_STATUS frame once
+ * every job of the command line has been reaped and its output sent,
+ * or a CUSHD_ERROR frame if the command line was not run.  The client
+ * may then send its next command line on the same connection.
+ * Numbers are in host byte order.
+ */
+#include <stdint.h>
+
+#define CUSHD_MAX_FRAME (1 << 20)       /* Longest payload accepted */
+
+enum cushd_frame_type {
+    CUSHD_RUN = 1,      /* uint32_t flags, then the command line */
+    CUSHD_STDOUT,       /* Output of the jobs */
+    CUSHD_STDERR,       /* Error output of the jobs */
+    CUSHD_STATUS,       /* struct cushd_status */
+    CUSHD_ERROR,        /* A message saying why nothing was run */
+};
+
+struct cushd_frame {
+    uint32_t type;      /* enum cushd_frame_type */
+    uint32_t length;    /* Bytes of payload after the frame */
+};
+
+/* Flags of CUSHD_RUN */
+#define CUSHD_CAPTURE 1 /* Send the jobs' output back instead of writing
+                           it to the shell's stdout and stderr */
+
+/* Result of a command line */
+struct cushd_status {
+    int32_t exit_status;        /* Wait status of the last job waited for,
+                                   or of a builtin after it */
+    int32_t njobs;              /* Number of jobs started */
+    int64_t wall_us;            /* From receipt to the last job reaped */
+    int64_t utime_us;           /* User CPU time of all jobs */
+    int64_t stime_us;           /* System CPU time of all jobs */
+    int64_t maxrss_kb;          /* Largest maximum RSS of any process */
+    uint64_t rchar;             /* Bytes read by all processes */
+    uint64_t wchar;             /* Bytes written by all processes */
+};
+
+#endif /* __CUSHD_H */
@@ -0,0 +1,119 @@
+/*
+ * cushjobs - list the jobs of running cush shells started with -S.
+ *
+ * Reads the job tables the shells publish in /dev/shm/cush-<pid>
+ * without any interaction with the shells.
+ *
+ * Usage: cushjobs [pid...]
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm_jobs.h"
+
+static const char *status_names[] = {
+    [SHM_JOB_FOREGROUND] = "Foreground",
+    [SHM_JOB_BACKGROUND] = "Running",
+    [SHM_JOB_STOPPED] = "Stopped",
+    [SHM_JOB_NEEDSTERMINAL] = "Stopped (tty)",
+};
+
+/* Copy a consistent snapshot of 'slot' into 'copy'.
+ * Returns false if the shell kept changing it. */
+static bool
+read_slot(const struct shm_job *slot, struct shm_job *copy)
+{
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(copy, (const void *) slot, sizeof *copy);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            return true;
+    }
+    return false;
+}
+
+/* Print the jobs of the shell with the given pid */
+static bool
+list_jobs(int pid)
+{
+    char name[32];
+    snprintf(name, sizeof name, "/cush-%d", pid);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        perror(name);
+        return false;
+    }
+    const struct shm_jobs_table *table = mmap(NULL, sizeof *table, PROT_READ,
+                                              MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        perror(name);
+        return false;
+    }
+    if (__atomic_load_n(&table->magic, __ATOMIC_ACQUIRE) != SHM_JOBS_MAGIC
+        || table->version != SHM_JOBS_VERSION) {
+        fprintf(stderr, "%s: not a cush job table\n", name);
+        munmap((void *) table, sizeof *table);
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (int i = 0; i < SHM_JOBS_SLOTS; i++) {
+        struct shm_job job;
+        if (!read_slot(&table->slots[i], &job) || job.jid == 0)
+            continue;
+
+        double age = (now.tv_sec - job.start_sec)
+                     + (now.tv_nsec - job.start_nsec) / 1e9;
+        printf("%-7d %-4d %-7d %-14s %7.1f ", pid, job.jid, job.pgid,
+               job.status >= 0 && job.status <= SHM_JOB_NEEDSTERMINAL ?
+               status_names[job.status] : "?", age);
+        for (int p = 0; p < job.nprocs && p < SHM_JOBS_PIDS; p++)
+            printf(p == 0 ? "%d" : ",%d", job.pids[p]);
+        job.cmdline[SHM_JOBS_CMDLINE - 1] = '\0';
+        printf(" (%d alive)\t%s\n", job.nalive, job.cmdline);
+    }
+
+    munmap((void *) table, sizeof *table);
+    return true;
+}
+
+int
+main(int ac, char *av[])
+{
+    bool ok = true;
+
+    printf("%-7s %-4s %-7s %-14s %7s %s\n", "SHELL", "JID", "PGID",
+           "STATUS", "AGE", "PIDS\tCOMMAND");
+    if (ac > 1) {
+        for (int i = 1; i < ac; i++)
+            ok &= list_jobs(atoi(av[i]));
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL) {
+        perror("/dev/shm");
+        return EXIT_FAILURE;
+    }
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        int pid;
+        if (sscanf(d->d_name, "cush-%d", &pid) == 1)
+            ok &= list_jobs(pid);
+    }
+    closedir(dir);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,3 +1,27 @@
 = Tests for Custom Features
 10 custom_prompt_test.py
 10 history_test.py
+10 jobserver_test.py
+10 time_test.py
+10 cgroup_test.py
+10 placement_test.py
+10 bgidle_test.py
+10 rusage_test.py
+10 bench_test.py
+10 profile_test.py
+10 trace_test.py
+10 stats_test.py
+10 shm_jobs_test.py
+10 jtop_test.py
+10 jacct_test.py
+10 predict_test.py
+10 headless_test.py
+10 script_test.py
+10 ast_cache_test.py
+10 daemon_test.py
+10 libcush_test.py
+10 lineedit_test.py
+10 inproc_test.py
+10 plugin_test.py
+10 control_test.py
+10 vars_test.py
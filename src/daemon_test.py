@@ -0,0 +1,67 @@
+#!/usr/bin/python
+#
+# Tests daemon mode: a shell started with -D runs command lines sent by
+# cushc over a UNIX socket, sends back their output and exit status,
+# and runs the command lines of several clients at the same time
+
+import atexit, proc_check, time, os, subprocess, tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+sock = os.path.join(tmpdir, "cush.sock")
+daemon = subprocess.Popen(["./cush", "-D", sock], stdin=open(os.devnull),
+                          stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+atexit.register(daemon.kill)
+for i in range(100):
+    if os.path.exists(sock):
+        break
+    time.sleep(0.05)
+
+def cushc(*args):
+    """Start cushc with the given arguments"""
+    return subprocess.Popen(["./cushc", "-s", sock] + list(args),
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+
+def run(*args):
+    """Run cushc, return its exit code, output and error output"""
+    client = cushc(*args)
+    out, err = client.communicate()
+    return client.returncode, out, err
+
+# output of pipelines and builtins is captured
+assert run("echo hello | tr a-z A-Z") == (0, "HELLO\n", ""), "pipeline"
+rc, out, err = run("ls", os.path.join(tmpdir, "nosuchfile"))
+assert rc != 0 and out == "" and "nosuchfile" in err, "error output"
+assert run('sh -c "exit 3"') == (3, "", ""), "exit status"
+rc, out, err = run("-r", "echo a ; echo b")
+assert rc == 0 and out == "a\nb\n", "command line with two pipelines"
+assert re.match("jobs 2 real [\d.]+s user [\d.]+s sys [\d.]+s maxrss \d+K",
+                err), "resource usage: " + err
+rc, out, err = run("echo a | | echo b")
+assert rc == 2 and err == "syntax error\n", "syntax error"
+
+# a long command line does not hold up the others
+slow = cushc("sleep 1")
+time.sleep(0.2)
+start = time.time()
+rc, out, err = run("jobs")
+assert re.search("Running\s+\(sleep 1\)", out), "jobs output: " + out
+assert run("echo quick") == (0, "quick\n", ""), "second client"
+assert time.time() - start < 0.5, "a client waited for another"
+assert slow.wait() == 0, "slow client failed"
+
+# builtins that wait are not run, as they would hold up every client
+start = time.time()
+rc, out, err = run("bench -n 3 -- sleep 1")
+assert out == "bench: not available in the daemon\n", "bench output: " + out
+assert time.time() - start < 0.5, "bench waited"
+rc, out, err = run("jtop -n 2 -d 1")
+assert "only one frame" in out, "jtop output: " + out
+rc, out, err = run("jtop")
+assert rc == 0 and out.startswith("jtop - "), "jtop output: " + out
+
+# large output is passed through
+rc, out, err = run("seq 1 200000")
+assert rc == 0 and len(out.splitlines()) == 200000, "large output"
+
+test_success()
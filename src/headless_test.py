@@ -0,0 +1,58 @@
+#!/usr/bin/python
+#
+# Tests headless mode: without a controlling terminal the shell reads
+# commands from stdin without a prompt or readline, and -b selects the
+# same mode on a terminal
+
+import atexit, proc_check, time, os, subprocess, tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+def tmpfile(name):
+    return os.path.join(tmpdir, name)
+
+with open(tmpfile("input"), "w") as f:
+    f.write("a\nb\nc\n")
+
+script = "\n".join([
+    "echo one",
+    "echo two | tr a-z A-Z",
+    "sleep 0.2 &",
+    "jobs",
+    "wc -l < %s > %s" % (tmpfile("input"), tmpfile("count")),
+    "cat %s" % tmpfile("count"),
+    "ls %s >& %s" % (tmpfile("nosuchfile"), tmpfile("errors")),
+    "wc -l < %s" % tmpfile("errors"),
+    ""])
+
+def run_headless(stdin, data=None):
+    """Run the shell in a new session, which has no controlling terminal"""
+    shell = subprocess.Popen(["./cush"], stdin=stdin, stdout=subprocess.PIPE,
+                             stderr=subprocess.PIPE, preexec_fn=os.setsid)
+    out, err = shell.communicate(data)
+    assert shell.returncode == 0, "Shell failed: " + err
+    assert err == "", "Unexpected error output: " + err
+    return out
+
+expected = "one\nTWO\n\[1\] \d+\n\[1\]\tRunning\t\t\(sleep 0.2\)\n3\n1\n"
+
+# a script read from a pipe
+out = run_headless(subprocess.PIPE, script)
+assert re.match(expected, out), "Unexpected output: " + out
+
+# a script read from a file; commands continue reading where the shell
+# stopped
+with open(tmpfile("script"), "w") as f:
+    f.write(script + "cat\nread by cat\n")
+with open(tmpfile("script")) as f:
+    out = run_headless(f)
+assert re.match(expected + "read by cat\n$", out), "Unexpected output: " + out
+
+# -b runs headless on a terminal as well: no prompt
+console = setup_tests([" -b"])
+sendline("echo headless")
+expect_exact("echo headless\r\nheadless\r\n")
+sendline("exit")
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,912 @@
+/*
+ * In-process versions of echo, true, false, printf, test, [ and cat.
+ *
+ * Output is collected in a buffer on the stack and written to the
+ * descriptor when it is full and at the end, so a utility makes one
+ * write for short output, as the programs do with stdio.  Errors are
+ * written unbuffered to the error descriptor.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "inproc.h"
+
+/* Buffered output to a file descriptor */
+struct output {
+    int fd;
+    int error;          /* errno of a failed write; later output is
+                           dropped */
+    size_t len;
+    char buf[4096];
+};
+
+/* Write all of 's'.  Returns 0, or an errno value. */
+static int
+write_all(int fd, const char *s, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(fd, s, n);
+        if (w == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        s += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static void
+output_flush(struct output *out)
+{
+    if (out->error == 0 && out->len > 0)
+        out->error = write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+}
+
+static void
+output_add(struct output *out, const char *s, size_t n)
+{
+    if (out->len + n > sizeof out->buf)
+        output_flush(out);
+    if (n >= sizeof out->buf) {
+        if (out->error == 0)
+            out->error = write_all(out->fd, s, n);
+        return;
+    }
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+}
+
+static void
+output_char(struct output *out, char c)
+{
+    if (out->len == sizeof out->buf)
+        output_flush(out);
+    out->buf[out->len++] = c;
+}
+
+/* Append a printf conversion of one argument */
+static void
+output_format(struct output *out, const char *format, ...)
+{
+    char small[256];
+    va_list ap;
+
+    va_start(ap, format);
+    int n = vsnprintf(small, sizeof small, format, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if ((size_t) n < sizeof small) {
+        output_add(out, small, n);
+        return;
+    }
+    char *big = malloc(n + 1);
+    if (big == NULL)
+        return;
+    va_start(ap, format);
+    vsnprintf(big, n + 1, format, ap);
+    va_end(ap);
+    output_add(out, big, n);
+    free(big);
+}
+
+/* Flush the output and return 'status', or 1 if writing failed.  A
+ * closed pipe is not an error worth reporting, as for a program
+ * killed by SIGPIPE. */
+static int
+output_finish(struct output *out, const char *name, int err, int status)
+{
+    output_flush(out);
+    if (out->error == 0)
+        return status;
+    if (out->error != EPIPE)
+        dprintf(err, "%s: write error: %s\n", name, strerror(out->error));
+    return 1;
+}
+
+static int
+octal_digit(char c)
+{
+    return c >= '0' && c <= '7' ? c - '0' : -1;
+}
+
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Append the character of the backslash escape 's', which points past
+ * the backslash.  Octal escapes are \nnn, and also \0nnn if
+ * 'octal_zero', as for echo and %b.  Returns the
+ * length of the escape after the backslash, or -1 for \c, which ends
+ * all output. */
+static int
+output_escape(struct output *out, const char *s, bool octal_zero)
+{
+    static const char letters[] = "\\\\a\ab\be\033f\fn\nr\rt\tv\v";
+    int n = 0, value = 0;
+
+    if (*s == 'c')
+        return -1;
+    if (*s == 'x' && hex_digit(s[1]) != -1) {
+        for (n = 1; n <= 2 && hex_digit(s[n]) != -1; n++)
+            value = value * 16 + hex_digit(s[n]);
+        output_char(out, value);
+        return n;
+    }
+    if (octal_digit(*s) != -1) {
+        int start = octal_zero && *s == '0' ? 1 : 0;
+        for (n = start; n < start + 3 && octal_digit(s[n]) != -1; n++)
+            value = value * 8 + octal_digit(s[n]);
+        output_char(out, value);
+        return n;
+    }
+    for (const char *l = letters; *l != '\0'; l += 2) {
+        if (*s == l[0]) {
+            output_char(out, l[1]);
+            return 1;
+        }
+    }
+    /* Unknown escapes, and a backslash at the end, are kept as is */
+    output_char(out, '\\');
+    if (*s == '\0')
+        return 0;
+    output_char(out, *s);
+    return 1;
+}
+
+/* Append 's' with its backslash escapes replaced.  Returns false if
+ * the output was ended by \c. */
+static bool
+output_escaped(struct output *out, const char *s, bool octal_zero)
+{
+    for (; *s != '\0'; s++) {
+        if (*s != '\\') {
+            output_char(out, *s);
+            continue;
+        }
+        int n = output_escape(out, s + 1, octal_zero);
+        if (n == -1)
+            return false;
+        s += n;
+    }
+    return true;
+}
+
+static int
+true_main(int argc, char **argv, const int fd[3])
+{
+    return 0;
+}
+
+static int
+false_main(int argc, char **argv, const int fd[3])
+{
+    return 1;
+}
+
+/* echo [-neE] [string ...] */
+static int
+echo_main(int argc, char **argv, const int fd[3])
+{
+    struct output out = { .fd = fd[1] };
+    bool newline = true, escapes = false;
+
+    /* Only words made of the option letters are options */
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (argv[i][strspn(argv[i] + 1, "neE") + 1] != '\0')
+            break;
+        for (char *p = argv[i] + 1; *p != '\0'; p++) {
+            if (*p == 'n')
+                newline = false;
+            else
+                escapes = *p == 'e';
+        }
+    }
+
+    for (int first = i; i < argc; i++) {
+        if (i > first)
+            output_char(&out, ' ');
+        if (!escapes)
+            output_add(&out, argv[i], strlen(argv[i]));
+        else if (!output_escaped(&out, argv[i], true))
+            return output_finish(&out, "echo", fd[2], 0);
+    }
+    if (newline)
+        output_char(&out, '\n');
+    return output_finish(&out, "echo", fd[2], 0);
+}
+
+/* The arguments of printf not yet converted */
+struct printf_args {
+    char **argv;
+    int argc;
+    int next;
+    int err;
+    int status;
+};
+
+static const char *
+next_arg(struct printf_args *a)
+{
+    return a->next < a->argc ? a->argv[a->next++] : NULL;
+}
+
+/* Check the conversion of a numeric argument, as strtoimax left it */
+static void
+check_number(struct printf_args *a, const char *arg, const char *end)
+{
+    if (end == arg) {
+        dprintf(a->err, "printf: '%s': expected a numeric value\n", arg);
+        a->status = 1;
+    } else if (*end != '\0') {
+        dprintf(a->err, "printf: '%s': value not completely converted\n", arg);
+        a->status = 1;
+    } else if (errno == ERANGE) {
+        dprintf(a->err, "printf: '%s': %s\n", arg, strerror(ERANGE));
+        a->status = 1;
+    }
+}
+
+/* A numeric argument.  A leading quote gives the value of the
+ * character that follows it. */
+static intmax_t
+int_arg(struct printf_args *a, bool is_unsigned)
+{
+    const char *arg = next_arg(a);
+    char *end;
+
+    if (arg == NULL)
+        return 0;
+    if (arg[0] == '"' || arg[0] == '\'')
+        return (unsigned char) arg[1];
+    errno = 0;
+    intmax_t value;
+    if (is_unsigned && arg[strspn(arg, " \t\n")] != '-')
+        value = (intmax_t) strtoumax(arg, &end, 0);
+    else
+        value = strtoimax(arg, &end, 0);
+    check_number(a, arg, end);
+    return value;
+}
+
+static long double
+float_arg(struct printf_args *a)
+{
+    const char *arg = next_arg(a);
+    char *end;
+
+    if (arg == NULL)
+        return 0;
+    if (arg[0] == '"' || arg[0] == '\'')
+        return (unsigned char) arg[1];
+    errno = 0;
+    long double value = strtold(arg, &end);
+    check_number(a, arg, end);
+    return value;
+}
+
+/* Convert the arguments with 'format' once.  Returns false if the
+ * output was ended by \c or an invalid conversion. */
+static bool
+printf_once(struct output *out, const char *format, struct printf_args *a)
+{
+    for (const char *f = format; *f != '\0'; f++) {
+        if (*f == '\\') {
+            int n = output_escape(out, f + 1, false);
+            if (n == -1)
+                return false;
+            f += n;
+            continue;
+        }
+        if (*f != '%') {
+            output_char(out, *f);
+            continue;
+        }
+        if (f[1] == '%') {
+            output_char(out, '%');
+            f++;
+            continue;
+        }
+
+        /* Copy the flags, width and precision into 'spec', with the
+         * values of the arguments of '*' */
+        char spec[64];
+        size_t len = 0;
+        const char *start = f++;
+        spec[len++] = '%';
+        while (*f != '\0' && strchr("-+ #0'", *f) != NULL && len < 16)
+            spec[len++] = *f++;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*f != '.')
+                    break;
+                spec[len++] = *f++;
+            }
+            if (*f == '*') {
+                len += snprintf(spec + len, 24, "%d",
+                                (int) int_arg(a, false));
+                f++;
+            } else {
+                while (*f >= '0' && *f <= '9' && len < sizeof spec - 8)
+                    spec[len++] = *f++;
+            }
+        }
+        /* Length modifiers are accepted and ignored */
+        while (*f != '\0' && strchr("hlLqjzt", *f) != NULL)
+            f++;
+
+        const char *arg;
+        switch (*f) {
+        case 'd':
+        case 'i':
+            spec[len] = 'j';
+            spec[len + 1] = *f;
+            spec[len + 2] = '\0';
+            output_format(out, spec, int_arg(a, false));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[len] = 'j';
+            spec[len + 1] = *f;
+            spec[len + 2] = '\0';
+            output_format(out, spec, (uintmax_t) int_arg(a, true));
+            break;
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+            spec[len] = 'L';
+            spec[len + 1] = *f;
+            spec[len + 2] = '\0';
+            output_format(out, spec, float_arg(a));
+            break;
+        case 'c':
+            arg = next_arg(a);
+            spec[len] = 'c';
+            spec[len + 1] = '\0';
+            output_format(out, spec, arg == NULL ? '\0' : arg[0]);
+            break;
+        case 's':
+            arg = next_arg(a);
+            spec[len] = 's';
+            spec[len + 1] = '\0';
+            output_format(out, spec, arg == NULL ? "" : arg);
+            break;
+        case 'b':
+            arg = next_arg(a);
+            if (arg != NULL && !output_escaped(out, arg, true))
+                return false;
+            break;
+        default:
+            dprintf(a->err, "printf: %.*s: invalid conversion specification\n",
+                    (int) (f - start + (*f != '\0')), start);
+            a->status = 1;
+            return false;
+        }
+    }
+    return true;
+}
+
+/* printf format [argument ...] */
+static int
+printf_main(int argc, char **argv, const int fd[3])
+{
+    struct output out = { .fd = fd[1] };
+    int i = 1;
+
+    if (i < argc && strcmp(argv[i], "--") == 0)
+        i++;
+    if (i >= argc) {
+        dprintf(fd[2], "printf: missing operand\n"
+                "Try 'printf --help' for more information.\n");
+        return 1;
+    }
+
+    /* The format is reused as long as it converts more arguments */
+    struct printf_args a = { argv, argc, i + 1, fd[2], 0 };
+    int before;
+    do {
+        before = a.next;
+        if (!printf_once(&out, argv[i], &a))
+            break;
+    } while (a.next < argc && a.next > before);
+    return output_finish(&out, "printf", fd[2], a.status);
+}
+
+/* The state of test while it parses its expression */
+struct test {
+    const char *name;   /* "test" or "[" */
+    char **argv;
+    int argc;
+    int pos;
+    const int *fd;
+    bool failed;        /* A syntax error was reported */
+};
+
+static bool test_or(struct test *t);
+static int test_eval(const char *name, char **argv, int argc,
+                     const int fd[3]);
+
+/* Report the first syntax error of the expression */
+static void
+test_error(struct test *t, const char *format, ...)
+{
+    va_list ap;
+
+    if (t->failed)
+        return;
+    t->failed = true;
+    dprintf(t->fd[2], "%s: ", t->name);
+    va_start(ap, format);
+    vdprintf(t->fd[2], format, ap);
+    va_end(ap);
+    dprintf(t->fd[2], "\n");
+}
+
+static bool
+is_unary_op(const char *s)
+{
+    return s[0] == '-' && s[1] != '\0' && s[2] == '\0' &&
+           strchr("bcdefgGhkLnOprsStuwxz", s[1]) != NULL;
+}
+
+static const char *const binary_ops[] = {
+    "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef", NULL
+};
+
+static bool
+is_binary_op(const char *s)
+{
+    for (int i = 0; binary_ops[i] != NULL; i++) {
+        if (strcmp(s, binary_ops[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool
+test_unary(struct test *t, char op, const char *arg)
+{
+    struct stat st;
+    int n;
+
+    switch (op) {
+    case 'n':
+        return arg[0] != '\0';
+    case 'z':
+        return arg[0] == '\0';
+    case 't':
+        /* Descriptors 0 to 2 are those of the utility */
+        n = atoi(arg);
+        return isatty(n >= 0 && n <= 2 ? t->fd[n] : n);
+    case 'r':
+        return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+    case 'w':
+        return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+    case 'x':
+        return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+    case 'h':
+    case 'L':
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) == -1)
+        return false;
+    switch (op) {
+    case 'b':
+        return S_ISBLK(st.st_mode);
+    case 'c':
+        return S_ISCHR(st.st_mode);
+    case 'd':
+        return S_ISDIR(st.st_mode);
+    case 'e':
+        return true;
+    case 'f':
+        return S_ISREG(st.st_mode);
+    case 'g':
+        return (st.st_mode & S_ISGID) != 0;
+    case 'G':
+        return st.st_gid == getegid();
+    case 'k':
+        return (st.st_mode & S_ISVTX) != 0;
+    case 'O':
+        return st.st_uid == geteuid();
+    case 'p':
+        return S_ISFIFO(st.st_mode);
+    case 's':
+        return st.st_size > 0;
+    case 'S':
+        return S_ISSOCK(st.st_mode);
+    case 'u':
+        return (st.st_mode & S_ISUID) != 0;
+    }
+    return false;
+}
+
+/* An integer operand, which may have blanks around it.  Values out of
+ * range are clamped. */
+static intmax_t
+test_integer(struct test *t, const char *arg)
+{
+    char *end;
+    intmax_t value = strtoimax(arg, &end, 10);
+    while (*end == ' ' || *end == '\t')
+        end++;
+    if (end == arg || *end != '\0')
+        test_error(t, "invalid integer '%s'", arg);
+    return value;
+}
+
+/* Compare the modification times of two files.  A missing file is
+ * older than any other. */
+static int
+compare_mtime(const char *a, const char *b)
+{
+    struct stat sa, sb;
+    bool has_a = stat(a, &sa) == 0, has_b = stat(b, &sb) == 0;
+
+    if (!has_a || !has_b)
+        return has_a - has_b;
+    if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+        return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ? -1 : 1;
+    if (sa.st_mtim.tv_nsec != sb.st_mtim.tv_nsec)
+        return sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static bool
+test_binary(struct test *t, const char *a, const char *op, const char *b)
+{
+    struct stat sa, sb;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(a, b) != 0;
+    if (strcmp(op, "-nt") == 0)
+        return compare_mtime(a, b) > 0;
+    if (strcmp(op, "-ot") == 0)
+        return compare_mtime(a, b) < 0;
+    if (strcmp(op, "-ef") == 0)
+        return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+               sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+
+    intmax_t x = test_integer(t, a), y = test_integer(t, b);
+    switch (op[1] << 8 | op[2]) {
+    case 'e' << 8 | 'q':
+        return x == y;
+    case 'n' << 8 | 'e':
+        return x != y;
+    case 'l' << 8 | 't':
+        return x < y;
+    case 'l' << 8 | 'e':
+        return x <= y;
+    case 'g' << 8 | 't':
+        return x > y;
+    default:
+        return x >= y;
+    }
+}
+
+/* primary: ( expr ) | unary-op word | word binary-op word | word */
+static bool
+test_primary(struct test *t)
+{
+    if (t->pos >= t->argc) {
+        test_error(t, "missing argument after '%s'", t->argv[t->argc - 1]);
+        return false;
+    }
+    const char *word = t->argv[t->pos];
+    if (t->pos + 2 < t->argc && is_binary_op(t->argv[t->pos + 1])) {
+        t->pos += 3;
+        return test_binary(t, word, t->argv[t->pos - 2], t->argv[t->pos - 1]);
+    }
+    if (strcmp(word, "(") == 0) {
+        t->pos++;
+        /* Up to three words before a ')' follow the rules of POSIX */
+        int n = 0;
+        while (n < 4 && t->pos + n < t->argc &&
+               strcmp(t->argv[t->pos + n], ")") != 0)
+            n++;
+        bool value;
+        if (n < 4 && t->pos + n < t->argc) {
+            int status = test_eval(t->name, t->argv + t->pos, n, t->fd);
+            t->failed |= status == 2;
+            t->pos += n;
+            value = status == 0;
+        } else {
+            value = test_or(t);
+        }
+        if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0)
+            test_error(t, "')' expected");
+        t->pos++;
+        return value;
+    }
+    if (is_unary_op(word) && t->pos + 1 < t->argc) {
+        t->pos += 2;
+        return test_unary(t, word[1], t->argv[t->pos - 1]);
+    }
+    t->pos++;
+    return word[0] != '\0';
+}
+
+static bool
+test_not(struct test *t)
+{
+    if (t->pos < t->argc && strcmp(t->argv[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool
+test_and(struct test *t)
+{
+    bool value = test_not(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        value = test_not(t) && value;
+    }
+    return value;
+}
+
+static bool
+test_or(struct test *t)
+{
+    bool value = test_and(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        value = test_and(t) || value;
+    }
+    return value;
+}
+
+/* Evaluate the words of a test expression, with the rules of POSIX for
+ * up to four words, which decide between a string and an operator by
+ * the number of words.  Returns the exit status. */
+static int
+test_eval(const char *name, char **argv, int argc, const int fd[3])
+{
+    struct test t = { name, argv, argc, 0, fd, false };
+    int status;
+    bool value;
+
+    switch (argc) {
+    case 0:
+        return 1;
+    case 1:
+        return argv[0][0] == '\0';
+    case 2:
+        if (strcmp(argv[0], "!") == 0)
+            return argv[1][0] != '\0';
+        if (argv[0][0] != '-' || argv[0][1] == '\0' || argv[0][2] != '\0') {
+            test_error(&t, "missing argument after '%s'", argv[1]);
+            return 2;
+        }
+        if (!is_unary_op(argv[0])) {
+            test_error(&t, "'%s': unary operator expected", argv[0]);
+            return 2;
+        }
+        return !test_unary(&t, argv[0][1], argv[1]);
+    case 3:
+        if (is_binary_op(argv[1]))
+            value = test_binary(&t, argv[0], argv[1], argv[2]);
+        else if (strcmp(argv[1], "-a") == 0)
+            value = argv[0][0] != '\0' && argv[2][0] != '\0';
+        else if (strcmp(argv[1], "-o") == 0)
+            value = argv[0][0] != '\0' || argv[2][0] != '\0';
+        else if (strcmp(argv[0], "!") == 0) {
+            status = test_eval(name, argv + 1, 2, fd);
+            return status == 2 ? 2 : !status;
+        }
+        else if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0)
+            value = argv[1][0] != '\0';
+        else {
+            test_error(&t, "'%s': binary operator expected", argv[1]);
+            return 2;
+        }
+        return t.failed ? 2 : !value;
+    case 4:
+        if (strcmp(argv[0], "!") == 0) {
+            status = test_eval(name, argv + 1, 3, fd);
+            return status == 2 ? 2 : !status;
+        }
+        if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0)
+            return test_eval(name, argv + 1, 2, fd);
+    }
+
+    value = test_or(&t);
+    if (t.pos < t.argc)
+        test_error(&t, "extra argument '%s'", t.argv[t.pos]);
+    return t.failed ? 2 : !value;
+}
+
+/* test expression */
+static int
+test_main(int argc, char **argv, const int fd[3])
+{
+    return test_eval("test", argv + 1, argc - 1, fd);
+}
+
+/* [ expression ] */
+static int
+bracket_main(int argc, char **argv, const int fd[3])
+{
+    if (strcmp(argv[argc - 1], "]") != 0) {
+        dprintf(fd[2], "[: missing ']'\n");
+        return 2;
+    }
+    return test_eval("[", argv + 1, argc - 2, fd);
+}
+
+/* Return true if 'word' is a word of options of cat, which are only
+ * -u, ignored as output is never buffered */
+static bool
+is_cat_option(const char *word)
+{
+    return word[0] == '-' && word[1] != '\0' &&
+           word[strspn(word + 1, "u") + 1] == '\0';
+}
+
+/* Copy 'in' to 'out'.  Returns 0, or an errno value and sets
+ * '*writing' if writing failed. */
+static int
+copy_fd(int in, int out, bool *writing)
+{
+    char buf[65536];
+
+    /* Regular files are copied in the kernel where it can.  Otherwise,
+     * and to tell a read error from a write error, the rest of the file
+     * is copied with read and write. */
+    for (;;) {
+        ssize_t n = sendfile(out, in, NULL, 1 << 30);
+        if (n == 0)
+            return 0;
+        if (n == -1 && errno != EINTR)
+            break;
+    }
+    for (;;) {
+        ssize_t n = read(in, buf, sizeof buf);
+        if (n == 0)
+            return 0;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        int error = write_all(out, buf, n);
+        if (error != 0) {
+            *writing = true;
+            return error;
+        }
+    }
+}
+
+/* cat [-u] [file ...] */
+static int
+cat_main(int argc, char **argv, const int fd[3])
+{
+    int status = 0;
+    bool options = true, operands = false;
+
+    for (int i = 1; i <= argc; i++) {
+        const char *path = argv[i];
+        if (path == NULL) {
+            if (operands)
+                break;
+            path = "-";
+        } else if (options && strcmp(path, "--") == 0) {
+            options = false;
+            continue;
+        } else if (options && is_cat_option(path)) {
+            continue;
+        }
+        operands = true;
+
+        int in = fd[0];
+        if (strcmp(path, "-") != 0) {
+            in = open(path, O_RDONLY | O_CLOEXEC);
+            if (in == -1) {
+                dprintf(fd[2], "cat: %s: %s\n", path, strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+        bool writing = false;
+        int error = copy_fd(in, fd[1], &writing);
+        if (in != fd[0])
+            close(in);
+        if (error == EPIPE && writing)
+            return 1;
+        if (error != 0) {
+            if (writing)
+                dprintf(fd[2], "cat: write error: %s\n", strerror(error));
+            else
+                dprintf(fd[2], "cat: %s: %s\n", path, strerror(error));
+            status = 1;
+            if (writing)
+                return status;
+        }
+    }
+    return status;
+}
+
+/* The utilities, registered as builtins by the shell */
+static const struct inproc_utility utilities[] = {
+    { "[", bracket_main, false },
+    { "cat", cat_main, true },
+    { "echo", echo_main, false },
+    { "false", false_main, false },
+    { "printf", printf_main, false },
+    { "test", test_main, false },
+    { "true", true_main, false },
+};
+
+/* Return the i-th utility, or NULL */
+const struct inproc_utility *
+inproc_utility(size_t i)
+{
+    return i < sizeof utilities / sizeof *utilities ? &utilities[i] : NULL;
+}
+
+static bool
+is_regular_file(const char *path)
+{
+    struct stat st;
+    return path != NULL && stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/* Return true if 'u' can run 'argv' in-process */
+bool
+inproc_can_run(const struct inproc_utility *u, char **argv,
+               const char *input)
+{
+    /* The programs print their manuals */
+    if (argv[1] != NULL && argv[2] == NULL &&
+        (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "--version") == 0))
+        return false;
+    if (!u->reads_input)
+        return true;
+
+    bool options = true, operands = false;
+    for (char **p = argv + 1; *p != NULL; p++) {
+        if (options && strcmp(*p, "--") == 0) {
+            options = false;
+        } else if (options && (*p)[0] == '-' && (*p)[1] != '\0') {
+            if (!is_cat_option(*p))
+                return false;
+        } else {
+            operands = true;
+            if (!is_regular_file(strcmp(*p, "-") == 0 ? input : *p))
+                return false;
+        }
+    }
+    return operands || is_regular_file(input);
+}
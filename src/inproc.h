@@ -0,0 +1,39 @@
+#ifndef __INPROC_H
+#define __INPROC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * In-process versions of utilities that scripts run very often: echo,
+ * true, false, printf, test, [ and cat.  The shell calls them instead
+ * of forking and executing the program of the same name: on the shell's
+ * thread when one makes up a whole pipeline, and on a thread of its own
+ * as a stage of a longer pipeline.
+ *
+ * They behave like the GNU coreutils programs for the options they
+ * accept, but use only the file descriptors they are given and never
+ * touch stdio, the environment or the shell's signal dispositions, so
+ * that several can run at the same time.
+ */
+
+struct inproc_utility {
+    const char *name;
+    /* Run the utility on the NULL-terminated 'argv'.  fd[0], fd[1] and
+     * fd[2] are its standard input, output and error.  Returns the
+     * exit status. */
+    int (*main)(int argc, char **argv, const int fd[3]);
+    bool reads_input;   /* Reads its files, or standard input */
+};
+
+/* Return the i-th utility, or NULL if there are fewer */
+const struct inproc_utility *inproc_utility(size_t i);
+
+/* Return true if 'u' can run 'argv' in-process: it understands all of
+ * its options, and it cannot wait for input because it reads nothing
+ * or only regular files.  'input' is the file standard input is
+ * redirected from, or NULL if it is a pipe or the terminal. */
+bool inproc_can_run(const struct inproc_utility *u, char **argv,
+                    const char *input);
+
+#endif /* __INPROC_H */
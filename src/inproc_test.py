@@ -0,0 +1,96 @@
+#!/usr/bin/python
+#
+# Tests the utilities the shell runs itself: their output, redirections
+# and pipelines are the same as with the programs after "set +o inproc",
+# none of them forks, and a job with one on a thread can be stopped
+
+import atexit, proc_check, time, os, re, json, shutil, signal, subprocess
+import tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+atexit.register(shutil.rmtree, tmpdir)
+def tmpfile(name):
+    return os.path.join(tmpdir, name)
+
+out = tmpfile("out")
+lines = [
+    "stats reset",
+    "echo hello world",
+    "echo -n no newline",
+    "echo -e a\\tb\\0101\\c never",
+    "printf %s=%d,%5.2f,%x\\n x 42 3.14159 255 y",
+    "printf %d\\n abc",
+    "[ 1 -eq x ]",
+    "test a b c",
+    "true",
+    "false",
+    "echo written > " + out,
+    "echo appended >> " + out,
+    "cat " + out,
+    "cat < " + out,
+    "cat -u " + out + " - < " + out,
+    "printf to-stderr\\n >& " + tmpfile("err"),
+    "stats -j",
+    "cat " + tmpfile("err"),
+    "cat " + tmpfile("nosuchfile"),
+    "echo piped | wc -c",
+    "seq 3 | echo ignores its input",
+    "cat " + out + " | wc -l",
+    "printf a\\nb\\n | cat | cat",
+    "true | printf %s\\n b",
+]
+
+def start_shell():
+    # Python ignores SIGPIPE, and its children would inherit that
+    signal.signal(signal.SIGPIPE, signal.SIG_DFL)
+    os.setsid()
+
+def run(options):
+    """Run the lines as a script, after 'options'"""
+    path = tmpfile("script.cush")
+    with open(path, "w") as f:
+        f.write("\n".join(options + lines) + "\n")
+    shell = subprocess.Popen(["./cush", path], stdin=subprocess.PIPE,
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                             preexec_fn=start_shell)
+    output = shell.communicate("")[0]
+    assert shell.returncode == 0, "Shell failed: " + output
+    # the location of errors differs by the options' lines
+    output = re.sub(re.escape(path) + ":\d+: ", "", output)
+    stats = re.search("^(\{.*\})$", output, re.M)
+    return output.replace(stats.group(1), ""), json.loads(stats.group(1))
+
+inproc, inproc_stats = run([])
+forked, forked_stats = run(["set +o inproc"])
+assert inproc == forked, "Output differs:\n" + inproc + "\nforked:\n" + forked
+assert "hello world\nno newline" in inproc, "Unexpected output: " + inproc
+assert "x=42, 3.14,ff\ny=0," in inproc, "Unexpected output: " + inproc
+assert "written\nappended\nwritten\nappended\n" in inproc, \
+    "Unexpected output: " + inproc
+assert inproc_stats["spawn"]["count"] == 0, "A utility was forked"
+assert forked_stats["spawn"]["count"] > 0, "set +o inproc did not fork"
+
+# a job whose cat thread writes to a stopped process
+console = setup_tests()
+expect_prompt()
+sendline("seq 100000 > " + out)
+expect_prompt()
+sendline("cat " + out + " | sleep 30")
+time.sleep(0.5)
+sendcontrol("z")
+expect("Stopped")
+expect_prompt()
+sendline("jobs")
+expect("\[1\]\s+Stopped")
+expect_prompt()
+sendline("kill 1")
+expect_prompt()
+sendline("echo after | cat")
+expect_exact("after\r\n")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,370 @@
+/*
+ * Job accounting log.
+ *
+ * Writing costs one write per job, under a file lock that keeps the
+ * logging stamps in order when several shells share the log.  Records
+ * are not sorted by end time: a job is logged when it is deleted, which
+ * can be well after it ended.  But no job logged before a time can have
+ * ended after it, so queries map the log read-only, binary-search the
+ * stamps for the first record logged in the window, and check the end
+ * times of the records from there on.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jacct.h"
+#include "proc_usage.h"
+#include "sample_stats.h"
+#include "utils.h"
+
+_Static_assert(sizeof(struct jacct_header) == 64, "header layout");
+_Static_assert(sizeof(struct jacct_record) == 256, "record layout");
+
+const char *jacct_key_names[JACCT_NKEYS] = {
+    [JACCT_CPU] = "cpu",
+    [JACCT_COUNT] = "count",
+    [JACCT_P50] = "p50",
+    [JACCT_P99] = "p99",
+    [JACCT_RSS] = "rss",
+    [JACCT_IO] = "io",
+};
+
+static int log_fd = -1;
+static char *log_path;
+
+/* Check that 'h' is the header of a log this code can read */
+static bool
+valid_header(const struct jacct_header *h)
+{
+    return memcmp(h->magic, JACCT_MAGIC, sizeof h->magic) == 0 &&
+           h->version == JACCT_VERSION &&
+           h->record_size == sizeof(struct jacct_record);
+}
+
+/* Open 'path' for appending */
+bool
+jacct_open(const char *path)
+{
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+
+    struct jacct_header h;
+    ssize_t len = pread(fd, &h, sizeof h, 0);
+    if (len == 0) {
+        memset(&h, 0, sizeof h);
+        memcpy(h.magic, JACCT_MAGIC, sizeof h.magic);
+        h.version = JACCT_VERSION;
+        h.record_size = sizeof(struct jacct_record);
+        if (write(fd, &h, sizeof h) != sizeof h) {
+            close(fd);
+            return false;
+        }
+    } else if (len != sizeof h || !valid_header(&h)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+
+    log_fd = fd;
+    free(log_path);
+    log_path = strdup(path);
+    return true;
+}
+
+/* The path of the open log */
+const char *
+jacct_path(void)
+{
+    return log_path;
+}
+
+/* Append one record */
+void
+jacct_append(const struct jacct_record *r)
+{
+    if (log_fd == -1)
+        return;
+
+    /* The stamp must not go back, even if the clock or another shell's
+     * did, or the binary search in find_logged would miss records */
+    struct jacct_record rec = *r;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec.logged_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    if (rec.logged_ns < rec.end_ns)
+        rec.logged_ns = rec.end_ns;
+
+    flock(log_fd, LOCK_EX);
+    struct stat st;
+    int64_t last;
+    if (fstat(log_fd, &st) == 0 && st.st_size >= (off_t)
+        (sizeof(struct jacct_header) + sizeof rec) &&
+        pread(log_fd, &last, sizeof last, st.st_size - sizeof rec +
+              offsetof(struct jacct_record, logged_ns)) == sizeof last &&
+        last > rec.logged_ns)
+        rec.logged_ns = last;
+    if (write(log_fd, &rec, sizeof rec) != sizeof rec)
+        utils_error("jacct: cannot append to %s: ", log_path);
+    flock(log_fd, LOCK_UN);
+}
+
+/* Return the key named 'name' */
+int
+jacct_parse_key(const char *name)
+{
+    for (int k = 0; k < JACCT_NKEYS; k++)
+        if (strcmp(jacct_key_names[k], name) == 0)
+            return k;
+    return -1;
+}
+
+/* A log mapped for reading */
+struct mapped_log {
+    void *base;
+    size_t size;
+    const struct jacct_record *records;
+    size_t n;
+};
+
+/* Map the log at 'path' */
+static bool
+map_log(const char *path, struct mapped_log *m)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size < (off_t) sizeof(struct jacct_header)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    m->size = st.st_size;
+    m->base = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m->base == MAP_FAILED)
+        return false;
+
+    if (!valid_header(m->base)) {
+        munmap(m->base, m->size);
+        errno = EINVAL;
+        return false;
+    }
+    m->records = (const struct jacct_record *)
+        ((char *) m->base + sizeof(struct jacct_header));
+    m->n = (m->size - sizeof(struct jacct_header)) / sizeof *m->records;
+    return true;
+}
+
+/* Return the index of the first record logged at or after 'since_ns'.
+ * Records logged before cannot have ended in the window. */
+static size_t
+find_logged(const struct mapped_log *m, int64_t since_ns)
+{
+    size_t lo = 0, hi = m->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->records[mid].logged_ns < since_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Wall time of a job in seconds */
+static double
+duration(const struct jacct_record *r)
+{
+    return (r->end_ns - r->start_ns) / 1e9;
+}
+
+/* Order records by command name, then by duration */
+static int
+compare_command(const void *a, const void *b)
+{
+    const struct jacct_record *x = *(const struct jacct_record **) a;
+    const struct jacct_record *y = *(const struct jacct_record **) b;
+    int c = strncmp(x->command, y->command, sizeof x->command);
+    if (c != 0)
+        return c;
+    return duration(x) < duration(y) ? -1 : duration(x) > duration(y);
+}
+
+/* Totals of all jobs of one command */
+struct command_summary {
+    const char *name;
+    int count;
+    double cpu;                 /* User and system time in seconds */
+    struct sample_summary wall;
+    int64_t maxrss_kb;
+    uint64_t io;                /* Bytes read and written */
+};
+
+static enum jacct_key sort_key;
+
+/* Value of the sort key */
+static double
+key_value(const struct command_summary *c)
+{
+    switch (sort_key) {
+    case JACCT_COUNT:
+        return c->count;
+    case JACCT_P50:
+        return c->wall.p50;
+    case JACCT_P99:
+        return c->wall.p99;
+    case JACCT_RSS:
+        return c->maxrss_kb;
+    case JACCT_IO:
+        return c->io;
+    default:
+        return c->cpu;
+    }
+}
+
+/* Order summaries by the sort key, largest first */
+static int
+compare_key(const void *a, const void *b)
+{
+    double x = key_value(a), y = key_value(b);
+    return x > y ? -1 : x < y;
+}
+
+/* Print a summary per command */
+bool
+jacct_summary(const char *path, int64_t since_ns, enum jacct_key key, int n,
+              FILE *out)
+{
+    struct mapped_log m;
+    if (!map_log(path, &m))
+        return false;
+
+    /* Group the jobs in the window by command */
+    size_t from = find_logged(&m, since_ns);
+    size_t max = m.n - from + 1;
+    const struct jacct_record **jobs = malloc(max * sizeof *jobs);
+    double *wall = malloc(max * sizeof *wall);
+    struct command_summary *commands = malloc(max * sizeof *commands);
+    if (jobs == NULL || wall == NULL || commands == NULL) {
+        free(jobs);
+        free(wall);
+        free(commands);
+        munmap(m.base, m.size);
+        errno = ENOMEM;
+        return false;
+    }
+    size_t count = 0;
+    for (size_t i = from; i < m.n; i++)
+        if (m.records[i].end_ns >= since_ns)
+            jobs[count++] = &m.records[i];
+    qsort(jobs, count, sizeof *jobs, compare_command);
+
+    int ncommands = 0;
+    for (size_t i = 0; i < count;) {
+        struct command_summary *c = &commands[ncommands++];
+        memset(c, 0, sizeof *c);
+        c->name = jobs[i]->command;
+        size_t start = i;
+        for (; i < count && strncmp(jobs[i]->command, c->name,
+                                    sizeof jobs[i]->command) == 0; i++) {
+            const struct jacct_record *r = jobs[i];
+            c->cpu += (r->utime_us + r->stime_us) / 1e6;
+            if (r->maxrss_kb > c->maxrss_kb)
+                c->maxrss_kb = r->maxrss_kb;
+            c->io += r->rchar + r->wchar;
+            wall[i] = duration(r);
+        }
+        c->count = i - start;
+        sample_summarize(&wall[start], c->count, &c->wall);
+    }
+    sort_key = key;
+    qsort(commands, ncommands, sizeof *commands, compare_key);
+
+    fprintf(out, "%-20s %6s %9s %9s %9s %9s %8s %8s\n", "command", "jobs",
+            "cpu", "mean", "p50", "p99", "maxrss", "io");
+    for (int i = 0; i < ncommands && (n == 0 || i < n); i++) {
+        struct command_summary *c = &commands[i];
+        char cpu[16], mean[16], p50[16], p99[16], rss[16], io[16];
+        sample_format_duration(cpu, sizeof cpu, c->cpu);
+        sample_format_duration(mean, sizeof mean, c->wall.mean);
+        sample_format_duration(p50, sizeof p50, c->wall.p50);
+        sample_format_duration(p99, sizeof p99, c->wall.p99);
+        proc_usage_format_bytes(rss, sizeof rss, c->maxrss_kb * 1024.0);
+        proc_usage_format_bytes(io, sizeof io, c->io);
+        fprintf(out, "%-20.*s %6d %9s %9s %9s %9s %8s %8s\n",
+                (int) sizeof jobs[0]->command, c->name, c->count, cpu, mean,
+                p50, p99, rss, io);
+    }
+
+    free(jobs);
+    free(wall);
+    free(commands);
+    munmap(m.base, m.size);
+    return true;
+}
+
+/* Print the last jobs of the window */
+bool
+jacct_list(const char *path, int64_t since_ns, int n, FILE *out)
+{
+    struct mapped_log m;
+    if (!map_log(path, &m))
+        return false;
+
+    /* Find the first of the last 'n' records in the window */
+    size_t from = find_logged(&m, since_ns);
+    size_t first = m.n;
+    int shown = 0;
+    for (size_t i = m.n; i-- > from && (n == 0 || shown < n);) {
+        if (m.records[i].end_ns >= since_ns) {
+            first = i;
+            shown++;
+        }
+    }
+
+    fprintf(out, "%-19s %9s %-10s %9s %8s  %s\n", "started", "wall",
+            "status", "cpu", "maxrss", "command");
+    for (size_t i = first; i < m.n; i++) {
+        const struct jacct_record *r = &m.records[i];
+        char started[32], wall[16], status[16], cpu[16], rss[16];
+        if (r->end_ns < since_ns)
+            continue;
+
+        time_t t = r->start_ns / 1000000000;
+        strftime(started, sizeof started, "%Y-%m-%d %H:%M:%S",
+                 localtime(&t));
+        sample_format_duration(wall, sizeof wall, duration(r));
+        if (WIFSIGNALED(r->exit_status))
+            snprintf(status, sizeof status, "signal %d",
+                     WTERMSIG(r->exit_status));
+        else
+            snprintf(status, sizeof status, "exit %d",
+                     WEXITSTATUS(r->exit_status));
+        sample_format_duration(cpu, sizeof cpu,
+                               (r->utime_us + r->stime_us) / 1e6);
+        proc_usage_format_bytes(rss, sizeof rss, r->maxrss_kb * 1024.0);
+        fprintf(out, "%-19s %9s %-10s %9s %8s  %.*s\n", started, wall,
+                status, cpu, rss, (int) sizeof r->cmdline, r->cmdline);
+    }
+
+    munmap(m.base, m.size);
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef __JACCT_H
+#define __JACCT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Job accounting log.
+ *
+ * The log is a file of fixed-size records, one per finished job, after
+ * a 64-byte header.  Records are appended with a single write to a
+ * file opened with O_APPEND, so several shells can share a log.  They
+ * are in the order in which the jobs were deleted, which is not the
+ * order in which they ended.  Each record is stamped with the time it
+ * was logged, which is never earlier than its end time nor than the
+ * stamp of the record before it, so queries over a time window
+ * binary-search the stamps and check the end times from there on.
+ */
+#define JACCT_MAGIC "CUSHACCT"
+#define JACCT_VERSION 2
+
+struct jacct_header {
+    char magic[8];              /* JACCT_MAGIC, not NUL-terminated */
+    uint32_t version;           /* JACCT_VERSION */
+    uint32_t record_size;       /* sizeof(struct jacct_record) */
+    char reserved[48];
+};
+
+struct jacct_record {
+    int64_t start_ns;           /* Start time, ns since the epoch */
+    int64_t end_ns;             /* When the last process was reaped */
+    int64_t logged_ns;          /* When the record was appended */
+    int64_t utime_us;           /* User CPU time of all processes */
+    int64_t stime_us;           /* System CPU time of all processes */
+    int64_t maxrss_kb;          /* Largest maximum RSS of any process */
+    uint64_t rchar;             /* Bytes read by all processes */
+    uint64_t wchar;             /* Bytes written by all processes */
+    int32_t exit_status;        /* Wait status of the last process */
+    int32_t nprocs;             /* Number of processes */
+    char command[32];           /* Name of the first program */
+    char cmdline[152];          /* The command line, truncated */
+};
+
+/* Columns the per-command summary can be sorted by */
+enum jacct_key {
+    JACCT_CPU,                  /* Total CPU time */
+    JACCT_COUNT,                /* Number of jobs */
+    JACCT_P50,                  /* Median duration */
+    JACCT_P99,                  /* 99th percentile duration */
+    JACCT_RSS,                  /* Largest maximum RSS */
+    JACCT_IO,                   /* Total bytes read and written */
+    JACCT_NKEYS
+};
+
+/* Names of the keys, as accepted by jacct_parse_key */
+extern const char *jacct_key_names[JACCT_NKEYS];
+
+/* Open 'path' for appending, creating it with a header if needed.
+ * Returns false, with errno set, if it cannot be opened or is not an
+ * accounting log. */
+bool jacct_open(const char *path);
+
+/* The path of the log opened with jacct_open, or NULL */
+const char *jacct_path(void);
+
+/* Stamp a copy of 'r' with the time it is logged and append it with a
+ * single write */
+void jacct_append(const struct jacct_record *r);
+
+/* Return the key named 'name', or -1 */
+int jacct_parse_key(const char *name);
+
+/* Print a summary per command of the jobs that ended at or after
+ * 'since_ns', sorted by 'key', at most 'n' lines (0 for all).
+ * Returns false, with errno set, if the log cannot be read. */
+bool jacct_summary(const char *path, int64_t since_ns, enum jacct_key key,
+                   int n, FILE *out);
+
+/* Print the last 'n' jobs (0 for all) that ended at or after
+ * 'since_ns'.  Returns false, with errno set, if the log cannot be
+ * read. */
+bool jacct_list(const char *path, int64_t since_ns, int n, FILE *out);
+
+#endif /* __JACCT_H */
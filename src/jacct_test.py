@@ -0,0 +1,110 @@
+#!/usr/bin/python
+#
+# Tests the job accounting log of -A: one record per finished job,
+# summarized per command and listed by the jacct builtin
+
+import atexit, proc_check, time, os, struct, tempfile
+from testutils import *
+
+logfile = os.path.join(tempfile.mkdtemp(), "acct.log")
+atexit.register(lambda: os.path.exists(logfile) and os.unlink(logfile))
+
+console = setup_tests([" -A " + logfile])
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("jacct -k nosuchkey")
+expect("jacct: usage")
+expect_prompt()
+
+# the log holds a header and no jobs yet
+assert os.path.getsize(logfile) == 64, "Expected an empty log"
+
+sendline("sleep 0.1")
+expect_prompt()
+sendline("sleep 0.3")
+expect_prompt()
+sendline("echo accounted | cat")
+expect_prompt()
+sendline("false")
+expect_prompt()
+
+# one fixed-size record per job
+assert os.path.getsize(logfile) == 64 + 4 * 256, "Expected four records"
+
+# each is stamped when logged, after it ended and in order
+with open(logfile, "rb") as f:
+    f.seek(64)
+    stamps = [struct.unpack("<qqq", f.read(256)[:24]) for i in range(4)]
+for i, (start, end, logged) in enumerate(stamps):
+    assert start <= end <= logged, "Expected a job logged after it ended"
+    assert i == 0 or stamps[i - 1][2] <= logged, "Expected ordered stamps"
+
+sendline("jacct -k count")
+expect("command\s+jobs\s+cpu\s+mean\s+p50\s+p99\s+maxrss\s+io\r\n")
+expect("sleep\s+2\s[^\r\n]*\r\n")
+expect_prompt()
+
+# the slowest command by p99 is the one that slept longest
+sendline("jacct -k p99 -n 1")
+expect("command[^\r\n]*\r\n")
+expect("sleep\s+2\s+\S+\s+\S+\s+\S+\s+3\d\d\.\d+ms\s[^\r\n]*\r\n")
+expect_prompt()
+
+sendline("jacct -l -n 2")
+expect("started\s+wall\s+status\s+cpu\s+maxrss\s+command\r\n")
+expect("\d+-\d+-\d+ \d+:\d+:\d+\s+\S+ exit 0\s[^\r\n]*echo accounted\| cat\r\n")
+expect("\d+-\d+-\d+ \d+:\d+:\d+\s+\S+ exit 1\s[^\r\n]*false\r\n")
+expect_prompt()
+
+# a killed job records its signal
+sendline("sleep 10 &")
+expect("\[1\] \d+")
+expect_prompt()
+sendline("kill 1")
+expect_prompt()
+time.sleep(0.5)
+
+# the job is deleted, and recorded, before the next prompt
+sendline("jobs")
+expect_prompt()
+
+# jobs that ended within the last minute
+sendline("jacct -s 1m -l -n 1")
+expect("started[^\r\n]*\r\n")
+expect("signal 9\s[^\r\n]*sleep 10\r\n")
+expect_prompt()
+
+sendline("jacct -s 1m")
+expect_prompt()
+
+# records are not sorted by end time: a job deleted late may follow jobs
+# that ended after it, but they are sorted by the time they were logged
+otherlog = os.path.join(os.path.dirname(logfile), "other.log")
+atexit.register(lambda: os.path.exists(otherlog) and os.unlink(otherlog))
+now = int(time.time() * 1e9)
+with open(otherlog, "wb") as f:
+    f.write(struct.pack("<8sII48s", "CUSHACCT", 2, 256, ""))
+    day = 86400 * 10**9
+    for name, end, logged in [("older", now - 5 * day, now - 5 * day),
+                              ("recent", now, now),
+                              ("old", now - 3 * day, now),
+                              ("late", now, now)]:
+        f.write(struct.pack("<qqqqqqQQii32s152s", end - 10**6, end, logged,
+                            0, 0, 0, 0, 0, 0, 1, name, name))
+sendline("jacct -f " + otherlog + " -s 1d -l")
+expect("started[^\r\n]*\r\n")
+expect("exit 0\s[^\r\n]*recent\r\n")
+expect("exit 0\s[^\r\n]*late\r\n")
+expect_prompt()
+sendline("jacct -f " + otherlog + " -s 1d -k count -n 0")
+expect("command[^\r\n]*\r\n")
+expect("(late|recent)\s+1\s[^\r\n]*\r\n")
+expect("(late|recent)\s+1\s[^\r\n]*\r\n")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,138 @@
+/*
+ * Support for acting as a GNU make jobserver.
+ *
+ * The shell owns a pipe that holds one byte ("token") per available
+ * job slot.  Every job the shell launches takes a token and returns it
+ * when it is reaped.  The pipe is passed down to children through
+ * MAKEFLAGS=--jobserver-auth=R,W, so that nested make -j invocations
+ * draw their additional tokens from the same pool.
+ *
+ * The shell itself reads tokens through a non-blocking descriptor of
+ * its own, opened through /proc/self/fd so that O_NONBLOCK is not set
+ * on the descriptors make inherits.  While it waits for a token it
+ * keeps reaping children, and ^C ends the wait.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "jobserver.h"
+#include "utils.h"
+
+#define JOBSERVER_TOKEN '+'
+
+static int token_fds[2] = { -1, -1 };   /* read end, write end */
+static int token_rd = -1;               /* non-blocking read end */
+
+/* Create the token pipe and export it via MAKEFLAGS */
+void
+jobserver_init(int slots)
+{
+    if (slots < 1) {
+        fprintf(stderr, "jobserver: need at least one slot\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The descriptors must survive exec so children can use them. */
+    if (pipe(token_fds) == -1)
+        utils_fatal_error("jobserver: cannot create token pipe: ");
+
+    char path[64];
+    snprintf(path, sizeof path, "/proc/self/fd/%d", token_fds[0]);
+    token_rd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (token_rd == -1)
+        utils_fatal_error("jobserver: cannot open %s: ", path);
+
+    for (int i = 0; i < slots; i++)
+        jobserver_release();
+
+    char flags[256];
+    char *old = getenv("MAKEFLAGS");
+    snprintf(flags, sizeof flags, "%s%s-j%d --jobserver-auth=%d,%d",
+             old ? old : "", old && *old ? " " : "",
+             slots, token_fds[0], token_fds[1]);
+    if (setenv("MAKEFLAGS", flags, 1) == -1)
+        utils_fatal_error("jobserver: cannot set MAKEFLAGS: ");
+}
+
+/* Return true if the shell acts as a jobserver */
+bool
+jobserver_enabled(void)
+{
+    return token_fds[0] != -1;
+}
+
+/* Take a token if one is available */
+bool
+jobserver_try_acquire(void)
+{
+    char token;
+    ssize_t rc;
+
+    while ((rc = read(token_rd, &token, 1)) == -1 && errno == EINTR)
+        continue;
+
+    if (rc == -1 && errno != EAGAIN)
+        utils_fatal_error("jobserver: reading token failed: ");
+    return rc == 1;
+}
+
+/* Take a token, waiting until one is returned to the pipe.
+ * SIGCHLD is handled while waiting, since tokens held by background
+ * jobs are returned from the SIGCHLD handler.  SIGINT is taken from
+ * a signalfd, so that ^C ends the wait instead of the shell. */
+bool
+jobserver_acquire(void)
+{
+    if (jobserver_try_acquire())
+        return true;
+
+    sigset_t intr, saved, waiting;
+    sigemptyset(&intr);
+    sigaddset(&intr, SIGINT);
+    sigprocmask(SIG_BLOCK, &intr, &saved);
+    waiting = saved;
+    sigaddset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGCHLD);
+
+    int sfd = signalfd(-1, &intr, SFD_CLOEXEC);
+    bool acquired;
+    while (!(acquired = jobserver_try_acquire())) {
+        struct pollfd pfd[2] = {
+            { .fd = token_rd, .events = POLLIN },
+            { .fd = sfd, .events = POLLIN },
+        };
+        if (ppoll(pfd, sfd == -1 ? 1 : 2, NULL, &waiting) == -1 &&
+                errno != EINTR)
+            utils_fatal_error("jobserver: waiting for a token failed: ");
+
+        if (pfd[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            read(sfd, &si, sizeof si);
+            break;
+        }
+    }
+    if (sfd != -1)
+        close(sfd);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+    return acquired;
+}
+
+/* Return a token to the pipe.  Async-signal-safe. */
+void
+jobserver_release(void)
+{
+    int saved_errno = errno;
+    char token = JOBSERVER_TOKEN;
+    while (write(token_fds[1], &token, 1) == -1 && errno == EINTR)
+        continue;
+    errno = saved_errno;
+}
@@ -0,0 +1,23 @@
+#ifndef __JOBSERVER_H
+#define __JOBSERVER_H
+
+#include <stdbool.h>
+
+/* Create a GNU make compatible token pipe holding 'slots' tokens
+ * and export it to children through MAKEFLAGS. */
+void jobserver_init(int slots);
+
+/* Return true if the shell acts as a jobserver */
+bool jobserver_enabled(void);
+
+/* Take a token if one is available, without waiting */
+bool jobserver_try_acquire(void);
+
+/* Take a token, waiting until one is returned to the pipe while
+ * still reaping children.  Returns false if ^C was typed first. */
+bool jobserver_acquire(void);
+
+/* Return a token to the pipe.  Async-signal-safe. */
+void jobserver_release(void);
+
+#endif /* __JOBSERVER_H */
@@ -0,0 +1,65 @@
+#!/usr/bin/python
+#
+# Tests the jobserver implement: children see the token pipe in
+# MAKEFLAGS, a job waits while all job slots are taken, ^C ends the
+# wait, and a stopped job gives up its slot until it is continued
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests([" -j 1"])
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the token pipe is exported to children
+sendline("env")
+expect("MAKEFLAGS=.*--jobserver-auth=\d+,\d+")
+expect_prompt()
+
+# occupy the only job slot
+sendline("sleep 2 &")
+(jobid, pid) = parse_bg_status()
+expect_prompt()
+
+# this job must wait until the background job returned its token
+start = time.time()
+sendline("expr 40 + 2")
+expect("42\r\n")
+assert time.time() - start > 1, "Job started without a jobserver token"
+expect_prompt()
+
+# a stopped job does not hold on to the only job slot
+sendline("sleep 60")
+wait_for_fg_child()
+sendcontrol('z')
+(jobid, statusmsg, cmdline) = parse_job_line()
+assert statusmsg == 'stopped', "Shell did not report stopped job"
+expect_prompt()
+
+start = time.time()
+sendline("expr 1 + 2")
+expect("3\r\n")
+assert time.time() - start < 1, "Stopped job kept its jobserver token"
+expect_prompt()
+
+# bg takes it again, so the next job waits until ^C ends the wait
+run_builtin('bg', jobid)
+expect_prompt()
+sendline("expr 2 + 3")
+time.sleep(0.5)
+sendintr()
+expect_prompt()
+assert "5" not in console.before, "Job started without a jobserver token"
+
+# the shell still works, and gets the slot once the job is gone
+run_builtin('kill', jobid)
+expect_prompt()
+sendline("expr 3 + 4")
+expect("7\r\n")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
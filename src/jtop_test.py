@@ -0,0 +1,65 @@
+#!/usr/bin/python
+#
+# Tests the jtop builtin: a table of the jobs with their CPU use,
+# memory and I/O rates, summed over all processes of each job
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("jtop -s nosuchcolumn")
+expect("jtop: usage")
+expect_prompt()
+
+# an idle job, a busy job and an idle pipeline
+sendline("sleep 30 &")
+expect("\[1\] \d+")
+expect_prompt()
+sendline("dd if=/dev/zero of=/dev/null bs=1 count=50000000 &")
+expect("\[2\] \d+")
+expect_prompt()
+sendline("sleep 30 | sleep 30 &")
+expect("\[3\] \d+")
+expect_prompt()
+time.sleep(0.5)
+
+# the busy job comes first when sorted by CPU use
+sendline("jtop -b -s cpu")
+expect("jtop - 3 jobs, sorted by cpu")
+expect("JID\s+STATE\s+NPROC\s+CPU%\s+RSS\s+READ/s\s+WRITE/s\s+TIME\s+COMMAND")
+expect("\r\n\s+2 Running\s+1\s+[1-9][\d.]*\s.*dd if=/dev/zero.*\r\n")
+expect_prompt()
+
+# two frames sorted by job id; the pipeline has two live processes
+sendline("jtop -b -n 2 -d 0.2 -s jid")
+for frame in range(2):
+    expect("sorted by jid")
+    expect("\r\n\s+1 Running\s+1\s.*sleep 30\r\n"
+           "\s+2 Running\s+1\s.*dd if=/dev/zero.*\r\n"
+           "\s+3 Running\s+2\s.*sleep 30\| sleep 30\r\n")
+expect_prompt()
+
+# the interactive view refreshes until q is pressed
+sendline("jtop -d 0.2")
+expect("q quit")
+expect("sorted by cpu")
+console.send("r")
+expect("sorted by cpu \(reversed\)")
+console.send("q")
+expect_prompt()
+
+sendline("kill 2")
+expect_prompt()
+sendline("kill 1")
+expect_prompt()
+sendline("kill 3")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,395 @@
+/*
+ * libcush - run shell pipelines from C and C++ without a shell.
+ *
+ * Every stage is started with posix_spawnp, whose file actions set up
+ * its pipes and redirections as the shell does (see stage_io.h), so the
+ * application is never forked and no code of ours runs between fork and
+ * exec.  All descriptors the
+ * library opens are close-on-exec; the file actions dup2 them onto
+ * 0, 1 and 2 of the one stage that needs them.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcush.h"
+#include "stage_io.h"
+
+extern char **environ;
+
+/* Stands in for the one in -ll, so that applications need not link it */
+int yywrap(void);
+int yywrap(void) { return 1; }
+
+struct stage {
+    pid_t pid;
+    bool reaped;
+};
+
+struct cush_job {
+    struct ast_pipeline *pipe;  /* The pipeline, owned by the job */
+    struct stage *stages;
+    int nstages;                /* Number of stages started */
+    int nrunning;               /* Of which not yet reaped */
+    pid_t pgid;
+    int fds[3];                 /* The application's ends, or -1 */
+    int pidfd;                  /* Of the last stage, or -1 */
+    int status;                 /* Wait status of the last stage */
+};
+
+/* The parser keeps its state in globals */
+static pthread_mutex_t parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct ast_command_line *
+cush_parse(const char *line)
+{
+    pthread_mutex_lock(&parse_lock);
+    bool quiet = ast_input_quiet;
+    ast_input_quiet = true;
+    /* The parser only reads the line */
+    struct ast_command_line *cline = ast_parse_command_line((char *) line);
+    ast_input_quiet = quiet;
+    pthread_mutex_unlock(&parse_lock);
+
+    if (cline == NULL)
+        errno = EINVAL;
+    return cline;
+}
+
+struct cush_job *
+cush_run(const char *line, int flags)
+{
+    struct ast_command_line *cline = cush_parse(line);
+    if (cline == NULL)
+        return NULL;
+
+    if (list_size(&cline->pipes) != 1) {
+        ast_command_line_free(cline);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct ast_pipeline *pipe = list_entry(list_pop_front(&cline->pipes),
+                                           struct ast_pipeline, elem);
+    ast_command_line_free(cline);
+    return cush_launch(pipe, flags);
+}
+
+static int
+pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void
+close_fd(int *fd)
+{
+    if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+/* Reap stage 'i', waiting for it if 'block'.  Returns true once it has
+ * been reaped. */
+static bool
+reap_stage(struct cush_job *job, int i, bool block)
+{
+    struct stage *stage = &job->stages[i];
+    if (stage->reaped)
+        return true;
+
+    int status = 0;
+    pid_t pid;
+    do {
+        pid = waitpid(stage->pid, &status, block ? 0 : WNOHANG);
+    } while (pid == -1 && errno == EINTR);
+
+    if (pid == 0)
+        return false;
+    /* ECHILD means the application ignores SIGCHLD, so there is no
+     * status to collect */
+    if (pid == -1)
+        status = 0;
+
+    stage->reaped = true;
+    job->nrunning--;
+    if (i == job->nstages - 1)
+        job->status = status;
+    return true;
+}
+
+/* Spawn stage 'i' into the job's process group */
+static int
+spawn_stage(struct cush_job *job, struct ast_command *cmd, int i,
+            int in, int out, int err)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t none, all;
+
+    sigemptyset(&none);
+    sigfillset(&all);
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+
+    /* The stages start with default dispositions and no blocked signals,
+     * whatever the application's threads have set up */
+    int rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+                                      | POSIX_SPAWN_SETSIGMASK
+                                      | POSIX_SPAWN_SETSIGDEF);
+    if (rc == 0)
+        rc = posix_spawnattr_setpgroup(&attr, job->pgid);
+    if (rc == 0)
+        rc = posix_spawnattr_setsigmask(&attr, &none);
+    if (rc == 0)
+        rc = posix_spawnattr_setsigdefault(&attr, &all);
+    if (rc == 0) {
+        struct stage_io io;
+        stage_io_init(&io, job->pipe, cmd, i == 0,
+                      list_next(&cmd->elem) == list_end(&job->pipe->commands),
+                      in, out, err);
+        rc = stage_io_add_actions(&io, &fa);
+    }
+
+    pid_t pid;
+    if (rc == 0)
+        rc = posix_spawnp(&pid, cmd->argv[0], &fa, &attr, cmd->argv, environ);
+
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0)
+        return rc;
+
+    if (i == 0)
+        job->pgid = pid;
+    job->stages[i].pid = pid;
+    job->stages[i].reaped = false;
+    job->nstages++;
+    job->nrunning++;
+    return 0;
+}
+
+struct cush_job *
+cush_launch(struct ast_pipeline *pipe, int flags)
+{
+    int n = list_size(&pipe->commands);
+    struct cush_job *job = calloc(1, sizeof *job);
+    struct stage *stages = calloc(n, sizeof *stages);
+    if (job == NULL || stages == NULL || n == 0) {
+        free(job);
+        free(stages);
+        ast_pipeline_free(pipe);
+        errno = n == 0 ? EINVAL : ENOMEM;
+        return NULL;
+    }
+    job->pipe = pipe;
+    job->stages = stages;
+    job->fds[0] = job->fds[1] = job->fds[2] = -1;
+    job->pidfd = -1;
+
+    /* The child's ends of the pipes to the application */
+    int child[3] = { -1, -1, -1 };
+    int rc = 0;
+    for (int fd = 0; fd < 3 && rc == 0; fd++) {
+        int p[2];
+        if (!(flags & (CUSH_PIPE_STDIN << fd)))
+            continue;
+        if (fd == 0 && pipe->iored_input != NULL)
+            continue;
+        if (pipe2(p, O_CLOEXEC) == -1) {
+            rc = errno;
+            break;
+        }
+        child[fd] = fd == 0 ? p[0] : p[1];
+        job->fds[fd] = fd == 0 ? p[1] : p[0];
+    }
+
+    /* 'in' is the read end of the pipe from the previous stage */
+    int in = child[0];
+    int i = 0;
+    for (struct list_elem *e = list_begin(&pipe->commands);
+         rc == 0 && e != list_end(&pipe->commands); e = list_next(e), i++) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        int p[2] = { -1, child[1] };
+
+        if (i < n - 1 && pipe2(p, O_CLOEXEC) == -1) {
+            rc = errno;
+            break;
+        }
+        rc = spawn_stage(job, cmd, i, in, p[1], child[2]);
+
+        if (in != child[0])
+            close(in);
+        if (p[1] != child[1])
+            close(p[1]);
+        in = p[0];
+    }
+    if (in != child[0])
+        close_fd(&in);
+    for (int fd = 0; fd < 3; fd++)
+        close_fd(&child[fd]);
+
+    if (rc != 0) {
+        if (job->nstages > 0)
+            killpg(job->pgid, SIGKILL);
+        cush_job_free(job);
+        errno = rc;
+        return NULL;
+    }
+
+    job->pidfd = pidfd_open(job->stages[n - 1].pid);
+    if (job->pidfd != -1)
+        fcntl(job->pidfd, F_SETFD, FD_CLOEXEC);
+    return job;
+}
+
+int
+cush_job_stdin(struct cush_job *job)
+{
+    return job->fds[0];
+}
+
+int
+cush_job_stdout(struct cush_job *job)
+{
+    return job->fds[1];
+}
+
+int
+cush_job_stderr(struct cush_job *job)
+{
+    return job->fds[2];
+}
+
+void
+cush_job_close_stdin(struct cush_job *job)
+{
+    close_fd(&job->fds[0]);
+}
+
+pid_t
+cush_job_pgid(struct cush_job *job)
+{
+    return job->pgid;
+}
+
+int
+cush_job_fd(struct cush_job *job)
+{
+    return job->pidfd;
+}
+
+bool
+cush_job_poll(struct cush_job *job, int *status)
+{
+    for (int i = 0; i < job->nstages; i++)
+        reap_stage(job, i, false);
+
+    if (job->nrunning > 0)
+        return false;
+    if (status != NULL)
+        *status = job->status;
+    return true;
+}
+
+int
+cush_job_wait(struct cush_job *job)
+{
+    for (int i = 0; i < job->nstages; i++)
+        reap_stage(job, i, true);
+    return job->status;
+}
+
+/* Milliseconds since an arbitrary point */
+static long long
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int
+cush_wait_any(struct cush_job **jobs, int n, int timeout_ms)
+{
+    struct pollfd *pfd = calloc(n, sizeof *pfd);
+    if (pfd == NULL)
+        return -1;
+
+    long long deadline = now_ms() + timeout_ms;
+    int ready = -1;
+    for (;;) {
+        /* Without pidfds, look again every 10ms.  A pidfd stays
+         * readable once the last stage is reaped, so a job whose other
+         * stages still run is looked at the same way. */
+        bool all_fds = true;
+        for (int i = 0; i < n; i++) {
+            struct cush_job *job = jobs[i];
+            if (cush_job_poll(job, NULL)) {
+                ready = i;
+                goto done;
+            }
+            pfd[i].fd = job->stages[job->nstages - 1].reaped ? -1
+                                                             : job->pidfd;
+            pfd[i].events = POLLIN;
+            all_fds = all_fds && pfd[i].fd != -1;
+        }
+
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            wait_ms = deadline - now_ms();
+            if (wait_ms < 0)
+                goto done;
+        }
+        if (!all_fds && (wait_ms == -1 || wait_ms > 10))
+            wait_ms = 10;
+
+        /* The stages of a job whose pidfd is readable are reaped,
+         * without waiting, at the top of the loop */
+        if (poll(pfd, n, wait_ms) == -1 && errno != EINTR)
+            goto done;
+    }
+
+done:
+    free(pfd);
+    return ready;
+}
+
+int
+cush_job_kill(struct cush_job *job, int sig)
+{
+    if (job->nrunning == 0)
+        return 0;
+    return killpg(job->pgid, sig);
+}
+
+void
+cush_job_free(struct cush_job *job)
+{
+    if (!cush_job_poll(job, NULL)) {
+        killpg(job->pgid, SIGKILL);
+        cush_job_wait(job);
+    }
+    for (int fd = 0; fd < 3; fd++)
+        close_fd(&job->fds[fd]);
+    close_fd(&job->pidfd);
+    ast_pipeline_free(job->pipe);
+    free(job->stages);
+    free(job);
+}
@@ -0,0 +1,91 @@
+#ifndef __LIBCUSH_H
+#define __LIBCUSH_H
+
+/*
+ * libcush - run shell pipelines from C and C++ without a shell.
+ *
+ * A command line is parsed with the shell's own grammar, and each stage
+ * of its pipeline is started with one posix_spawnp, so no intermediate
+ * /bin/sh runs.  The stages form their own process group and are reaped
+ * by pid only, so the library neither installs a SIGCHLD handler nor
+ * takes the application's other children.  Every job has a pollable
+ * descriptor, so an application can manage many jobs from one event
+ * loop.
+ *
+ * Parsing is serialized with a lock; everything else works on the job
+ * it is given, and jobs may be used from different threads.
+ *
+ * Link with libcush.a or libcush.so, built along with the shell.
+ */
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "shell-ast.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Flags of cush_launch: connect stdin, stdout or stderr of the job to
+ * a pipe instead of the application's.  Redirections on the command
+ * line take precedence. */
+#define CUSH_PIPE_STDIN  1
+#define CUSH_PIPE_STDOUT 2
+#define CUSH_PIPE_STDERR 4
+
+struct cush_job;
+
+/* Parse a command line.  Returns NULL, with errno set to EINVAL, if it
+ * has a syntax error.  Free it with ast_command_line_free. */
+struct ast_command_line *cush_parse(const char *line);
+
+/* Start the stages of 'pipe', which is freed with the job.  Returns
+ * NULL, with errno set and 'pipe' freed, if a stage could not be
+ * started, for example ENOENT if a program was not found; stages
+ * already started are then killed. */
+struct cush_job *cush_launch(struct ast_pipeline *pipe, int flags);
+
+/* Parse and launch a command line of exactly one pipeline */
+struct cush_job *cush_run(const char *line, int flags);
+
+/* The application's ends of the job's pipes, or -1.  They belong to
+ * the job, but may be closed early with cush_job_close_stdin. */
+int cush_job_stdin(struct cush_job *job);
+int cush_job_stdout(struct cush_job *job);
+int cush_job_stderr(struct cush_job *job);
+
+/* Close the pipe to the job's stdin, to signal end of input */
+void cush_job_close_stdin(struct cush_job *job);
+
+/* The process group of the job's stages */
+pid_t cush_job_pgid(struct cush_job *job);
+
+/* A descriptor that polls readable once the last stage has exited,
+ * or -1 if the kernel lacks pidfd_open.  Call cush_job_poll then. */
+int cush_job_fd(struct cush_job *job);
+
+/* Reap the stages that have exited without blocking.  Returns true,
+ * with the wait status of the last stage in '*status', once all have
+ * exited. */
+bool cush_job_poll(struct cush_job *job, int *status);
+
+/* Wait for all stages to exit and return the wait status of the last */
+int cush_job_wait(struct cush_job *job);
+
+/* Wait until all stages of one of 'n' jobs have exited, or for
+ * 'timeout_ms' milliseconds (-1 for no limit).  Returns its index after
+ * reaping its stages, or -1 on timeout or error. */
+int cush_wait_any(struct cush_job **jobs, int n, int timeout_ms);
+
+/* Send 'sig' to all stages of the job */
+int cush_job_kill(struct cush_job *job, int sig);
+
+/* Close the pipes and free the job.  Stages still running are killed
+ * with SIGKILL and reaped. */
+void cush_job_free(struct cush_job *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBCUSH_H */
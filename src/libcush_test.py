@@ -0,0 +1,94 @@
+#!/usr/bin/python
+#
+# Tests libcush: a C program linked with libcush.a launches pipelines,
+# feeds and reads them through pipes, waits for several at once and
+# gets the exit status of the last stage
+#
+
+import os, shutil, subprocess, tempfile
+from testutils import *
+
+program = r"""
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "libcush.h"
+
+static void
+drain(int fd)
+{
+    char buf[256];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+        fwrite(buf, 1, n, stdout);
+}
+
+int
+main(void)
+{
+    struct cush_job *job = cush_run("tr a-z A-Z | sed s/HELLO/BYE/",
+                                    CUSH_PIPE_STDIN | CUSH_PIPE_STDOUT);
+    write(cush_job_stdin(job), "hello world\n", 12);
+    cush_job_close_stdin(job);
+    drain(cush_job_stdout(job));
+    printf("status %d\n", WEXITSTATUS(cush_job_wait(job)));
+    cush_job_free(job);
+
+    job = cush_run("sh -c \"echo oops >&2; exit 3\"", CUSH_PIPE_STDERR);
+    drain(cush_job_stderr(job));
+    printf("status %d\n", WEXITSTATUS(cush_job_wait(job)));
+    cush_job_free(job);
+
+    struct cush_job *jobs[2] = {
+        cush_run("sleep 5", 0),
+        cush_run("sleep 0.1", 0),
+    };
+    printf("first %d\n", cush_wait_any(jobs, 2, 2000));
+    cush_job_kill(jobs[0], SIGTERM);
+    printf("signal %d\n", WTERMSIG(cush_job_wait(jobs[0])));
+    cush_job_free(jobs[0]);
+    cush_job_free(jobs[1]);
+
+    /* The last stage exits at once, but the job is not done */
+    jobs[0] = cush_run("sleep 5 | true", 0);
+    time_t start = time(NULL);
+    printf("timeout %d\n", cush_wait_any(jobs, 1, 300));
+    printf("waited %s\n", time(NULL) - start < 3 ? "briefly" : "too long");
+    cush_job_free(jobs[0]);
+
+    errno = 0;
+    if (cush_run("no-such-command-for-libcush", 0) == NULL)
+        printf("launch %s\n", strerror(errno));
+    if (cush_run("echo a | | echo b", 0) == NULL && errno == EINVAL)
+        printf("syntax error\n");
+    return 0;
+}
+"""
+
+expected = """BYE WORLD
+status 0
+oops
+status 3
+first 1
+signal 15
+timeout -1
+waited briefly
+launch No such file or directory
+syntax error
+"""
+
+tmpdir = tempfile.mkdtemp()
+source = os.path.join(tmpdir, "embed.c")
+binary = os.path.join(tmpdir, "embed")
+open(source, "w").write(program)
+subprocess.check_call(["cc", "-I.", "-o", binary, source, "libcush.a",
+                       "-lpthread"])
+output = subprocess.Popen([binary], stdout=subprocess.PIPE).communicate()[0]
+shutil.rmtree(tmpdir)
+assert output == expected, "unexpected output: " + output
+
+test_success()
@@ -0,0 +1,638 @@
+/*
+ * A small line editor.
+ *
+ * The text before the cursor is at the start of the buffer and the
+ * text after it at the end, with the gap in between, so an insertion
+ * or deletion at the cursor moves no text, and moving the cursor moves
+ * only the bytes it passes.  Input is read in blocks and the line is
+ * redrawn once a block has been handled, not once per key.
+ */
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "lineedit.h"
+
+#define INPUT_BLOCK 65536
+
+static const char paste_end[] = "\033[201~";
+#define PASTE_END_LEN (sizeof paste_end - 1)
+
+int (*lineedit_event_hook)(void);
+
+/* The line being edited */
+struct gap_buffer {
+    char *text;
+    size_t size;        /* Allocated */
+    size_t gap_start;   /* The cursor */
+    size_t gap_end;
+};
+
+struct editor {
+    struct gap_buffer line;
+    const char *prompt;
+    size_t prompt_width;
+    int fd;             /* Input; the line is drawn on stdout */
+    size_t scroll;      /* First byte of the line on the screen */
+    int history_pos;    /* Entry shown, or history_len for a new line */
+    char *new_line;     /* The new line while browsing the history */
+    char input[INPUT_BLOCK];
+    size_t input_pos, input_end;
+};
+
+/* Output of one redraw */
+struct output {
+    char *data;
+    size_t len, cap;
+};
+
+static char **history;
+static int history_len, history_cap;
+
+static size_t
+gb_length(struct gap_buffer *gb)
+{
+    return gb->size - (gb->gap_end - gb->gap_start);
+}
+
+static char
+gb_at(struct gap_buffer *gb, size_t i)
+{
+    return i < gb->gap_start ? gb->text[i]
+                             : gb->text[i + gb->gap_end - gb->gap_start];
+}
+
+/* Make room for 'n' more bytes in the gap */
+static bool
+gb_reserve(struct gap_buffer *gb, size_t n)
+{
+    if (gb->gap_end - gb->gap_start >= n)
+        return true;
+
+    size_t tail = gb->size - gb->gap_end;
+    size_t size = gb->size * 2;
+    if (size < gb_length(gb) + n + 256)
+        size = gb_length(gb) + n + 256;
+    char *text = realloc(gb->text, size);
+    if (text == NULL)
+        return false;
+    memmove(text + size - tail, text + gb->gap_end, tail);
+    gb->text = text;
+    gb->gap_end = size - tail;
+    gb->size = size;
+    return true;
+}
+
+static void
+gb_insert(struct gap_buffer *gb, const char *s, size_t n)
+{
+    if (!gb_reserve(gb, n))
+        return;
+    memcpy(gb->text + gb->gap_start, s, n);
+    gb->gap_start += n;
+}
+
+static void
+gb_move_to(struct gap_buffer *gb, size_t pos)
+{
+    if (pos < gb->gap_start) {
+        size_t n = gb->gap_start - pos;
+        memmove(gb->text + gb->gap_end - n, gb->text + pos, n);
+        gb->gap_start -= n;
+        gb->gap_end -= n;
+    } else if (pos > gb->gap_start) {
+        size_t n = pos - gb->gap_start;
+        memmove(gb->text + gb->gap_start, gb->text + gb->gap_end, n);
+        gb->gap_start += n;
+        gb->gap_end += n;
+    }
+}
+
+/* Delete the bytes from 'from' to 'to' and leave the cursor there */
+static void
+gb_delete(struct gap_buffer *gb, size_t from, size_t to)
+{
+    gb_move_to(gb, to);
+    gb->gap_start = from;
+}
+
+static void
+gb_set(struct gap_buffer *gb, const char *s)
+{
+    gb->gap_start = 0;
+    gb->gap_end = gb->size;
+    gb_insert(gb, s, strlen(s));
+}
+
+/* Return the line as a string */
+static char *
+gb_string(struct gap_buffer *gb)
+{
+    size_t tail = gb->size - gb->gap_end;
+    char *s = malloc(gb_length(gb) + 1);
+    if (s == NULL)
+        return NULL;
+    memcpy(s, gb->text, gb->gap_start);
+    memcpy(s + gb->gap_start, gb->text + gb->gap_end, tail);
+    s[gb->gap_start + tail] = '\0';
+    return s;
+}
+
+static void
+output_add(struct output *out, const char *s, size_t n)
+{
+    if (out->len + n > out->cap) {
+        size_t cap = out->cap * 2 + n + 256;
+        char *data = realloc(out->data, cap);
+        if (data == NULL)
+            return;
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, s, n);
+    out->len += n;
+}
+
+static void
+write_all(int fd, const char *s, size_t n)
+{
+    while (n > 0) {
+        ssize_t written = write(fd, s, n);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        s += written;
+        n -= written;
+    }
+}
+
+/* UTF-8 continuation bytes take no column */
+static bool
+is_continuation(char c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+static size_t
+text_width(const char *s)
+{
+    size_t width = 0;
+    for (; *s != '\0'; s++)
+        width += !is_continuation(*s);
+    return width;
+}
+
+/* Redraw the prompt and the part of the line around the cursor */
+static void
+refresh(struct editor *e)
+{
+    struct winsize ws;
+    size_t cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        cols = ws.ws_col;
+
+    size_t avail = cols > e->prompt_width + 1 ? cols - e->prompt_width - 1 : 1;
+    size_t len = gb_length(&e->line);
+    size_t pos = e->line.gap_start;
+    if (pos < e->scroll)
+        e->scroll = pos;
+    if (pos - e->scroll > avail)
+        e->scroll = pos - avail;
+    if (len - e->scroll < avail && e->scroll > 0)
+        e->scroll = len > avail ? len - avail : 0;
+    size_t end = e->scroll + avail < len ? e->scroll + avail : len;
+
+    /* Clear the old line before the new one is drawn, so that a line
+     * drawn with the cursor at its end ends with its text */
+    struct output out = { NULL, 0, 0 };
+    output_add(&out, "\r", 1);
+    output_add(&out, e->prompt, strlen(e->prompt));
+    output_add(&out, "\033[K", 3);
+    size_t column = e->prompt_width;
+    for (size_t i = e->scroll; i < end; i++) {
+        char c = gb_at(&e->line, i);
+        if ((unsigned char) c < ' ' || c == 0x7f)
+            c = '?';
+        output_add(&out, &c, 1);
+        if (i < pos && !is_continuation(c))
+            column++;
+    }
+    if (pos < end) {
+        char move[32];
+        int n = snprintf(move, sizeof move, "\r\033[%zuC", column);
+        output_add(&out, move, n);
+    }
+    write_all(STDOUT_FILENO, out.data, out.len);
+    free(out.data);
+}
+
+/* Read more input, calling the event hook while waiting */
+static bool
+fill_input(struct editor *e)
+{
+    for (;;) {
+        if (lineedit_event_hook != NULL) {
+            struct pollfd pfd = { .fd = e->fd, .events = POLLIN };
+            int ready = poll(&pfd, 1, 100);
+            if (ready == 0) {
+                lineedit_event_hook();
+                continue;
+            }
+        }
+        ssize_t n = read(e->fd, e->input, sizeof e->input);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        e->input_pos = 0;
+        e->input_end = n;
+        return true;
+    }
+}
+
+/* Return the next byte of input, or -1 at EOF */
+static int
+next_byte(struct editor *e)
+{
+    if (e->input_pos == e->input_end && !fill_input(e))
+        return -1;
+    return (unsigned char) e->input[e->input_pos++];
+}
+
+/* Insert a bracketed paste, reading it straight into the gap */
+static void
+paste(struct editor *e)
+{
+    struct gap_buffer *gb = &e->line;
+    size_t start = gb->gap_start;
+    size_t scanned = start;
+
+    gb_insert(gb, e->input + e->input_pos, e->input_end - e->input_pos);
+    e->input_pos = e->input_end = 0;
+    for (;;) {
+        char *text = gb->text;
+        char *found = memmem(text + scanned, gb->gap_start - scanned,
+                             paste_end, PASTE_END_LEN);
+        if (found != NULL) {
+            /* Keep what follows the paste as input */
+            size_t after = found + PASTE_END_LEN - text;
+            e->input_end = gb->gap_start - after;
+            memcpy(e->input, text + after, e->input_end);
+            gb->gap_start = found - text;
+            return;
+        }
+        if (gb->gap_start - start >= PASTE_END_LEN)
+            scanned = gb->gap_start - (PASTE_END_LEN - 1);
+
+        if (!gb_reserve(gb, sizeof e->input))
+            return;
+        ssize_t n = read(e->fd, gb->text + gb->gap_start, sizeof e->input);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        gb->gap_start += n;
+    }
+}
+
+/* Move the cursor by one character */
+static void
+move_left(struct gap_buffer *gb)
+{
+    size_t pos = gb->gap_start;
+    while (pos > 0 && is_continuation(gb_at(gb, --pos)))
+        continue;
+    gb_move_to(gb, pos);
+}
+
+static void
+move_right(struct gap_buffer *gb)
+{
+    size_t pos = gb->gap_start, len = gb_length(gb);
+    if (pos < len)
+        pos++;
+    while (pos < len && is_continuation(gb_at(gb, pos)))
+        pos++;
+    gb_move_to(gb, pos);
+}
+
+/* The start of the word before, or the end of the word after, 'pos' */
+static size_t
+word_left(struct gap_buffer *gb, size_t pos)
+{
+    while (pos > 0 && gb_at(gb, pos - 1) == ' ')
+        pos--;
+    while (pos > 0 && gb_at(gb, pos - 1) != ' ')
+        pos--;
+    return pos;
+}
+
+static size_t
+word_right(struct gap_buffer *gb, size_t pos)
+{
+    size_t len = gb_length(gb);
+    while (pos < len && gb_at(gb, pos) == ' ')
+        pos++;
+    while (pos < len && gb_at(gb, pos) != ' ')
+        pos++;
+    return pos;
+}
+
+/* Show history entry 'pos', or the new line */
+static void
+show_history(struct editor *e, int pos)
+{
+    if (pos < 0 || pos > history_len || pos == e->history_pos)
+        return;
+    if (e->history_pos == history_len) {
+        free(e->new_line);
+        e->new_line = gb_string(&e->line);
+    }
+    e->history_pos = pos;
+    gb_set(&e->line, pos == history_len ? (e->new_line ? e->new_line : "")
+                                        : history[pos]);
+}
+
+/* Handle the rest of an escape sequence */
+static void
+handle_escape(struct editor *e)
+{
+    struct gap_buffer *gb = &e->line;
+    int c = next_byte(e);
+    if (c == 'b' || c == 'f') {
+        gb_move_to(gb, c == 'b' ? word_left(gb, gb->gap_start)
+                                : word_right(gb, gb->gap_start));
+        return;
+    }
+    if (c != '[' && c != 'O')
+        return;
+
+    /* CSI or SS3: parameters, then the final byte */
+    int param = 0;
+    do {
+        c = next_byte(e);
+        if (c >= '0' && c <= '9')
+            param = param * 10 + c - '0';
+    } while (c != -1 && (c < 0x40 || c > 0x7e));
+
+    switch (c) {
+    case 'A': show_history(e, e->history_pos - 1); break;
+    case 'B': show_history(e, e->history_pos + 1); break;
+    case 'C': move_right(gb); break;
+    case 'D': move_left(gb); break;
+    case 'H': gb_move_to(gb, 0); break;
+    case 'F': gb_move_to(gb, gb_length(gb)); break;
+    case '~':
+        if (param == 1 || param == 7)
+            gb_move_to(gb, 0);
+        else if (param == 4 || param == 8)
+            gb_move_to(gb, gb_length(gb));
+        else if (param == 3 && gb->gap_start < gb_length(gb)) {
+            size_t from = gb->gap_start;
+            move_right(gb);
+            gb_delete(gb, from, gb->gap_start);
+        } else if (param == 200)
+            paste(e);
+        break;
+    }
+}
+
+/* Edit a line on the terminal.  Returns false at EOF. */
+static bool
+edit(struct editor *e)
+{
+    struct gap_buffer *gb = &e->line;
+    for (;;) {
+        if (e->input_pos == e->input_end)
+            refresh(e);
+        int c = next_byte(e);
+        size_t pos = gb->gap_start;
+        switch (c) {
+        case -1:
+            write_all(STDOUT_FILENO, "\033[?2004l", 8);
+            refresh(e);
+            return gb_length(gb) > 0;
+        case '\r':
+        case '\n':
+            write_all(STDOUT_FILENO, "\033[?2004l", 8);
+            refresh(e);
+            return true;
+        case CTRL('A'):
+            gb_move_to(gb, 0);
+            break;
+        case CTRL('B'):
+            move_left(gb);
+            break;
+        case CTRL('C'):
+            gb_move_to(gb, gb_length(gb));
+            refresh(e);
+            write_all(STDOUT_FILENO, "^C\033[?2004l", 10);
+            gb_set(gb, "");
+            return true;
+        case CTRL('D'):
+            if (gb_length(gb) == 0) {
+                write_all(STDOUT_FILENO, "\033[?2004l", 8);
+                return false;
+            }
+            move_right(gb);
+            gb_delete(gb, pos, gb->gap_start);
+            break;
+        case CTRL('E'):
+            gb_move_to(gb, gb_length(gb));
+            break;
+        case CTRL('F'):
+            move_right(gb);
+            break;
+        case CTRL('H'):
+        case 0x7f:
+            move_left(gb);
+            gb_delete(gb, gb->gap_start, pos);
+            break;
+        case CTRL('K'):
+            gb_delete(gb, pos, gb_length(gb));
+            break;
+        case CTRL('L'):
+            write_all(STDOUT_FILENO, "\033[H\033[2J", 7);
+            break;
+        case CTRL('N'):
+            show_history(e, e->history_pos + 1);
+            break;
+        case CTRL('P'):
+            show_history(e, e->history_pos - 1);
+            break;
+        case CTRL('T'):
+            if (pos > 0 && gb_length(gb) > 1) {
+                if (pos == gb_length(gb))
+                    gb_move_to(gb, --pos);
+                char swap[2] = { gb_at(gb, pos), gb_at(gb, pos - 1) };
+                gb_delete(gb, pos - 1, pos + 1);
+                gb_insert(gb, swap, 2);
+            }
+            break;
+        case CTRL('U'):
+            gb_delete(gb, 0, pos);
+            break;
+        case CTRL('W'):
+            gb_delete(gb, word_left(gb, pos), pos);
+            break;
+        case '\033':
+            handle_escape(e);
+            break;
+        default:
+            if (c >= ' ' || c == '\t') {
+                char ch = c;
+                gb_insert(gb, &ch, 1);
+            }
+            break;
+        }
+    }
+}
+
+/* Read a line from input that is not a terminal */
+static bool
+read_plain(struct editor *e)
+{
+    int c;
+    while ((c = next_byte(e)) != -1 && c != '\n') {
+        char ch = c;
+        gb_insert(&e->line, &ch, 1);
+    }
+    return c != -1 || gb_length(&e->line) > 0;
+}
+
+char *
+lineedit_read(const char *prompt)
+{
+    /* The editor keeps its unused input for the next line */
+    static struct editor *e;
+    if (e == NULL) {
+        e = calloc(1, sizeof *e);
+        if (e == NULL)
+            return NULL;
+        e->fd = STDIN_FILENO;
+    }
+    e->prompt = prompt;
+    e->prompt_width = text_width(prompt);
+    e->scroll = 0;
+    e->history_pos = history_len;
+    gb_set(&e->line, "");
+
+    fflush(stdout);
+    struct termios saved;
+    bool done;
+    if (tcgetattr(e->fd, &saved) == 0) {
+        struct termios raw = saved;
+        raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+        raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(e->fd, TCSADRAIN, &raw);
+        write_all(STDOUT_FILENO, "\033[?2004h", 8);
+        done = edit(e);
+        write_all(STDOUT_FILENO, "\n", 1);
+        tcsetattr(e->fd, TCSADRAIN, &saved);
+    } else {
+        write_all(STDOUT_FILENO, prompt, strlen(prompt));
+        done = read_plain(e);
+    }
+    free(e->new_line);
+    e->new_line = NULL;
+    return done ? gb_string(&e->line) : NULL;
+}
+
+/* Append a line to the history, ignoring empty lines */
+void
+lineedit_add_history(const char *line)
+{
+    if (line[0] == '\0')
+        return;
+    if (history_len == history_cap) {
+        int cap = history_cap ? history_cap * 2 : 64;
+        char **entries = realloc(history, cap * sizeof *entries);
+        if (entries == NULL)
+            return;
+        history = entries;
+        history_cap = cap;
+    }
+    char *copy = strdup(line);
+    if (copy != NULL)
+        history[history_len++] = copy;
+}
+
+int
+lineedit_history_length(void)
+{
+    return history_len;
+}
+
+const char *
+lineedit_history_get(int i)
+{
+    return i >= 0 && i < history_len ? history[i] : NULL;
+}
+
+/* Find the entry a reference after '!' at 's' stands for, and the
+ * length of the reference */
+static const char *
+find_event(const char *s, size_t *len)
+{
+    if (s[0] == '!') {
+        *len = 1;
+        return lineedit_history_get(history_len - 1);
+    }
+    if ((s[0] >= '0' && s[0] <= '9') || (s[0] == '-' && s[1] >= '0'
+                                                      && s[1] <= '9')) {
+        char *end;
+        long n = strtol(s, &end, 10);
+        *len = end - s;
+        return lineedit_history_get(n < 0 ? history_len + n : n - 1);
+    }
+    *len = strcspn(s, " \t\n;&|<>:");
+    for (int i = history_len - 1; i >= 0; i--)
+        if (strncmp(history[i], s, *len) == 0)
+            return history[i];
+    return NULL;
+}
+
+int
+lineedit_history_expand(const char *line, char **expansion)
+{
+    struct output out = { NULL, 0, 0 };
+    bool quoted = false, expanded = false;
+
+    for (const char *s = line; *s != '\0'; s++) {
+        if (*s == '\'')
+            quoted = !quoted;
+        if (*s == '\\' && s[1] != '\0') {
+            output_add(&out, s++, 2);
+            continue;
+        }
+        if (*s != '!' || quoted || strchr(" \t\n=(", s[1]) != NULL) {
+            output_add(&out, s, 1);
+            continue;
+        }
+
+        size_t len;
+        const char *event = find_event(s + 1, &len);
+        if (event == NULL) {
+            free(out.data);
+            if (asprintf(expansion, "!%.*s: event not found",
+                         (int) len, s + 1) == -1)
+                *expansion = NULL;
+            return -1;
+        }
+        output_add(&out, event, strlen(event));
+        s += len;
+        expanded = true;
+    }
+    output_add(&out, "", 1);
+    *expansion = out.data;
+    return expanded;
+}
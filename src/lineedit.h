@@ -0,0 +1,45 @@
+#ifndef __LINEEDIT_H
+#define __LINEEDIT_H
+
+#include <stdbool.h>
+
+/*
+ * A small line editor for the prompt, used instead of GNU readline with
+ * -e or when the shell is built with NO_READLINE.
+ *
+ * The terminal is put into raw mode while a line is read.  The line is
+ * kept in a gap buffer, so typing and deleting at the cursor cost the
+ * same anywhere in the line, and only the part of the line that fits
+ * on the screen is redrawn, scrolling horizontally.  Bracketed paste is
+ * enabled: a paste is taken from the input buffer as one block and
+ * inserted with a single copy, however large.
+ *
+ * Keys: ^A/Home, ^E/End, ^B/Left, ^F/Right, ^P/Up and ^N/Down for
+ * history, ^H/Backspace, ^D/Delete (EOF on an empty line), ^K, ^U, ^W,
+ * ^L, ^T, and ^C to discard the line.
+ */
+
+/* Print 'prompt' and read a line.  Returns the line, to be freed by the
+ * caller, or NULL at EOF.  Input that is not a terminal is read without
+ * editing. */
+char *lineedit_read(const char *prompt);
+
+/* Called about every 100ms while lineedit_read waits for input */
+extern int (*lineedit_event_hook)(void);
+
+/* Append a line to the history, unless it is empty */
+void lineedit_add_history(const char *line);
+
+/* The number of lines in the history, and line 'i' of them, oldest
+ * first */
+int lineedit_history_length(void);
+const char *lineedit_history_get(int i);
+
+/* Expand the history references !!, !n, !-n and !prefix in 'line',
+ * except in single quotes or after a backslash.  Sets '*expansion' to
+ * a new string and returns 0 if there was nothing to expand, 1 if
+ * something was, and -1, with an error message in '*expansion', if a
+ * reference was not found; as history_expand in GNU readline. */
+int lineedit_history_expand(const char *line, char **expansion);
+
+#endif /* __LINEEDIT_H */
@@ -0,0 +1,61 @@
+#!/usr/bin/python
+#
+# Tests the built-in line editor selected with -e: editing keys, history
+# and its expansion, ^C, and bracketed paste of a large command line
+#
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests([" -e"])
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("echo hello")
+expect_exact("\r\nhello\r\n")
+expect_prompt()
+
+# ^A moves to the start, ^U deletes up to the cursor, ^K after it
+console.send("cho edited\x01e\r")
+expect_exact("\r\nedited\r\n")
+expect_prompt()
+console.send("garbage\x15echo killed\r")
+expect_exact("\r\nkilled\r\n")
+expect_prompt()
+console.send("echo kept tail\x02\x02\x02\x02\x0b\r")
+expect_exact("\r\nkept\r\n")
+expect_prompt()
+
+# ^C discards the line
+console.send("echo discarded\x03")
+expect_exact("^C")
+expect_prompt()
+
+# history, its expansion, and recalling the last line with up arrow
+sendline("history")
+expect_exact("1 echo hello\r\n2 echo edited\r\n3 echo killed\r\n"
+             "4 echo kept \r\n5 history\r\n")
+expect_prompt()
+sendline("!3")
+expect_exact("\r\nkilled\r\n")
+expect_prompt()
+console.send("\x1b[A\r")
+expect_exact("\r\nkilled\r\n")
+expect_prompt()
+
+# a paste is inserted as a whole
+console.send("\x1b[200~echo pasted\x1b[201~\r")
+expect_exact("\r\npasted\r\n")
+expect_prompt()
+words = " ".join(["y" * 99] * 2000)
+console.send("\x1b[200~echo " + words + " | wc -c\x1b[201~\r")
+assert console.expect("\r\n\s*200000\r\n", timeout=10) == 0, "large paste"
+expect_prompt()
+
+sendline("exit");
+
+# ensure that no extra characters are output after exiting
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -26,8 +26,9 @@ bgjob_regex = "\[(\d+)\] (\d+)"
 #
 # a regexp matching a job status when printed using the 'jobs' command
 # must capture (jobid, jobstatus, commandline)
+# Running jobs may be followed by an ETA.
 #
-job_status_regex =  "\[(\d+)\].?\s+(\S+)\s+\((.+?)\)\r\n"
+job_status_regex =  "\[(\d+)\].?\s+(\S+)\s+\((.+?)\)(?:\tETA [^\r\n]*)?\r\n"
 
 #
 # job status messages your shell prints
@@ -0,0 +1,186 @@
+/*
+ * Per-process hardware and software counters via perf_event_open.
+ *
+ * The counters of a process are opened by the shell after fork, while
+ * the child waits, with enable_on_exec so the shell's own work in the
+ * child is not counted, and with inherit so that they include the
+ * processes the command starts.
+ */
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf_counters.h"
+#include "utils.h"
+
+/* Description of each counter */
+static struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} counters[PERF_NCOUNTERS] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+                      "cycles" },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+                            "instructions" },
+    [PERF_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+                            "cache-misses" },
+    [PERF_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,
+                          "task-clock" },
+    [PERF_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE,
+                                PERF_COUNT_SW_CONTEXT_SWITCHES,
+                                "context-switches" },
+    [PERF_PAGE_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,
+                           "page-faults" },
+};
+
+/* Set once perf_event_paranoid turned out to forbid counting in the
+ * kernel; the counters then only count user space */
+static bool user_only;
+
+static int
+open_counter(pid_t pid, enum perf_counter c, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = counters[c].type;
+    attr.config = counters[c].config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;
+    /* Members follow the state of their group leader */
+    attr.disabled = group_fd == -1;
+    attr.enable_on_exec = group_fd == -1;
+    attr.exclude_hv = 1;
+
+    for (;;) {
+        attr.exclude_kernel = user_only;
+        int fd = syscall(SYS_perf_event_open, &attr, pid, -1, group_fd,
+                         PERF_FLAG_FD_CLOEXEC);
+        if (fd == -1 && (errno == EACCES || errno == EPERM) && !user_only) {
+            user_only = true;
+            continue;
+        }
+        return fd;
+    }
+}
+
+/* Open the group of counters 'first' .. 'last' */
+static bool
+open_group(pid_t pid, struct perf_counters *pc,
+           enum perf_counter first, enum perf_counter last)
+{
+    pc->fd[first] = open_counter(pid, first, -1);
+    if (pc->fd[first] == -1)
+        return false;
+
+    for (int c = first + 1; c <= last; c++)
+        pc->fd[c] = open_counter(pid, c, pc->fd[first]);
+    return true;
+}
+
+/* Mark all counters as not open */
+void
+perf_counters_init(struct perf_counters *pc)
+{
+    for (int c = 0; c < PERF_NCOUNTERS; c++)
+        pc->fd[c] = -1;
+}
+
+/* Open the hardware and software groups on 'pid' */
+bool
+perf_counters_open(pid_t pid, struct perf_counters *pc)
+{
+    static bool warned;
+
+    perf_counters_init(pc);
+    /* Hardware counters are often missing in virtual machines */
+    open_group(pid, pc, PERF_CYCLES, PERF_CACHE_MISSES);
+    if (open_group(pid, pc, PERF_TASK_CLOCK, PERF_PAGE_FAULTS)
+        || pc->fd[PERF_CYCLES] != -1)
+        return true;
+
+    if (!warned) {
+        utils_error("profile: perf_event_open failed: ");
+        warned = true;
+    }
+    return false;
+}
+
+/* Read and close the counters, async-signal-safe */
+void
+perf_counters_read(struct perf_counters *pc, struct perf_values *v)
+{
+    memset(v, 0, sizeof *v);
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        uint64_t buf[3];    /* value, time enabled, time running */
+        if (pc->fd[c] == -1)
+            continue;
+
+        if (read(pc->fd[c], buf, sizeof buf) == sizeof buf) {
+            v->valid[c] = true;
+            v->value[c] = buf[0];
+            v->enabled[c] = buf[1];
+            v->running[c] = buf[2];
+        }
+        close(pc->fd[c]);
+        pc->fd[c] = -1;
+    }
+}
+
+/* Add 'v' to 'sum' */
+void
+perf_values_add(struct perf_values *sum, const struct perf_values *v)
+{
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        if (!v->valid[c])
+            continue;
+
+        sum->valid[c] = true;
+        sum->value[c] += v->value[c];
+        sum->enabled[c] += v->enabled[c];
+        sum->running[c] += v->running[c];
+    }
+}
+
+/* Return the value of a counter, scaled up if it was multiplexed */
+static double
+scaled_value(const struct perf_values *v, enum perf_counter c)
+{
+    if (v->running[c] == 0)
+        return 0;
+    return (double) v->value[c] * v->enabled[c] / v->running[c];
+}
+
+/* Print the counters in the style of perf stat */
+void
+perf_values_print(FILE *out, const struct perf_values *v)
+{
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        if (!v->valid[c]) {
+            fprintf(out, "%18s  %s\n", "<not supported>", counters[c].name);
+            continue;
+        }
+
+        if (c == PERF_TASK_CLOCK)
+            fprintf(out, "%18.3f  %s (ms)", scaled_value(v, c) / 1e6,
+                    counters[c].name);
+        else
+            fprintf(out, "%18.0f  %s", scaled_value(v, c), counters[c].name);
+        if (user_only && c != PERF_TASK_CLOCK)
+            fprintf(out, ":u");
+
+        if (c == PERF_INSTRUCTIONS && v->valid[PERF_CYCLES]
+            && scaled_value(v, PERF_CYCLES) > 0)
+            fprintf(out, "\t# %.2f insn per cycle",
+                    scaled_value(v, c) / scaled_value(v, PERF_CYCLES));
+        if (v->running[c] < v->enabled[c])
+            fprintf(out, "\t(%.1f%%)", 100.0 * v->running[c] / v->enabled[c]);
+        fprintf(out, "\n");
+    }
+}
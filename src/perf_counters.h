@@ -0,0 +1,54 @@
+#ifndef __PERF_COUNTERS_H
+#define __PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Counters measured by the profile prefix.  The first three form the
+ * hardware group, the others the software group. */
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_TASK_CLOCK,
+    PERF_CONTEXT_SWITCHES,
+    PERF_PAGE_FAULTS,
+    PERF_NCOUNTERS
+};
+
+/* The counter file descriptors of one process, -1 if not open */
+struct perf_counters {
+    int fd[PERF_NCOUNTERS];
+};
+
+/* Counter values, or the sum over several processes */
+struct perf_values {
+    bool valid[PERF_NCOUNTERS];           /* True if the counter was open */
+    unsigned long long value[PERF_NCOUNTERS];
+    unsigned long long enabled[PERF_NCOUNTERS]; /* Time enabled in ns */
+    unsigned long long running[PERF_NCOUNTERS]; /* Time counted in ns, less
+                                                   than enabled if the PMU
+                                                   was multiplexed */
+};
+
+/* Mark all counters of 'pc' as not open */
+void perf_counters_init(struct perf_counters *pc);
+
+/* Open the counter groups on 'pid'.  Counting starts when 'pid' calls
+ * exec and includes its descendants.  Falls back to the software group
+ * if the hardware counters are not available.
+ * Returns false if no counter could be opened. */
+bool perf_counters_open(pid_t pid, struct perf_counters *pc);
+
+/* Read the counters of 'pc' into 'v' and close them.
+ * Async-signal-safe. */
+void perf_counters_read(struct perf_counters *pc, struct perf_values *v);
+
+/* Add 'v' to 'sum' */
+void perf_values_add(struct perf_values *sum, const struct perf_values *v);
+
+/* Print 'v', one counter per line */
+void perf_values_print(FILE *out, const struct perf_values *v);
+
+#endif /* __PERF_COUNTERS_H */
@@ -0,0 +1,96 @@
+#!/usr/bin/python
+#
+# Tests set -o placement: each stage of a pipeline is pinned to a core
+# of its own, all within one last level cache, as far as the machine's
+# cores allow
+
+import atexit, proc_check, time, os
+from testutils import *
+
+def parse_cpulist(text):
+    cpus = set()
+    for part in text.strip().split(","):
+        if part:
+            lo, _, hi = part.partition("-")
+            cpus.update(range(int(lo), int(hi or lo) + 1))
+    return frozenset(cpus)
+
+def read_cpulist(path):
+    with open(path) as f:
+        return parse_cpulist(f.read())
+
+def affinity(pid):
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("Cpus_allowed_list:"):
+                return parse_cpulist(line.split(":")[1])
+
+# the SMT siblings and the last level cache of a CPU
+def core_of(cpu):
+    path = "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list"
+    return read_cpulist(path % cpu) if os.path.exists(path % cpu) \
+        else frozenset([cpu])
+
+def llc_of(cpu):
+    caches = "/sys/devices/system/cpu/cpu%d/cache" % cpu
+    best = (0, None)
+    for index in os.listdir(caches) if os.path.isdir(caches) else []:
+        if not index.startswith("index"):
+            continue
+        with open(os.path.join(caches, index, "level")) as f:
+            level = int(f.read())
+        if level in (2, 3) and level > best[0]:
+            best = (level, read_cpulist(
+                os.path.join(caches, index, "shared_cpu_list")))
+    return best[1]
+
+# start a three-stage pipeline and return the pids of its stages
+def start_pipeline():
+    sendline("sleep 10 | sleep 10 | sleep 10 &")
+    expect("\[(\d+)\] \d+\r\n")
+    jid = console.match.group(1)
+    expect_prompt()
+    sendline("jobs -l")
+    expect("\tpids (\d+) (\d+) (\d+)\r\n")
+    pids = [int(p) for p in console.match.groups()]
+    expect_prompt()
+    return jid, pids
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+allowed = affinity(console.pid)
+
+# without the option the stages may run anywhere the shell may
+jid, pids = start_pipeline()
+for pid in pids:
+    assert affinity(pid) == allowed, "Expected the shell's affinity"
+sendline("kill " + jid)
+expect_prompt()
+
+sendline("set -o placement")
+expect_prompt()
+
+jid, pids = start_pipeline()
+placed = [affinity(pid) for pid in pids]
+if llc_of(min(allowed)) is not None:
+    llc = llc_of(min(placed[0])) & allowed
+    cores = set(core_of(cpu) & allowed for cpu in llc)
+    stage_cores = []
+    for cpus in placed:
+        assert cpus and cpus <= llc, "Expected the stages in one cache"
+        core = core_of(min(cpus)) & allowed
+        assert cpus == core, "Expected each stage on one whole core"
+        stage_cores.append(core)
+    if len(cores) >= len(pids):
+        assert len(set(stage_cores)) == len(pids), \
+            "Expected the stages on distinct cores"
+sendline("kill " + jid)
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,110 @@
+#!/usr/bin/python
+#
+# Tests plugins loaded with -p: their builtins run in the shell with
+# redirections and pipes, in a child when they read from a pipe, and a
+# plugin cannot take the name of a builtin or run with another ABI
+
+import atexit, os, re, json, shutil, signal, subprocess
+import tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+atexit.register(shutil.rmtree, tmpdir)
+def tmpfile(name):
+    return os.path.join(tmpdir, name)
+
+plugin = r"""
+#include <string.h>
+#include <unistd.h>
+#include "cush_plugin.h"
+
+static int greet(int argc, char *argv[], const int fd[3])
+{
+    for (int i = 1; i < argc; i++) {
+        write(fd[1], argv[i], strlen(argv[i]));
+        write(fd[1], i + 1 < argc ? " " : "\n", 1);
+    }
+    return argc > 1 ? 0 : 3;
+}
+
+static int upcase(int argc, char *argv[], const int fd[3])
+{
+    char buf[512];
+    ssize_t n;
+    while ((n = read(fd[0], buf, sizeof buf)) > 0) {
+        for (ssize_t i = 0; i < n; i++)
+            if (buf[i] >= 'a' && buf[i] <= 'z')
+                buf[i] -= 'a' - 'A';
+        write(fd[1], buf, n);
+    }
+    return 0;
+}
+
+static const struct cush_builtin builtins[] = {
+    { "greet", greet, 0 },
+    { "upcase", upcase, CUSH_BUILTIN_READS_INPUT },
+    { "jobs", greet, 0 },
+};
+
+int cush_plugin_init(const struct cush_plugin_host *host)
+{
+    if (host->abi_version != ABI)
+        return -1;
+    for (int i = 0; i < 3; i++)
+        host->register_builtin(&builtins[i]);
+    return 0;
+}
+"""
+
+def build(name, abi):
+    source = tmpfile(name + ".c")
+    with open(source, "w") as f:
+        f.write(plugin)
+    subprocess.check_call(["cc", "-shared", "-fPIC", "-I.", "-DABI=" + abi,
+                           "-o", tmpfile(name + ".so"), source])
+
+build("good", "CUSH_PLUGIN_ABI_VERSION")
+build("other", "CUSH_PLUGIN_ABI_VERSION + 1")
+
+out = tmpfile("out")
+lines = [
+    "stats reset",
+    "greet hello world",
+    "greet to a file > " + out,
+    "greet appended >> " + out,
+    "upcase < " + out,
+    "greet piped | wc -c",
+    "upcase < " + out + " | cat",
+    "stats -j",
+    "stats reset",
+    "echo from a pipe | upcase",
+    "stats -j",
+    "jobs",
+]
+
+def start_shell():
+    # Python ignores SIGPIPE, and its children would inherit that
+    signal.signal(signal.SIGPIPE, signal.SIG_DFL)
+
+path = tmpfile("script.cush")
+with open(path, "w") as f:
+    f.write("\n".join(lines) + "\n")
+shell = subprocess.Popen(["./cush", "-p", tmpdir, path],
+                         stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                         stderr=subprocess.STDOUT, preexec_fn=start_shell)
+output = shell.communicate("")[0]
+assert shell.returncode == 0, "Shell failed: " + output
+
+assert "good.so: jobs is already a builtin\n" in output, \
+    "Duplicate name not refused: " + output
+assert "other.so: plugin failed to initialize\n" in output, \
+    "Plugin of another ABI loaded: " + output
+assert "hello world\n" in output, "Unexpected output: " + output
+assert "TO A FILE\nAPPENDED\n" in output, "Unexpected output: " + output
+assert "\n6\n" in output, "Unexpected output: " + output
+assert "FROM A PIPE\n" in output, "Unexpected output: " + output
+stats = [json.loads(s) for s in re.findall("^(\{.*\})$", output, re.M)]
+assert stats[0]["spawn"]["count"] == 2, "A builtin was forked"
+assert stats[1]["spawn"]["count"] == 1, "Reading a pipe did not fork"
+
+test_success()
@@ -0,0 +1,134 @@
+/*
+ * Duration predictions for repeated commands.
+ *
+ * The table has PREDICT_SETS sets of PREDICT_WAYS entries.  An entry
+ * holds the full 64-bit key, so commands that share a set are told
+ * apart without keeping their command lines.
+ */
+#include <math.h>
+#include <stdio.h>
+
+#include "predict.h"
+
+#define PREDICT_SETS 256            /* A power of 2 */
+#define PREDICT_WAYS 4
+#define ALPHA 0.3                   /* Weight of the newest run */
+
+struct entry {
+    uint64_t key;                   /* 0 if the entry is free */
+    double mean;
+    double var;
+    unsigned count;
+    uint64_t last_used;             /* For LRU replacement in the set */
+};
+
+static struct entry table[PREDICT_SETS][PREDICT_WAYS];
+static uint64_t use_clock;
+
+/* Add the bytes of 's', and a terminating 0, to an FNV-1a hash */
+static uint64_t
+hash_string(uint64_t h, const char *s)
+{
+    do {
+        h ^= (unsigned char) *s;
+        h *= 0x100000001b3ULL;
+    } while (*s++);
+    return h;
+}
+
+/* Return the key of a pipeline */
+uint64_t
+predict_key(struct ast_pipeline *pipeline)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    struct list_elem *e = list_begin(&pipeline->commands);
+    for (; e != list_end(&pipeline->commands); e = list_next(e)) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        for (char **p = cmd->argv; *p; p++)
+            h = hash_string(h, *p);
+        /* Separate the commands, so "a b" differs from "a | b" */
+        h = hash_string(h, "|");
+    }
+    return h != 0 ? h : 1;
+}
+
+/* Return the entry for 'key', or NULL */
+static struct entry *
+find_entry(uint64_t key)
+{
+    struct entry *set = table[key & (PREDICT_SETS - 1)];
+    for (int i = 0; i < PREDICT_WAYS; i++)
+        if (set[i].key == key)
+            return &set[i];
+    return NULL;
+}
+
+/* Record a run */
+void
+predict_record(uint64_t key, double seconds)
+{
+    struct entry *e = find_entry(key);
+    if (e == NULL) {
+        /* Take a free entry, or the least recently used one */
+        struct entry *set = table[key & (PREDICT_SETS - 1)];
+        e = &set[0];
+        for (int i = 1; i < PREDICT_WAYS; i++)
+            if (set[i].last_used < e->last_used)
+                e = &set[i];
+        e->key = key;
+        e->mean = seconds;
+        e->var = 0;
+        e->count = 0;
+    }
+
+    /* Exponentially weighted mean and variance */
+    double diff = seconds - e->mean;
+    e->mean += ALPHA * diff;
+    e->var = (1 - ALPHA) * (e->var + ALPHA * diff * diff);
+    e->count++;
+    e->last_used = ++use_clock;
+}
+
+/* Look up a prediction */
+bool
+predict_lookup(uint64_t key, struct prediction *p)
+{
+    struct entry *e = find_entry(key);
+    if (e == NULL)
+        return false;
+
+    e->last_used = ++use_clock;
+    p->mean = e->mean;
+    p->stddev = sqrt(e->var);
+    p->count = e->count;
+    return true;
+}
+
+/* Format a duration in whole seconds, minutes or hours */
+static void
+format_short(char *buf, size_t size, double sec)
+{
+    int s = (int) (sec + 0.5);
+    if (s < 60)
+        snprintf(buf, size, "%ds", s);
+    else if (s < 3600)
+        snprintf(buf, size, "%dm%02ds", s / 60, s % 60);
+    else
+        snprintf(buf, size, "%dh%02dm", s / 3600, s / 60 % 60);
+}
+
+/* Format the time left and progress of a running job */
+void
+predict_format_eta(char *buf, size_t size, const struct prediction *p,
+                   double elapsed)
+{
+    char left[16];
+    if (elapsed < p->mean) {
+        format_short(left, sizeof left, p->mean - elapsed);
+        snprintf(buf, size, "ETA %s (%d%%)", left,
+                 (int) (100 * elapsed / p->mean));
+    } else {
+        format_short(left, sizeof left, elapsed - p->mean);
+        snprintf(buf, size, "ETA overdue by %s", left);
+    }
+}
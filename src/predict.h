@@ -0,0 +1,43 @@
+#ifndef __PREDICT_H
+#define __PREDICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shell-ast.h"
+
+/*
+ * Duration predictions for repeated commands.
+ *
+ * Past wall times are kept per normalized command line in a fixed-size
+ * set-associative table, as exponentially weighted moving averages of
+ * the mean and variance.  Recording and lookup hash the key to one set
+ * and scan its few ways, so both take constant time; when a set is
+ * full, the least recently used command is forgotten.
+ */
+
+/* Predicted duration of a command */
+struct prediction {
+    double mean;            /* Expected wall time in seconds */
+    double stddev;          /* Expected deviation from it */
+    unsigned count;         /* Number of runs recorded */
+};
+
+/* Return the key of a pipeline: a hash of the words of its commands.
+ * Redirections and '&' are not part of the key. */
+uint64_t predict_key(struct ast_pipeline *pipeline);
+
+/* Record that a run of the command with 'key' took 'seconds' */
+void predict_record(uint64_t key, double seconds);
+
+/* Look up the prediction for 'key'.  Returns false if the command has
+ * not been recorded. */
+bool predict_lookup(uint64_t key, struct prediction *p);
+
+/* Format the time left and progress of a job that has been running
+ * for 'elapsed' seconds, such as "ETA 1m05s (40%)" */
+void predict_format_eta(char *buf, size_t size, const struct prediction *p,
+                        double elapsed);
+
+#endif /* __PREDICT_H */
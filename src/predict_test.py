@@ -0,0 +1,59 @@
+#!/usr/bin/python
+#
+# Tests duration predictions: running jobs of commands that ran before
+# show an ETA and their progress in the jobs output
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a command that has not run before has no ETA
+sendline("sleep 1.5 &")
+expect("\[1\] \d+")
+expect_prompt()
+sendline("jobs")
+expect("\[1\]\tRunning\t\t\(sleep 1\.5\)\r\n")
+expect_prompt()
+
+# teach the shell how long 'sleep 1.5' takes
+sendline("kill 1")
+expect_prompt()
+sendline("sleep 1.5")
+expect_prompt()
+
+# redirections and & do not change the key
+sendline("sleep 1.5 > /dev/null &")
+expect("\[(\d+)\] \d+")
+jid = console.match.group(1)
+expect_prompt()
+sendline("jobs")
+expect("\[" + jid + "\]\tRunning\t\t\(sleep 1\.5\)\tETA [12]s \([0-4]?\d%\)\r\n")
+expect_prompt()
+
+time.sleep(1)
+sendline("jobs")
+expect("\[" + jid + "\]\tRunning\t\t\(sleep 1\.5\)\tETA [01]s \([5-9]\d%\)\r\n")
+expect_prompt()
+
+# stopped jobs do not show an ETA
+sendline("stop " + jid)
+expect_prompt()
+time.sleep(0.5)
+sendline("jobs")
+expect("\[" + jid + "\]\tStopped\t\t\(sleep 1\.5\)\r\n")
+expect_prompt()
+
+sendline("kill " + jid)
+expect_prompt()
+time.sleep(0.5)
+sendline("jobs")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
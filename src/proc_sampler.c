@@ -0,0 +1,294 @@
+/*
+ * Repeated sampling of live processes from /proc.
+ *
+ * Processes are kept in an open-addressing hash table keyed by pid.
+ * Entries are never deleted one by one; proc_sampler_sweep rebuilds
+ * the table from the entries that were read since the last sweep,
+ * which keeps probing free of tombstones.
+ *
+ * An open /proc/<pid> file refers to the process, not to the pid, so
+ * a read fails once the process is reaped, even if its pid has been
+ * reused.  The entry is then reopened for the new process.
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proc_sampler.h"
+
+struct proc_entry {
+    pid_t pid;                  /* 0 if the entry is free */
+    int stat_fd;                /* /proc/<pid>/stat, or -1 if closed */
+    int io_fd;                  /* /proc/<pid>/io, or -1 if unreadable */
+    bool seen;                  /* Read since the last sweep */
+    bool primed;                /* The fields below hold a sample */
+    unsigned long long ticks;   /* utime + stime at the last sample */
+    unsigned long long rchar;   /* Bytes read at the last sample */
+    unsigned long long wchar;   /* Bytes written at the last sample */
+    double time;                /* When the last sample was taken */
+};
+
+struct proc_sampler {
+    struct proc_entry *entries;
+    size_t capacity;            /* A power of 2 */
+    size_t count;
+    long ticks_per_sec;
+    long page_kb;
+};
+
+/* Open the files of the process e->pid */
+static bool
+open_files(struct proc_entry *e)
+{
+    char path[64];
+
+    snprintf(path, sizeof path, "/proc/%d/stat", (int) e->pid);
+    e->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (e->stat_fd == -1)
+        return false;
+
+    snprintf(path, sizeof path, "/proc/%d/io", (int) e->pid);
+    e->io_fd = open(path, O_RDONLY | O_CLOEXEC);
+    e->primed = false;
+    return true;
+}
+
+/* Close the files of 'e'.  The entry stays in place, so probing
+ * still works, until the next sweep drops it. */
+static void
+close_files(struct proc_entry *e)
+{
+    if (e->stat_fd != -1)
+        close(e->stat_fd);
+    if (e->io_fd != -1)
+        close(e->io_fd);
+    e->stat_fd = e->io_fd = -1;
+}
+
+/* Seconds since boot, the clock /proc uses for process start times */
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+hash_pid(pid_t pid, size_t capacity)
+{
+    return ((unsigned) pid * 2654435761u) & (capacity - 1);
+}
+
+/* Find the entry for 'pid', or the free entry where it belongs */
+static struct proc_entry *
+find_entry(struct proc_entry *entries, size_t capacity, pid_t pid)
+{
+    size_t i = hash_pid(pid, capacity);
+    while (entries[i].pid != 0 && entries[i].pid != pid)
+        i = (i + 1) & (capacity - 1);
+    return &entries[i];
+}
+
+/* Move the entries into a table of 'capacity' entries.  With
+ * 'only_seen', for a sweep, entries not read since the last sweep are
+ * dropped and the others start over as unread; a table that grows
+ * keeps them as they are. */
+static bool
+rehash(struct proc_sampler *s, size_t capacity, bool only_seen)
+{
+    struct proc_entry *entries = calloc(capacity, sizeof *entries);
+    if (entries == NULL)
+        return false;
+
+    s->count = 0;
+    for (size_t i = 0; i < s->capacity; i++) {
+        struct proc_entry *e = &s->entries[i];
+        if (e->pid == 0)
+            continue;
+        if (only_seen && !e->seen) {
+            close_files(e);
+            continue;
+        }
+        struct proc_entry *n = find_entry(entries, capacity, e->pid);
+        *n = *e;
+        if (only_seen)
+            n->seen = false;
+        s->count++;
+    }
+    free(s->entries);
+    s->entries = entries;
+    s->capacity = capacity;
+    return true;
+}
+
+/* Create an empty sampler */
+struct proc_sampler *
+proc_sampler_create(void)
+{
+    struct proc_sampler *s = calloc(1, sizeof *s);
+    if (s == NULL)
+        return NULL;
+
+    s->capacity = 64;
+    s->entries = calloc(s->capacity, sizeof *s->entries);
+    if (s->entries == NULL) {
+        free(s);
+        return NULL;
+    }
+    s->ticks_per_sec = sysconf(_SC_CLK_TCK);
+    s->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    return s;
+}
+
+/* Close all files and free the sampler */
+void
+proc_sampler_destroy(struct proc_sampler *s)
+{
+    for (size_t i = 0; i < s->capacity; i++) {
+        if (s->entries[i].pid != 0)
+            close_files(&s->entries[i]);
+    }
+    free(s->entries);
+    free(s);
+}
+
+/* Return the unsigned number at 'p' and advance past it */
+static unsigned long long
+parse_number(const char **p)
+{
+    unsigned long long v = 0;
+    while (**p >= '0' && **p <= '9')
+        v = v * 10 + (*(*p)++ - '0');
+    return v;
+}
+
+/* Extract utime + stime, starttime and rss from a stat line.
+ * Parsed by hand; this runs for every process on every refresh. */
+static bool
+parse_stat(const char *buf, unsigned long long *ticks,
+           unsigned long long *start, unsigned long long *rss)
+{
+    /* The command name may contain spaces; fields resume after ')'.
+     * The first field after it is field 3, the state. */
+    const char *p = strrchr(buf, ')');
+    if (p == NULL)
+        return false;
+
+    p += 2;
+    *ticks = 0;
+    for (int field = 3; field <= 24 && *p; field++) {
+        if (field == 14 || field == 15)
+            *ticks += parse_number(&p);
+        else if (field == 22)
+            *start = parse_number(&p);
+        else if (field == 24)
+            *rss = parse_number(&p);
+        while (*p && *p != ' ')
+            p++;
+        while (*p == ' ')
+            p++;
+        if (field == 24)
+            return true;
+    }
+    return false;
+}
+
+/* Return the number following "key: " in /proc/<pid>/io */
+static unsigned long long
+io_value(const char *buf, const char *key)
+{
+    const char *p = strstr(buf, key);
+    if (p == NULL)
+        return 0;
+
+    p += strlen(key);
+    while (*p == ':' || *p == ' ')
+        p++;
+    return parse_number(&p);
+}
+
+/* Sample 'pid' */
+bool
+proc_sampler_read(struct proc_sampler *s, pid_t pid, struct proc_sample *out)
+{
+    if ((s->count + 1) * 2 > s->capacity && !rehash(s, s->capacity * 2, false))
+        return false;
+
+    struct proc_entry *e = find_entry(s->entries, s->capacity, pid);
+    if (e->pid == 0) {
+        e->pid = pid;
+        e->stat_fd = e->io_fd = -1;
+        s->count++;
+    }
+    e->seen = true;
+    if (e->stat_fd == -1 && !open_files(e))
+        return false;
+
+    char buf[1024];
+    ssize_t len = pread(e->stat_fd, buf, sizeof buf - 1, 0);
+    if (len <= 0 && e->primed) {
+        /* The process we had open is gone; 'pid' may be a new one */
+        close_files(e);
+        if (!open_files(e))
+            return false;
+        len = pread(e->stat_fd, buf, sizeof buf - 1, 0);
+    }
+    if (len <= 0) {
+        close_files(e);
+        return false;
+    }
+    buf[len] = '\0';
+
+    unsigned long long ticks, start = 0, rss = 0;
+    if (!parse_stat(buf, &ticks, &start, &rss))
+        return false;
+
+    unsigned long long rchar = 0, wchar = 0;
+    if (e->io_fd != -1) {
+        len = pread(e->io_fd, buf, sizeof buf - 1, 0);
+        if (len > 0) {
+            buf[len] = '\0';
+            rchar = io_value(buf, "rchar");
+            wchar = io_value(buf, "wchar");
+        }
+    }
+
+    /* Compare with the previous sample, or with the start of the
+     * process if there is none */
+    double t = now();
+    double since = e->primed ? e->time : (double) start / s->ticks_per_sec;
+    double interval = t - since;
+    if (!e->primed)
+        e->ticks = e->rchar = e->wchar = 0;
+
+    memset(out, 0, sizeof *out);
+    if (interval > 0) {
+        out->cpu_pct = 100.0 * (ticks - e->ticks) / s->ticks_per_sec
+                       / interval;
+        out->read_rate = (rchar - e->rchar) / interval;
+        out->write_rate = (wchar - e->wchar) / interval;
+    }
+    out->rss_kb = rss * s->page_kb;
+
+    e->ticks = ticks;
+    e->rchar = rchar;
+    e->wchar = wchar;
+    e->time = t;
+    e->primed = true;
+    return true;
+}
+
+/* Close the files of processes not read since the last sweep */
+void
+proc_sampler_sweep(struct proc_sampler *s)
+{
+    size_t capacity = s->capacity;
+    while (capacity > 64 && s->count * 8 < capacity)
+        capacity /= 2;
+    rehash(s, capacity, true);
+}
@@ -0,0 +1,41 @@
+#ifndef __PROC_SAMPLER_H
+#define __PROC_SAMPLER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Repeated sampling of live processes.
+ *
+ * A sampler keeps /proc/<pid>/stat and /proc/<pid>/io open for every
+ * process it has seen, so that each refresh costs two preads per
+ * process and no path lookups.  Rates are computed against the
+ * previous sample of the same process; the first sample of a process
+ * reports its average since it was started.
+ */
+struct proc_sampler;
+
+/* Current usage of one process */
+struct proc_sample {
+    double cpu_pct;     /* CPU use, in percent of one CPU */
+    long rss_kb;        /* Resident set size in KiB */
+    double read_rate;   /* Bytes read per second */
+    double write_rate;  /* Bytes written per second */
+};
+
+/* Create an empty sampler */
+struct proc_sampler *proc_sampler_create(void);
+
+/* Close all files and free the sampler */
+void proc_sampler_destroy(struct proc_sampler *s);
+
+/* Sample the process 'pid', opening its files on first use.
+ * Returns false if the process is gone. */
+bool proc_sampler_read(struct proc_sampler *s, pid_t pid,
+                       struct proc_sample *out);
+
+/* Close the files of every process that was not read since the
+ * previous sweep.  Call once per refresh. */
+void proc_sampler_sweep(struct proc_sampler *s);
+
+#endif /* __PROC_SAMPLER_H */
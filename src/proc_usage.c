@@ -0,0 +1,173 @@
+/*
+ * Collecting and formatting per-process resource usage.
+ *
+ * Usage of reaped processes comes from the rusage returned by wait4,
+ * usage of live processes is sampled from /proc.  I/O byte counts are
+ * not part of rusage and are always read from /proc/<pid>/io.
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "proc_usage.h"
+
+/* Read /proc/<pid>/<file> into 'buf' with plain system calls.  The
+ * path is built by hand, as snprintf is not async-signal-safe. */
+static bool
+read_proc_file(pid_t pid, const char *file, char *buf, size_t size)
+{
+    char digits[16], path[64];
+    int n = 0;
+    unsigned int v = pid;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    if (strlen("/proc//") + n + strlen(file) >= sizeof path)
+        return false;
+    char *p = stpcpy(path, "/proc/");
+    while (n > 0)
+        *p++ = digits[--n];
+    *p++ = '/';
+    strcpy(p, file);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len <= 0)
+        return false;
+
+    buf[len] = '\0';
+    return true;
+}
+
+/* Return the number following "key" in a "key: value" file */
+static unsigned long long
+find_value(const char *buf, const char *key)
+{
+    const char *p = strstr(buf, key);
+    if (p == NULL)
+        return 0;
+
+    p += strlen(key);
+    while (*p == ':' || *p == ' ' || *p == '\t')
+        p++;
+    /* Not strtoull, which is not async-signal-safe */
+    unsigned long long v = 0;
+    for (; *p >= '0' && *p <= '9'; p++)
+        v = v * 10 + (*p - '0');
+    return v;
+}
+
+/* Fill the rusage part of 'u' from 'ru' */
+void
+proc_usage_from_rusage(struct proc_usage *u, const struct rusage *ru)
+{
+    u->utime_us = ru->ru_utime.tv_sec * 1000000LL + ru->ru_utime.tv_usec;
+    u->stime_us = ru->ru_stime.tv_sec * 1000000LL + ru->ru_stime.tv_usec;
+    u->maxrss_kb = ru->ru_maxrss;
+    u->majflt = ru->ru_majflt;
+    u->nvcsw = ru->ru_nvcsw;
+    u->nivcsw = ru->ru_nivcsw;
+}
+
+/* Read the I/O counters of 'pid' */
+bool
+proc_usage_read_io(pid_t pid, struct proc_usage *u)
+{
+    char buf[512];
+    if (!read_proc_file(pid, "io", buf, sizeof buf))
+        return false;
+
+    u->rchar = find_value(buf, "rchar");
+    u->wchar = find_value(buf, "wchar");
+    return true;
+}
+
+/* Sample the usage of the live process 'pid' */
+bool
+proc_usage_sample(pid_t pid, struct proc_usage *u)
+{
+    char buf[4096];
+
+    memset(u, 0, sizeof *u);
+    if (!read_proc_file(pid, "stat", buf, sizeof buf))
+        return false;
+
+    /* The command name may contain spaces; fields resume after ')'. */
+    char *p = strrchr(buf, ')');
+    if (p == NULL)
+        return false;
+
+    unsigned long majflt, utime, stime;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %lu %*u %lu %lu",
+               &majflt, &utime, &stime) != 3)
+        return false;
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    u->utime_us = utime * 1000000LL / ticks;
+    u->stime_us = stime * 1000000LL / ticks;
+    u->majflt = majflt;
+
+    if (read_proc_file(pid, "status", buf, sizeof buf)) {
+        u->maxrss_kb = find_value(buf, "VmHWM");
+        u->nvcsw = find_value(buf, "\nvoluntary_ctxt_switches");
+        u->nivcsw = find_value(buf, "nonvoluntary_ctxt_switches");
+    }
+    proc_usage_read_io(pid, u);
+    return true;
+}
+
+/* Add 'u' to 'sum' */
+void
+proc_usage_add(struct proc_usage *sum, const struct proc_usage *u)
+{
+    sum->utime_us += u->utime_us;
+    sum->stime_us += u->stime_us;
+    if (u->maxrss_kb > sum->maxrss_kb)
+        sum->maxrss_kb = u->maxrss_kb;
+    sum->majflt += u->majflt;
+    sum->nvcsw += u->nvcsw;
+    sum->nivcsw += u->nivcsw;
+    sum->rchar += u->rchar;
+    sum->wchar += u->wchar;
+}
+
+/* Format a byte count with a binary unit suffix */
+void
+proc_usage_format_bytes(char *buf, size_t size, double bytes)
+{
+    static const char units[] = "BKMGTP";
+    int unit = 0;
+    while (bytes >= 1024 && units[unit + 1]) {
+        bytes /= 1024;
+        unit++;
+    }
+    if (unit == 0)
+        snprintf(buf, size, "%.0fB", bytes);
+    else
+        snprintf(buf, size, "%.1f%c", bytes, units[unit]);
+}
+
+/* Format 'u' and the elapsed wall time into 'buf' */
+void
+proc_usage_format(char *buf, size_t size,
+                  double real_sec, const struct proc_usage *u)
+{
+    char rss[16], rd[16], wr[16];
+
+    proc_usage_format_bytes(rss, sizeof rss, u->maxrss_kb * 1024.0);
+    proc_usage_format_bytes(rd, sizeof rd, u->rchar);
+    proc_usage_format_bytes(wr, sizeof wr, u->wchar);
+    snprintf(buf, size,
+             "real %.3fs user %.3fs sys %.3fs maxrss %s majflt %ld "
+             "csw %ld/%ld read %s written %s",
+             real_sec, u->utime_us / 1e6, u->stime_us / 1e6, rss, u->majflt,
+             u->nvcsw, u->nivcsw, rd, wr);
+}
@@ -0,0 +1,41 @@
+#ifndef __PROC_USAGE_H
+#define __PROC_USAGE_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Resource usage of a process, or the sum over several processes */
+struct proc_usage {
+    long long utime_us;         /* User CPU time in microseconds */
+    long long stime_us;         /* System CPU time in microseconds */
+    long maxrss_kb;             /* Maximum resident set size in KiB */
+    long majflt;                /* Major page faults */
+    long nvcsw;                 /* Voluntary context switches */
+    long nivcsw;                /* Involuntary context switches */
+    unsigned long long rchar;   /* Bytes read, including pipes */
+    unsigned long long wchar;   /* Bytes written, including pipes */
+};
+
+/* Fill the rusage part of 'u' from 'ru', as returned by wait4 */
+void proc_usage_from_rusage(struct proc_usage *u, const struct rusage *ru);
+
+/* Read the I/O counters of 'pid' from /proc/<pid>/io.
+ * Works on zombies, so it can be called before reaping.
+ * Async-signal-safe. */
+bool proc_usage_read_io(pid_t pid, struct proc_usage *u);
+
+/* Sample the usage of the live process 'pid' from /proc */
+bool proc_usage_sample(pid_t pid, struct proc_usage *u);
+
+/* Add 'u' to 'sum'.  maxrss is the maximum over all processes. */
+void proc_usage_add(struct proc_usage *sum, const struct proc_usage *u);
+
+/* Format a byte count with a binary unit suffix, e.g. 1.5M */
+void proc_usage_format_bytes(char *buf, size_t size, double bytes);
+
+/* Format 'u', together with the elapsed wall time, into 'buf' */
+void proc_usage_format(char *buf, size_t size,
+                       double real_sec, const struct proc_usage *u);
+
+#endif /* __PROC_USAGE_H */
@@ -0,0 +1,35 @@
+#!/usr/bin/python
+#
+# Tests the profile prefix: perf counters summed over the stages of a
+# job, with unavailable hardware counters marked as not supported
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# the prefix without a command
+sendline("profile")
+expect("profile: command is missing")
+expect_prompt()
+
+# software counters are always available
+sendline("profile head -c 1000000 /dev/zero | wc -c")
+expect("1000000")
+expect("Performance counters for 'head -c 1000000 /dev/zero \| wc -c':")
+expect("(\d+|<not supported>)\s+cycles")
+expect("(\d+|<not supported>)\s+instructions")
+expect("(\d+|<not supported>)\s+cache-misses")
+expect("\d+\.\d+\s+task-clock \(ms\)")
+expect("\d+\s+context-switches")
+expect("\d+\s+page-faults")
+expect("\d+\.\d+\s+seconds time elapsed")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
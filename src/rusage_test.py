@@ -0,0 +1,59 @@
+#!/usr/bin/python
+#
+# Tests the resource usage of jobs: the pids and usage lines of
+# 'jobs -l' and the summary line of 'set -o rusage'
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# jobs -l adds the pids of the job and its usage so far
+sendline("sleep 5 | sleep 5 &")
+expect("\[1\] (\d+)\r\n")
+last_pid = int(console.match.group(1))
+expect_prompt()
+
+sendline("jobs -l")
+expect("\[1\]\tRunning\t\t\(sleep 5\| sleep 5\)\r\n")
+expect("\tpids (\d+) (\d+)\r\n")
+pids = [int(p) for p in console.match.groups()]
+assert pids[1] == last_pid and pids[0] != last_pid, \
+    "Expected the pids of the job"
+expect("\treal \d+\.\d{3}s user \d+\.\d{3}s sys \d+\.\d{3}s "
+       "maxrss \d+(\.\d)?[BKMGTP] majflt \d+ csw \d+/\d+ "
+       "read \d+(\.\d)?[BKMGTP] written \d+(\.\d)?[BKMGTP]\r\n")
+expect_prompt()
+
+sendline("kill 1")
+expect_prompt()
+
+# without the option, a foreground job prints no summary
+sendline("true")
+expect_prompt()
+
+# with it, every foreground job prints one, including what it read
+sendline("set -o rusage")
+expect_prompt()
+sendline("head -c 300000 /dev/zero | cat > /dev/null")
+expect("\[\d+\] real \d+\.\d{3}s user \d+\.\d{3}s sys \d+\.\d{3}s "
+       "maxrss \d+(\.\d)?[BKMGTP] majflt \d+ csw \d+/\d+ "
+       "read (?P<amount>\d+(\.\d)?)(?P<unit>[BKMGTP]) written \S+\r\n")
+amount = float(console.match.group("amount"))
+unit = console.match.group("unit")
+assert unit == "M" or (unit == "K" and amount >= 290), \
+    "Expected the bytes read by the pipeline"
+expect_prompt()
+
+sendline("set +o rusage")
+expect_prompt()
+sendline("true")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
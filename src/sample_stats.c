@@ -0,0 +1,73 @@
+/*
+ * Summary statistics for repeated measurements.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sample_stats.h"
+
+/* qsort comparator for doubles */
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Return the q-quantile of the sorted samples, using nearest rank */
+static double
+quantile(const double *sorted, int n, double q)
+{
+    int rank = (int) ceil(q * n);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+/* Summarize the 'n' samples in 'v' */
+void
+sample_summarize(double *v, int n, struct sample_summary *s)
+{
+    s->n = n;
+    if (n == 0)
+        return;
+
+    qsort(v, n, sizeof *v, compare_double);
+
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += v[i];
+    s->mean = sum / n;
+
+    double sq = 0;
+    for (int i = 0; i < n; i++)
+        sq += (v[i] - s->mean) * (v[i] - s->mean);
+    s->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+
+    s->min = v[0];
+    s->max = v[n - 1];
+    s->p50 = quantile(v, n, 0.50);
+    s->p95 = quantile(v, n, 0.95);
+    s->p99 = quantile(v, n, 0.99);
+
+    /* Tukey's fences: 1.5 interquartile ranges beyond the quartiles */
+    double q1 = quantile(v, n, 0.25), q3 = quantile(v, n, 0.75);
+    double iqr = q3 - q1;
+    s->outliers = 0;
+    for (int i = 0; i < n; i++)
+        if (v[i] < q1 - 1.5 * iqr || v[i] > q3 + 1.5 * iqr)
+            s->outliers++;
+}
+
+/* Format a duration given in seconds with a fitting unit */
+void
+sample_format_duration(char *buf, size_t size, double sec)
+{
+    if (sec >= 1)
+        snprintf(buf, size, "%.3fs", sec);
+    else if (sec >= 1e-3)
+        snprintf(buf, size, "%.2fms", sec * 1e3);
+    else
+        snprintf(buf, size, "%.1fus", sec * 1e6);
+}
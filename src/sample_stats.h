@@ -0,0 +1,25 @@
+#ifndef __SAMPLE_STATS_H
+#define __SAMPLE_STATS_H
+
+#include <stddef.h>
+
+/* Summary statistics of a set of samples */
+struct sample_summary {
+    int n;                      /* Number of samples */
+    double mean;
+    double stddev;              /* Sample standard deviation */
+    double min;
+    double max;
+    double p50;
+    double p95;
+    double p99;
+    int outliers;               /* Samples outside the Tukey fences */
+};
+
+/* Summarize the 'n' samples in 'v'.  Sorts 'v' in place. */
+void sample_summarize(double *v, int n, struct sample_summary *s);
+
+/* Format a duration given in seconds with a fitting unit */
+void sample_format_duration(char *buf, size_t size, double sec);
+
+#endif /* __SAMPLE_STATS_H */
@@ -0,0 +1,188 @@
+/*
+ * Support for running background jobs at idle priority.
+ *
+ * An unprivileged process may enter SCHED_IDLE, but leaving it again
+ * requires an RLIMIT_NICE that permits nice 0 (or CAP_SYS_NICE).  When
+ * that is not available, we use SCHED_BATCH instead, which can always
+ * be undone.  The I/O priority is moved to the idle class, which any
+ * process may leave again.
+ *
+ * Both are settings of a thread, not of a process, so every thread
+ * listed in /proc/<pid>/task is demoted and restored.  A thread created
+ * while the process was demoted inherits the idle settings; on restore
+ * it gets those of the main thread.
+ */
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sched_policy.h"
+
+/* From linux/ioprio.h, which older kernel headers do not provide */
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_CLASS_IDLE       3
+#define IOPRIO_WHO_PROCESS      1
+
+/* Return the policy used for demoted processes */
+static int
+demoted_policy(void)
+{
+    static int policy = -1;
+    if (policy != -1)
+        return policy;
+
+    /* SCHED_IDLE counts as nice 19; going back to nice 0 must be
+     * permitted by RLIMIT_NICE (ceiling 20 - nice), see sched(7). */
+    struct rlimit rlim;
+    if (geteuid() == 0 ||
+        (getrlimit(RLIMIT_NICE, &rlim) == 0 && rlim.rlim_cur >= 20))
+        policy = SCHED_IDLE;
+    else
+        policy = SCHED_BATCH;
+    return policy;
+}
+
+/* Demote thread 'tid', saving its settings in 't' */
+static bool
+demote_thread(pid_t tid, struct sched_thread *t)
+{
+    struct sched_param param;
+
+    t->tid = tid;
+    t->policy = sched_getscheduler(tid);
+    if (t->policy == -1 || sched_getparam(tid, &param) == -1)
+        return false;
+    t->priority = param.sched_priority;
+    t->ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+
+    /* Leave real-time threads alone, the user chose their priority. */
+    if (t->policy != SCHED_OTHER && t->policy != SCHED_BATCH)
+        return false;
+
+    param.sched_priority = 0;
+    if (sched_setscheduler(tid, demoted_policy(), &param) == -1)
+        return false;
+
+    if (t->ioprio != -1)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    return true;
+}
+
+/* Restore the settings 't' to thread 'tid' */
+static void
+restore_thread(pid_t tid, const struct sched_thread *t)
+{
+    struct sched_param param = { .sched_priority = t->priority };
+
+    sched_setscheduler(tid, t->policy, &param);
+    if (t->ioprio != -1)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, t->ioprio);
+}
+
+/* Open /proc/<pid>/task */
+static DIR *
+open_tasks(pid_t pid)
+{
+    char path[32];
+    snprintf(path, sizeof path, "/proc/%d/task", (int) pid);
+    return opendir(path);
+}
+
+/* Return the next thread id in 'dir', or 0 at the end */
+static pid_t
+next_task(DIR *dir)
+{
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        pid_t tid = atoi(d->d_name);
+        if (tid > 0)
+            return tid;
+    }
+    return 0;
+}
+
+/* Move the threads of process 'pid' to idle CPU and I/O scheduling */
+bool
+sched_demote(pid_t pid, struct sched_saved *saved)
+{
+    saved->demoted = false;
+    saved->nthreads = 0;
+    saved->threads = NULL;
+
+    DIR *dir = open_tasks(pid);
+    if (dir == NULL)
+        return false;
+
+    int capacity = 0;
+    pid_t tid;
+    while ((tid = next_task(dir)) != 0) {
+        if (saved->nthreads == capacity) {
+            int n = capacity == 0 ? 4 : capacity * 2;
+            struct sched_thread *t = realloc(saved->threads, n * sizeof *t);
+            if (t == NULL)
+                break;
+            saved->threads = t;
+            capacity = n;
+        }
+        if (demote_thread(tid, &saved->threads[saved->nthreads]))
+            saved->nthreads++;
+    }
+    closedir(dir);
+
+    saved->demoted = saved->nthreads > 0;
+    if (!saved->demoted)
+        sched_forget(saved);
+    return saved->demoted;
+}
+
+/* Restore the settings saved by sched_demote */
+void
+sched_restore(pid_t pid, struct sched_saved *saved)
+{
+    if (!saved->demoted)
+        return;
+
+    /* Threads created since take the settings of the main thread, or
+     * of the first thread that was demoted if it was not. */
+    const struct sched_thread *main_thread = &saved->threads[0];
+    for (int i = 0; i < saved->nthreads; i++) {
+        if (saved->threads[i].tid == pid)
+            main_thread = &saved->threads[i];
+    }
+
+    DIR *dir = open_tasks(pid);
+    if (dir != NULL) {
+        pid_t tid;
+        while ((tid = next_task(dir)) != 0) {
+            const struct sched_thread *t = NULL;
+            for (int i = 0; i < saved->nthreads && t == NULL; i++) {
+                if (saved->threads[i].tid == tid)
+                    t = &saved->threads[i];
+            }
+            /* A new thread that left the idle class chose its own */
+            if (t == NULL && sched_getscheduler(tid) != demoted_policy())
+                continue;
+            restore_thread(tid, t != NULL ? t : main_thread);
+        }
+        closedir(dir);
+    }
+    sched_forget(saved);
+}
+
+/* Release the settings saved for a process that has exited */
+void
+sched_forget(struct sched_saved *saved)
+{
+    free(saved->threads);
+    saved->threads = NULL;
+    saved->nthreads = 0;
+    saved->demoted = false;
+}
@@ -0,0 +1,35 @@
+#ifndef __SCHED_POLICY_H
+#define __SCHED_POLICY_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Scheduling settings of a thread before it was demoted */
+struct sched_thread {
+    pid_t tid;
+    int policy;                 /* CPU scheduling policy */
+    int priority;               /* Static priority for that policy */
+    int ioprio;                 /* I/O priority (class and data), or -1 */
+};
+
+/* Scheduling settings of a process before it was demoted */
+struct sched_saved {
+    bool demoted;               /* True if sched_demote changed a thread */
+    int nthreads;
+    struct sched_thread *threads; /* The threads it changed */
+};
+
+/* Move the threads of process 'pid' to an idle CPU and I/O scheduling
+ * class, saving their previous settings in 'saved', which must not
+ * hold a demotion already.
+ * Returns false if no thread could be demoted. */
+bool sched_demote(pid_t pid, struct sched_saved *saved);
+
+/* Restore the settings saved by sched_demote, if it demoted any
+ * thread, and release them */
+void sched_restore(pid_t pid, struct sched_saved *saved);
+
+/* Release the settings saved for a process that has exited */
+void sched_forget(struct sched_saved *saved);
+
+#endif /* __SCHED_POLICY_H */
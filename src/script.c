@@ -0,0 +1,237 @@
+/*
+ * Reading command lines from a script or from stdin.
+ *
+ * Mapped input is only read, so the current line is copied out to add
+ * its terminating NUL.  Block input belongs to us, and its newlines
+ * are overwritten in place.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script.h"
+
+struct script {
+    const char *name;
+    int fd;
+    bool mapped;        /* 'data' is a mapping of the whole file, or
+                           a string if 'fd' is -1 */
+    char *data;         /* The mapping, the string or the block buffer */
+    size_t size;        /* Bytes mapped, or allocated for the buffer */
+    size_t pos;         /* Start of the unread input in 'data' */
+    size_t end;         /* End of the input in 'data' */
+    bool synced;        /* Commands may have moved the file offset */
+    char *line;         /* Copy of the last line of mapped input */
+    size_t line_size;
+    unsigned lineno;
+};
+
+/* Map a regular file, starting at its current offset */
+static bool
+map_file(struct script *s, off_t size)
+{
+    off_t offset = lseek(s->fd, 0, SEEK_CUR);
+    if (offset == -1 || offset > size)
+        offset = size;
+    s->mapped = true;
+    s->pos = offset;
+    s->end = size;
+    if (size == 0)
+        return true;
+
+    s->size = size;
+    s->data = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, s->fd, 0);
+    if (s->data == MAP_FAILED)
+        return false;
+    madvise(s->data, s->size, MADV_SEQUENTIAL);
+    return true;
+}
+
+/* Open a script, or stdin */
+struct script *
+script_open(const char *path)
+{
+    struct script *s = calloc(1, sizeof *s);
+    if (s == NULL)
+        return NULL;
+
+    if (path == NULL) {
+        s->name = "<stdin>";
+        s->fd = STDIN_FILENO;
+    } else {
+        s->name = path;
+        s->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (s->fd == -1) {
+            free(s);
+            return NULL;
+        }
+    }
+
+    struct stat st;
+    if (fstat(s->fd, &st) == -1)
+        goto fail;
+    if (S_ISREG(st.st_mode)) {
+        if (!map_file(s, st.st_size))
+            goto fail;
+    } else {
+        s->size = SCRIPT_BLOCK;
+        s->data = malloc(s->size);
+        if (s->data == NULL)
+            goto fail;
+    }
+    return s;
+
+fail:;
+    int saved_errno = errno;
+    if (s->fd != STDIN_FILENO)
+        close(s->fd);
+    free(s);
+    errno = saved_errno;
+    return NULL;
+}
+
+/* Read from a string, as if it were a mapped file */
+struct script *
+script_open_string(const char *name, const char *text)
+{
+    struct script *s = calloc(1, sizeof *s);
+    if (s == NULL)
+        return NULL;
+
+    s->name = name;
+    s->fd = -1;
+    s->mapped = true;
+    s->data = (char *) text;
+    s->end = strlen(text);
+    return s;
+}
+
+/* Return the next line of mapped input */
+static char *
+next_mapped_line(struct script *s)
+{
+    /* Continue after whatever the commands read */
+    if (s->synced) {
+        off_t offset = lseek(s->fd, 0, SEEK_CUR);
+        if (offset >= (off_t) s->pos && offset <= (off_t) s->end)
+            s->pos = offset;
+        s->synced = false;
+    }
+    if (s->pos == s->end)
+        return NULL;
+
+    char *start = s->data + s->pos;
+    char *nl = memchr(start, '\n', s->end - s->pos);
+    size_t len = nl ? nl - start : s->end - s->pos;
+    s->pos += nl ? len + 1 : len;
+
+    if (len + 1 > s->line_size) {
+        char *line = realloc(s->line, len + 1);
+        if (line == NULL)
+            return NULL;
+        s->line = line;
+        s->line_size = len + 1;
+    }
+    memcpy(s->line, start, len);
+    s->line[len] = '\0';
+    return s->line;
+}
+
+/* Return the next line of block input, reading more as needed */
+static char *
+next_block_line(struct script *s)
+{
+    size_t scanned = s->pos;
+    for (;;) {
+        char *nl = memchr(s->data + scanned, '\n', s->end - scanned);
+        if (nl != NULL) {
+            char *line = s->data + s->pos;
+            *nl = '\0';
+            s->pos = nl + 1 - s->data;
+            return line;
+        }
+        scanned = s->end;
+
+        /* Make room for another block after the partial line */
+        if (s->pos > 0) {
+            memmove(s->data, s->data + s->pos, s->end - s->pos);
+            s->end -= s->pos;
+            scanned -= s->pos;
+            s->pos = 0;
+        }
+        if (s->size - s->end < SCRIPT_BLOCK / 2) {
+            char *data = realloc(s->data, s->size * 2);
+            if (data == NULL)
+                return NULL;
+            s->data = data;
+            s->size *= 2;
+        }
+
+        ssize_t n;
+        do {
+            n = read(s->fd, s->data + s->end, s->size - s->end - 1);
+        } while (n == -1 && errno == EINTR);
+        if (n <= 0) {
+            /* A last line without a newline */
+            if (s->end == s->pos)
+                return NULL;
+            char *line = s->data + s->pos;
+            s->data[s->end] = '\0';
+            s->pos = s->end;
+            return line;
+        }
+        s->end += n;
+    }
+}
+
+/* Return the next line */
+char *
+script_read_line(struct script *s)
+{
+    char *line = s->mapped ? next_mapped_line(s) : next_block_line(s);
+    if (line != NULL)
+        s->lineno++;
+    return line;
+}
+
+const char *
+script_name(struct script *s)
+{
+    return s->name;
+}
+
+unsigned
+script_line(struct script *s)
+{
+    return s->lineno;
+}
+
+/* Let the commands that read stdin start at the next line */
+void
+script_sync(struct script *s)
+{
+    if (s->mapped && s->fd == STDIN_FILENO && !s->synced) {
+        lseek(s->fd, s->pos, SEEK_SET);
+        s->synced = true;
+    }
+}
+
+/* Release the input */
+void
+script_close(struct script *s)
+{
+    if (s->mapped) {
+        if (s->size > 0)
+            munmap(s->data, s->size);
+    } else {
+        free(s->data);
+    }
+    if (s->fd != STDIN_FILENO && s->fd != -1)
+        close(s->fd);
+    free(s->line);
+    free(s);
+}
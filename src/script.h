@@ -0,0 +1,43 @@
+#ifndef __SCRIPT_H
+#define __SCRIPT_H
+
+#include <stdbool.h>
+
+/*
+ * Reading command lines from a script or from stdin without readline.
+ *
+ * A regular file is mapped and split at newlines with memchr, so a
+ * line costs one copy and no system calls.  Anything else, such as a
+ * pipe, is read in blocks of SCRIPT_BLOCK bytes and split in place.
+ */
+#define SCRIPT_BLOCK 65536
+
+struct script;
+
+/* Open the script at 'path', or stdin if 'path' is NULL.  Returns
+ * NULL, with errno set, if the file cannot be opened or read. */
+struct script *script_open(const char *path);
+
+/* Read the lines of 'text', which must outlive the script, as a script
+ * called 'name' */
+struct script *script_open_string(const char *name, const char *text);
+
+/* Return the next line without its newline, or NULL at the end of the
+ * input.  The line is valid until the next call. */
+char *script_read_line(struct script *s);
+
+/* The name of the script for messages: its path, or "<stdin>" */
+const char *script_name(struct script *s);
+
+/* The number of the line last returned, starting at 1 */
+unsigned script_line(struct script *s);
+
+/* Move the file offset of a seekable stdin to the start of the next
+ * line, so that commands that read stdin continue from there.  The
+ * next line is then read from wherever they left the offset. */
+void script_sync(struct script *s);
+
+/* Unmap or free the input and close the file if it was opened */
+void script_close(struct script *s);
+
+#endif /* __SCRIPT_H */
@@ -0,0 +1,58 @@
+#!/usr/bin/python
+#
+# Tests script mode: 'cush file' runs the commands in file, skips
+# comments, and reports errors with the file name and line number;
+# 'cush -c commands' does the same for the lines of its argument
+
+import atexit, proc_check, time, os, subprocess, tempfile
+from testutils import *
+
+tmpdir = tempfile.mkdtemp()
+def tmpfile(name):
+    return os.path.join(tmpdir, name)
+
+path = tmpfile("script.cush")
+with open(path, "w") as f:
+    f.write("\n".join([
+        "#!./cush",
+        "echo first",
+        "",
+        "nosuchcommand",
+        "cat < %s" % tmpfile("nosuchfile"),
+        "echo a | | echo b",
+        "# a comment",
+        "echo last"]))
+
+# the script's stdin is the shell's, not the script
+env = dict(os.environ, XDG_CACHE_HOME=tmpdir)
+shell = subprocess.Popen(["./cush", path], env=env, stdin=subprocess.PIPE,
+                         stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                         preexec_fn=os.setsid)
+out, err = shell.communicate("")
+assert shell.returncode == 0, "Shell failed: " + err
+assert out == "first\nlast\n", "Unexpected output: " + out
+errors = err.splitlines()
+assert errors[0].startswith(path + ":4: nosuchcommand: "), \
+    "Unexpected error: " + errors[0]
+assert errors[1].startswith(path + ":5: " + tmpfile("nosuchfile") + ": "), \
+    "Unexpected error: " + errors[1]
+assert errors[2] == path + ":6: Invalid null command.", \
+    "Unexpected error: " + errors[2]
+
+# a script that cannot be opened
+shell = subprocess.Popen(["./cush", tmpfile("nosuchscript")],
+                         stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+out, err = shell.communicate()
+assert shell.returncode != 0, "Shell ran a missing script"
+assert err.startswith(tmpfile("nosuchscript") + ": "), "Unexpected error: " + err
+
+# commands given with -c; the shell's stdin is left to them
+shell = subprocess.Popen(["./cush", "-c", "echo one; cat\necho a | | b\necho two"],
+                         stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                         stderr=subprocess.PIPE, preexec_fn=os.setsid)
+out, err = shell.communicate("input\n")
+assert shell.returncode == 0, "Shell failed: " + err
+assert out == "one\ninput\ntwo\n", "Unexpected output: " + out
+assert err == "-c:2: Invalid null command.\n", "Unexpected error: " + err
+
+test_success()
@@ -10,9 +10,15 @@
 #include <sys/types.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "shell-ast.h"
 
+const char *ast_input_name;
+unsigned ast_input_line;
+bool ast_input_quiet;
+bool ast_mark_variables;
+
 /* Create new command structure.  Takes ownership of argv. */
 struct ast_command * 
 ast_command_create(char ** argv, bool dup_stderr_to_stdout)
@@ -36,6 +42,18 @@ struct ast_pipeline * ast_pipeline_create(char *iored_input,
     pipe->iored_input = iored_input;
     pipe->append_to_output = append_to_output;
     pipe->bg_job = false;
+    pipe->connector = AST_SEQ;
+    pipe->compound = NULL;
+    return pipe;
+}
+
+/* Create a pipeline that is a compound command.  Takes ownership of c. */
+struct ast_pipeline *
+ast_pipeline_create_compound(struct ast_compound *c)
+{
+    struct ast_pipeline *pipe = ast_pipeline_create(NULL, NULL, false);
+
+    pipe->compound = c;
     return pipe;
 }
 
@@ -46,6 +64,75 @@ ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd)
     list_push_back(&pipe->commands, &cmd->elem);
 }
 
+/* Copy a NULL terminated array of words */
+static char **
+clone_words(char **words)
+{
+    int n = 0;
+    while (words[n])
+        n++;
+
+    char **copy = malloc((n + 1) * sizeof *copy);
+    for (int i = 0; i < n; i++)
+        copy[i] = strdup(words[i]);
+    copy[n] = NULL;
+    return copy;
+}
+
+/* Create a deep copy of a compound command */
+struct ast_compound *
+ast_compound_clone(struct ast_compound *c)
+{
+    struct ast_compound *copy = ast_compound_create(c->kind);
+
+    if (c->name)
+        copy->name = strdup(c->name);
+    if (c->words)
+        copy->words = clone_words(c->words);
+    if (c->cond)
+        copy->cond = ast_command_line_clone(c->cond);
+    if (c->body)
+        copy->body = ast_command_line_clone(c->body);
+    if (c->orelse)
+        copy->orelse = ast_command_line_clone(c->orelse);
+    return copy;
+}
+
+/* Create a deep copy of a pipeline */
+struct ast_pipeline *
+ast_pipeline_clone(struct ast_pipeline *pipe)
+{
+    struct ast_pipeline *copy = ast_pipeline_create(
+        pipe->iored_input ? strdup(pipe->iored_input) : NULL,
+        pipe->iored_output ? strdup(pipe->iored_output) : NULL,
+        pipe->append_to_output);
+
+    copy->bg_job = pipe->bg_job;
+    copy->connector = pipe->connector;
+    if (pipe->compound)
+        copy->compound = ast_compound_clone(pipe->compound);
+    for (struct list_elem * e = list_begin(&pipe->commands); 
+         e != list_end(&pipe->commands); 
+         e = list_next(e)) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+
+        ast_pipeline_add_command(copy,
+                ast_command_create(clone_words(cmd->argv),
+                                   cmd->dup_stderr_to_stdout));
+    }
+    return copy;
+}
+
+/* Create a compound command without parts */
+struct ast_compound *
+ast_compound_create(enum ast_compound_kind kind)
+{
+    struct ast_compound *c = calloc(1, sizeof *c);
+
+    c->kind = kind;
+    return c;
+}
+
 /* Create an empty command line */
 struct ast_command_line *
 ast_command_line_create_empty(void)
@@ -66,6 +153,37 @@ ast_command_line_create(struct ast_pipeline *pipe)
     return cmdline;
 }
 
+/* Create a deep copy of a command line */
+struct ast_command_line *
+ast_command_line_clone(struct ast_command_line *cmdline)
+{
+    struct ast_command_line *copy = ast_command_line_create_empty();
+
+    for (struct list_elem * e = list_begin(&cmdline->pipes); 
+         e != list_end(&cmdline->pipes); 
+         e = list_next(e)) {
+        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
+
+        list_push_back(&copy->pipes, &ast_pipeline_clone(pipe)->elem);
+    }
+    return copy;
+}
+
+/* Check for compound commands, && and || */
+bool
+ast_command_line_is_simple(struct ast_command_line *cmdline)
+{
+    for (struct list_elem * e = list_begin(&cmdline->pipes); 
+         e != list_end(&cmdline->pipes); 
+         e = list_next(e)) {
+        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
+
+        if (pipe->compound || pipe->connector != AST_SEQ)
+            return false;
+    }
+    return true;
+}
+
 /* Print ast_command structure to stdout */
 void
 ast_command_print(struct ast_command *cmd)
@@ -82,12 +200,49 @@ ast_command_print(struct ast_command *cmd)
         printf("  stderr shall also be redirected\n");
 }
   
+static const char *compound_names[] = {
+    [AST_IF] = "if", [AST_WHILE] = "while", [AST_UNTIL] = "until",
+    [AST_FOR] = "for", [AST_GROUP] = "{", [AST_FUNCTION] = "function",
+};
+
+/* Print ast_compound structure to stdout */
+static void
+ast_compound_print(struct ast_compound *c)
+{
+    printf(" Compound command: %s", compound_names[c->kind]);
+    if (c->name)
+        printf(" %s", c->name);
+    for (char **p = c->words; p && *p; p++)
+        printf(" %s", *p);
+    printf("\n");
+
+    if (c->cond) {
+        printf(" condition:\n");
+        ast_command_line_print(c->cond);
+    }
+    if (c->body) {
+        printf(" body:\n");
+        ast_command_line_print(c->body);
+    }
+    if (c->orelse) {
+        printf(" else:\n");
+        ast_command_line_print(c->orelse);
+    }
+}
+
 /* Print ast_pipeline structure to stdout */
 void
 ast_pipeline_print(struct ast_pipeline *pipe)
 {
     int i = 1;
 
+    if (pipe->connector != AST_SEQ)
+        printf(" Runs if the pipeline before %s\n",
+               pipe->connector == AST_AND ? "succeeded" : "failed");
+    if (pipe->compound) {
+        ast_compound_print(pipe->compound);
+        return;
+    }
     printf(" Pipeline consists of %ld commands\n", list_size(&pipe->commands));
     for (struct list_elem * e = list_begin(&pipe->commands); 
          e != list_end(&pipe->commands); 
@@ -154,9 +309,30 @@ ast_pipeline_free(struct ast_pipeline *pipe)
     if (pipe->iored_output)
         free(pipe->iored_output);
 
+    if (pipe->compound)
+        ast_compound_free(pipe->compound);
+
     free(pipe);
 }
 
+void
+ast_compound_free(struct ast_compound *c)
+{
+    free(c->name);
+    if (c->words) {
+        for (char **p = c->words; *p; p++)
+            free(*p);
+        free(c->words);
+    }
+    if (c->cond)
+        ast_command_line_free(c->cond);
+    if (c->body)
+        ast_command_line_free(c->body);
+    if (c->orelse)
+        ast_command_line_free(c->orelse);
+    free(c);
+}
+
 void 
 ast_command_free(struct ast_command * cmd)
 {
@@ -7,12 +7,20 @@
 struct ast_command;
 struct ast_pipeline;
 struct ast_command_line;
+struct ast_compound;
 
 /* A command line may contain multiple pipelines. */
 struct ast_command_line {
     struct list/* <ast_pipeline> */ pipes;        /* List of pipelines */
 };
 
+/* How a pipeline is joined to the pipeline before it */
+enum ast_connector {
+    AST_SEQ,                 /* ; & or a newline: it always runs */
+    AST_AND,                 /* &&: it runs if the one before succeeded */
+    AST_OR,                  /* ||: it runs if the one before failed */
+};
+
 /* A pipeline is a list of one or more commands. 
  * For the purposes of job control, a pipeline forms one job.
  */
@@ -24,9 +32,37 @@ struct ast_pipeline {
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
     bool bg_job;             /* True if user entered & */
+    enum ast_connector connector; /* How it follows the pipeline before */
+    struct ast_compound *compound; /* If non-NULL, the pipeline is this
+                                compound command and has no commands */
     struct list_elem elem;   /* Link element. */
 };
 
+/* The kinds of compound commands */
+enum ast_compound_kind {
+    AST_IF,                  /* if cond; then body; else orelse; fi */
+    AST_WHILE,               /* while cond; do body; done */
+    AST_UNTIL,               /* until cond; do body; done */
+    AST_FOR,                 /* for name in words; do body; done */
+    AST_GROUP,               /* { body; } */
+    AST_FUNCTION,            /* name() body */
+};
+
+/* A compound command, which the shell runs itself.  Its parts are NULL
+ * where its kind has none. */
+struct ast_compound {
+    enum ast_compound_kind kind;
+    char *name;              /* The variable of a for loop, or the name of
+                                a function */
+    char **words;            /* NULL terminated words a for loop iterates
+                                over */
+    struct ast_command_line *cond;   /* Condition of if, while and until */
+    struct ast_command_line *body;   /* Commands run by the compound; for a
+                                        function, one compound command */
+    struct ast_command_line *orelse; /* else part of an if.  An elif is an
+                                        if in the else part. */
+};
+
 /* A command is part of a pipeline. */
 struct ast_command {
     char **argv;             /* NULL terminated array of pointers to words
@@ -47,6 +83,25 @@ struct ast_pipeline * ast_pipeline_create(char *iored_input,
 /* Add a new command to this pipeline */
 void ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd);
 
+/* Create a pipeline that is a compound command */
+struct ast_pipeline * ast_pipeline_create_compound(struct ast_compound *c);
+
+/* Create a deep copy of a pipeline */
+struct ast_pipeline * ast_pipeline_clone(struct ast_pipeline *pipe);
+
+/* Create a compound command of the given kind without parts */
+struct ast_compound * ast_compound_create(enum ast_compound_kind kind);
+
+/* Create a deep copy of a compound command */
+struct ast_compound * ast_compound_clone(struct ast_compound *c);
+
+/* Create a deep copy of a command line */
+struct ast_command_line * ast_command_line_clone(struct ast_command_line *line);
+
+/* Return true if the command line has no compound commands, && or ||,
+ * so that it can be run one pipeline after the other */
+bool ast_command_line_is_simple(struct ast_command_line *line);
+
 /* Create an empty command line */
 struct ast_command_line * ast_command_line_create_empty(void);
 
@@ -57,14 +112,35 @@ struct ast_command_line * ast_command_line_create(struct ast_pipeline *pipe);
 void ast_command_line_free(struct ast_command_line *);
 void ast_pipeline_free(struct ast_pipeline *);
 void ast_command_free(struct ast_command *);
+void ast_compound_free(struct ast_compound *);
 
 /* Print functions */
 void ast_command_print(struct ast_command *cmd);
 void ast_pipeline_print(struct ast_pipeline *pipe);
 void ast_command_line_print(struct ast_command_line *line);
 
-/* Parse a command line.  Implemented in shell-grammar.y */
+/* Parse a command line, which may span several lines separated by
+ * newlines.  Implemented in shell-grammar.y */
 struct ast_command_line * ast_parse_command_line(char * line);
 
+/* Set if the last command line did not parse only because it ended
+ * inside a compound command or after && or ||.  No error was printed;
+ * it should be parsed again with the next line appended. */
+extern bool ast_input_incomplete;
+
+/* Where the line being parsed came from.  If ast_input_name is not
+ * NULL, parse errors are prefixed with "name:line: ". */
+extern const char *ast_input_name;
+extern unsigned ast_input_line;
+
+/* If true, parse errors are not printed */
+extern bool ast_input_quiet;
+
+/* If true, the lexer replaces each $ outside of double quotes with
+ * AST_VAR, which marks a reference to a variable that the shell expands
+ * when it runs the command.  Otherwise, $ is an ordinary character. */
+extern bool ast_mark_variables;
+#define AST_VAR '\001'
+
 /** ----------------------------------------------------------- */
 #endif /* __SHELL_AST_H */
@@ -26,8 +26,12 @@ int yylex(void);
 #define INVNUL  "Invalid null command."
 #define AMBINP  "Ambiguous input redirect."
 #define AMBOUT  "Ambiguous output redirect."
+#define BGCOMP  "Compound commands cannot run in the background."
+#define SYNTAX  "Syntax error."
 
 #include "shell-ast.h"
+#include <ctype.h>
+#include <string.h>
 #include <obstack.h>
 #include <assert.h>
 
@@ -76,11 +80,9 @@ init_cmd(char *firstcmd,
 /* print error message */
 static void p_error(char *msg);
 
-/* Convert cmd_helper to ast_command.
- * Ensures NULL-terminated argv[] array
- */
-static struct ast_command * 
-make_ast_command(struct cmd_helper *cmd)
+/* Take the words of a cmd_helper as a NULL-terminated array */
+static char **
+finish_words(struct cmd_helper *cmd)
 {
     obstack_ptr_grow(&cmd->words, NULL);
 
@@ -88,6 +90,16 @@ make_ast_command(struct cmd_helper *cmd)
     char **argv = malloc(sz);
     memcpy(argv, obstack_finish(&cmd->words), sz);
     obstack_free(&cmd->words, NULL);
+    return argv;
+}
+
+/* Convert cmd_helper to ast_command.
+ * Ensures NULL-terminated argv[] array
+ */
+static struct ast_command * 
+make_ast_command(struct cmd_helper *cmd)
+{
+    char **argv = finish_words(cmd);
 
     if (*argv == NULL) {
         free(argv);
@@ -121,6 +133,37 @@ add_to_pipeline(struct pipe_helper *pipe,
     return true;
 }
 
+/* Run the last pipeline of a command line in the background */
+static bool
+set_background(struct ast_command_line *cline)
+{
+    /* Error: '& ls' */
+    if (list_empty(&cline->pipes)) { p_error(INVNUL); return false; }
+
+    struct ast_pipeline * last;
+    last = list_entry(list_back(&cline->pipes), struct ast_pipeline, elem);
+    /* Error: 'while true; do ls; done &' */
+    if (last->compound) { p_error(BGCOMP); return false; }
+    last->bg_job = true;
+    return true;
+}
+
+/* Move the pipelines of 'rest' to the end of 'cline' */
+static void
+append_pipelines(struct ast_command_line *cline, struct ast_command_line *rest)
+{
+    while (!list_empty(&rest->pipes))
+        list_push_back(&cline->pipes, list_pop_front(&rest->pipes));
+    ast_command_line_free(rest);
+}
+
+/* Wrap a compound command into a command line of its own */
+static struct ast_command_line *
+compound_line(struct ast_compound *c)
+{
+    return ast_command_line_create(ast_pipeline_create_compound(c));
+}
+
 /* Called by parser when command line is complete */
 static void cmdline_complete(struct ast_command_line *);
 
@@ -135,47 +178,118 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
   struct pipe_helper *pipe;
   struct ast_pipeline *ast_pipe;
   struct ast_command_line *cmdline;
+  struct ast_compound *compound;
   char *word;
 }
 
 /* Nonterminals */
 %type <command> input output
-%type <command> command
+%type <command> command words
 %type <pipe> pipeline
-%type <ast_pipe> ast_pipeline
-%type <cmdline> cmd_list
+%type <ast_pipe> ast_pipeline item
+%type <cmdline> cmd_list and_or else_part
+%type <compound> compound
 
 /* Terminals */
-%token <word> WORD
-%token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND
+%token <word> WORD FUNCNAME
+%token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND AND_AND OR_OR
+/* Reserved words, recognized where a command starts */
+%token IF THEN ELSE ELIF FI WHILE UNTIL DO DONE FOR IN LBRACE RBRACE
 
 %%
 cmd_line: cmd_list { cmdline_complete($1); }
 
 cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(); }
-|		ast_pipeline { 
-            $$ = ast_command_line_create($1);
-        } 
-|		cmd_list ';'
+|		and_or
+|		cmd_list separator
 |		cmd_list '&' {
+            if (!set_background($1))
+                YYABORT;
             $$ = $1;
-            struct ast_pipeline * last;
-            last = list_entry(list_back(&$1->pipes), 
-                              struct ast_pipeline, elem);
-            last->bg_job = true;
         }
-|		cmd_list ';' ast_pipeline	{ 
+|		cmd_list separator and_or	{ 
             $$ = $1;
-            list_push_back(&$$->pipes, &$3->elem);
+            append_pipelines($$, $3);
         }
-|		cmd_list '&' ast_pipeline	{ 
-            struct ast_pipeline * last;
-            last = list_entry(list_back(&$1->pipes), 
-                              struct ast_pipeline, elem);
-            last->bg_job = true;
+|		cmd_list '&' and_or	{ 
+            if (!set_background($1))
+                YYABORT;
+            $$ = $1;
+            append_pipelines($$, $3);
+        }
+
+separator: ';' | '\n'
 
+linebreak: /* empty */ | linebreak '\n'
+
+and_or: item {
+            $$ = ast_command_line_create($1);
+        }
+|		and_or AND_AND linebreak item {
+            $4->connector = AST_AND;
             $$ = $1;
-            list_push_back(&$$->pipes, &$3->elem);
+            list_push_back(&$$->pipes, &$4->elem);
+        }
+|		and_or OR_OR linebreak item {
+            $4->connector = AST_OR;
+            $$ = $1;
+            list_push_back(&$$->pipes, &$4->elem);
+        }
+
+item: ast_pipeline
+|		compound {
+            $$ = ast_pipeline_create_compound($1);
+        }
+
+compound: IF cmd_list THEN cmd_list else_part FI {
+            $$ = ast_compound_create(AST_IF);
+            $$->cond = $2;
+            $$->body = $4;
+            $$->orelse = $5;
+        }
+|		WHILE cmd_list DO cmd_list DONE {
+            $$ = ast_compound_create(AST_WHILE);
+            $$->cond = $2;
+            $$->body = $4;
+        }
+|		UNTIL cmd_list DO cmd_list DONE {
+            $$ = ast_compound_create(AST_UNTIL);
+            $$->cond = $2;
+            $$->body = $4;
+        }
+|		FOR WORD IN words separator linebreak DO cmd_list DONE {
+            $$ = ast_compound_create(AST_FOR);
+            $$->name = $2;
+            $$->words = finish_words($4);
+            free($4);
+            $$->body = $8;
+        }
+|		LBRACE cmd_list RBRACE {
+            $$ = ast_compound_create(AST_GROUP);
+            $$->body = $2;
+        }
+|		FUNCNAME linebreak compound {
+            $$ = ast_compound_create(AST_FUNCTION);
+            $$->name = $1;
+            $$->body = compound_line($3);
+        }
+
+else_part: /* no else */ { $$ = NULL; }
+|		ELSE cmd_list { $$ = $2; }
+|		ELIF cmd_list THEN cmd_list else_part {
+            struct ast_compound *c = ast_compound_create(AST_IF);
+            c->cond = $2;
+            c->body = $4;
+            c->orelse = $5;
+            $$ = compound_line(c);
+        }
+
+words: /* none */ {
+            $$ = init_cmd(NULL, NULL, NULL, false, false);
+        }
+|		words WORD {
+            $$ = $1;
+            obstack_ptr_grow(&$$->words, $2);
         }
 
 ast_pipeline: pipeline {
@@ -273,20 +387,102 @@ static char * inputline;    /* currently processed input line */
     }
 
 #define YY_NO_INPUT
+
+/* Reserved words are only recognized where a command starts, and "in"
+ * after "for name" */
+static bool command_start;
+static enum { FOR_NONE, FOR_KEYWORD, FOR_NAME } for_state;
+
+static const struct {
+    const char *word;
+    int token;
+} reserved_words[] = {
+    { "if", IF }, { "then", THEN }, { "else", ELSE }, { "elif", ELIF },
+    { "fi", FI }, { "while", WHILE }, { "until", UNTIL }, { "do", DO },
+    { "done", DONE }, { "for", FOR }, { "{", LBRACE }, { "}", RBRACE },
+};
+
+/* Return true if 'word' is "name()" for a valid function name */
+static bool
+is_function_name(const char *word)
+{
+    size_t len = strlen(word);
+    if (len < 3 || strcmp(word + len - 2, "()") != 0 ||
+        !(isalpha((unsigned char) word[0]) || word[0] == '_'))
+        return false;
+    for (size_t i = 1; i < len - 2; i++)
+        if (!(isalnum((unsigned char) word[i]) || word[i] == '_'))
+            return false;
+    return true;
+}
+
+/* Classify a word the lexer found, which is freed unless it is
+ * returned in yylval.  Quoted words are never reserved. */
+static int
+word_token(char *word, bool quoted)
+{
+    int token = WORD;
+    if (!quoted && ast_mark_variables)
+        for (char *p = word; (p = strchr(p, '$')) != NULL; p++)
+            *p = AST_VAR;
+    if (!quoted && command_start) {
+        for (size_t i = 0; i < sizeof reserved_words / sizeof *reserved_words;
+             i++)
+            if (strcmp(word, reserved_words[i].word) == 0)
+                token = reserved_words[i].token;
+        if (token == WORD && is_function_name(word)) {
+            word[strlen(word) - 2] = '\0';
+            token = FUNCNAME;
+        }
+    } else if (!quoted && for_state == FOR_NAME && strcmp(word, "in") == 0) {
+        token = IN;
+    }
+
+    /* A command starts after a keyword that is followed by one */
+    command_start = token != WORD && token != FI && token != DONE &&
+                    token != RBRACE && token != FOR && token != IN;
+    if (token == FOR)
+        for_state = FOR_KEYWORD;
+    else if (token == WORD && for_state == FOR_KEYWORD)
+        for_state = FOR_NAME;
+    else
+        for_state = FOR_NONE;
+
+    if (token == WORD || token == FUNCNAME)
+        yylval.word = word;
+    else
+        free(word);
+    return token;
+}
+
 #include "lex.yy.c"
 
+/* Set when an error message was printed, or the input ended early */
+static bool error_reported;
+static bool error_at_eof;
+bool ast_input_incomplete;
+
 static void
 p_error(char *msg) 
 { 
+    error_reported = true;
     /* print error */
+    if (ast_input_quiet)
+        return;
+    if (ast_input_name != NULL)
+        fprintf(stderr, "%s:%u: ", ast_input_name, ast_input_line);
     fprintf(stderr, "%s\n", msg); 
 }
 
 extern int yyparse (void);
 
-/* do not use default error handling since errors are handled above. */
+/* do not use default error handling since errors are handled above,
+ * or reported once parsing failed. */
 void 
-yyerror(const char *msg) { }
+yyerror(const char *msg)
+{
+    error_at_eof = yychar == YYEOF;
+}
 
 static struct ast_command_line * commandline;
 static void cmdline_complete(struct ast_command_line *cline)
@@ -302,8 +498,15 @@ ast_parse_command_line(char * line)
 {
     inputline = line;
     commandline = NULL;
+    command_start = true;
+    for_state = FOR_NONE;
+    error_reported = error_at_eof = false;
 
     int error = yyparse();
 
+    /* An unfinished compound command is not an error yet */
+    ast_input_incomplete = error && !error_reported && error_at_eof;
+    if (error && !error_reported && !error_at_eof)
+        p_error(SYNTAX);
     return error ? NULL : commandline;
 }
@@ -0,0 +1,109 @@
+/*
+ * Publishing the job table in shared memory.
+ *
+ * The table is a fixed-size array of slots in a POSIX shared memory
+ * object that others can only read.  Updates are plain stores into
+ * the mapping; see shm_jobs.h for the sequence lock that readers use.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shm_jobs.h"
+#include "utils.h"
+
+static struct shm_jobs_table *table;
+static char shm_name[32];
+
+bool
+shm_jobs_init(void)
+{
+    snprintf(shm_name, sizeof shm_name, "/cush-%d", (int) getpid());
+
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        utils_error("shm_open %s: ", shm_name);
+        return false;
+    }
+    if (ftruncate(fd, sizeof *table) == -1) {
+        utils_error("ftruncate %s: ", shm_name);
+        close(fd);
+        shm_unlink(shm_name);
+        return false;
+    }
+
+    table = mmap(NULL, sizeof *table, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        utils_error("mmap %s: ", shm_name);
+        table = NULL;
+        shm_unlink(shm_name);
+        return false;
+    }
+
+    table->version = SHM_JOBS_VERSION;
+    table->shell_pid = getpid();
+    table->nslots = SHM_JOBS_SLOTS;
+    /* Readers check the magic number last */
+    __atomic_store_n(&table->magic, SHM_JOBS_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool
+shm_jobs_enabled(void)
+{
+    return table != NULL;
+}
+
+int
+shm_jobs_alloc(int jid)
+{
+    for (int i = 0; i < SHM_JOBS_SLOTS; i++) {
+        if (table->slots[i].jid == 0) {
+            struct shm_job *s = shm_jobs_begin(i);
+            uint32_t seq = s->seq;
+            memset(s, 0, sizeof *s);
+            s->seq = seq;
+            s->jid = jid;
+            shm_jobs_end(i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+struct shm_job *
+shm_jobs_begin(int slot)
+{
+    struct shm_job *s = &table->slots[slot];
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return s;
+}
+
+void
+shm_jobs_end(int slot)
+{
+    struct shm_job *s = &table->slots[slot];
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void
+shm_jobs_free(int slot)
+{
+    struct shm_job *s = shm_jobs_begin(slot);
+    s->jid = 0;
+    shm_jobs_end(slot);
+}
+
+void
+shm_jobs_cleanup(void)
+{
+    if (table != NULL)
+        shm_unlink(shm_name);
+}
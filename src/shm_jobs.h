@@ -0,0 +1,77 @@
+#ifndef __SHM_JOBS_H
+#define __SHM_JOBS_H
+
+/*
+ * Layout of the job table a shell publishes in the POSIX shared memory
+ * object /cush-<pid> (/dev/shm/cush-<pid>), shared with readers such as
+ * cushjobs.
+ *
+ * Each slot is protected by a sequence lock.  The shell makes 'seq' odd
+ * before it changes a slot and even again afterwards, so a reader copies
+ * a slot and retries if 'seq' was odd or changed during the copy.  The
+ * shell never waits for readers.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHM_JOBS_MAGIC   0x68737563     /* "cush" */
+#define SHM_JOBS_VERSION 1
+#define SHM_JOBS_SLOTS   64
+#define SHM_JOBS_PIDS    10
+#define SHM_JOBS_CMDLINE 256
+
+/* Values of 'status', as in the shell's enum job_status */
+enum shm_job_status {
+    SHM_JOB_FOREGROUND,
+    SHM_JOB_BACKGROUND,
+    SHM_JOB_STOPPED,
+    SHM_JOB_NEEDSTERMINAL,
+};
+
+/* One job; 'jid' is 0 if the slot is free */
+struct shm_job {
+    uint32_t seq;
+    int32_t jid;
+    int32_t pgid;
+    int32_t status;
+    int32_t nprocs;                     /* Number of processes started */
+    int32_t nalive;                     /* Number not yet reaped */
+    int32_t pids[SHM_JOBS_PIDS];
+    int64_t start_sec;                  /* Start time, CLOCK_REALTIME */
+    int64_t start_nsec;
+    char cmdline[SHM_JOBS_CMDLINE];     /* Truncated if too long */
+};
+
+struct shm_jobs_table {
+    uint32_t magic;
+    uint32_t version;
+    int32_t shell_pid;
+    uint32_t nslots;
+    struct shm_job slots[SHM_JOBS_SLOTS];
+};
+
+/* Create and map /cush-<pid>.  Returns false on failure. */
+bool shm_jobs_init(void);
+
+/* Return true if the job table is published */
+bool shm_jobs_enabled(void);
+
+/* Claim a free slot for job 'jid' and clear it.
+ * Returns -1 if all slots are taken. */
+int shm_jobs_alloc(int jid);
+
+/* Start changing a slot and return it.  The caller must make sure
+ * that a signal handler does not change the same slot meanwhile.
+ * Async-signal-safe, like the other slot functions. */
+struct shm_job *shm_jobs_begin(int slot);
+
+/* Finish changing a slot */
+void shm_jobs_end(int slot);
+
+/* Mark a slot as free */
+void shm_jobs_free(int slot);
+
+/* Remove /cush-<pid> */
+void shm_jobs_cleanup(void);
+
+#endif /* __SHM_JOBS_H */
@@ -0,0 +1,53 @@
+#!/usr/bin/python
+#
+# Tests the shared job table of -S: cushjobs sees the jobs, their
+# processes and status changes, and the table is removed on exit
+
+import atexit, proc_check, time, os, subprocess
+from testutils import *
+
+console = setup_tests([" -S"])
+
+def cushjobs():
+    return subprocess.Popen(["./cushjobs", str(console.pid)],
+                            stdout=subprocess.PIPE).communicate()[0]
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+assert os.path.exists("/dev/shm/cush-%d" % console.pid), \
+    "Shared job table was not created"
+
+sendline("sleep 30 | cat &")
+(jid, pid) = parse_bg_status()
+expect_prompt()
+
+table = cushjobs()
+assert re.search("^%d\s+%s\s+\d+\s+Running\s.*sleep 30\| cat$" %
+                 (console.pid, jid), table, re.M), \
+    "Job missing from the table:\n" + table
+# the shell reports the pid of the last stage
+assert re.search("\d+,%s \(2 alive\)" % pid, table), \
+    "Stage pids missing from the table:\n" + table
+
+# status changes are published
+sendline("stop " + jid)
+expect_prompt()
+time.sleep(0.2)
+assert re.search("\s+Stopped\s", cushjobs()), "Stopped job not published"
+
+# deleted jobs are removed
+sendline("kill " + jid)
+expect_prompt()
+sendline("jobs")
+expect_prompt()
+assert "sleep 30" not in cushjobs(), "Deleted job still in the table"
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+time.sleep(0.2)
+assert not os.path.exists("/dev/shm/cush-%d" % console.pid), \
+    "Shared job table was not removed"
+
+test_success()
@@ -0,0 +1,88 @@
+/*
+ * The stdio of a stage of a pipeline.
+ *
+ * Standard input is set up first, then standard output, then standard
+ * error, so that >& and |& send stderr to the file or pipe that stdout
+ * ends up on.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stage_io.h"
+
+/* Describe the stdio of a stage */
+void
+stage_io_init(struct stage_io *io, struct ast_pipeline *pipe,
+              struct ast_command *cmd, bool first, bool last,
+              int in, int out, int err)
+{
+    io->input = first ? pipe->iored_input : NULL;
+    io->output = last ? pipe->iored_output : NULL;
+    io->output_flags = O_WRONLY | O_CREAT |
+                       (pipe->append_to_output ? O_APPEND : O_TRUNC);
+    io->fd[0] = io->input != NULL ? -1 : in;
+    io->fd[1] = io->output != NULL ? -1 : out;
+    io->dup_stderr = cmd->dup_stderr_to_stdout;
+    io->fd[2] = io->dup_stderr ? -1 : err;
+}
+
+/* Open 'path' onto 'target' */
+static bool
+open_onto(const char *path, int flags, int target)
+{
+    int fd = open(path, flags, 0666);
+    if (fd == -1 || dup2(fd, target) == -1)
+        return false;
+    if (fd != target)
+        close(fd);
+    return true;
+}
+
+/* Set up the stdio of the calling process */
+bool
+stage_io_apply(const struct stage_io *io, const char **failed)
+{
+    if (io->input != NULL && !open_onto(io->input, O_RDONLY, STDIN_FILENO)) {
+        *failed = io->input;
+        return false;
+    }
+    if (io->output != NULL &&
+        !open_onto(io->output, io->output_flags, STDOUT_FILENO)) {
+        *failed = io->output;
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (i == STDERR_FILENO && io->dup_stderr &&
+            dup2(STDOUT_FILENO, STDERR_FILENO) == -1) {
+            *failed = "dup2";
+            return false;
+        }
+        if (io->fd[i] != -1 && dup2(io->fd[i], i) == -1) {
+            *failed = "dup2";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Add the file actions of a spawned stage */
+int
+stage_io_add_actions(const struct stage_io *io,
+                     posix_spawn_file_actions_t *fa)
+{
+    int rc = 0;
+    if (io->input != NULL)
+        rc = posix_spawn_file_actions_addopen(fa, STDIN_FILENO, io->input,
+                                              O_RDONLY, 0);
+    if (rc == 0 && io->output != NULL)
+        rc = posix_spawn_file_actions_addopen(fa, STDOUT_FILENO, io->output,
+                                              io->output_flags, 0666);
+    for (int i = 0; i < 3 && rc == 0; i++) {
+        if (i == STDERR_FILENO && io->dup_stderr)
+            rc = posix_spawn_file_actions_adddup2(fa, STDOUT_FILENO,
+                                                  STDERR_FILENO);
+        else if (io->fd[i] != -1)
+            rc = posix_spawn_file_actions_adddup2(fa, io->fd[i], i);
+    }
+    return rc;
+}
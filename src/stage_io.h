@@ -0,0 +1,42 @@
+#ifndef __STAGE_IO_H
+#define __STAGE_IO_H
+
+#include <spawn.h>
+#include <stdbool.h>
+
+#include "shell-ast.h"
+
+/*
+ * The standard input, output and error of one stage of a pipeline: the
+ * redirections of the pipeline for its first and last stage, and
+ * otherwise the pipes between the stages.  The shell applies them in
+ * the child it forked, libcush turns them into posix_spawn file
+ * actions, and both follow the same rules.
+ */
+struct stage_io {
+    const char *input;          /* File to open as stdin, or NULL */
+    const char *output;         /* File to open as stdout, or NULL */
+    int output_flags;           /* How to open 'output' */
+    int fd[3];                  /* Descriptors to dup2 onto 0, 1 and 2,
+                                   or -1 to keep them */
+    bool dup_stderr;            /* Send stderr where stdout goes */
+};
+
+/* Describe the stdio of 'cmd' in 'pipe', the first and/or last stage
+ * of it as given.  It reads 'in' and writes 'out' and 'err', or keeps
+ * its descriptor for -1, unless it is redirected. */
+void stage_io_init(struct stage_io *io, struct ast_pipeline *pipe,
+                   struct ast_command *cmd, bool first, bool last,
+                   int in, int out, int err);
+
+/* Set up the stdio of the calling process, which is about to exec.
+ * Returns false, with errno set and '*failed' naming the file or call
+ * that failed. */
+bool stage_io_apply(const struct stage_io *io, const char **failed);
+
+/* Add the file actions that set up the stdio of a spawned stage.
+ * Returns 0 or an error number. */
+int stage_io_add_actions(const struct stage_io *io,
+                         posix_spawn_file_actions_t *fa);
+
+#endif /* __STAGE_IO_H */
@@ -0,0 +1,221 @@
+/*
+ * Latency histograms.
+ *
+ * Values are kept in log-linear buckets, as in HdrHistogram: every
+ * power of two is split into SUB_BUCKETS linear buckets, so a value is
+ * known to within 1/SUB_BUCKETS of itself, from nanoseconds up to
+ * centuries, in a fixed-size array that recording only increments.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define SUB_BITS 3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NBUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+struct histogram {
+    uint64_t count;
+    uint64_t sum;       /* in ns */
+    uint64_t min, max;
+    uint32_t buckets[NBUCKETS];
+};
+
+static struct histogram histograms[STAT_COUNT];
+
+/* Names used in the table and JSON, and for the Prometheus metrics */
+static struct {
+    const char *name;
+    const char *metric;
+    const char *help;
+} stat_names[STAT_COUNT] = {
+    [STAT_SPAWN] = { "spawn", "cush_spawn_latency_seconds",
+                     "Time to fork one pipeline stage" },
+    [STAT_REAP] = { "reap", "cush_reap_handling_seconds",
+                    "Time to reap a child, from noticing its state change "
+                    "until its status was processed" },
+    [STAT_PARSE] = { "parse", "cush_parse_seconds",
+                     "Time to parse a command line" },
+    [STAT_PROMPT] = { "prompt", "cush_prompt_render_seconds",
+                      "Time to build and print the prompt" },
+};
+
+/* Return the bucket of 'v' */
+static int
+bucket_of(uint64_t v)
+{
+    if (v < SUB_BUCKETS)
+        return v;
+
+    int exp = 63 - __builtin_clzll(v);
+    int sub = (v >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/* Return the smallest value that falls into bucket 'b' */
+static uint64_t
+bucket_low(int b)
+{
+    if (b < SUB_BUCKETS)
+        return b;
+
+    int exp = b / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = b % SUB_BUCKETS;
+    return (1ULL << exp) | (sub << (exp - SUB_BITS));
+}
+
+/* Return the largest value that falls into bucket 'b' */
+static uint64_t
+bucket_high(int b)
+{
+    return b == NBUCKETS - 1 ? UINT64_MAX : bucket_low(b + 1) - 1;
+}
+
+void
+stats_record(enum stat_id id, uint64_t ns)
+{
+    struct histogram *h = &histograms[id];
+
+    if (h->count == 0 || ns < h->min)
+        h->min = ns;
+    if (ns > h->max)
+        h->max = ns;
+    h->count++;
+    h->sum += ns;
+    h->buckets[bucket_of(ns)]++;
+}
+
+void
+stats_reset(void)
+{
+    memset(histograms, 0, sizeof histograms);
+}
+
+/* Return the value at quantile 'q', as the upper end of the bucket
+ * that contains it, clamped to the largest value recorded */
+static uint64_t
+quantile(struct histogram *h, double q)
+{
+    uint64_t rank = q * h->count + 0.5;
+    uint64_t seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+    for (int b = 0; b < NBUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank)
+            return bucket_high(b) < h->max ? bucket_high(b) : h->max;
+    }
+    return h->max;
+}
+
+/* Format 'ns' with a unit that keeps it short */
+static const char *
+format_ns(char *buf, size_t size, uint64_t ns)
+{
+    if (ns >= 1000000000)
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    else if (ns >= 1000000)
+        snprintf(buf, size, "%.2fms", ns / 1e6);
+    else if (ns >= 1000)
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    else
+        snprintf(buf, size, "%luns", (unsigned long) ns);
+    return buf;
+}
+
+void
+stats_print(FILE *out)
+{
+    static const double qs[] = { 0.5, 0.9, 0.99 };
+
+    fprintf(out, "%-8s %8s %9s %9s %9s %9s %9s %9s\n", "", "count",
+            "min", "mean", "p50", "p90", "p99", "max");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+        char buf[16];
+
+        fprintf(out, "%-8s %8lu", stat_names[i].name,
+                (unsigned long) h->count);
+        if (h->count == 0) {
+            fprintf(out, "\n");
+            continue;
+        }
+        fprintf(out, " %9s", format_ns(buf, sizeof buf, h->min));
+        fprintf(out, " %9s", format_ns(buf, sizeof buf, h->sum / h->count));
+        for (int q = 0; q < sizeof qs / sizeof qs[0]; q++)
+            fprintf(out, " %9s", format_ns(buf, sizeof buf, quantile(h, qs[q])));
+        fprintf(out, " %9s\n", format_ns(buf, sizeof buf, h->max));
+    }
+}
+
+void
+stats_print_json(FILE *out)
+{
+    fprintf(out, "{");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+
+        fprintf(out, "%s\"%s\": {\"count\": %lu, \"sum_ns\": %lu, "
+                "\"min_ns\": %lu, \"max_ns\": %lu, \"p50_ns\": %lu, "
+                "\"p90_ns\": %lu, \"p99_ns\": %lu, \"buckets\": [",
+                i == 0 ? "" : ", ", stat_names[i].name,
+                (unsigned long) h->count, (unsigned long) h->sum,
+                (unsigned long) h->min, (unsigned long) h->max,
+                (unsigned long) quantile(h, 0.5),
+                (unsigned long) quantile(h, 0.9),
+                (unsigned long) quantile(h, 0.99));
+
+        /* Only the buckets that have values, as [low, high, count] */
+        const char *sep = "";
+        for (int b = 0; b < NBUCKETS; b++) {
+            if (h->buckets[b] == 0)
+                continue;
+            fprintf(out, "%s[%lu, %lu, %u]", sep,
+                    (unsigned long) bucket_low(b),
+                    (unsigned long) bucket_high(b), h->buckets[b]);
+            sep = ", ";
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "}\n");
+}
+
+bool
+stats_write_prometheus(const char *path)
+{
+    char tmp[4096];
+    if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= sizeof tmp)
+        return false;
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL)
+        return false;
+
+    for (int i = 0; i < STAT_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+        const char *metric = stat_names[i].metric;
+
+        fprintf(f, "# HELP %s %s.\n", metric, stat_names[i].help);
+        fprintf(f, "# TYPE %s histogram\n", metric);
+
+        /* Cumulative buckets at powers of two from 1us to ~67s */
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (uint64_t le = 1000; le <= (1ULL << 26) * 1000; le *= 2) {
+            for (; b < NBUCKETS && bucket_high(b) <= le; b++)
+                cumulative += h->buckets[b];
+            fprintf(f, "%s_bucket{le=\"%.9g\"} %lu\n", metric, le / 1e9,
+                    (unsigned long) cumulative);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %lu\n", metric,
+                (unsigned long) h->count);
+        fprintf(f, "%s_sum %.9f\n", metric, h->sum / 1e9);
+        fprintf(f, "%s_count %lu\n", metric, (unsigned long) h->count);
+    }
+
+    if (fclose(f) != 0)
+        return false;
+    return rename(tmp, path) == 0;
+}
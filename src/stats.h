@@ -0,0 +1,38 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The latencies the shell keeps histograms of */
+enum stat_id {
+    STAT_SPAWN,     /* fork of one pipeline stage, in the parent */
+    STAT_REAP,      /* from noticing a child's state change until
+                       handle_child_status has processed it; the
+                       kernel does not tell when the child exited */
+    STAT_PARSE,     /* parsing a command line */
+    STAT_PROMPT,    /* building and printing the prompt */
+    STAT_COUNT
+};
+
+/* Add a latency of 'ns' nanoseconds to a histogram.
+ * Async-signal-safe. */
+void stats_record(enum stat_id id, uint64_t ns);
+
+/* Clear all histograms */
+void stats_reset(void);
+
+/* Print a table of counts and percentiles */
+void stats_print(FILE *out);
+
+/* Print the histograms as JSON */
+void stats_print_json(FILE *out);
+
+/* Write the histograms in the Prometheus text exposition format.
+ * The file is replaced atomically, as the node exporter's textfile
+ * collector expects.
+ * Returns false, with errno set, if it could not be written. */
+bool stats_write_prometheus(const char *path);
+
+#endif /* __STATS_H */
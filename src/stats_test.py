@@ -0,0 +1,54 @@
+#!/usr/bin/python
+#
+# Tests the stats builtin: latency histograms for spawning and reaping
+# jobs, parsing and prompt rendering, in human and JSON form
+
+import atexit, proc_check, time, json
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+sendline("stats x")
+expect("stats: usage")
+expect_prompt()
+
+# after a reset, only the stats command itself has been counted
+sendline("stats reset")
+expect_prompt()
+sendline("stats")
+expect("spawn\s+0\r\n")
+expect("parse\s+1\s")
+expect_prompt()
+
+# one job with two stages
+sendline("/bin/echo counted | cat")
+expect_prompt()
+
+sendline("stats -j")
+expect("(\{.*\})\r\n")
+stats = json.loads(console.match.group(1))
+assert stats["spawn"]["count"] == 2, "Expected two spawns"
+assert stats["spawn"]["min_ns"] <= stats["spawn"]["p50_ns"] <= \
+    stats["spawn"]["max_ns"], "Percentiles out of order"
+assert sum(b[2] for b in stats["reap"]["buckets"]) == 2, \
+    "Bucket counts do not add up"
+expect_prompt()
+
+sendline("stats")
+expect("count\s+min\s+mean\s+p50\s+p90\s+p99\s+max")
+expect("spawn\s+2\s")
+expect("reap\s+2\s")
+expect("parse\s+\d+\s")
+expect("prompt\s+\d+\s")
+expect_prompt()
+
+sendline("stats reset")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
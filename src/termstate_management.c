@@ -16,6 +16,7 @@
 #include "termstate_management.h"
 #include "utils.h"
 #include "signal_support.h"
+#include "trace.h"
 
 static int terminal_fd = -1;           /* The controlling terminal */
 static struct termios saved_tty_state; /* The state of the terminal when shell
@@ -90,6 +91,7 @@ termstate_get_tty_fd(void)
 void
 termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp)
 {
+    uint64_t start = trace_begin();
     signal_block(SIGTTOU);
     int rc = tcsetpgrp(termstate_get_tty_fd(), pgrp);
     if (rc == -1)
@@ -98,6 +100,7 @@ termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp)
     if (pg_tty_state)
         termstate_restore(pg_tty_state);
     signal_unblock(SIGTTOU);
+    trace_end("tcsetpgrp", start, -1, pgrp);
 }
 
 void 
@@ -0,0 +1,30 @@
+#!/usr/bin/python
+#
+# Tests the time keyword implement: totals for the job and a
+# per-stage breakdown that flags the bottleneck stage
+
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# a single command reports wall, user and system time
+sendline("time sleep 0.5")
+expect("real 0\.5\d*s\s+user \d+\.\d+s\s+sys \d+\.\d+s")
+expect_prompt()
+
+# the busy stage of a pipeline is flagged as the bottleneck
+sendline("time head -c 50000000 /dev/zero | sha256sum | wc -c")
+expect("real \d+\.\d+s")
+expect("1: user .*\r\n")
+expect("2: user .*sha256sum\s+<- bottleneck\r\n")
+expect("3: user .*wc -c\r\n")
+expect_prompt()
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
@@ -0,0 +1,124 @@
+/*
+ * Event tracing of the shell's internals.
+ *
+ * Events are recorded into a ring buffer of fixed-size records.  A
+ * slot is claimed with an atomic increment, so events can be recorded
+ * from the SIGCHLD handler while the main loop records its own.  The
+ * event names must be string literals; only the pointer is stored.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* One recorded event */
+struct trace_event {
+    const char *name;
+    uint64_t ts;        /* Start time in nanoseconds */
+    uint64_t dur;       /* Duration in nanoseconds, 0 for instants */
+    int jid, pid, status;
+    char ph;            /* Chrome trace event phase */
+};
+
+bool trace_active;
+
+static struct trace_event *ring;
+static unsigned ring_size;
+static unsigned long next_event;    /* Total number of events recorded */
+
+/* Start recording into a fresh ring buffer */
+void
+trace_start(unsigned capacity)
+{
+    if (capacity == 0)
+        capacity = 1;
+
+    trace_active = false;
+    free(ring);
+    ring = calloc(capacity, sizeof *ring);
+    if (ring == NULL)
+        return;
+
+    ring_size = capacity;
+    next_event = 0;
+    trace_active = true;
+}
+
+/* Stop recording, keeping the events */
+void
+trace_stop(void)
+{
+    trace_active = false;
+}
+
+/* Return CLOCK_MONOTONIC in nanoseconds */
+uint64_t
+trace_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Record an event into the next slot of the ring */
+void
+trace_record(char ph, const char *name, uint64_t start,
+             int jid, int pid, int status)
+{
+    uint64_t now = trace_clock();
+    unsigned long n = __atomic_fetch_add(&next_event, 1, __ATOMIC_RELAXED);
+    struct trace_event *ev = &ring[n % ring_size];
+
+    ev->name = name;
+    ev->ph = ph;
+    ev->ts = ph == 'X' ? start : now;
+    ev->dur = ph == 'X' ? now - start : 0;
+    ev->jid = jid;
+    ev->pid = pid;
+    ev->status = status;
+}
+
+/* Write the events in the Chrome trace event format */
+bool
+trace_dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return false;
+
+    unsigned long first = next_event > ring_size ? next_event - ring_size : 0;
+    int shell = getpid();
+    const char *sep = ",\n";
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+               "\"args\": {\"name\": \"cush\"}}", shell);
+    for (unsigned long n = first; n < next_event; n++) {
+        struct trace_event *ev = &ring[n % ring_size];
+        fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, ",
+                sep, ev->name, ev->ph, ev->ts / 1e3);
+        if (ev->ph == 'X')
+            fprintf(f, "\"dur\": %.3f, ", ev->dur / 1e3);
+        else
+            fprintf(f, "\"s\": \"t\", ");
+        fprintf(f, "\"pid\": %d, \"tid\": %d, \"args\": {", shell, shell);
+
+        const char *arg_sep = "";
+        if (ev->jid != -1) {
+            fprintf(f, "\"jid\": %d", ev->jid);
+            arg_sep = ", ";
+        }
+        if (ev->pid != -1) {
+            fprintf(f, "%s\"pid\": %d", arg_sep, ev->pid);
+            arg_sep = ", ";
+        }
+        if (ev->status != -1)
+            fprintf(f, "%s\"status\": %d", arg_sep, ev->status);
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) == 0;
+}
@@ -0,0 +1,56 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* True while events are being recorded.  Trace points test this flag
+ * first, so they cost a load and a branch while tracing is off. */
+extern bool trace_active;
+
+/* Start recording into a ring buffer of 'capacity' events.
+ * Once the ring is full, the oldest events are overwritten. */
+void trace_start(unsigned capacity);
+
+/* Stop recording.  The recorded events are kept for trace_dump. */
+void trace_stop(void);
+
+/* Write the recorded events to 'path' in the Chrome trace event
+ * format, which chrome://tracing and Perfetto can load.
+ * Returns false, with errno set, if the file could not be written. */
+bool trace_dump(const char *path);
+
+/* Return the current time in nanoseconds. Async-signal-safe. */
+uint64_t trace_clock(void);
+
+/* Record an event. 'ph' is 'X' for an event that started at 'start'
+ * and ends now, or 'i' for an instant event.  'jid', 'pid' and
+ * 'status' are shown as arguments unless they are -1.
+ * Async-signal-safe. */
+void trace_record(char ph, const char *name, uint64_t start,
+                  int jid, int pid, int status);
+
+/* Return the start time for a trace_end call, or 0 if not tracing */
+static inline uint64_t
+trace_begin(void)
+{
+    return trace_active ? trace_clock() : 0;
+}
+
+/* Record an event that started at 'start', as returned by trace_begin */
+static inline void
+trace_end(const char *name, uint64_t start, int jid, int pid)
+{
+    if (trace_active && start != 0)
+        trace_record('X', name, start, jid, pid, -1);
+}
+
+/* Record an instant event */
+static inline void
+trace_instant(const char *name, int jid, int pid, int status)
+{
+    if (trace_active)
+        trace_record('i', name, 0, jid, pid, status);
+}
+
+#endif /* __TRACE_H */
@@ -0,0 +1,52 @@
+#!/usr/bin/python
+#
+# Tests the trace builtin: events recorded while tracing is on are
+# written in the Chrome trace event format
+
+import atexit, proc_check, time, os, json
+from testutils import *
+
+console = setup_tests()
+
+tracefile = "trace_test.json"
+def cleanup():
+    if os.path.exists(tracefile):
+        os.remove(tracefile)
+atexit.register(cleanup)
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+# usage message
+sendline("trace")
+expect("trace: usage")
+expect_prompt()
+
+sendline("trace on")
+expect_prompt()
+sendline("/bin/echo traced | cat")
+expect("traced")
+expect_prompt()
+sendline("trace off")
+expect_prompt()
+
+# events after trace off are not recorded
+sendline("true")
+expect_prompt()
+
+sendline("trace dump " + tracefile)
+expect_prompt()
+
+events = json.load(open(tracefile))["traceEvents"]
+names = [e["name"] for e in events]
+forks = [e for e in events if e["name"] == "fork"]
+assert len(forks) == 2, "Expected a fork event for each stage"
+for name in ["parse", "add_job", "tcsetpgrp", "waitpid", "delete_job"]:
+    assert name in names, "Missing " + name + " event"
+assert all(e["args"]["jid"] == forks[0]["args"]["jid"] for e in forks), \
+    "Fork events of one pipeline have different job ids"
+
+sendline("exit");
+expect_exact("exit\r\n", "Shell output extraneous characters")
+
+test_success()
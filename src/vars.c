@@ -0,0 +1,222 @@
+/*
+ * The variables of the shell.
+ *
+ * The table is open addressing with linear probing on a power of two
+ * of slots, at most half of which are used, as the table of builtins.
+ * A variable that is unset keeps its slot, so nothing is ever removed.
+ * Each value is kept as the "name=value" string of the environment,
+ * which the cached environment points to.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vars.h"
+
+struct var {
+    char *name;                 /* NULL in a free slot */
+    size_t name_len;
+    char *pair;                 /* "name=value", or NULL if unset */
+    bool exported;
+};
+
+static struct var *table;
+static size_t table_size;       /* A power of two, or 0 */
+static size_t table_used;
+
+/* The environment of the children, or NULL after a change */
+static char **env;
+
+/* FNV-1a */
+static uint32_t
+hash_name(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+    return h;
+}
+
+/* The slot of 'name', or the free slot where it belongs */
+static struct var *
+lookup(struct var *slots, size_t size, const char *name, size_t len)
+{
+    size_t i = hash_name(name, len) & (size - 1);
+    while (slots[i].name != NULL && (slots[i].name_len != len ||
+                                     memcmp(slots[i].name, name, len) != 0))
+        i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+static bool
+grow(void)
+{
+    size_t size = table_size == 0 ? 64 : table_size * 2;
+    struct var *slots = calloc(size, sizeof *slots);
+    if (slots == NULL)
+        return false;
+    for (size_t i = 0; i < table_size; i++) {
+        struct var *v = &table[i];
+        if (v->name != NULL)
+            *lookup(slots, size, v->name, v->name_len) = *v;
+    }
+    free(table);
+    table = slots;
+    table_size = size;
+    return true;
+}
+
+/* Return the variable 'name', adding it unset if it is new */
+static struct var *
+find_or_add(const char *name, size_t len)
+{
+    if ((table_used + 1) * 2 > table_size && !grow())
+        return NULL;
+    struct var *v = lookup(table, table_size, name, len);
+    if (v->name == NULL) {
+        v->name = strndup(name, len);
+        v->name_len = len;
+        table_used++;
+    }
+    return v;
+}
+
+static void
+changed(struct var *v)
+{
+    if (v->exported && env != NULL) {
+        free(env);
+        env = NULL;
+    }
+}
+
+/* Check for a letter or _, then letters, digits and _ */
+bool
+vars_valid_name(const char *name, size_t len)
+{
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '_'))
+            return false;
+    }
+    return true;
+}
+
+/* Import the environment */
+void
+vars_init(char **envp)
+{
+    for (char **e = envp; *e != NULL; e++) {
+        char *eq = strchr(*e, '=');
+        if (eq == NULL || !vars_valid_name(*e, eq - *e))
+            continue;
+        struct var *v = find_or_add(*e, eq - *e);
+        if (v == NULL)
+            return;
+        free(v->pair);
+        v->pair = strdup(*e);
+        v->exported = true;
+    }
+    free(env);
+    env = NULL;
+}
+
+/* Return the value of a variable, or NULL */
+const char *
+vars_get(const char *name, size_t len)
+{
+    if (table_size == 0)
+        return NULL;
+    struct var *v = lookup(table, table_size, name, len);
+    return v->pair != NULL ? v->pair + len + 1 : NULL;
+}
+
+/* Set a variable */
+bool
+vars_set(const char *name, const char *value)
+{
+    size_t len = strlen(name);
+    if (!vars_valid_name(name, len))
+        return false;
+    struct var *v = find_or_add(name, len);
+    if (v == NULL)
+        return false;
+    char *pair = malloc(len + strlen(value) + 2);
+    if (pair == NULL)
+        return false;
+    memcpy(pair, name, len);
+    pair[len] = '=';
+    strcpy(pair + len + 1, value);
+    free(v->pair);
+    v->pair = pair;
+    changed(v);
+    return true;
+}
+
+/* Export a variable */
+bool
+vars_export(const char *name)
+{
+    size_t len = strlen(name);
+    if (!vars_valid_name(name, len))
+        return false;
+    struct var *v = find_or_add(name, len);
+    if (v == NULL)
+        return false;
+    if (!v->exported) {
+        v->exported = true;
+        changed(v);
+    }
+    return true;
+}
+
+/* Unset a variable */
+void
+vars_unset(const char *name)
+{
+    if (table_size == 0)
+        return;
+    struct var *v = lookup(table, table_size, name, strlen(name));
+    if (v->name == NULL)
+        return;
+    changed(v);
+    free(v->pair);
+    v->pair = NULL;
+    v->exported = false;
+}
+
+/* Print the exported variables */
+void
+vars_print_exported(void)
+{
+    for (size_t i = 0; i < table_size; i++) {
+        struct var *v = &table[i];
+        if (v->exported)
+            printf("export %s\n", v->pair != NULL ? v->pair : v->name);
+    }
+}
+
+/* Build the environment, if a variable changed since it was last built */
+char **
+vars_environ(void)
+{
+    if (env != NULL)
+        return env;
+    size_t n = 0;
+    for (size_t i = 0; i < table_size; i++)
+        n += table[i].exported && table[i].pair != NULL;
+    env = malloc((n + 1) * sizeof *env);
+    if (env == NULL)
+        return NULL;
+    n = 0;
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].exported && table[i].pair != NULL)
+            env[n++] = table[i].pair;
+    }
+    env[n] = NULL;
+    return env;
+}
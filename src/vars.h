@@ -0,0 +1,45 @@
+#ifndef __VARS_H
+#define __VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The variables of the shell, which start out as its environment.
+ *
+ * They are kept in a hash table, so that expanding $name costs one
+ * lookup.  Exported variables make up the environment of the commands
+ * the shell runs: its array is built the first time it is needed after
+ * an exported variable changed, and every fork until the next change
+ * reuses it.
+ */
+
+/* Import 'envp' as exported variables */
+void vars_init(char **envp);
+
+/* Return true if the 'len' characters at 'name' are a variable name */
+bool vars_valid_name(const char *name, size_t len);
+
+/* Return the value of the variable named by the 'len' characters at
+ * 'name', or NULL if it is not set */
+const char *vars_get(const char *name, size_t len);
+
+/* Set a variable, which stays exported if it was.  Returns false if
+ * 'name' is not a variable name. */
+bool vars_set(const char *name, const char *value);
+
+/* Export a variable, set or not.  Returns false if 'name' is not a
+ * variable name. */
+bool vars_export(const char *name);
+
+/* Unset a variable and stop exporting it */
+void vars_unset(const char *name);
+
+/* Print the exported variables as export commands */
+void vars_print_exported(void);
+
+/* Return the NULL-terminated environment of the exported variables,
+ * which stays valid until a variable changes */
+char **vars_environ(void);
+
+#endif /* __VARS_H */
@@ -0,0 +1,43 @@
+#!/usr/bin/python
+#
+# Tests variables: assignments, $name and ${name}, export and unset, and
+# that children see the exported variables only, found in their PATH
+
+import os, signal, subprocess
+from testutils import *
+
+script = """x=hello y=world
+echo $x ${y}!
+sh -c "echo child [$x]"
+export x
+sh -c "echo child [$x]"
+export z=3 PATH=/nonexistent
+sh -c "echo no"
+export PATH=%s
+sh -c "echo child z=$z"
+unset z
+sh -c "echo child z=[$z]"
+echo unset [$z]
+for x in a b; do echo $x; done
+sh -c "echo child [$x]"
+export 1x
+""" % os.environ["PATH"]
+
+def start_shell():
+    # Python ignores SIGPIPE, and its children would inherit that
+    signal.signal(signal.SIGPIPE, signal.SIG_DFL)
+
+shell = subprocess.Popen(["./cush"], stdin=subprocess.PIPE,
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                         preexec_fn=start_shell)
+output = shell.communicate(script)[0]
+assert shell.returncode == 0, "Shell failed: " + output
+
+expected = ["hello world!", "child []", "child [hello]", "child z=3",
+            "child z=[]", "unset []", "a", "b", "child [b]",
+            "export: 1x: invalid variable name"]
+lines = [l for l in output.splitlines() if "No such file" not in l]
+assert lines == expected, "Unexpected output: " + output
+assert "no\n" not in output, "PATH of the child not used: " + output
+
+test_success()